@@ -5,15 +5,30 @@
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
 ../broadcast/src/pacsat_broadcast.c \
-../broadcast/src/pacsat_command.c 
+../broadcast/src/pacsat_command.c \
+../broadcast/src/pacsat_crc.c \
+../broadcast/src/pacsat_fountain.c \
+../broadcast/src/pacsat_pass.c \
+../broadcast/src/pacsat_readahead.c \
+../broadcast/src/pacsat_stats.c 
 
 C_DEPS += \
 ./broadcast/src/pacsat_broadcast.d \
-./broadcast/src/pacsat_command.d 
+./broadcast/src/pacsat_command.d \
+./broadcast/src/pacsat_crc.d \
+./broadcast/src/pacsat_fountain.d \
+./broadcast/src/pacsat_pass.d \
+./broadcast/src/pacsat_readahead.d \
+./broadcast/src/pacsat_stats.d 
 
 OBJS += \
 ./broadcast/src/pacsat_broadcast.o \
-./broadcast/src/pacsat_command.o 
+./broadcast/src/pacsat_command.o \
+./broadcast/src/pacsat_crc.o \
+./broadcast/src/pacsat_fountain.o \
+./broadcast/src/pacsat_pass.o \
+./broadcast/src/pacsat_readahead.o \
+./broadcast/src/pacsat_stats.o 
 
 
 # Each subdirectory must supply rules for building sources it contributes
@@ -28,7 +43,7 @@ broadcast/src/%.o: ../broadcast/src/%.c broadcast/src/subdir.mk
 clean: clean-broadcast-2f-src
 
 clean-broadcast-2f-src:
-	-$(RM) ./broadcast/src/pacsat_broadcast.d ./broadcast/src/pacsat_broadcast.o ./broadcast/src/pacsat_command.d ./broadcast/src/pacsat_command.o
+	-$(RM) ./broadcast/src/pacsat_broadcast.d ./broadcast/src/pacsat_broadcast.o ./broadcast/src/pacsat_command.d ./broadcast/src/pacsat_command.o ./broadcast/src/pacsat_crc.d ./broadcast/src/pacsat_crc.o ./broadcast/src/pacsat_fountain.d ./broadcast/src/pacsat_fountain.o ./broadcast/src/pacsat_pass.d ./broadcast/src/pacsat_pass.o ./broadcast/src/pacsat_readahead.d ./broadcast/src/pacsat_readahead.o ./broadcast/src/pacsat_stats.d ./broadcast/src/pacsat_stats.o
 
 .PHONY: clean-broadcast-2f-src
 
@@ -4,18 +4,36 @@
 
 # Add inputs and outputs from these tool invocations to the build variables 
 C_SRCS += \
+../src/agw_emulator.c \
 ../src/config.c \
+../src/pacsat_callsign.c \
+../src/pacsat_frame_queue.c \
 ../src/pacsat_main.c \
+../src/pacsat_timer.c \
+../src/pacsat_trace.c \
+../src/pacsat_tx.c \
 ../src/state_file.c 
 
 C_DEPS += \
+./src/agw_emulator.d \
 ./src/config.d \
+./src/pacsat_callsign.d \
+./src/pacsat_frame_queue.d \
 ./src/pacsat_main.d \
+./src/pacsat_timer.d \
+./src/pacsat_trace.d \
+./src/pacsat_tx.d \
 ./src/state_file.d 
 
 OBJS += \
+./src/agw_emulator.o \
 ./src/config.o \
+./src/pacsat_callsign.o \
+./src/pacsat_frame_queue.o \
 ./src/pacsat_main.o \
+./src/pacsat_timer.o \
+./src/pacsat_trace.o \
+./src/pacsat_tx.o \
 ./src/state_file.o 
 
 
@@ -31,7 +49,7 @@ src/%.o: ../src/%.c src/subdir.mk
 clean: clean-src
 
 clean-src:
-	-$(RM) ./src/config.d ./src/config.o ./src/pacsat_main.d ./src/pacsat_main.o ./src/state_file.d ./src/state_file.o
+	-$(RM) ./src/agw_emulator.d ./src/agw_emulator.o ./src/config.d ./src/config.o ./src/pacsat_callsign.d ./src/pacsat_callsign.o ./src/pacsat_frame_queue.d ./src/pacsat_frame_queue.o ./src/pacsat_main.d ./src/pacsat_main.o ./src/pacsat_timer.d ./src/pacsat_timer.o ./src/pacsat_trace.d ./src/pacsat_trace.o ./src/pacsat_tx.d ./src/pacsat_tx.o ./src/state_file.d ./src/state_file.o
 
 .PHONY: clean-src
 
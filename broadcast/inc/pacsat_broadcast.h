@@ -24,13 +24,30 @@
 #define PACSAT_BROADCAST_H_
 
 #include <stdint.h>
+#include <time.h>
+#include "pacsat_callsign.h"
 
 #define PID_FILE		0xBB
 #define PID_DIRECTORY	0xBD
 #define PID_COMMAND 	0xBC
 #define PID_NO_PROTOCOL	0xF0
 
-#define MAX_PB_LENGTH 10 /* This is the maximum number of stations that can be on the PB at one time */
+#define MAX_PB_LENGTH 10 /* This is the default number of stations that can be on the PB at one time.  Set max_pb_length in the config to change it */
+#define PB_MAX_CAPACITY 512 /* Limit on max_pb_length.  Each station on the PB holds a callsign id, so the PBs must never hold the whole callsign table */
+#define PB_SCHEDULER_RR "rr" /* Each station sends one frame per turn */
+#define PB_SCHEDULER_DRR "drr" /* Deficit round robin weighted by request type, priority and completion */
+#define PB_DRR_DEFAULT_QUANTUM 256 /* Bytes of airtime a station with weight 1 can send each turn */
+#define PB_DRR_DIR_WEIGHT 1 /* Extra weight given to DIR fills, which are short */
+#define PB_DRR_MAX_PRIORITY_WEIGHT 3 /* Limit on the extra weight from the PFH priority */
+#define PB_AX25_HEADER_BYTES 17 /* Added to the length of each frame when we count airtime */
+#define PB_MAX_POPULAR_FILES 16 /* Files whose requests we count for the idle broadcasts */
+#define PB_POPULARITY_REQUEST_SCORE 16 /* Added to the score of a file each time it is requested */
+#define PB_POPULARITY_HALF_LIFE_IN_SECONDS 900 /* The scores halve after this long so only recent requests count */
+#define PB_IDLE_DIR_PFHS 4 /* The number of the newest PFHs sent in an idle DIR broadcast */
+#define PB_RECENT_RANGES 64 /* File chunks remembered so that we do not send them again straight away */
+#define PB_PROGRESS_ENTRIES 32 /* Station and file pairs whose download progress is remembered during a pass */
+#define PB_PROGRESS_NEAR_COMPLETE_PERCENT 50 /* Stations this far through a file are served next and can overrun their time on the PB once */
+#define PB_PROGRESS_FINISH_TURNS 2 /* A station that could finish in this many turns is given enough airtime to finish in one */
 #define PB_DIR_REQUEST_TYPE 1
 #define PB_FILE_REQUEST_TYPE 2
 
@@ -58,6 +75,11 @@
 #define L_BIT 0
 #define E_BIT 5
 #define N_BIT 6
+#define VV_BIT 2 /* The two bit version in the file broadcast flags */
+#define F_BIT 5 /* Set in the flags of a file request to ask for fountain repair symbols after the file */
+
+#define PB_FILE_VERSION_CHUNK 0b00 /* The offset is a byte offset in the file */
+#define PB_FILE_VERSION_REPAIR 0b01 /* A fountain repair symbol.  The offset is the symbol id */
 
 #define PB_START_SENDING_FILE 0b00
 #define PB_STOP_SENDING_FILE 0b01
@@ -114,14 +136,24 @@ struct t_dir_pair {
 } __attribute__ ((__packed__));
 typedef struct t_dir_pair DIR_DATE_PAIR;
 
+int pb_init();
+int pb_set_scheduler(char *name);
 int pb_send_ok(char *from_callsign);
 int pb_send_err(char *from_callsign, int err);
 int pb_next_action();
-void pb_process_frame(char *from_callsign, char *to_callsign, unsigned char *data, int len);
+void pb_process_frame(int port, CALLSIGN_ID from_id, unsigned char *data, int len);
 int pb_is_file_in_use(uint32_t file_id);
+void pb_note_file_request(uint32_t file_id, time_t now);
+void pb_note_dir_request(time_t now);
 int test_pb();
 int test_pb_list();
 int test_pb_file();
 int test_pb_file_holes();
+int test_pb_normalize_holes();
+int test_pb_scheduler();
+int test_pb_idle();
+int test_pb_recent();
+int test_pb_fountain();
+int test_pb_progress();
 
 #endif /* PACSAT_BROADCAST_H_ */
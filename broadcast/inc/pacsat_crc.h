@@ -0,0 +1,34 @@
+/*
+ * pacsat_crc.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_CRC_H_
+#define PACSAT_CRC_H_
+
+#include <stdint.h>
+
+#define CRC16_POLY 0x1021 /* CRC-16 CCITT, initial value 0, no final xor.  Same as gen_crc() */
+
+void crc16_init();
+uint16_t crc16_update(uint16_t crc, const unsigned char *data, int len);
+uint16_t crc16(const unsigned char *data, int len);
+void crc16_put(unsigned char *buffer, uint16_t crc);
+int test_crc16();
+
+#endif /* PACSAT_CRC_H_ */
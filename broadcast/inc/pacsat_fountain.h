@@ -0,0 +1,63 @@
+/*
+ * pacsat_fountain.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_FOUNTAIN_H_
+#define PACSAT_FOUNTAIN_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define FOUNTAIN_MAX_SYMBOL_ID 0xFFFFFF /* The symbol id is sent in the 24 bit offset field */
+#define FOUNTAIN_SOLITON_C 0.1 /* Robust soliton tuning.  These are the usual values from the LT code literature */
+#define FOUNTAIN_SOLITON_DELTA 0.05
+
+/* A repair symbol that could not be used yet because more than one of its blocks is unknown */
+struct fountain_symbol {
+	unsigned char *data;
+	int *neighbours;
+	int degree;
+};
+
+/* The reference decoder, which reassembles a file from systematic chunks and repair symbols */
+struct fountain_decoder {
+	uint32_t file_id;
+	int file_size;
+	int block_size;
+	int k; /* The number of source blocks */
+	unsigned char *blocks; /* k * block_size bytes.  The last block is padded with zeros */
+	unsigned char *known; /* True for each block that we have */
+	int num_known;
+	struct fountain_symbol *pending;
+	int num_pending;
+	int max_pending;
+};
+typedef struct fountain_decoder FOUNTAIN_DECODER;
+
+int fountain_num_blocks(int file_size, int block_size);
+int fountain_neighbours(uint32_t file_id, uint32_t symbol_id, int k, int *neighbours);
+int fountain_encode_symbol(FILE *f, int file_size, int block_size, uint32_t file_id, uint32_t symbol_id, unsigned char *symbol);
+int fountain_decoder_init(FOUNTAIN_DECODER *dec, uint32_t file_id, int file_size, int block_size);
+int fountain_decoder_add_chunk(FOUNTAIN_DECODER *dec, int offset, unsigned char *data, int len);
+int fountain_decoder_add_symbol(FOUNTAIN_DECODER *dec, uint32_t symbol_id, unsigned char *data);
+int fountain_decoder_complete(FOUNTAIN_DECODER *dec);
+void fountain_decoder_free(FOUNTAIN_DECODER *dec);
+int test_fountain();
+
+#endif /* PACSAT_FOUNTAIN_H_ */
@@ -0,0 +1,57 @@
+/*
+ * pacsat_pass.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_PASS_H_
+#define PACSAT_PASS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define PASS_MAX_WINDOWS 512 /* AOS/LOS windows read from the pass schedule file */
+#define PASS_SIM_MAX_STATIONS 64 /* Requests that can be on the simulated PB at one time */
+
+/* An AOS to LOS window from the pass schedule */
+struct pass_window {
+	time_t aos;
+	time_t los;
+};
+typedef struct pass_window PASS_WINDOW;
+
+/* The results of a simulator run */
+struct pass_sim_result {
+	int requests; /* Requests in the trace */
+	int outside; /* Requests made when there was no pass in the schedule */
+	int rejected_full; /* Rejected because the PB was full */
+	int rejected_admission; /* Rejected because they could not finish before LOS */
+	int admitted;
+	int completed; /* Admitted and finished before LOS */
+	int incomplete; /* Admitted but still on the PB at LOS */
+	uint32_t wasted_bytes; /* Bytes sent for requests that did not finish */
+};
+typedef struct pass_sim_result PASS_SIM_RESULT;
+
+int pass_load_schedule(char *filename);
+int pass_seconds_remaining(time_t now);
+uint32_t pass_estimate_ms(int bytes, int stations_on_pb);
+int pass_can_complete(time_t now, int bytes, int stations_on_pb);
+int pass_simulate(char *trace_filename, PASS_SIM_RESULT *result);
+int test_pass();
+
+#endif /* PACSAT_PASS_H_ */
@@ -0,0 +1,37 @@
+/*
+ * pacsat_readahead.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_READAHEAD_H_
+#define PACSAT_READAHEAD_H_
+
+#include <stdint.h>
+
+#define RA_POOL_SIZE 48 /* File chunks held in memory.  Each is PB_FILE_DEFAULT_BLOCK_SIZE bytes.  Enough for RA_CHUNKS_AHEAD for a full PB */
+#define RA_CHUNKS_AHEAD 4 /* Chunks read ahead for each file request on the PB */
+#define RA_NOT_READY -1 /* Returned by ra_read() when the chunk is still being read from disk */
+
+int ra_start();
+void ra_stop();
+int ra_prefetch(uint32_t file_id, char *filename, int offset);
+int ra_read(uint32_t file_id, char *filename, int offset, unsigned char *buffer, int len);
+void ra_invalidate(uint32_t file_id);
+int test_readahead();
+
+#endif /* PACSAT_READAHEAD_H_ */
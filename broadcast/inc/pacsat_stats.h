@@ -0,0 +1,58 @@
+/*
+ * pacsat_stats.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_STATS_H_
+#define PACSAT_STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#define BSTAT "BSTAT" // destination for the broadcast statistics
+
+/* The kinds of traffic that we account for */
+#define STATS_TYPE_DIR 0 /* DIR broadcasts */
+#define STATS_TYPE_FILE 1 /* FILE broadcasts */
+#define STATS_TYPE_PB_STATUS 2 /* PB status, OK and NO responses */
+#define STATS_TYPE_FTL0 3 /* Uplink status and connected mode FTL0 frames */
+#define STATS_TYPE_BSTAT 4 /* The BSTAT frames themselves */
+#define STATS_NUMBER_OF_TYPES 5
+
+#define STATS_MAX_STATIONS 32 /* Stations counted individually in a pass.  Any more are counted together */
+#define STATS_MAX_FILES 32 /* Files counted individually in a pass.  Any more are counted together */
+
+struct stats_count {
+	uint32_t frames;
+	uint32_t bytes; /* Bytes on the air including the AX25 header */
+};
+typedef struct stats_count STATS_COUNT;
+
+void stats_tx_frame(int type, int pid, char *callsign, uint32_t file_id, int len);
+void stats_rx_frame(time_t now);
+void stats_next_action(time_t now);
+int stats_end_pass(time_t now);
+uint32_t stats_airtime_ms(uint32_t bytes);
+void stats_make_bstat_str(char *buffer, int len, time_t now);
+STATS_COUNT stats_get_type_count(int type);
+STATS_COUNT stats_get_station_count(char *callsign);
+STATS_COUNT stats_get_file_count(uint32_t file_id);
+time_t stats_get_pass_start();
+int test_stats();
+
+#endif /* PACSAT_STATS_H_ */
@@ -36,6 +36,7 @@ Entries are removed from the queue:
            after a file has been completely transmitted (for start request);
            when a new request is received from a station already in the queue;
            if the file associated with the entry cannot be opened and read;
+           when the station sends a request to stop sending the file;
 
 On a periodic basis we broadcast the PB Status with a UI packet from the BBS callsign
 to one of the following callsigns: PBLIST, PBFULL, PBSHUT, PBSTAT
@@ -68,6 +69,7 @@ packet: NO
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <time.h>
 #include <dirent.h>
 #include <sys/stat.h>
@@ -80,76 +82,225 @@ packet: NO
 #include "agw_tnc.h"
 #include "pacsat_header.h"
 #include "pacsat_broadcast.h"
+#include "pacsat_stats.h"
+#include "pacsat_tx.h"
+#include "pacsat_timer.h"
 #include "pacsat_command.h"
 #include "pacsat_dir.h"
 #include "str_util.h"
-#include "crc.h"
+#include "pacsat_crc.h"
+#include "pacsat_fountain.h"
+#include "pacsat_readahead.h"
+#include "pacsat_pass.h"
 #include "ax25_tools.h"
 
 /* An entry on the PB list keeps track of the requester and where we are in the request process */
 struct pb_entry {
 	int pb_type; /* DIR or FILE request */
-	char callsign[MAX_CALLSIGN_LEN];
+	CALLSIGN_ID callsign_id; /* The station that made the request */
 	DIR_NODE *node; /* Pointer to the node that we should broadcast next */
 //	int file_id; /* File id of the file we are broadcasting if this is a file request */
 	int offset; /* The current offset in the file we are broadcasting or the PFH we are transmitting */
 	int block_size; /* The maximum size of broadcasts. THIS IS CURRENTLY IGNORED but in theory is sent from the ground for file requests */
-	void *hole_list; /* This is a DIR or FILE hole list */
+	void *hole_list; /* This is a DIR or FILE hole list.  It points to the part of the hole arena owned by this slot */
 	int hole_num; /* The number of holes from the request */
 	int current_hole_num; /* The next hole number from the request that we should process when this one is done */
-	time_t request_time; /* The time the request was received for timeout purposes */
+	time_t request_time; /* The time the request was received, or extended */
+	TIMER session_timer; /* Expires after g_pb_max_period_for_client_in_seconds */
+	int in_use; /* True if this slot holds a request, false if it is on the free list */
+	int next; /* Next slot in the round robin ring.  When the slot is free this is the next free slot */
+	int prev; /* Previous slot in the round robin ring */
+	int deficit; /* Bytes of airtime this station can still use.  Only used by the DRR scheduler */
+	int turn_started; /* True once the scheduler has given this station its quantum for the current turn */
+	int suppress_recent; /* True if holes that were broadcast in the last pb_recent_window_in_seconds are skipped */
+	int fountain_symbols; /* Repair symbols still to send once the whole file has been sent.  0 unless the station asked for them */
+	int extended; /* True once the station has been allowed to stay past g_pb_max_period_for_client_in_seconds */
 };
 typedef struct pb_entry PB_ENTRY;
 
 /* Forward declarations */
 int pb_send_status();
-int pb_add_request(char *from_callsign, int type, DIR_NODE * node, int file_id, int offset, void *holes, int num_of_holes);
-int pb_handle_dir_request(char *from_callsign, unsigned char *data, int len);
-int pb_handle_file_request(char *from_callsign, unsigned char *data, int len);
+int pb_add_request(CALLSIGN_ID callsign_id, int type, DIR_NODE * node, int file_id, int offset, void *holes, int num_of_holes);
+int pb_remove_request(int slot);
+static void pb_status_expired(TIMER *timer, void *arg, uint64_t now_ms);
+static void pb_session_expired(TIMER *timer, void *arg, uint64_t now_ms);
+int pb_find_request(CALLSIGN_ID callsign_id);
+void pb_progress_update(int slot);
+int pb_progress_percent(int slot);
+int pb_handle_dir_request(CALLSIGN_ID from_id, unsigned char *data, int len);
+int pb_handle_file_request(CALLSIGN_ID from_id, unsigned char *data, int len);
+int pb_handle_stop_file_request(CALLSIGN_ID from_id, uint32_t file_id);
 void pb_make_list_str(char *buffer, int len);
 int pb_make_dir_broadcast_packet(DIR_NODE *node, unsigned char *data_bytes, int *offset);
+unsigned char * pb_get_dir_broadcast_frame(DIR_NODE *node, int *offset, int *len);
 DIR_DATE_PAIR * get_dir_holes_list(unsigned char *data);
 int get_num_of_dir_holes(int request_len);
-int pb_broadcast_next_file_chunk(HEADER *psf, char * psf_filename, int offset, int length, int file_size);
+int pb_broadcast_next_file_chunk(HEADER *psf, char * psf_filename, int offset, int length, int file_size, CALLSIGN_ID callsign_id);
+int pb_idle_action(time_t now);
+int pb_broadcast_fountain_symbol(HEADER *pfh, char * psf_filename, int file_size, CALLSIGN_ID callsign_id);
 int pb_make_file_broadcast_packet(HEADER *pfh, unsigned char *data_bytes,
-		unsigned char *buffer, int number_of_bytes_read, int offset, int chunk_includes_last_byte);
+		int number_of_bytes_read, int offset, int chunk_includes_last_byte, int version);
 FILE_DATE_PAIR * get_file_holes_list(unsigned char *data);
 int get_num_of_file_holes(int request_len);
+int pb_normalize_file_holes(FILE_DATE_PAIR *holes, int num_of_holes, uint32_t file_size,
+		FILE_DATE_PAIR *normalized, int max_holes);
+int pb_normalize_dir_holes(DIR_DATE_PAIR *holes, int num_of_holes, DIR_DATE_PAIR *normalized, int max_holes);
 
 void pb_debug_print_dir_req(unsigned char *data, int len);
 void pb_debug_print_dir_holes(DIR_DATE_PAIR *holes, int num_of_holes);
 void pb_debug_print_file_holes(FILE_DATE_PAIR *holes, int num_of_holes);
 void pb_debug_print_list_item(int i);
 
+/**
+ * PB Schedulers
+ * The scheduler decides how long each station keeps its turn on the PB.  current_station is
+ * the station being served.  select() is called before we take an action for the current station
+ * and charge() is called afterwards with the number of bytes that were put on the air.  charge()
+ * moves round the ring when the turn is over.
+ */
+struct pb_scheduler {
+	char *name;
+	void (*select)();
+	void (*charge)(int slot, int bytes);
+};
+typedef struct pb_scheduler PB_SCHEDULER;
+
+void pb_rr_select();
+void pb_rr_charge(int slot, int bytes);
+void pb_drr_select();
+void pb_drr_charge(int slot, int bytes);
+
+static PB_SCHEDULER pb_schedulers[] = {
+		{PB_SCHEDULER_RR, pb_rr_select, pb_rr_charge},
+		{PB_SCHEDULER_DRR, pb_drr_select, pb_drr_charge}
+};
+#define PB_NUMBER_OF_SCHEDULERS (sizeof(pb_schedulers) / sizeof(PB_SCHEDULER))
+
+/* The largest frame we send, including the AX25 header, in bytes.  A DRR quantum must be at least this big */
+#define PB_MAX_FRAME_BYTES (PB_AX25_HEADER_BYTES + sizeof(PB_DIR_HEADER) + MAX_DIR_PFH_LENGTH + 2)
+
 /* Local Variables */
 
+/**
+ * Recently sent chunks
+ * When several stations ask for holes in the same file we would send the same bytes again and again.
+ * Each file chunk that is broadcast is remembered in a ring with the time it was sent.  A hole that
+ * was broadcast in the last pb_recent_window_in_seconds is skipped because the stations that are
+ * listening already have it.  The bytes that are skipped for a station are remembered in a second
+ * ring.  If a station asks again for bytes that were sent for it, or that were skipped for it, then it
+ * missed them, and its request is not suppressed.
+ */
+struct pb_sent_range {
+	uint32_t file_id; /* 0 if the entry is not used */
+	uint32_t start;
+	uint32_t end; /* One past the last byte sent */
+	time_t sent_time;
+	CALLSIGN_ID callsign_id; /* The station it was sent for or CALLSIGN_ID_NONE for an idle broadcast */
+};
+
 /**
  * pb_list
+ * Each radio port has its own PB, which is a pb_port.  The ports share the directory and the
+ * caches of broadcast frames and file chunks.
+ *
  * This Directory and File broadcast list is a list of callsigns that will receive attention from
  * the PACSAT.  It stores the callsign and the request, which is for a file or a directory.
- * This is a static block of memory that exists throughout the duration of the program to
- * keep track of stations on the PB.
+ * This is a block of memory that is allocated once by pb_init() and then exists throughout the
+ * duration of the program to keep track of stations on the PB.
+ *
+ * The array is a pool of slots.  Unused slots are chained together on a free list.  Slots that
+ * hold a request are linked into a circular ring in the order they were added.  The round robin
+ * walks the ring, so adding or removing a station is O(1) and nothing is shuffled.  A table
+ * indexed by the interned callsign id gives the slot of a station without scanning the list.
  */
-static PB_ENTRY pb_list[MAX_PB_LENGTH];
 
 /**
  * dir hole_list
  * The hole list works in parallel to the pb_list.  For each entry on the PB there can be a list
- * of holes in the directory or in the file.  This array keeps track of the holes.
- *
+ * of holes in the directory or in the file.  The lists are kept in one arena that is allocated
+ * with the pb_list.  Each slot owns PB_HOLE_LIST_BYTES of it, which is enough for the longest
+ * list of either type that fits in a request, so adding and removing a request never allocates
+ * or frees memory.
  */
-//static DATE_PAIR hole_lists[MAX_PB_LENGTH][AX25_MAX_DATA_LEN/8]; /* The holes lists */
-
-static char pb_status_buffer[135]; // 10 callsigns * 13 bytes + 4 + nul
-unsigned char broadcast_buffer[PB_FILE_DEFAULT_BLOCK_SIZE]; // This is the chunk we will send
-unsigned char packet_buffer[AX25_MAX_DATA_LEN];
-unsigned char packet_data_bytes[AX25_MAX_DATA_LEN];
-static int number_on_pb = 0; /* This keeps track of how many stations are in the pb_list array */
-static int current_station_on_pb = 0; /* This keeps track of which station we will send data to next */
-time_t last_pb_status_time;
+#define PB_HOLE_LIST_BYTES AX25_MAX_DATA_LEN
+
+/* The PB for one radio port */
+struct pb_port {
+	int port;
+	PB_ENTRY *list;
+	int capacity; /* The number of slots in list */
+	int free_head; /* The first free slot or -1 if the PB is full */
+	int head; /* The oldest request on the PB or -1 if it is empty.  The status is listed from here */
+	int *slot_by_callsign; /* The slot for each callsign id or -1 if the station is not on the PB */
+	unsigned char *hole_arena;
+	int number_on_pb; /* This keeps track of how many stations are in the list array */
+	int current_station; /* The slot of the station we will send data to next or -1 if the PB is empty */
+	TIMER status_timer;
+
+	int idle_type; /* PB_DIR_REQUEST_TYPE or PB_FILE_REQUEST_TYPE for the idle broadcast in progress, otherwise 0 */
+	uint32_t idle_file_id; /* The file being broadcast */
+	uint32_t idle_upload_time; /* The upload time of the PFH being broadcast.  We look the node up each time in case it was removed */
+	int idle_offset; /* Offset in the file or PFH */
+	int idle_count; /* PFHs sent in this idle DIR broadcast */
+	int idle_last_type; /* So that DIR and FILE broadcasts take turns */
+	time_t last_idle_time;
+
+	struct pb_sent_range recent[PB_RECENT_RANGES]; /* Stations on another port did not hear these */
+	int recent_next; /* The oldest entry, which is replaced next */
+	struct pb_sent_range suppressed[PB_RECENT_RANGES]; /* Skipped for the station because they were in recent */
+	int suppressed_next;
+};
+typedef struct pb_port PB_PORT;
+
+static PB_PORT pb_ports[MAX_PORTS];
+static PB_PORT *pb = &pb_ports[0]; /* The port that the PB is working on.  Only the PB thread changes it */
+static TIMER_WHEEL pb_timer_wheel; /* The timers for all ports.  Only used by the PB thread */
+
+static char pb_status_buffer[AX25_MAX_DATA_LEN]; // Callsigns that do not fit in one frame are not listed
+static unsigned char packet_buffer[AX25_MAX_DATA_LEN]; // File frames are assembled here.  The chunk is read straight in behind the header
+static PB_SCHEDULER *pb_scheduler = &pb_schedulers[1]; /* Set from the pb_scheduler config value by pb_init() */
+static int pb_drr_quantum = PB_DRR_DEFAULT_QUANTUM; /* Bytes given to a station of weight 1 each turn */
 time_t last_pb_frames_queued_time;
 int sent_pb_status = false;
 
+/**
+ * Popularity and idle broadcasts
+ * Each file request adds to the score of the file and each DIR request adds to the DIR score.  The
+ * scores halve every PB_POPULARITY_HALF_LIFE_IN_SECONDS.  When the PB is empty we use the idle
+ * airtime to broadcast the newest PFHs or the most popular file, so that stations listening can
+ * fill their caches without asking.  Only one idle frame is sent every pb_idle_period_in_seconds
+ * and a real request always comes first.  The idle broadcast carries on where it left off when
+ * the PB is empty again.
+ */
+struct pb_popular_file {
+	uint32_t file_id; /* 0 if the entry is not used */
+	uint32_t score;
+	time_t score_time; /* The time that score was last decayed to */
+};
+static struct pb_popular_file pb_popular_files[PB_MAX_POPULAR_FILES];
+static struct pb_popular_file pb_popular_dir; /* file_id is not used */
+
+/**
+ * Download progress
+ * A PB entry is removed when the request is done, when it times out or when the station makes a
+ * new request, but the station usually comes back for the rest of the file.  This ledger remembers,
+ * for each station and file in the current pass, the bytes we broadcast for it and the bytes it still
+ * needs.  The scheduler uses it to favor the stations that are close to finishing, so that more files
+ * complete before loss of signal.  The ledger is cleared when a new pass starts.
+ */
+struct pb_progress {
+	CALLSIGN_ID callsign_id;
+	uint32_t file_id; /* 0 if the entry is not used */
+	int file_size;
+	int bytes_delivered; /* Bytes of the file broadcast for this station in this pass */
+	int bytes_remaining; /* Bytes it still needs, from its last request less what was sent since */
+	time_t last_update;
+};
+static struct pb_progress pb_progress[PB_PROGRESS_ENTRIES];
+static time_t pb_progress_pass = 0; /* Start time of the pass that the ledger is for */
+
+static uint32_t pb_fountain_next_symbol = 1; /* Every repair symbol gets a new id, so each one can help a station that has heard earlier ones */
+
 /**
  * pb_send_status()
  *
@@ -163,11 +314,12 @@ int pb_send_status() {
 		unsigned char shut[] = "PB Closed.";
 		int rc = EXIT_SUCCESS;
 		if (!g_run_self_test)
-			send_raw_packet(g_broadcast_callsign, PBSHUT, PID_NO_PROTOCOL, shut, sizeof(shut));
+			tx_queue_raw_packet(pb->port, TX_CLASS_BULK, g_broadcast_callsign, PBSHUT, PID_NO_PROTOCOL, shut, sizeof(shut));
+		stats_tx_frame(STATS_TYPE_PB_STATUS, PID_NO_PROTOCOL, NULL, 0, sizeof(shut));
 		return rc;
 	} else  {
 		char * CALL = PBLIST;
-		if (number_on_pb == MAX_PB_LENGTH) {
+		if (pb->number_on_pb == pb->capacity) {
 			CALL = PBFULL;
 		}
 		pb_make_list_str(pb_status_buffer, sizeof(pb_status_buffer));
@@ -175,7 +327,8 @@ int pb_send_status() {
 		strlcpy((char *)command, (char *)pb_status_buffer,sizeof(command));
 		int rc = EXIT_SUCCESS;
 		if (!g_run_self_test)
-			send_raw_packet(g_broadcast_callsign, CALL, PID_NO_PROTOCOL, command, sizeof(command));
+			tx_queue_raw_packet(pb->port, TX_CLASS_BULK, g_broadcast_callsign, CALL, PID_NO_PROTOCOL, command, sizeof(command));
+		stats_tx_frame(STATS_TYPE_PB_STATUS, PID_NO_PROTOCOL, NULL, 0, sizeof(command));
 		return rc;
 	}
 }
@@ -194,7 +347,9 @@ int pb_send_ok(char *from_callsign) {
     int len = 3 + strlen(from_callsign);
     buffer[len] = 0x0D; // this replaces the string termination
 	if (!g_run_self_test)
-		rc = send_raw_packet(g_broadcast_callsign, from_callsign, PID_FILE, (unsigned char *)buffer, sizeof(buffer));
+		rc = tx_queue_raw_packet(pb->port, TX_CLASS_CONTROL, g_broadcast_callsign, from_callsign, PID_FILE, (unsigned char *)buffer, sizeof(buffer));
+	if (rc == EXIT_SUCCESS)
+		stats_tx_frame(STATS_TYPE_PB_STATUS, PID_FILE, from_callsign, 0, sizeof(buffer));
 
 	return rc;
 }
@@ -220,11 +375,178 @@ int pb_send_err(char *from_callsign, int err) {
 	strlcat(buffer, from_callsign, sizeof(buffer));
 	strncat(buffer,&CR,1); // very specifically add just one char to the end of the string for the CR
 	if (!g_run_self_test)
-		rc = send_raw_packet(g_broadcast_callsign, from_callsign, PID_FILE, (unsigned char *)buffer, sizeof(buffer));
+		rc = tx_queue_raw_packet(pb->port, TX_CLASS_CONTROL, g_broadcast_callsign, from_callsign, PID_FILE, (unsigned char *)buffer, sizeof(buffer));
+	if (rc == EXIT_SUCCESS)
+		stats_tx_frame(STATS_TYPE_PB_STATUS, PID_FILE, from_callsign, 0, sizeof(buffer));
 
 	return rc;
 }
 
+/**
+ * pb_port_init()
+ *
+ * Allocate the slots for the PB list of the selected port.  All of the slots start on the
+ * free list.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the memory could not be allocated
+ *
+ */
+static int pb_port_init() {
+	if (pb->list != NULL) return EXIT_SUCCESS; // already allocated
+	pb->capacity = g_max_pb_length;
+	if (pb->capacity < 1) pb->capacity = MAX_PB_LENGTH;
+	if (pb->capacity > PB_MAX_CAPACITY) {
+		error_print("max_pb_length of %d is too long, using %d\n", pb->capacity, PB_MAX_CAPACITY);
+		pb->capacity = PB_MAX_CAPACITY;
+	}
+	pb->list = (PB_ENTRY *)calloc(pb->capacity, sizeof(PB_ENTRY));
+	if (pb->list == NULL) return EXIT_FAILURE;
+	pb->hole_arena = (unsigned char *)malloc(pb->capacity * PB_HOLE_LIST_BYTES);
+	if (pb->hole_arena == NULL) {
+		free(pb->list);
+		pb->list = NULL;
+		return EXIT_FAILURE;
+	}
+
+	pb->slot_by_callsign = (int *)malloc(CALLSIGN_TABLE_SIZE * sizeof(int));
+	if (pb->slot_by_callsign == NULL) {
+		free(pb->hole_arena);
+		pb->hole_arena = NULL;
+		free(pb->list);
+		pb->list = NULL;
+		return EXIT_FAILURE;
+	}
+	for (int i=0; i < CALLSIGN_TABLE_SIZE; i++)
+		pb->slot_by_callsign[i] = -1;
+
+	for (int i=0; i < pb->capacity; i++) {
+		pb->list[i].in_use = false;
+		pb->list[i].next = (i == pb->capacity - 1) ? -1 : i + 1;
+		pb->list[i].prev = -1;
+		pb->list[i].hole_list = pb->hole_arena + i * PB_HOLE_LIST_BYTES;
+		timer_init(&pb->list[i].session_timer, pb_session_expired, pb);
+	}
+	pb->free_head = 0;
+	pb->head = -1;
+	pb->number_on_pb = 0;
+	pb->current_station = -1;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * pb_init()
+ *
+ * Allocate a PB list for each port.  The number of slots is set by the max_pb_length config
+ * value and the number of ports by number_of_ports.  Both are only read at startup.  The CRC
+ * tables used for the broadcast frames are also built here.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the memory could not be allocated
+ *
+ */
+int pb_init() {
+	crc16_init();
+	uint64_t now_ms = tx_now_ms();
+	timer_wheel_init(&pb_timer_wheel, now_ms);
+	for (int port=0; port < g_number_of_ports; port++) {
+		pb = &pb_ports[port];
+		pb->port = port;
+		if (pb_port_init() != EXIT_SUCCESS) {
+			pb = &pb_ports[0];
+			return EXIT_FAILURE;
+		}
+		timer_init(&pb->status_timer, pb_status_expired, pb);
+		timer_start(&pb_timer_wheel, &pb->status_timer, now_ms + (uint64_t)g_pb_status_period_in_seconds * 1000);
+	}
+	pb = &pb_ports[0];
+
+	if (pb_set_scheduler(g_pb_scheduler) != EXIT_SUCCESS) {
+		error_print("Unknown PB scheduler %s, using %s\n", g_pb_scheduler, PB_SCHEDULER_DRR);
+		pb_set_scheduler(PB_SCHEDULER_DRR);
+	}
+	pb_drr_quantum = g_pb_drr_quantum;
+	if (pb_drr_quantum < PB_MAX_FRAME_BYTES)
+		pb_drr_quantum = PB_MAX_FRAME_BYTES; // Otherwise a station could have a turn and not be able to send a frame
+	return EXIT_SUCCESS;
+}
+
+/**
+ * pb_set_scheduler()
+ *
+ * Select the PB scheduler by name.  Each station starts a new turn when the scheduler changes.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if there is no scheduler with this name
+ *
+ */
+int pb_set_scheduler(char *name) {
+	for (int i=0; i < PB_NUMBER_OF_SCHEDULERS; i++) {
+		if (strcmp(pb_schedulers[i].name, name) == 0) {
+			pb_scheduler = &pb_schedulers[i];
+			for (int port=0; port < MAX_PORTS; port++) {
+				for (int j=0; j < pb_ports[port].capacity; j++) {
+					pb_ports[port].list[j].deficit = 0;
+					pb_ports[port].list[j].turn_started = false;
+				}
+			}
+			return EXIT_SUCCESS;
+		}
+	}
+	return EXIT_FAILURE;
+}
+
+/**
+ * pb_find_request()
+ *
+ * Return the slot that holds the request for this callsign or -1 if the station is
+ * not on the PB.
+ *
+ */
+int pb_find_request(CALLSIGN_ID callsign_id) {
+	if (pb->list == NULL || callsign_id == CALLSIGN_ID_NONE || callsign_id >= CALLSIGN_TABLE_SIZE) return -1;
+	return pb->slot_by_callsign[callsign_id];
+}
+
+/**
+ * pb_set_node()
+ *
+ * Point an entry at a directory node, which may be NULL.  The entry holds the node so
+ * that it is not freed while the request uses it, and releases the node it held before.
+ *
+ */
+static void pb_set_node(PB_ENTRY *entry, DIR_NODE *node) {
+	dir_node_hold(node);
+	dir_node_release(entry->node);
+	entry->node = node;
+}
+
+/**
+ * pb_refresh_nodes()
+ *
+ * A node can be removed from the directory while a request on the PB points to it, for
+ * example when a command reloads the directory.  The node is not freed while the request
+ * holds it, but it is no longer in the list.  A file request moves to the node that now
+ * holds the file, or is removed if the file has gone.  A DIR request searches its current
+ * hole again from the start of the directory.
+ *
+ */
+static void pb_refresh_nodes() {
+	for (int i=0; i < pb->capacity; i++) {
+		PB_ENTRY *entry = &pb->list[i];
+		if (!entry->in_use || entry->node == NULL || !dir_node_removed(entry->node)) continue;
+		if (entry->pb_type == PB_FILE_REQUEST_TYPE) {
+			DIR_NODE *node = dir_get_node_by_id(entry->node->pfh->fileId);
+			if (node == NULL) {
+				debug_print("PB: File %04x for %s was removed from the directory\n", entry->node->pfh->fileId, callsign_str(entry->callsign_id));
+				pb_remove_request(i);
+			} else {
+				pb_set_node(entry, node);
+			}
+		} else {
+			pb_set_node(entry, NULL);
+			entry->offset = 0;
+		}
+	}
+}
+
 /**
  * pb_add_request()
  *
@@ -232,54 +554,78 @@ int pb_send_err(char *from_callsign, int err) {
  *
  * Make a copy of all the data because the original packet will be purged soon from the
  * circular buffer
- * Note that when we are adding an item the variable number_on_pb is pointing to the
- * empty slot where we want to insert data because the number is one greater than the
- * array index (which starts at 0)
+ * The request is placed in a slot from the free list and linked in at the end of the
+ * round robin ring, which is just before the head.
  *
  * returns EXIT_SUCCESS it it succeeds or EXIT_FAILURE if the PB is shut or full
  *
  */
-int pb_add_request(char *from_callsign, int type, DIR_NODE * node, int file_id, int offset, void *holes, int num_of_holes) {
+int pb_add_request(CALLSIGN_ID callsign_id, int type, DIR_NODE * node, int file_id, int offset, void *holes, int num_of_holes) {
 	if (!g_state_pb_open) return EXIT_FAILURE;
-	if (number_on_pb == MAX_PB_LENGTH) {
+	if (pb->free_head == -1) {
 		return EXIT_FAILURE; // PB full
 	}
+	if (callsign_id == CALLSIGN_ID_NONE || callsign_id >= CALLSIGN_TABLE_SIZE) return EXIT_FAILURE;
 
 	/* Each station can only be on the PB once, so reject if the callsign is already in the list */
-	for (int i=0; i < number_on_pb; i++) {
-		if ((strcmp(pb_list[i].callsign, from_callsign) == 0)) {
-			return EXIT_FAILURE; // Station is already on the PB
-		}
+	if (pb_find_request(callsign_id) != -1) {
+		return EXIT_FAILURE; // Station is already on the PB
 	}
 
-	strlcpy(pb_list[number_on_pb].callsign, from_callsign, MAX_CALLSIGN_LEN);
-	pb_list[number_on_pb].pb_type = type;
-//	pb_list[number_on_pb].file_id = file_id;
-	pb_list[number_on_pb].offset = offset;
-	pb_list[number_on_pb].request_time = time(0);
-	pb_list[number_on_pb].hole_num = num_of_holes;
-	pb_list[number_on_pb].current_hole_num = 0;
-	pb_list[number_on_pb].node = node;
-	if (num_of_holes > 0) {
-		if (type == PB_DIR_REQUEST_TYPE) {
-			DIR_DATE_PAIR *dir_holes = (DIR_DATE_PAIR *)holes;
-			DIR_DATE_PAIR *hole_list = (DIR_DATE_PAIR *)malloc(num_of_holes * sizeof(DIR_DATE_PAIR));
-			for (int i=0; i<num_of_holes; i++) {
-				hole_list[i].start = dir_holes[i].start;
-				hole_list[i].end = dir_holes[i].end;
-			}
-			pb_list[number_on_pb].hole_list = hole_list;
-		} else {
-			FILE_DATE_PAIR *file_holes = (FILE_DATE_PAIR *)holes;
-			FILE_DATE_PAIR *hole_list = (FILE_DATE_PAIR *)malloc(num_of_holes * sizeof(FILE_DATE_PAIR));
-			for (int i=0; i<num_of_holes; i++) {
-				hole_list[i].offset = file_holes[i].offset;
-				hole_list[i].length = file_holes[i].length;
-			}
-			pb_list[number_on_pb].hole_list = hole_list;
-		}
+	int pair_size = (type == PB_DIR_REQUEST_TYPE) ? sizeof(DIR_DATE_PAIR) : sizeof(FILE_DATE_PAIR);
+	if (num_of_holes < 0 || num_of_holes * pair_size > PB_HOLE_LIST_BYTES) {
+		error_print("Hole list of %d holes from %s is too long\n", num_of_holes, callsign_str(callsign_id));
+		return EXIT_FAILURE;
+	}
+
+	int slot = pb->free_head;
+	PB_ENTRY *entry = &pb->list[slot];
+	pb->free_head = entry->next;
+
+	entry->callsign_id = callsign_id;
+	entry->pb_type = type;
+	entry->offset = offset;
+	entry->request_time = time(0);
+	entry->hole_num = num_of_holes;
+	entry->current_hole_num = 0;
+	pb_set_node(entry, node);
+	entry->deficit = 0;
+	entry->turn_started = false;
+	entry->suppress_recent = true;
+	entry->fountain_symbols = 0;
+	entry->extended = false;
+	timer_start(&pb_timer_wheel, &entry->session_timer, tx_now_ms() + (uint64_t)g_pb_max_period_for_client_in_seconds * 1000);
+	/* The hole list is copied into the part of the arena that belongs to this slot */
+	if (num_of_holes > 0)
+		memcpy(entry->hole_list, holes, num_of_holes * pair_size);
+
+	/* Link into the round robin ring at the tail, unless the ledger says the station is well
+	 * through this file, in which case it is served straight after the current station */
+	pb_progress_update(slot);
+	if (pb->head == -1) {
+		entry->next = slot;
+		entry->prev = slot;
+		pb->head = slot;
+		pb->current_station = slot;
+	} else if (pb_progress_percent(slot) >= PB_PROGRESS_NEAR_COMPLETE_PERCENT) {
+		int prev = pb->current_station;
+		entry->prev = prev;
+		entry->next = pb->list[prev].next;
+		pb->list[entry->next].prev = slot;
+		pb->list[prev].next = slot;
+	} else {
+		int tail = pb->list[pb->head].prev;
+		entry->next = pb->head;
+		entry->prev = tail;
+		pb->list[tail].next = slot;
+		pb->list[pb->head].prev = slot;
 	}
-	number_on_pb++;
+
+	pb->slot_by_callsign[callsign_id] = slot;
+	callsign_hold(callsign_id);
+
+	entry->in_use = true;
+	pb->number_on_pb++;
 
 	return EXIT_SUCCESS;
 }
@@ -287,54 +633,246 @@ int pb_add_request(char *from_callsign, int type, DIR_NODE * node, int file_id,
 /**
  * pb_remove_request()
  *
- * Remove the callsign at the designated position.  This is most likely the
- * head because we finished a request.
+ * Remove the request in the designated slot.  This is most likely the current
+ * station because we finished a request.
  *
- * note that the variable number_on_pb is one greater than the last array position
- * with data.
+ * The slot is unlinked from the ring and the callsign table and returned to the
+ * free list.  If it was the current station then the next station in the ring
+ * becomes current.
  *
  * Returns EXIT_SUCCESS if it can be removed or EXIT_FAILURE if there was
  * no such item
  *
  */
-int pb_remove_request(int pos) {
-	if (number_on_pb == 0) return EXIT_FAILURE;
-	if (pos >= number_on_pb) return EXIT_FAILURE;
-	if (pos != number_on_pb-1) {
-
-		/* Remove the item and shuffle all the other items to the left */
-		for (int i = pos + 1; i < number_on_pb; i++) {
-			strlcpy(pb_list[i-1].callsign, pb_list[i].callsign, MAX_CALLSIGN_LEN);
-			pb_list[i-1].pb_type = pb_list[i].pb_type;
-//			pb_list[i-1].file_id = pb_list[i].file_id;
-			pb_list[i-1].offset = pb_list[i].offset;
-			pb_list[i-1].request_time = pb_list[i].request_time;
-			pb_list[i-1].hole_num = pb_list[i].hole_num;
-			pb_list[i-1].node = pb_list[i].node;
-			pb_list[i-1].current_hole_num = pb_list[i].current_hole_num;
-			pb_list[i-1].hole_list = pb_list[i].hole_list;
+int pb_remove_request(int slot) {
+	if (pb->number_on_pb == 0) return EXIT_FAILURE;
+	if (slot < 0 || slot >= pb->capacity) return EXIT_FAILURE;
+	PB_ENTRY *entry = &pb->list[slot];
+	if (!entry->in_use) return EXIT_FAILURE;
+
+	pb_progress_update(slot); /* Remember how far it got */
+	timer_stop(&entry->session_timer);
+	entry->hole_num = 0; /* The hole list stays with the slot */
+	pb_set_node(entry, NULL);
+
+	pb->slot_by_callsign[entry->callsign_id] = -1;
+
+	/* Unlink from the ring.  If the current station was removed then we move to the
+	 * next station, which is the one that would have been served after it. */
+	if (entry->next == slot) {
+		pb->head = -1;
+		pb->current_station = -1;
+	} else {
+		pb->list[entry->prev].next = entry->next;
+		pb->list[entry->next].prev = entry->prev;
+		if (pb->head == slot)
+			pb->head = entry->next;
+		if (pb->current_station == slot)
+			pb->current_station = entry->next;
+	}
+
+	/* Return the slot to the free list */
+	entry->in_use = false;
+	callsign_release(entry->callsign_id);
+	entry->callsign_id = CALLSIGN_ID_NONE;
+	entry->prev = -1;
+	entry->next = pb->free_head;
+	pb->free_head = slot;
+	pb->number_on_pb--;
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * pb_slot_at()
+ *
+ * Return the slot of the station at position pos on the PB, counting from the oldest
+ * request, or -1 if there is no such position.  This walks the ring, so it is only used
+ * for status and testing.
+ *
+ */
+int pb_slot_at(int pos) {
+	if (pos < 0 || pos >= pb->number_on_pb) return -1;
+	int slot = pb->head;
+	for (int i=0; i < pos; i++)
+		slot = pb->list[slot].next;
+	return slot;
+}
+
+/**
+ * pb_remaining_bytes()
+ *
+ * Return the number of bytes of the file that we still need to send for this
+ * request.  This is the rest of the file for a whole file request, or what is left
+ * of the current hole plus the later holes.  Returns 0 for a DIR request.
+ *
+ */
+int pb_remaining_bytes(int slot) {
+	PB_ENTRY *entry = &pb->list[slot];
+	if (entry->pb_type != PB_FILE_REQUEST_TYPE || entry->node == NULL || entry->node->pfh == NULL)
+		return 0;
+	int file_size = entry->node->pfh->fileSize;
+	if (entry->hole_num == 0) {
+		int remaining = file_size - entry->offset;
+		return remaining > 0 ? remaining : 0;
+	}
+	FILE_DATE_PAIR *holes = (FILE_DATE_PAIR *)entry->hole_list;
+	int remaining = 0;
+	for (int i = entry->current_hole_num; i < entry->hole_num; i++) {
+		int start = holes[i].offset;
+		int end = holes[i].offset + holes[i].length;
+		if (i == entry->current_hole_num && entry->offset > start)
+			start = entry->offset;
+		if (end > file_size)
+			end = file_size;
+		if (end > start)
+			remaining += end - start;
+	}
+	return remaining;
+}
+
+/**
+ * pb_progress_find()
+ *
+ * Find the ledger entry for a station and file.  If create is true and there is none then the
+ * least recently updated entry is reused.  The ledger is cleared first if a new pass has started.
+ *
+ * Returns a pointer to the entry or NULL
+ */
+static struct pb_progress *pb_progress_find(CALLSIGN_ID callsign_id, uint32_t file_id, int create) {
+	time_t pass = stats_get_pass_start();
+	if (pass != pb_progress_pass) {
+		for (int i=0; i < PB_PROGRESS_ENTRIES; i++)
+			callsign_release(pb_progress[i].callsign_id);
+		memset(pb_progress, 0, sizeof(pb_progress));
+		pb_progress_pass = pass;
+	}
+	int oldest = 0;
+	for (int i=0; i < PB_PROGRESS_ENTRIES; i++) {
+		if (pb_progress[i].file_id == file_id && pb_progress[i].callsign_id == callsign_id)
+			return &pb_progress[i];
+		if (pb_progress[i].last_update < pb_progress[oldest].last_update)
+			oldest = i;
+	}
+	if (!create) return NULL;
+	struct pb_progress *p = &pb_progress[oldest];
+	callsign_release(p->callsign_id);
+	memset(p, 0, sizeof(struct pb_progress));
+	callsign_hold(callsign_id);
+	p->callsign_id = callsign_id;
+	p->file_id = file_id;
+	return p;
+}
+
+/**
+ * pb_progress_update()
+ *
+ * Take the bytes that the file request in slot still needs from its entry.  Called when the
+ * request is added, after each of its turns and when it is removed.
+ */
+void pb_progress_update(int slot) {
+	PB_ENTRY *entry = &pb->list[slot];
+	if (entry->pb_type != PB_FILE_REQUEST_TYPE || entry->node == NULL || entry->node->pfh == NULL)
+		return;
+	struct pb_progress *p = pb_progress_find(entry->callsign_id, entry->node->pfh->fileId, true);
+	p->file_size = entry->node->pfh->fileSize;
+	p->bytes_remaining = pb_remaining_bytes(slot);
+	p->last_update = time(0);
+}
+
+/**
+ * pb_progress_percent()
+ *
+ * Returns how far the station in slot is through its file, from 0 to 100.  DIR requests are 0.
+ */
+int pb_progress_percent(int slot) {
+	PB_ENTRY *entry = &pb->list[slot];
+	if (entry->pb_type != PB_FILE_REQUEST_TYPE || entry->node == NULL || entry->node->pfh == NULL)
+		return 0;
+	struct pb_progress *p = pb_progress_find(entry->callsign_id, entry->node->pfh->fileId, false);
+	if (p == NULL || p->file_size <= 0) return 0;
+	int remaining = p->bytes_remaining;
+	if (remaining > p->file_size) remaining = p->file_size;
+	return (int)(100 - (int64_t)remaining * 100 / p->file_size);
+}
+
+/**
+ * pb_drr_weight()
+ *
+ * Return the weight of a station for the deficit round robin.  Each turn the station
+ * can send weight * quantum bytes.
+ * DIR fills are short so they get a bigger share to clear them quickly.  Files get extra
+ * weight from the priority in their PFH and as they get close to completion, which
+ * reduces the mean time for stations to complete their downloads.  Completion comes from the
+ * progress ledger, so it counts what was sent for earlier requests in the pass.
+ *
+ */
+int pb_drr_weight(int slot) {
+	PB_ENTRY *entry = &pb->list[slot];
+	int weight = 1;
+	if (entry->pb_type == PB_DIR_REQUEST_TYPE) {
+		weight += PB_DRR_DIR_WEIGHT;
+	} else if (entry->node != NULL && entry->node->pfh != NULL) {
+		int priority = entry->node->pfh->priority;
+		if (priority > PB_DRR_MAX_PRIORITY_WEIGHT)
+			priority = PB_DRR_MAX_PRIORITY_WEIGHT;
+		weight += priority;
+		int percent = pb_progress_percent(slot);
+		if (percent >= 75)
+			weight += 2;
+		else if (percent >= 50)
+			weight += 1;
+	}
+	return weight;
+}
+
+/**
+ * pb_rr_select() pb_rr_charge()
+ *
+ * Simple round robin.  Every station gets one frame per turn regardless of the request.
+ */
+void pb_rr_select() {
+}
+
+void pb_rr_charge(int slot, int bytes) {
+	pb->current_station = pb->list[slot].next;
+}
+
+/**
+ * pb_drr_select() pb_drr_charge()
+ *
+ * Deficit round robin measured in bytes of airtime.  At the start of its turn a station has
+ * its quantum, based on its weight, added to its deficit.  It keeps the turn while the deficit
+ * is big enough to send another full frame.  Any unused deficit is carried to its next turn.
+ * The quantum is at least one full frame so each station sends at least one frame per turn.
+ * A file request that could finish within PB_PROGRESS_FINISH_TURNS turns is given the airtime
+ * to finish in this one, so that it completes before the pass ends.
+ */
+void pb_drr_select() {
+	PB_ENTRY *entry = &pb->list[pb->current_station];
+	if (!entry->turn_started) {
+		int quantum = pb_drr_weight(pb->current_station) * pb_drr_quantum;
+		int remaining = pb_remaining_bytes(pb->current_station);
+		if (remaining > 0) {
+			int frames = (remaining + PB_FILE_DEFAULT_BLOCK_SIZE - 1) / PB_FILE_DEFAULT_BLOCK_SIZE;
+			int to_finish = remaining + frames * (sizeof(PB_FILE_HEADER) + 2 + PB_AX25_HEADER_BYTES);
+			if (to_finish > quantum && to_finish <= PB_PROGRESS_FINISH_TURNS * quantum)
+				quantum = to_finish;
 		}
+		entry->deficit += quantum;
+		entry->turn_started = true;
 	}
-	/* We want to free the hole list from the last position in the list before we decrement the number on pb
-	 * number_on_pb is pointing to an empty position now. */
-	if (pb_list[pos].hole_num  > 0)
-		free(pb_list[number_on_pb].hole_list);
-	number_on_pb--;
-
-	/* We have to update the station we will next send data to.
-	 * If a station earlier in the list was removed, then this decrements by one.
-	 * If a station later in the list was remove we do nothing.
-	 * If the current station was removed then we do nothing because we are already
-	 * pointing to the next station, unless we are at the end of the list */
-	if (pos < current_station_on_pb) {
-		current_station_on_pb--;
-		if (current_station_on_pb < 0)
-			current_station_on_pb = 0;
-	} else if (pos == current_station_on_pb) {
-		if (current_station_on_pb >= number_on_pb)
-			current_station_on_pb = 0;
+}
+
+void pb_drr_charge(int slot, int bytes) {
+	PB_ENTRY *entry = &pb->list[slot];
+	entry->deficit -= bytes;
+	if (entry->deficit < PB_MAX_FRAME_BYTES) {
+		/* Turn over.  Keep what is left for the next turn */
+		if (entry->deficit < 0) entry->deficit = 0;
+		entry->turn_started = false;
+		pb->current_station = entry->next;
 	}
-	return EXIT_SUCCESS;
 }
 
 /**
@@ -344,16 +882,18 @@ int pb_remove_request(int pos) {
  * The *buffer to receive the string and its length len should be passed in.
  */
 void pb_make_list_str(char *buffer, int len) {
-	if (number_on_pb == 0)
+	if (pb->number_on_pb == 0)
 		strlcpy(buffer, "PB Empty.", len);
 	else
 		strlcpy(buffer, "PB ", len);
-	for (int i=0; i < number_on_pb; i++) {
-			strlcat(buffer, pb_list[i].callsign, len);
-		if (pb_list[i].pb_type == PB_DIR_REQUEST_TYPE)
+	int slot = pb->head;
+	for (int i=0; i < pb->number_on_pb; i++) {
+			strlcat(buffer, callsign_str(pb->list[slot].callsign_id), len);
+		if (pb->list[slot].pb_type == PB_DIR_REQUEST_TYPE)
 			strlcat(buffer, "/D ", len);
 		else
 			strlcat(buffer, " ", len);
+		slot = pb->list[slot].next;
 	}
 }
 
@@ -361,25 +901,27 @@ void pb_debug_print_list() {
 	char buffer[256];
 	pb_make_list_str(buffer, sizeof(buffer));
 	debug_print("%s\n",buffer);
-	for (int i=0; i < number_on_pb; i++) {
-		pb_debug_print_list_item(i);
+	int slot = pb->head;
+	for (int i=0; i < pb->number_on_pb; i++) {
+		pb_debug_print_list_item(slot);
+		slot = pb->list[slot].next;
 	}
 }
 
 void pb_debug_print_list_item(int i) {
-	debug_print("--%s Ty:%d ",pb_list[i].callsign,pb_list[i].pb_type);
-	if (pb_list[i].node != NULL)
-		debug_print("File:%d ",pb_list[i].node->pfh->fileId);
-	debug_print("Off:%d Holes:%d Cur:%d",pb_list[i].offset,pb_list[i].hole_num,pb_list[i].current_hole_num);
+	debug_print("--%s Ty:%d ",callsign_str(pb->list[i].callsign_id),pb->list[i].pb_type);
+	if (pb->list[i].node != NULL)
+		debug_print("File:%d ",pb->list[i].node->pfh->fileId);
+	debug_print("Off:%d Holes:%d Cur:%d",pb->list[i].offset,pb->list[i].hole_num,pb->list[i].current_hole_num);
 	char buf[30];
-	time_t now = pb_list[i].request_time;
+	time_t now = pb->list[i].request_time;
 	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", gmtime(&now));
 	debug_print(" at:%s", buf);
 
-	if (pb_list[i].pb_type == PB_DIR_REQUEST_TYPE)
-		pb_debug_print_dir_holes(pb_list[i].hole_list, pb_list[i].hole_num);
+	if (pb->list[i].pb_type == PB_DIR_REQUEST_TYPE)
+		pb_debug_print_dir_holes(pb->list[i].hole_list, pb->list[i].hole_num);
 	else
-		pb_debug_print_file_holes(pb_list[i].hole_list, pb_list[i].hole_num);
+		pb_debug_print_file_holes(pb->list[i].hole_list, pb->list[i].hole_num);
 }
 
 /**
@@ -388,24 +930,28 @@ void pb_debug_print_list_item(int i) {
  * process a UI frame received from a ground station.  This may contain a Pacsat Broadcast request,
  * otherwise it can be ignored.
  * This is called from the main processing loop whenever a type K frame is sent to the broadcast
- * callsign.
+ * callsign.  The request goes on the PB for the port that it was heard on.  A receiver can hear
+ * requests on a port that we can not send UI frames on, so those go on the PB for port 0.
  *
  */
-void pb_process_frame(char *from_callsign, char *to_callsign, unsigned char *data, int len) {
+void pb_process_frame(int port, CALLSIGN_ID from_id, unsigned char *data, int len) {
+	if (port < 0 || port >= g_number_of_ports)
+		port = 0;
+	pb = &pb_ports[port];
 	struct t_ax25_header *broadcast_request_header;
 	broadcast_request_header = (struct t_ax25_header *)data;
 
 	//debug_print("Broadcast Request: pid: %02x \n", broadcast_request_header->pid & 0xff);
 	if ((broadcast_request_header->pid & 0xff) == PID_DIRECTORY) {
-		pb_handle_dir_request(from_callsign, data, len);
+		pb_handle_dir_request(from_id, data, len);
 	}
 	if ((broadcast_request_header->pid & 0xff) == PID_FILE) {
 		// File Request
-		pb_handle_file_request(from_callsign, data, len);
+		pb_handle_file_request(from_id, data, len);
 	}
 	if ((broadcast_request_header->pid & 0xff) == PID_COMMAND) {
 		// Command Request
-		pc_handle_command(from_callsign, data, len);
+		pc_handle_command(callsign_str(from_id), data, len);
 	}
 }
 
@@ -419,7 +965,8 @@ void pb_process_frame(char *from_callsign, char *to_callsign, unsigned char *dat
  * station was not added to the PB.  Only returns EXIT_FAILURE if there is
  * an unexpected error, such as the TNC is unavailable.
  */
-int pb_handle_dir_request(char *from_callsign, unsigned char *data, int len) {
+int pb_handle_dir_request(CALLSIGN_ID from_id, unsigned char *data, int len) {
+	char *from_callsign = callsign_str(from_id);
 	// Dir Request
 	int rc=EXIT_SUCCESS;
 	DIR_REQ_HEADER *dir_header;
@@ -443,9 +990,21 @@ int pb_handle_dir_request(char *from_callsign, unsigned char *data, int len) {
 			}
 			return EXIT_SUCCESS;
 		}
-		/* Add to the PB if we can*/
+		/* Sort, merge and clip the holes.  Reject the request if nothing is left */
 		DIR_DATE_PAIR * holes = get_dir_holes_list(data);
-		if (pb_add_request(from_callsign, PB_DIR_REQUEST_TYPE, NULL, 0, 0, holes, num_of_holes) == EXIT_SUCCESS) {
+		DIR_DATE_PAIR normalized_holes[num_of_holes];
+		num_of_holes = pb_normalize_dir_holes(holes, num_of_holes, normalized_holes, num_of_holes);
+		if (num_of_holes < 1) {
+			rc = pb_send_err(from_callsign, PB_ERR_FILE_INVALID_PACKET);
+			if (rc != EXIT_SUCCESS) {
+				error_print("\n Error : Could not send ERR Response to TNC \n");
+				return EXIT_FAILURE;
+			}
+			return EXIT_SUCCESS;
+		}
+		pb_note_dir_request(time(0));
+		/* Add to the PB if we can*/
+		if (pb_add_request(from_id, PB_DIR_REQUEST_TYPE, NULL, 0, 0, normalized_holes, num_of_holes) == EXIT_SUCCESS) {
 			// ACK the station
 			rc = pb_send_ok(from_callsign);
 			if (rc != EXIT_SUCCESS) {
@@ -530,6 +1089,290 @@ void pb_debug_print_dir_req(unsigned char *data, int len) {
 	}
 }
 
+/* A hole as a range of bytes or upload times [start, end] used while we normalize a hole list */
+struct pb_range {
+	uint32_t start;
+	uint32_t end;
+};
+typedef struct pb_range PB_RANGE;
+
+/**
+ * pb_sort_and_merge_ranges()
+ *
+ * Sort the ranges by their start and merge any that overlap or are next to each other.
+ * The lists are short, at most one packet, so an insertion sort is fine.  The end is compared
+ * in 64 bits because an open DIR hole ends at 0xFFFFFFFF.
+ *
+ * Returns the number of ranges left
+ *
+ */
+static int pb_sort_and_merge_ranges(PB_RANGE *ranges, int num) {
+	for (int i=1; i < num; i++) {
+		PB_RANGE r = ranges[i];
+		int j = i - 1;
+		while (j >= 0 && ranges[j].start > r.start) {
+			ranges[j+1] = ranges[j];
+			j--;
+		}
+		ranges[j+1] = r;
+	}
+	int n = 0;
+	for (int i=0; i < num; i++) {
+		if (n > 0 && (uint64_t)ranges[i].start <= (uint64_t)ranges[n-1].end + 1) {
+			if (ranges[i].end > ranges[n-1].end)
+				ranges[n-1].end = ranges[i].end;
+		} else {
+			ranges[n++] = ranges[i];
+		}
+	}
+	return n;
+}
+
+/**
+ * pb_normalize_file_holes()
+ *
+ * Put a file hole list from a request into canonical form.  Holes are clipped to the file
+ * size, which handles the 0xFFFF length that the ground station uses for "to the end".  Holes
+ * of zero length or that start beyond the end of the file are dropped.  The rest are sorted
+ * and overlapping holes are merged so that no byte is sent twice for one request.  A merged
+ * hole longer than a FILE_DATE_PAIR can describe is split.
+ *
+ * The result is written to normalized, which holds max_holes.
+ *
+ * Returns the number of holes in the normalized list, which is 0 if the list is degenerate
+ *
+ */
+int pb_normalize_file_holes(FILE_DATE_PAIR *holes, int num_of_holes, uint32_t file_size,
+		FILE_DATE_PAIR *normalized, int max_holes) {
+	PB_RANGE ranges[num_of_holes > 0 ? num_of_holes : 1];
+	int n = 0;
+	for (int i=0; i < num_of_holes; i++) {
+		uint32_t start = holes[i].offset;
+		uint32_t end = start + holes[i].length; // exclusive
+		if (holes[i].length == 0 || start >= file_size) continue;
+		if (end > file_size) end = file_size;
+		ranges[n].start = start;
+		ranges[n].end = end - 1;
+		n++;
+	}
+	n = pb_sort_and_merge_ranges(ranges, n);
+
+	int num = 0;
+	for (int i=0; i < n && num < max_holes; i++) {
+		uint32_t start = ranges[i].start;
+		while (start <= ranges[i].end && num < max_holes) {
+			uint32_t length = ranges[i].end - start + 1;
+			if (length > 0xFFFF) length = 0xFFFF;
+			normalized[num].offset = start;
+			normalized[num].length = length;
+			num++;
+			start += length;
+		}
+	}
+	return num;
+}
+
+/**
+ * pb_normalize_dir_holes()
+ *
+ * Put a directory hole list from a request into canonical form.  Holes where the start is
+ * after the end are dropped.  The start of the rest is clipped to the upload time of the
+ * oldest file in the directory, then they are sorted and merged.  The end is not clipped to
+ * the newest file, because files uploaded while the request is on the PB are in the hole
+ * too, and dir_get_pfh_by_date() only finds the files that exist when the hole is served.
+ *
+ * A hole that is entirely older or newer than the directory still needs an answer, because
+ * we send the nearest header so the station knows there is nothing there.  A hole that is
+ * older becomes the single upload time of the oldest file and a hole that is newer starts at
+ * the upload time of the newest file, which give the same response.  Any number of these
+ * requests then merge into one.
+ *
+ * The result is written to normalized, which holds max_holes.
+ *
+ * Returns the number of holes in the normalized list, which is 0 if the list is degenerate
+ *
+ */
+int pb_normalize_dir_holes(DIR_DATE_PAIR *holes, int num_of_holes, DIR_DATE_PAIR *normalized, int max_holes) {
+	PB_RANGE ranges[num_of_holes > 0 ? num_of_holes : 1];
+	uint32_t oldest, newest;
+	int have_range = (dir_get_time_range(&oldest, &newest) == EXIT_SUCCESS);
+	int n = 0;
+	for (int i=0; i < num_of_holes; i++) {
+		uint32_t start = holes[i].start;
+		uint32_t end = holes[i].end;
+		if (start > end) continue;
+		if (have_range) {
+			if (start > newest) {
+				start = newest;
+			} else if (end < oldest) {
+				start = oldest;
+				end = oldest;
+			} else if (start < oldest) {
+				start = oldest;
+			}
+		}
+		ranges[n].start = start;
+		ranges[n].end = end;
+		n++;
+	}
+	n = pb_sort_and_merge_ranges(ranges, n);
+	if (n > max_holes) n = max_holes;
+	for (int i=0; i < n; i++) {
+		normalized[i].start = ranges[i].start;
+		normalized[i].end = ranges[i].end;
+	}
+	return n;
+}
+
+/**
+ * pb_handle_stop_file_request()
+ *
+ * A station has asked us to stop broadcasting a file, usually because it now has all of it.
+ * A station can only stop a file broadcast that it started, and because a station can only
+ * be on the PB once, that is the entry for its callsign.  If the entry is for this file then
+ * it is removed so the airtime goes to other stations, and we send OK.  If the station is
+ * waiting for something else then we leave it alone and send NO -1.  If the station is not on
+ * the PB then there is nothing to stop and we send OK.
+ *
+ * Returns EXIT_SUCCESS if the request was stopped or there was nothing to stop, otherwise
+ * EXIT_FAILURE
+ *
+ */
+int pb_handle_stop_file_request(CALLSIGN_ID from_id, uint32_t file_id) {
+	char *from_callsign = callsign_str(from_id);
+	int rc = EXIT_SUCCESS;
+	int slot = pb_find_request(from_id);
+	if (slot != -1) {
+		PB_ENTRY *entry = &pb->list[slot];
+		if (entry->pb_type != PB_FILE_REQUEST_TYPE || entry->node == NULL || entry->node->pfh == NULL
+				|| entry->node->pfh->fileId != file_id) {
+			rc = pb_send_err(from_callsign, PB_ERR_TEMPORARY);
+			if (rc != EXIT_SUCCESS) {
+				error_print("Error : Could not send ERR Response to TNC \n");
+			}
+			return EXIT_FAILURE;
+		}
+		pb_remove_request(slot);
+	}
+	rc = pb_send_ok(from_callsign);
+	if (rc != EXIT_SUCCESS) {
+		error_print("Error : Could not send OK Response to TNC \n");
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * pb_range_add()
+ *
+ * Replace the oldest entry in a ring of ranges.
+ */
+static void pb_range_add(struct pb_sent_range *ranges, int *next, uint32_t file_id, uint32_t start, uint32_t end,
+		CALLSIGN_ID callsign_id, time_t now) {
+	struct pb_sent_range *range = &ranges[*next];
+	range->file_id = file_id;
+	range->start = start;
+	range->end = end;
+	range->sent_time = now;
+	callsign_hold(callsign_id);
+	callsign_release(range->callsign_id);
+	range->callsign_id = callsign_id;
+	*next = (*next + 1) % PB_RECENT_RANGES;
+}
+
+/**
+ * pb_recent_add()
+ *
+ * Remember that a chunk of a file was broadcast.
+ */
+static void pb_recent_add(uint32_t file_id, uint32_t start, uint32_t end, CALLSIGN_ID callsign_id, time_t now) {
+	pb_range_add(pb->recent, &pb->recent_next, file_id, start, end, callsign_id, now);
+}
+
+/**
+ * pb_suppressed_add()
+ *
+ * Remember that a chunk of a file was skipped for a station because it was broadcast recently.
+ */
+static void pb_suppressed_add(uint32_t file_id, uint32_t start, uint32_t end, CALLSIGN_ID callsign_id, time_t now) {
+	pb_range_add(pb->suppressed, &pb->suppressed_next, file_id, start, end, callsign_id, now);
+}
+
+/**
+ * pb_recent_sent_until()
+ *
+ * Returns the offset of the first byte at or after offset that was not broadcast in the last
+ * pb_recent_window_in_seconds.  This is offset itself if it was not sent recently.
+ */
+static uint32_t pb_recent_sent_until(uint32_t file_id, uint32_t offset, time_t now) {
+	if (g_pb_recent_window_in_seconds <= 0) return offset;
+	int found = true;
+	while (found) {
+		found = false;
+		for (int i=0; i < PB_RECENT_RANGES; i++) {
+			struct pb_sent_range *range = &pb->recent[i];
+			if (range->file_id != file_id || (now - range->sent_time) > g_pb_recent_window_in_seconds) continue;
+			if (range->start <= offset && offset < range->end) {
+				offset = range->end;
+				found = true;
+			}
+		}
+	}
+	return offset;
+}
+
+/**
+ * pb_ranges_overlap()
+ *
+ * Returns true if any of the holes overlap a range in the ring that was added for this station
+ * in the last pb_recent_window_in_seconds.
+ */
+static int pb_ranges_overlap(struct pb_sent_range *ranges, CALLSIGN_ID callsign_id, uint32_t file_id,
+		FILE_DATE_PAIR *holes, int num_of_holes, time_t now) {
+	for (int i=0; i < PB_RECENT_RANGES; i++) {
+		struct pb_sent_range *range = &ranges[i];
+		if (range->file_id != file_id || (now - range->sent_time) > g_pb_recent_window_in_seconds) continue;
+		if (range->callsign_id != callsign_id) continue;
+		for (int h=0; h < num_of_holes; h++)
+			if (holes[h].offset < range->end && range->start < holes[h].offset + holes[h].length)
+				return true;
+	}
+	return false;
+}
+
+/**
+ * pb_recent_requested_again()
+ *
+ * Returns true if any of the holes were broadcast for this station, or were skipped for it
+ * because they were broadcast for another station, in the last pb_recent_window_in_seconds.
+ * The station missed them so we should send them again.
+ */
+static int pb_recent_requested_again(CALLSIGN_ID callsign_id, uint32_t file_id, FILE_DATE_PAIR *holes, int num_of_holes, time_t now) {
+	return pb_ranges_overlap(pb->recent, callsign_id, file_id, holes, num_of_holes, now)
+			|| pb_ranges_overlap(pb->suppressed, callsign_id, file_id, holes, num_of_holes, now);
+}
+
+/**
+ * pb_admit_file_request()
+ *
+ * Decide if a request for bytes of a file can finish before LOS, given the stations that are
+ * already sharing the PB.  If it can not then the station is sent NO -1 so that it can try again
+ * next pass.  A station that is already on the PB is not counted twice.
+ *
+ * Returns true if the request should be added to the PB
+ */
+static int pb_admit_file_request(CALLSIGN_ID from_id, int bytes) {
+	char *from_callsign = callsign_str(from_id);
+	int others = pb->number_on_pb;
+	if (pb_find_request(from_id) != -1) others--;
+	if (pass_can_complete(time(0), bytes, others)) return true;
+	debug_print("PB: %s refused %d bytes that can not finish before LOS\n", from_callsign, bytes);
+	int rc = pb_send_err(from_callsign, PB_ERR_TEMPORARY);
+	if (rc != EXIT_SUCCESS) {
+		error_print("Error : Could not send ERR Response to TNC \n");
+	}
+	return false;
+}
+
 /**
  * pb_handle_file_request()
  *
@@ -538,7 +1381,8 @@ void pb_debug_print_dir_req(unsigned char *data, int len) {
  * Returns EXIT_SUCCESS if the station was added to the PB, otherwise it
  * returns EXIT_FAILURE
  */
-int pb_handle_file_request(char *from_callsign, unsigned char *data, int len) {
+int pb_handle_file_request(CALLSIGN_ID from_id, unsigned char *data, int len) {
+	char *from_callsign = callsign_str(from_id);
 	// File Request
 	int rc=EXIT_SUCCESS;
 	int num_of_holes = 0;
@@ -547,6 +1391,10 @@ int pb_handle_file_request(char *from_callsign, unsigned char *data, int len) {
 
 	//debug_print("FILE REQUEST: flags: %02x file: %04x BLK_SIZE: %04x\n", file_header->flags & 0xff, file_header->file_id &0xffff, file_header->block_size &0xffff);
 
+	/* A stop request does not need the file, which may have been removed since the station requested it */
+	if ((file_header->flags & 0b11) == PB_STOP_SENDING_FILE)
+		return pb_handle_stop_file_request(from_id, file_header->file_id);
+
 	/* First, does the file exist */
 	DIR_NODE * node = dir_get_node_by_id(file_header->file_id);
 	if (node == NULL) {
@@ -586,13 +1434,23 @@ int pb_handle_file_request(char *from_callsign, unsigned char *data, int len) {
 		}
 	}
 
+	pb_note_file_request(file_header->file_id, time(0));
+
 	switch ((file_header->flags & 0b11)) {
 
 	case PB_START_SENDING_FILE :
 		/* least sig 2 bits of flags are 00 if this is a request to send a new file */
 		// Add to the PB
 		//debug_print(" - send whole file\n");
-		if (pb_add_request(from_callsign, PB_FILE_REQUEST_TYPE, node, file_header->file_id, 0, 0, 0) == EXIT_SUCCESS) {
+		if (!pb_admit_file_request(from_id, node->pfh->fileSize))
+			return EXIT_FAILURE;
+		if (pb_add_request(from_id, PB_FILE_REQUEST_TYPE, node, file_header->file_id, 0, 0, 0) == EXIT_SUCCESS) {
+			/* If the F bit is set then follow the file with repair symbols, which fill whichever
+			 * chunks each listening station missed */
+			if ((file_header->flags & (1 << F_BIT)) && g_pb_fountain_repair_percent > 0) {
+				int k = fountain_num_blocks(node->pfh->fileSize, PB_FILE_DEFAULT_BLOCK_SIZE);
+				pb->list[pb_find_request(from_id)].fountain_symbols = (k * g_pb_fountain_repair_percent + 99) / 100;
+			}
 			// ACK the station
 			rc = pb_send_ok(from_callsign);
 			if (rc != EXIT_SUCCESS) {
@@ -611,13 +1469,6 @@ int pb_handle_file_request(char *from_callsign, unsigned char *data, int len) {
 		break;
 
 
-	case PB_STOP_SENDING_FILE :
-		/* A station can only stop a file broadcast if they started it */
-		//debug_print(" - stop sending file\n");
-		error_print("\n NOT IMPLEMENTED YET : Unable to handle a file download cancel request \n");
-		return EXIT_FAILURE;
-		break;
-
 	case PB_FILE_HOLE_LIST :
 		/* Process the hole list for the file */
 		num_of_holes = get_num_of_file_holes(len);
@@ -630,106 +1481,316 @@ int pb_handle_file_request(char *from_callsign, unsigned char *data, int len) {
 			}
 			return EXIT_FAILURE;
 		}
-		FILE_DATE_PAIR * holes = get_file_holes_list(data);
-		//pb_debug_print_file_holes(holes, num_of_holes);
-		/* We could check the integrity of the holes list.  The offset should be inside the file length
-		 * but note that the ground station can just give FFFF as the upper length for a hole*/
-//		for (int i=0; i < num_of_holes; i++) {
-//			if (holes[i].offset >= node->pfh->fileSize) {
-//				/* This does not have a valid holes list */
-//				rc = pb_send_err(from_callsign, PB_ERR_FILE_INVALID_PACKET);
-//				if (rc != EXIT_SUCCESS) {
-//					error_print("\n Error : Could not send ERR Response to TNC \n");
-//					//exit(EXIT_FAILURE);
-//				}
-//				return EXIT_FAILURE;
-//			}
-//		}
-		if (pb_add_request(from_callsign, PB_FILE_REQUEST_TYPE, node, file_header->file_id, 0, holes, num_of_holes) == EXIT_SUCCESS) {
-			// ACK the station
-			rc = pb_send_ok(from_callsign);
-			if (rc != EXIT_SUCCESS) {
-				error_print("Error : Could not send OK Response to TNC \n");
-				//exit(EXIT_FAILURE);
-			}
+		FILE_DATE_PAIR * holes = get_file_holes_list(data);
+		//pb_debug_print_file_holes(holes, num_of_holes);
+		/* Sort, merge and clip the holes against the file size.  The ground station can give FFFF as the
+		 * length of the last hole.  If no valid holes are left then the request is rejected. */
+		FILE_DATE_PAIR normalized_holes[AX25_MAX_DATA_LEN / sizeof(FILE_DATE_PAIR)];
+		num_of_holes = pb_normalize_file_holes(holes, num_of_holes, node->pfh->fileSize,
+				normalized_holes, AX25_MAX_DATA_LEN / sizeof(FILE_DATE_PAIR));
+		if (num_of_holes < 1) {
+			rc = pb_send_err(from_callsign, PB_ERR_FILE_INVALID_PACKET);
+			if (rc != EXIT_SUCCESS) {
+				error_print("Error : Could not send ERR Response to TNC \n");
+			}
+			return EXIT_FAILURE;
+		}
+		int hole_bytes = 0;
+		for (int h=0; h < num_of_holes; h++)
+			hole_bytes += normalized_holes[h].length;
+		if (!pb_admit_file_request(from_id, hole_bytes))
+			return EXIT_FAILURE;
+		if (pb_add_request(from_id, PB_FILE_REQUEST_TYPE, node, file_header->file_id, 0, normalized_holes, num_of_holes) == EXIT_SUCCESS) {
+			if (pb_recent_requested_again(from_id, file_header->file_id, normalized_holes, num_of_holes, time(0)))
+				pb->list[pb_find_request(from_id)].suppress_recent = false;
+			// ACK the station
+			rc = pb_send_ok(from_callsign);
+			if (rc != EXIT_SUCCESS) {
+				error_print("Error : Could not send OK Response to TNC \n");
+				//exit(EXIT_FAILURE);
+			}
+		} else {
+			return EXIT_FAILURE;
+		}
+		break;
+
+
+	default :
+		rc = pb_send_err(from_callsign, PB_ERR_FILE_INVALID_PACKET);
+		if (rc != EXIT_SUCCESS) {
+			error_print("Error : Could not send ERR Response to TNC \n");
+			//exit(EXIT_FAILURE);
+		}
+		return EXIT_FAILURE;
+		break;
+
+	}
+	return rc;
+}
+
+
+/**
+ * pb_decay_score()
+ *
+ * Halve the score once for every half life that has passed since it was last decayed.
+ */
+static void pb_decay_score(struct pb_popular_file *entry, time_t now) {
+	if (now <= entry->score_time) return;
+	long half_lives = (now - entry->score_time) / PB_POPULARITY_HALF_LIFE_IN_SECONDS;
+	if (half_lives == 0) return;
+	entry->score = (half_lives >= 32) ? 0 : entry->score >> half_lives;
+	entry->score_time += half_lives * PB_POPULARITY_HALF_LIFE_IN_SECONDS;
+}
+
+/**
+ * pb_note_file_request()
+ *
+ * Count a request for a file.  If the file is not in the table it replaces the file with the
+ * lowest score.
+ */
+void pb_note_file_request(uint32_t file_id, time_t now) {
+	int lowest = 0;
+	for (int i=0; i < PB_MAX_POPULAR_FILES; i++) {
+		pb_decay_score(&pb_popular_files[i], now);
+		if (pb_popular_files[i].file_id == file_id) {
+			pb_popular_files[i].score += PB_POPULARITY_REQUEST_SCORE;
+			return;
+		}
+		if (pb_popular_files[i].score < pb_popular_files[lowest].score)
+			lowest = i;
+	}
+	pb_popular_files[lowest].file_id = file_id;
+	pb_popular_files[lowest].score = PB_POPULARITY_REQUEST_SCORE;
+	pb_popular_files[lowest].score_time = now;
+}
+
+/**
+ * pb_note_dir_request()
+ *
+ * Count a request for the directory.
+ */
+void pb_note_dir_request(time_t now) {
+	pb_decay_score(&pb_popular_dir, now);
+	if (pb_popular_dir.score_time == 0) pb_popular_dir.score_time = now;
+	pb_popular_dir.score += PB_POPULARITY_REQUEST_SCORE;
+}
+
+/**
+ * pb_idle_choose()
+ *
+ * Start the next idle broadcast.  DIR and FILE broadcasts take turns if both are wanted.  The
+ * file with the highest score is chosen and its score is halved when it has been sent, so the
+ * other popular files get a turn.
+ *
+ * Returns true if there is something to broadcast
+ */
+static int pb_idle_choose(time_t now) {
+	pb_decay_score(&pb_popular_dir, now);
+	int best = -1;
+	for (int i=0; i < PB_MAX_POPULAR_FILES; i++) {
+		pb_decay_score(&pb_popular_files[i], now);
+		if (pb_popular_files[i].file_id == 0 || pb_popular_files[i].score == 0) continue;
+		if (best == -1 || pb_popular_files[i].score > pb_popular_files[best].score)
+			best = i;
+	}
+	uint32_t oldest, newest;
+	int want_dir = pb_popular_dir.score > 0 && dir_get_time_range(&oldest, &newest) == EXIT_SUCCESS;
+	if (want_dir && (best == -1 || pb->idle_last_type != PB_DIR_REQUEST_TYPE)) {
+		pb->idle_type = PB_DIR_REQUEST_TYPE;
+		pb->idle_upload_time = newest;
+		pb->idle_count = 0;
+		pb_popular_dir.score = pb_popular_dir.score / 2;
+	} else if (best != -1) {
+		pb->idle_type = PB_FILE_REQUEST_TYPE;
+		pb->idle_file_id = pb_popular_files[best].file_id;
+		pb_popular_files[best].score = pb_popular_files[best].score / 2;
+	} else {
+		return false;
+	}
+	pb->idle_offset = 0;
+	pb->idle_last_type = pb->idle_type;
+	return true;
+}
+
+/**
+ * pb_idle_action()
+ *
+ * Called when the PB is empty.  Send the next frame of the idle broadcast if one is due.
+ *
+ * Returns EXIT_SUCCESS unless we could not send the frame to the TNC
+ */
+int pb_idle_action(time_t now) {
+	if (g_pb_idle_period_in_seconds <= 0 || !g_state_pb_open) return EXIT_SUCCESS;
+	if ((now - pb->last_idle_time) < g_pb_idle_period_in_seconds) return EXIT_SUCCESS;
+	if (pb->idle_type == 0 && !pb_idle_choose(now)) return EXIT_SUCCESS;
+	pb->last_idle_time = now;
+
+	int rc = EXIT_SUCCESS;
+	if (pb->idle_type == PB_DIR_REQUEST_TYPE) {
+		DIR_DATE_PAIR pair = {pb->idle_upload_time, pb->idle_upload_time};
+		DIR_NODE *node = dir_get_pfh_by_date(pair, NULL);
+		if (node == NULL) {
+			pb->idle_type = 0;
+			return EXIT_SUCCESS;
+		}
+		int offset = pb->idle_offset;
+		int data_len = 0;
+		unsigned char *frame = pb_get_dir_broadcast_frame(node, &offset, &data_len);
+		if (frame == NULL) {
+			pb->idle_type = 0;
+			return EXIT_SUCCESS;
+		}
+		if (!g_run_self_test)
+			rc = tx_send_raw_packet(pb->port, g_broadcast_callsign, QST, PID_DIRECTORY, frame, data_len);
+		if (rc != EXIT_SUCCESS) {
+			error_print("Could not send idle broadcast packet to TNC \n");
+			pb->idle_type = 0;
+			return EXIT_FAILURE;
+		}
+		stats_tx_frame(STATS_TYPE_DIR, PID_DIRECTORY, NULL, node->pfh->fileId, data_len);
+		if (offset == node->pfh->bodyOffset) {
+			pb->idle_offset = 0;
+			pb->idle_count++;
+			DIR_NODE *prev = dir_prev_node(node);
+			if (prev == NULL || pb->idle_count >= PB_IDLE_DIR_PFHS)
+				pb->idle_type = 0;
+			else
+				pb->idle_upload_time = prev->pfh->uploadTime;
 		} else {
-			return EXIT_FAILURE;
+			pb->idle_offset = offset;
 		}
-		break;
-
+	} else if (pb->idle_type == PB_FILE_REQUEST_TYPE) {
+		DIR_NODE *node = dir_get_node_by_id(pb->idle_file_id);
+		if (node == NULL) {
+			pb->idle_type = 0;
+			return EXIT_SUCCESS;
+		}
+		char psf_filename[MAX_FILE_PATH_LEN];
+		dir_get_file_path_from_file_id(pb->idle_file_id, get_dir_folder(), psf_filename, MAX_FILE_PATH_LEN);
+		int number_of_bytes_read = pb_broadcast_next_file_chunk(node->pfh, psf_filename, pb->idle_offset,
+				PB_FILE_DEFAULT_BLOCK_SIZE, node->pfh->fileSize, CALLSIGN_ID_NONE);
+		if (number_of_bytes_read == RA_NOT_READY) {
+			pb->last_idle_time = 0; /* Still on the disk, try again on the next loop */
+			return EXIT_SUCCESS;
+		}
+		pb->idle_offset += number_of_bytes_read;
+		if (number_of_bytes_read == 0 || pb->idle_offset >= node->pfh->fileSize)
+			pb->idle_type = 0;
+	}
+	return rc;
+}
 
-	default :
-		rc = pb_send_err(from_callsign, PB_ERR_FILE_INVALID_PACKET);
-		if (rc != EXIT_SUCCESS) {
-			error_print("Error : Could not send ERR Response to TNC \n");
-			//exit(EXIT_FAILURE);
+/**
+ * pb_prefetch_chunks()
+ *
+ * Ask the read ahead thread for the next RA_CHUNKS_AHEAD chunks of each file request on the PB.
+ * They are the chunks that pb_next_action() will send next for that station, following the
+ * hole list if there is one.
+ */
+void pb_prefetch_chunks() {
+	for (int i=0; i < pb->capacity; i++) {
+		if (!pb->list[i].in_use || pb->list[i].pb_type != PB_FILE_REQUEST_TYPE || pb->list[i].node == NULL) continue;
+		int file_size = pb->list[i].node->pfh->fileSize;
+		char psf_filename[MAX_FILE_PATH_LEN];
+		dir_get_file_path_from_file_id(pb->list[i].node->pfh->fileId, get_dir_folder(), psf_filename, MAX_FILE_PATH_LEN);
+
+		int offset = pb->list[i].offset;
+		int hole = pb->list[i].current_hole_num;
+		FILE_DATE_PAIR *holes = pb->list[i].hole_list;
+		if (pb->list[i].hole_num > 0 && offset == 0 && hole < pb->list[i].hole_num)
+			offset = holes[hole].offset;
+		for (int c=0; c < RA_CHUNKS_AHEAD && offset < file_size; c++) {
+			if (ra_prefetch(pb->list[i].node->pfh->fileId, psf_filename, offset) != EXIT_SUCCESS)
+				return; /* The pool is busy */
+			offset += PB_FILE_DEFAULT_BLOCK_SIZE;
+			if (pb->list[i].hole_num > 0 && offset >= holes[hole].offset + holes[hole].length) {
+				if (++hole >= pb->list[i].hole_num) break;
+				offset = holes[hole].offset;
+			}
 		}
-		return EXIT_FAILURE;
-		break;
+	}
+}
 
+/**
+ * pb_status_expired()
+ *
+ * Send the status of the PB for the port in arg and start the timer for the next one.
+ */
+static void pb_status_expired(TIMER *timer, void *arg, uint64_t now_ms) {
+	pb = (PB_PORT *)arg;
+	if (pb_send_status() != EXIT_SUCCESS) {
+		error_print("Could not send PB status to TNC \n");
 	}
-	return rc;
+	sent_pb_status = true;
+	timer_start(&pb_timer_wheel, timer, now_ms + (uint64_t)g_pb_status_period_in_seconds * 1000);
 }
 
+/**
+ * pb_session_expired()
+ *
+ * The station has been on the PB of the port in arg for g_pb_max_period_for_client_in_seconds.
+ * If it is nearly done then it gets one more period, otherwise it is removed.
+ */
+static void pb_session_expired(TIMER *timer, void *arg, uint64_t now_ms) {
+	pb = (PB_PORT *)arg;
+	PB_ENTRY *entry = (PB_ENTRY *)((char *)timer - offsetof(PB_ENTRY, session_timer));
+	int slot = entry - pb->list;
+	if (!entry->extended && pb_progress_percent(slot) >= PB_PROGRESS_NEAR_COMPLETE_PERCENT) {
+		/* Nearly done.  Give it one more period rather than send it to the back of the PB */
+		entry->extended = true;
+		entry->request_time = time(0);
+		timer_start(&pb_timer_wheel, timer, now_ms + (uint64_t)g_pb_max_period_for_client_in_seconds * 1000);
+	} else {
+		/* This station has exceeded the time allowed on the PB */
+		pb_remove_request(slot);
+	}
+}
 
 /**
- * pb_next_action()
+ * pb_port_next_action()
  *
- * When called take the next action for next station on the PB
+ * When called take the next action for next station on the PB of the selected port
  *
  * Returns EXIT_SUCCESS, even if we can not process the request.  Only returns
  * EXIT_FAILURE if something goes badly wrong, such as we can not send data to
  * the TNC
  *
  */
-int pb_next_action() {
+static int pb_port_next_action(time_t now) {
 	int rc = EXIT_SUCCESS;
 
-	//TODO - broadcast the number of bytes transmitted to BSTAT periodically so stations can calc efficiency
-
-	/* First see if we need to send the status */
-	time_t now = time(0);
-	if (last_pb_status_time == 0) last_pb_status_time = now; // Initialize at startup
-
-	if ((now - last_pb_status_time) > g_pb_status_period_in_seconds) {
-		// then send the status
-		rc = pb_send_status();
-		if (rc != EXIT_SUCCESS) {
-			error_print("Could not send PB status to TNC \n");
-		}
-//		char buffer[256];
-//		pb_make_list_str(buffer, sizeof(buffer));
-//		debug_print("%s | %d frames queued\n", buffer, tnc_get_frames_queued());
-		last_pb_status_time = now;
-		sent_pb_status = true;
-	}
-
-	//TODO - broadcast the number of bytes transmitted to BSTAT periodically so stations can calc efficiency
+	/* Move any request off a node that was removed from the directory */
+	pb_refresh_nodes();
 
 	/* Now process the next station on the PB if there is one and take its action */
-	if (number_on_pb == 0) return EXIT_SUCCESS; // nothing to do
-
-	if ((now - pb_list[current_station_on_pb].request_time) > g_pb_max_period_for_client_in_seconds) {
-		/* This station has exceeded the time allowed on the PB */
-		pb_remove_request(current_station_on_pb);
-		/* If we removed a station then we don't want/need to increment the current station pointer */
-		return EXIT_SUCCESS;
+	if (pb->number_on_pb == 0) {
+		/* Use the spare airtime for the popular files and newest PFHs */
+		if (!g_run_self_test)
+			if (tx_busy(pb->port, tx_now_ms())) return EXIT_SUCCESS; /* TNC is Busy */
+		return pb_idle_action(now);
 	}
 
+	/* Keep the disk reads ahead of the broadcasts, even while the TNC is busy */
+	pb_prefetch_chunks();
+
 	if (!g_run_self_test)
-		if (tnc_busy()) return EXIT_SUCCESS; /* TNC is Busy */
+		if (tx_busy(pb->port, tx_now_ms())) return EXIT_SUCCESS; /* TNC is Busy */
+
+	/* Start or continue the turn of the current station.  bytes_sent is charged to it at the end */
+	pb_scheduler->select();
+	int bytes_sent = 0;
 
 	/**
 	 *  Process Request to broadcast directory
 	 */
-	if (pb_list[current_station_on_pb].pb_type == PB_DIR_REQUEST_TYPE) {
+	if (pb->list[pb->current_station].pb_type == PB_DIR_REQUEST_TYPE) {
 
-//		debug_print("Preparing DIR Broadcast for %s\n",pb_list[current_station_on_pb].callsign);
-		if (pb_list[current_station_on_pb].hole_num < 1) {
+//		debug_print("Preparing DIR Broadcast for %s\n",callsign_str(pb->list[pb->current_station].callsign_id));
+		if (pb->list[pb->current_station].hole_num < 1) {
 			/* This is not a valid DIR Request.  There is no hole list.  We should not get here because this
 			 * should not have been added.  So just remove it. */
-			error_print("Invalid DIR request with no hole list from %s\n", pb_list[current_station_on_pb].callsign);
-			pb_remove_request(current_station_on_pb);
+			error_print("Invalid DIR request with no hole list from %s\n", callsign_str(pb->list[pb->current_station].callsign_id));
+			pb_remove_request(pb->current_station);
 			/* If we removed a station then we don't want/need to increment the current station pointer */
 			return EXIT_SUCCESS;
 		}
@@ -739,153 +1800,214 @@ int pb_next_action() {
 		 * are we are at hole "current_hole_num", which is zero if we are just starting
 		 * empty_hole_list is updated if we find at least one hole
 		 */
-		int current_hole_num = pb_list[current_station_on_pb].current_hole_num;
-		DIR_DATE_PAIR *holes = pb_list[current_station_on_pb].hole_list;
-		DIR_NODE *node = dir_get_pfh_by_date(holes[current_hole_num], pb_list[current_station_on_pb].node);
+		int current_hole_num = pb->list[pb->current_station].current_hole_num;
+		DIR_DATE_PAIR *holes = pb->list[pb->current_station].hole_list;
+		DIR_NODE *node = dir_get_pfh_by_date(holes[current_hole_num], pb->list[pb->current_station].node);
 		if (node == NULL) {
 			/* We have finished the broadcasts for this hole, or there were no records for the hole, move to the next hole if there is one. */
-			pb_list[current_station_on_pb].current_hole_num++; /* Increment now.  If the data is bad and we can't make a frame, we want to move on to the next */
-			if (pb_list[current_station_on_pb].current_hole_num == pb_list[current_station_on_pb].hole_num) {
+			pb->list[pb->current_station].current_hole_num++; /* Increment now.  If the data is bad and we can't make a frame, we want to move on to the next */
+			if (pb->list[pb->current_station].current_hole_num == pb->list[pb->current_station].hole_num) {
 				/* We have finished this hole list */
-				//debug_print("Added last hole for request from %s\n", pb_list[current_station_on_pb].callsign);
-				pb_remove_request(current_station_on_pb);
+				//debug_print("Added last hole for request from %s\n", callsign_str(pb->list[pb->current_station].callsign_id));
+				pb_remove_request(pb->current_station);
 				/* If we removed a station then we don't want/need to increment the current station pointer */
 				return EXIT_SUCCESS;
 			} else {
-				// debug_print("PB: No more files for this hole for request from %s\n", pb_list[current_station_on_pb].callsign);
-				pb_list[current_station_on_pb].node = NULL; // next search will be from start of the DIR as we have no idea what the next hole may be
+				// debug_print("PB: No more files for this hole for request from %s\n", callsign_str(pb->list[pb->current_station].callsign_id));
+				pb_set_node(&pb->list[pb->current_station], NULL); // next search will be from start of the DIR as we have no idea what the next hole may be
 			}
 		}
 		else {
 			/* We found a dir header */
 
-			//debug_print("DIR BD Offset %d: ", pb_list[current_station_on_pb].offset);
+			//debug_print("DIR BD Offset %d: ", pb->list[pb->current_station].offset);
 			//pfh_debug_print(node->pfh);
 
 			/* Store the offset and pass it into the function that makes the broadcast packet.  The offset after
 			 * the broadcast is returned in this offset variable.  It equals the length of the PFH if the whole header
 			 * has been broadcast. */
-			int offset = pb_list[current_station_on_pb].offset;
-			int data_len = pb_make_dir_broadcast_packet(node, packet_data_bytes, &offset);
-			if (data_len == 0) {
+			int offset = pb->list[pb->current_station].offset;
+			int data_len = 0;
+			unsigned char *frame = pb_get_dir_broadcast_frame(node, &offset, &data_len);
+			if (frame == NULL) {
 				debug_print("ERROR: ** Could not create the DIR Broadcast frame\n");
 				/* To avoid a loop where we keep hitting this error, we remove the station from the PB */
 				// TODO - this only occirs if we cant read from file system, so requested file is corrupt perhaps.
 				// We can't now send ER as we already sent OK.  But can remove the entry from the dir and Mark as unavailable?
-				pb_remove_request(current_station_on_pb);
+				pb_remove_request(pb->current_station);
 				return EXIT_FAILURE;
 			}
 
 			/* Send the fill and finish */
 			int rc = EXIT_SUCCESS;
 			if (!g_run_self_test)
-				send_raw_packet(g_broadcast_callsign, QST, PID_DIRECTORY, packet_data_bytes, data_len);
+				rc = tx_send_raw_packet(pb->port, g_broadcast_callsign, QST, PID_DIRECTORY, frame, data_len);
 			//int rc = send_raw_packet('K', g_bbs_callsign, QST, PID_DIRECTORY, data_bytes, data_len);
 			if (rc != EXIT_SUCCESS) {
 				error_print("Could not send broadcast packet to TNC \n");
 				/* To avoid a loop where we keep hitting this error, we remove the station from the PB */
 				// TODO - we could not send the packet.  We should log/report it in telemetry
-				pb_remove_request(current_station_on_pb);
+				pb_remove_request(pb->current_station);
 				return EXIT_FAILURE;
 			}
+			bytes_sent = data_len + PB_AX25_HEADER_BYTES;
+			stats_tx_frame(STATS_TYPE_DIR, PID_DIRECTORY, callsign_str(pb->list[pb->current_station].callsign_id), node->pfh->fileId, data_len);
 
 			/* check if we sent the whole PFH or if it is split into more than one broadcast */
 			if (offset == node->pfh->bodyOffset) {
 				/* Then we have sent this whole PFH */
-				pb_list[current_station_on_pb].node = node->next; /* Store where we are in this broadcast of DIR fills */
-				pb_list[current_station_on_pb].offset = 0; /* Reset this ready to send the next one */
+				DIR_NODE *next = dir_next_node(node);
+				pb_set_node(&pb->list[pb->current_station], next); /* Store where we are in this broadcast of DIR fills */
+				pb->list[pb->current_station].offset = 0; /* Reset this ready to send the next one */
 
-				if (node->next == NULL) {
+				if (next == NULL) {
 					/* There are no more records, we are at the end of the list, move to next hole if there is one */
-					pb_list[current_station_on_pb].current_hole_num++;
-					if (pb_list[current_station_on_pb].current_hole_num == pb_list[current_station_on_pb].hole_num) {
+					pb->list[pb->current_station].current_hole_num++;
+					if (pb->list[pb->current_station].current_hole_num == pb->list[pb->current_station].hole_num) {
 						/* We have finished this hole list */
-//						debug_print("Added last hole for request from %s\n", pb_list[current_station_on_pb].callsign);
-						pb_remove_request(current_station_on_pb);
+//						debug_print("Added last hole for request from %s\n", callsign_str(pb->list[pb->current_station].callsign_id));
+						pb_remove_request(pb->current_station);
 						/* If we removed a station then we don't want/need to increment the current station pointer */
 						return EXIT_SUCCESS;
 					}
 				}
 			} else {
-				pb_list[current_station_on_pb].offset = offset; /* Store the offset so we send the next part of the PFH next time */
+				pb->list[pb->current_station].offset = offset; /* Store the offset so we send the next part of the PFH next time */
 			}
 		}
 
 	/**
 	 *  Process Request to broadcast a file or parts of a file
 	 */
-	} else if (pb_list[current_station_on_pb].pb_type == PB_FILE_REQUEST_TYPE) {
-//		debug_print("Preparing FILE Broadcast for %s\n",pb_list[current_station_on_pb].callsign);
+	} else if (pb->list[pb->current_station].pb_type == PB_FILE_REQUEST_TYPE) {
+//		debug_print("Preparing FILE Broadcast for %s\n",callsign_str(pb->list[pb->current_station].callsign_id));
 
 		char psf_filename[MAX_FILE_PATH_LEN];
-		dir_get_file_path_from_file_id(pb_list[current_station_on_pb].node->pfh->fileId,get_dir_folder(), psf_filename, MAX_FILE_PATH_LEN);
-
-		if (pb_list[current_station_on_pb].hole_num == 0) {
+		dir_get_file_path_from_file_id(pb->list[pb->current_station].node->pfh->fileId,get_dir_folder(), psf_filename, MAX_FILE_PATH_LEN);
+
+		if (pb->list[pb->current_station].hole_num == 0
+				&& pb->list[pb->current_station].offset >= pb->list[pb->current_station].node->pfh->fileSize) {
+			/* The whole file has been sent, now send the repair symbols that the station asked for */
+			int number_of_bytes_read = pb_broadcast_fountain_symbol(pb->list[pb->current_station].node->pfh, psf_filename,
+					pb->list[pb->current_station].node->pfh->fileSize, pb->list[pb->current_station].callsign_id);
+			bytes_sent = number_of_bytes_read + sizeof(PB_FILE_HEADER) + 2 + PB_AX25_HEADER_BYTES;
+			pb->list[pb->current_station].fountain_symbols--;
+			if (number_of_bytes_read == 0 || pb->list[pb->current_station].fountain_symbols <= 0) {
+				pb_remove_request(pb->current_station);
+				/* If we removed a station then we don't want/need to increment the current station pointer */
+				return EXIT_SUCCESS;
+			}
+		} else if (pb->list[pb->current_station].hole_num == 0) {
 			/* Request to broadcast the whole file */
 			/* SEND THE NEXT CHUNK OF THE FILE BASED ON THE OFFSET */
-			int number_of_bytes_read = pb_broadcast_next_file_chunk(pb_list[current_station_on_pb].node->pfh, psf_filename,
-					pb_list[current_station_on_pb].offset, PB_FILE_DEFAULT_BLOCK_SIZE, pb_list[current_station_on_pb].node->pfh->fileSize);
-			pb_list[current_station_on_pb].offset += number_of_bytes_read;
+			int number_of_bytes_read = pb_broadcast_next_file_chunk(pb->list[pb->current_station].node->pfh, psf_filename,
+					pb->list[pb->current_station].offset, PB_FILE_DEFAULT_BLOCK_SIZE, pb->list[pb->current_station].node->pfh->fileSize,
+					pb->list[pb->current_station].callsign_id);
+			if (number_of_bytes_read == RA_NOT_READY) return EXIT_SUCCESS; /* Still on the disk, try again next time */
+			pb->list[pb->current_station].offset += number_of_bytes_read;
+			bytes_sent = number_of_bytes_read + sizeof(PB_FILE_HEADER) + 2 + PB_AX25_HEADER_BYTES;
 			if (number_of_bytes_read == 0) {
-				pb_remove_request(current_station_on_pb);
+				pb_remove_request(pb->current_station);
 				/* If we removed a station then we don't want/need to increment the current station pointer */
 				return EXIT_SUCCESS;
 			}
 
-			/* If we are done then remove this request */
-			if (pb_list[current_station_on_pb].offset >= pb_list[current_station_on_pb].node->pfh->fileSize) {
-				pb_remove_request(current_station_on_pb);
+			/* If we are done then remove this request, unless repair symbols follow */
+			if (pb->list[pb->current_station].offset >= pb->list[pb->current_station].node->pfh->fileSize
+					&& pb->list[pb->current_station].fountain_symbols == 0) {
+				pb_remove_request(pb->current_station);
 				/* If we removed a station then we don't want/need to increment the current station pointer */
 				return EXIT_SUCCESS;
 			}
 		} else { // there is a hole list
 
 			/* Request to fill holes in the file */
-			int current_hole_num = pb_list[current_station_on_pb].current_hole_num;
-//			debug_print("Preparing Fill %d of %d from FILE %04x for %s --",(current_hole_num+1), pb_list[current_station_on_pb].hole_num,
-//					pb_list[current_station_on_pb].node->pfh->fileId, pb_list[current_station_on_pb].callsign);
+			int current_hole_num = pb->list[pb->current_station].current_hole_num;
+//			debug_print("Preparing Fill %d of %d from FILE %04x for %s --",(current_hole_num+1), pb->list[pb->current_station].hole_num,
+//					pb->list[pb->current_station].node->pfh->fileId, callsign_str(pb->list[pb->current_station].callsign_id));
 
-			FILE_DATE_PAIR *holes = pb_list[current_station_on_pb].hole_list;
+			FILE_DATE_PAIR *holes = pb->list[pb->current_station].hole_list;
 
-			if (pb_list[current_station_on_pb].offset == 0) {
+			if (pb->list[pb->current_station].offset == 0) {
 				/* Then this is probablly a new hole, initialize to the start of it */
-				pb_list[current_station_on_pb].offset = holes[current_hole_num].offset;
+				pb->list[pb->current_station].offset = holes[current_hole_num].offset;
 			}
-//			debug_print("  Chunk from %d length %d at offset %d\n",holes[current_hole_num].offset, holes[current_hole_num].length, pb_list[current_station_on_pb].offset);
+//			debug_print("  Chunk from %d length %d at offset %d\n",holes[current_hole_num].offset, holes[current_hole_num].length, pb->list[pb->current_station].offset);
 
-			/* We are currently at byte pb_list[current_station_on_pb].offset for this request.  So this hole
+			/* We are currently at byte pb->list[pb->current_station].offset for this request.  So this hole
 			 * still has the following remaining bytes */
-			int remaining_length_of_hole = holes[current_hole_num].offset + holes[current_hole_num].length - pb_list[current_station_on_pb].offset;
-
-			int number_of_bytes_read = pb_broadcast_next_file_chunk(pb_list[current_station_on_pb].node->pfh, psf_filename,
-					pb_list[current_station_on_pb].offset, remaining_length_of_hole, pb_list[current_station_on_pb].node->pfh->fileSize);
-			pb_list[current_station_on_pb].offset += number_of_bytes_read;
+			int remaining_length_of_hole = holes[current_hole_num].offset + holes[current_hole_num].length - pb->list[pb->current_station].offset;
+
+			/* Skip the bytes that were broadcast moments ago.  The station has them unless it asked again */
+			int number_of_bytes_read = 0;
+			if (pb->list[pb->current_station].suppress_recent)
+				number_of_bytes_read = pb_recent_sent_until(pb->list[pb->current_station].node->pfh->fileId,
+						pb->list[pb->current_station].offset, now) - pb->list[pb->current_station].offset;
+			if (number_of_bytes_read > 0) {
+				pb_suppressed_add(pb->list[pb->current_station].node->pfh->fileId, pb->list[pb->current_station].offset,
+						pb->list[pb->current_station].offset + number_of_bytes_read, pb->list[pb->current_station].callsign_id, now);
+			} else {
+				number_of_bytes_read = pb_broadcast_next_file_chunk(pb->list[pb->current_station].node->pfh, psf_filename,
+						pb->list[pb->current_station].offset, remaining_length_of_hole, pb->list[pb->current_station].node->pfh->fileSize,
+						pb->list[pb->current_station].callsign_id);
+				if (number_of_bytes_read == RA_NOT_READY) return EXIT_SUCCESS; /* Still on the disk, try again next time */
+				bytes_sent = number_of_bytes_read + sizeof(PB_FILE_HEADER) + 2 + PB_AX25_HEADER_BYTES;
+			}
+			pb->list[pb->current_station].offset += number_of_bytes_read;
 			if (number_of_bytes_read == 0) {
-				pb_remove_request(current_station_on_pb);
+				pb_remove_request(pb->current_station);
 				/* If we removed a station then we don't want/need to increment the current station pointer */
 				return EXIT_SUCCESS;
 			}
-			if (pb_list[current_station_on_pb].offset >= holes[current_hole_num].offset + holes[current_hole_num].length
-					|| pb_list[current_station_on_pb].offset >= pb_list[current_station_on_pb].node->pfh->fileSize) {
+			if (pb->list[pb->current_station].offset >= holes[current_hole_num].offset + holes[current_hole_num].length
+					|| pb->list[pb->current_station].offset >= pb->list[pb->current_station].node->pfh->fileSize) {
 				/* We have finished this hole, or we are at the end of the file */
-				pb_list[current_station_on_pb].current_hole_num++;
-				if (pb_list[current_station_on_pb].current_hole_num == pb_list[current_station_on_pb].hole_num) {
+				pb->list[pb->current_station].current_hole_num++;
+				if (pb->list[pb->current_station].current_hole_num == pb->list[pb->current_station].hole_num) {
 					/* We have finished the fole list */
-					pb_remove_request(current_station_on_pb);
+					pb_remove_request(pb->current_station);
 					/* If we removed a station then we don't want/need to increment the current station pointer */
 					return EXIT_SUCCESS;
 				} else {
 					/* Move the offset to the start of the next hole */
-					pb_list[current_station_on_pb].offset = holes[pb_list[current_station_on_pb].current_hole_num].offset;
+					pb->list[pb->current_station].offset = holes[pb->list[pb->current_station].current_hole_num].offset;
 				}
 			}
 		}
 	}
 
-	current_station_on_pb++;
-	if (current_station_on_pb == number_on_pb)
-		current_station_on_pb = 0;
+	/* Charge the airtime to this station.  The scheduler moves to the next station when the turn is over */
+	pb_progress_update(pb->current_station);
+	pb_scheduler->charge(pb->current_station, bytes_sent);
+
+	return rc;
+}
+
+/**
+ * pb_next_action()
+ *
+ * Take the next action on the PB of each port.  Each port has its own TX pacing, so a busy
+ * port does not hold up the others.
+ *
+ * Returns EXIT_SUCCESS unless something went badly wrong on one of the ports
+ *
+ */
+int pb_next_action() {
+	int rc = EXIT_SUCCESS;
+	time_t now = time(0);
 
+	/* The status and the stations that have been on the PB too long are timers */
+	timer_wheel_advance(&pb_timer_wheel, tx_now_ms());
+
+	for (int port=0; port < g_number_of_ports; port++) {
+		pb = &pb_ports[port];
+		if (pb_port_next_action(now) != EXIT_SUCCESS)
+			rc = EXIT_FAILURE;
+	}
+	pb = &pb_ports[0];
+
+	/* Broadcast the bytes transmitted to BSTAT periodically so stations can calc efficiency */
+	stats_next_action(now);
 	return rc;
 }
 
@@ -897,28 +2019,28 @@ int pb_next_action() {
  * that it exists.  Any errors at this point are unrecoverable and should
  * result in the request being removed from the PB.
  *
- * Returns EXIT SUCCESS or the offset to be stored for the next transmission.
- * // TODO - we cant return EXIT_FAILURE here, but could return -ve number..
+ * callsign is the station the chunk is sent for, or NULL for an idle broadcast.  It is only
+ * used for the statistics.
+ *
+ * Returns the number of bytes sent, 0 if there was an error, or RA_NOT_READY if the chunk
+ * is still being read from disk and nothing was sent.
  */
-int pb_broadcast_next_file_chunk(HEADER *pfh, char * psf_filename, int offset, int length, int file_size) {
+int pb_broadcast_next_file_chunk(HEADER *pfh, char * psf_filename, int offset, int length, int file_size, CALLSIGN_ID callsign_id) {
 	int rc = EXIT_SUCCESS;
 
 	if (length > PB_FILE_DEFAULT_BLOCK_SIZE)
 		length = PB_FILE_DEFAULT_BLOCK_SIZE;
 
-	FILE * f = fopen(psf_filename, "r");
-	if (f == NULL) {
-		return EXIT_SUCCESS;
-	}
-
 	// TODO - this is where the logic would go to check the block size that the client sends and potentially use that
 
-	if (fseek( f, offset, SEEK_SET ) != 0) {
-		return EXIT_SUCCESS;
-	}
-	int number_of_bytes_read = fread(broadcast_buffer, sizeof(char), PB_FILE_DEFAULT_BLOCK_SIZE, f);
+	/* Copy the chunk into its final place in the frame, after the header.  If the read ahead thread
+	 * does not have it in memory yet then we try again next time rather than wait for the disk */
+	int number_of_bytes_read = ra_read(pfh->fileId, psf_filename, offset, packet_buffer + sizeof(PB_FILE_HEADER), PB_FILE_DEFAULT_BLOCK_SIZE);
+	if (number_of_bytes_read == RA_NOT_READY)
+		return RA_NOT_READY;
+	if (number_of_bytes_read == 0)
+		return 0;
 	//debug_print("Read %d bytes from %s\n", number_of_bytes_read, psf_filename);
-	fclose(f);
 
 	int chunk_includes_last_byte = false;
 
@@ -928,8 +2050,8 @@ int pb_broadcast_next_file_chunk(HEADER *pfh, char * psf_filename, int offset, i
 	//debug_print("FILE BB to send: ");
 	//pfh_debug_print(pfh);
 
-	int data_len = pb_make_file_broadcast_packet(pfh, packet_buffer, broadcast_buffer,
-			number_of_bytes_read, offset, chunk_includes_last_byte);
+	int data_len = pb_make_file_broadcast_packet(pfh, packet_buffer,
+			number_of_bytes_read, offset, chunk_includes_last_byte, PB_FILE_VERSION_CHUNK);
 	if (data_len == 0) {
 		/* Hmm, something went badly wrong here.  We better remove this request or we will keep
 		 * hitting this error.  It's unclear what went wrong do we mark the file as not available?
@@ -941,15 +2063,118 @@ int pb_broadcast_next_file_chunk(HEADER *pfh, char * psf_filename, int offset, i
 
 	/* Send the broadcast and finish */
 	if (!g_run_self_test)
-		rc = send_raw_packet(g_broadcast_callsign, QST, PID_FILE, packet_buffer, data_len);
+		rc = tx_send_raw_packet(pb->port, g_broadcast_callsign, QST, PID_FILE, packet_buffer, data_len);
 	if (rc != EXIT_SUCCESS) {
 		error_print("Could not send broadcast packet to TNC \n");
 		return EXIT_SUCCESS;
 	}
+	stats_tx_frame(STATS_TYPE_FILE, PID_FILE, callsign_str(callsign_id), pfh->fileId, data_len);
+	pb_recent_add(pfh->fileId, offset, offset + number_of_bytes_read, callsign_id, time(0));
+	if (callsign_id != CALLSIGN_ID_NONE) {
+		struct pb_progress *p = pb_progress_find(callsign_id, pfh->fileId, false);
+		if (p != NULL)
+			p->bytes_delivered += number_of_bytes_read;
+	}
 
 	return number_of_bytes_read;
 }
 
+/**
+ * pb_broadcast_fountain_symbol()
+ *
+ * Broadcast the next fountain repair symbol for a file.  It is always a full block, with
+ * VV set to PB_FILE_VERSION_REPAIR and the symbol id in the offset field.  The ground
+ * station works out which blocks were xored together from the file id and symbol id, see
+ * pacsat_fountain.c
+ *
+ * Returns the number of bytes in the symbol or 0 if it could not be sent
+ */
+int pb_broadcast_fountain_symbol(HEADER *pfh, char * psf_filename, int file_size, CALLSIGN_ID callsign_id) {
+	int rc = EXIT_SUCCESS;
+
+	FILE * f = fopen(psf_filename, "r");
+	if (f == NULL) {
+		return 0;
+	}
+	uint32_t symbol_id = pb_fountain_next_symbol;
+	pb_fountain_next_symbol = (pb_fountain_next_symbol % FOUNTAIN_MAX_SYMBOL_ID) + 1;
+	rc = fountain_encode_symbol(f, file_size, PB_FILE_DEFAULT_BLOCK_SIZE, pfh->fileId, symbol_id,
+			packet_buffer + sizeof(PB_FILE_HEADER));
+	fclose(f);
+	if (rc != EXIT_SUCCESS) {
+		error_print("Could not make repair symbol %d for file %04x\n", symbol_id, pfh->fileId);
+		return 0;
+	}
+
+	int data_len = pb_make_file_broadcast_packet(pfh, packet_buffer,
+			PB_FILE_DEFAULT_BLOCK_SIZE, symbol_id, false, PB_FILE_VERSION_REPAIR);
+
+	if (!g_run_self_test)
+		rc = tx_send_raw_packet(pb->port, g_broadcast_callsign, QST, PID_FILE, packet_buffer, data_len);
+	if (rc != EXIT_SUCCESS) {
+		error_print("Could not send broadcast packet to TNC \n");
+		return 0;
+	}
+	stats_tx_frame(STATS_TYPE_FILE, PID_FILE, callsign_str(callsign_id), pfh->fileId, data_len);
+
+	return PB_FILE_DEFAULT_BLOCK_SIZE;
+}
+
+/**
+ * pb_get_dir_broadcast_frame()
+ *
+ * Return the DIR broadcast frame for the part of the PFH that starts at *offset and put
+ * its length in *len.  *offset is moved past the PFH bytes in the frame, so it equals the
+ * bodyOffset once the whole header has been sent.
+ *
+ * All of the frames for a PFH are built the first time one of them is needed and are cached
+ * on the directory node.  The directory increments bd_gen when the neighbors of the node
+ * change, which is the only time that t_old, t_new or the N bit can change, and the frames
+ * are built again if they were made for an older bd_gen.  Only the PB uses the cache, so it
+ * frees the old frames itself.  Sending a DIR fill is then just a matter of passing the
+ * cached frame to the TNC.
+ *
+ * Returns a pointer to the frame or NULL if it could not be built
+ *
+ */
+unsigned char * pb_get_dir_broadcast_frame(DIR_NODE *node, int *offset, int *len) {
+	int frame_size = sizeof(PB_DIR_HEADER) + MAX_DIR_PFH_LENGTH + 2;
+	int pfh_len = node->pfh->bodyOffset;
+	if (*offset < 0 || *offset >= pfh_len) return NULL;
+
+	/* Read the generation before the neighbors, so a change while we build is seen next time */
+	unsigned int gen = atomic_load(&node->bd_gen);
+	if (node->bd_frames != NULL && node->bd_frames_gen != gen) {
+		free(node->bd_frames);
+		node->bd_frames = NULL;
+		node->bd_frames_num = 0;
+	}
+	if (node->bd_frames == NULL) {
+		int frames_num = (pfh_len + MAX_DIR_PFH_LENGTH - 1) / MAX_DIR_PFH_LENGTH;
+		unsigned char *frames = (unsigned char *)malloc(frames_num * frame_size);
+		if (frames == NULL) return NULL;
+		int frame_offset = 0;
+		for (int i=0; i < frames_num; i++) {
+			if (pb_make_dir_broadcast_packet(node, frames + i * frame_size, &frame_offset) == 0) {
+				free(frames);
+				return NULL;
+			}
+		}
+		node->bd_frames = frames;
+		node->bd_frames_num = frames_num;
+		node->bd_frames_gen = gen;
+	}
+
+	int i = *offset / MAX_DIR_PFH_LENGTH;
+	if (i >= node->bd_frames_num) return NULL;
+	int pfh_bytes = pfh_len - i * MAX_DIR_PFH_LENGTH;
+	if (pfh_bytes > MAX_DIR_PFH_LENGTH)
+		pfh_bytes = MAX_DIR_PFH_LENGTH;
+	*len = sizeof(PB_DIR_HEADER) + pfh_bytes + 2;
+	*offset = i * MAX_DIR_PFH_LENGTH + pfh_bytes;
+	return node->bd_frames + i * frame_size;
+}
+
 /**
  * pb_make_dir_broadcast_packet()
  *
@@ -1012,12 +2237,7 @@ int pb_make_dir_broadcast_packet(DIR_NODE *node, unsigned char *data_bytes, int
 
 	PB_DIR_HEADER dir_broadcast;
 	char flag = 0;
-	///////////////////////// TODO - some logic here to set the E bit if this is the entire PFH otherwise deal with offset etc
-	if (node->pfh->bodyOffset < MAX_DIR_PFH_LENGTH) {
-		flag |= 1UL << E_BIT; // Set the E bit, All of this header is contained in the broadcast frame
-	}
 	dir_broadcast.offset = *offset;
-	dir_broadcast.flags = flag;
 	dir_broadcast.file_id = node->pfh->fileId;
 
 	/* The dates guarantee:
@@ -1028,12 +2248,14 @@ int pb_make_dir_broadcast_packet(DIR_NODE *node, unsigned char *data_bytes, int
       t_old is 1 second after the upload time of the prev file
       t_new is 1 second before the upload time of the next file
      */
-	if (node->prev != NULL)
-		dir_broadcast.t_old = node->prev->pfh->uploadTime + 1;
+	DIR_NODE *prev = dir_prev_node(node);
+	DIR_NODE *next = dir_next_node(node);
+	if (prev != NULL)
+		dir_broadcast.t_old = prev->pfh->uploadTime + 1;
 	else
 		dir_broadcast.t_old = 0;
-	if (node->next != NULL)
-		dir_broadcast.t_new = node->next->pfh->uploadTime - 1;
+	if (next != NULL)
+		dir_broadcast.t_new = next->pfh->uploadTime - 1;
 	else {
 		dir_broadcast.t_new = node->pfh->uploadTime; // no files past this one so use its own uptime for now
 		flag |= 1UL << N_BIT; /* Set the N bit to say this is the newest file on the server */
@@ -1041,45 +2263,42 @@ int pb_make_dir_broadcast_packet(DIR_NODE *node, unsigned char *data_bytes, int
 
 	char psf_filename[MAX_FILE_PATH_LEN];
 	dir_get_file_path_from_file_id(node->pfh->fileId,get_dir_folder(), psf_filename, MAX_FILE_PATH_LEN);
-	FILE * f = fopen(psf_filename, "r");
-	if (f == NULL) {
-		error_print("** Can't open psf: %s\n",psf_filename);
-		return 0;
-	}
 	int buffer_size = node->pfh->bodyOffset - *offset;  /* This is how much we have left to read */
 	if (buffer_size <= 0) return 0; /* This is a failure as we return length 0 */
 	if (buffer_size >= MAX_DIR_PFH_LENGTH) {
 		/* If we have an offset then we have already sent part of this, send the next part */
 		buffer_size = MAX_DIR_PFH_LENGTH;
 	}
+	FILE * f = fopen(psf_filename, "r");
+	if (f == NULL) {
+		error_print("** Can't open psf: %s\n",psf_filename);
+		return 0;
+	}
 
 	if (*offset != 0)
 		if (fseek( f, *offset, SEEK_SET ) != 0) {
+			fclose(f);
 			return 0; /* This is a failure as we return length 0 */
 		}
-	int num = fread(packet_buffer, sizeof(char), buffer_size, f);
+	/* Read the PFH bytes straight into the frame after the header */
+	int num = fread(data_bytes + sizeof(PB_DIR_HEADER), sizeof(char), buffer_size, f);
 	if (num != buffer_size) {
 		fclose(f);
 		return 0; // Error with the read
 	}
 	fclose(f);
 	*offset = *offset + num;
-	/* Copy the bytes into the frame */
-	unsigned char *header = (unsigned char *)&dir_broadcast;
-	for (int i=0; i<sizeof(PB_DIR_HEADER);i++ )
-		data_bytes[i] = header[i];
-	for (int i=0; i<num; i++)
-		data_bytes[i+sizeof(PB_DIR_HEADER)] = packet_buffer[i];
+	if (*offset == node->pfh->bodyOffset) {
+		flag |= 1UL << E_BIT; // Set the E bit, this frame contains the last byte of the header
+	}
+	dir_broadcast.flags = flag;
+
+	memcpy(data_bytes, &dir_broadcast, sizeof(PB_DIR_HEADER));
 
 	length = sizeof(PB_DIR_HEADER) + num +2;
-	int checksum = gen_crc(data_bytes, length-2);
+	uint16_t checksum = crc16(data_bytes, length-2);
 	//debug_print("crc: %04x\n",checksum);
-
-	/* Despite everything being little endian, the CRC needs to be in network byte order, or big endian */
-	unsigned char one = (unsigned char)(checksum & 0xff);
-	unsigned char two = (unsigned char)((checksum >> 8) & 0xff);
-	data_bytes[length-1] = one;
-	data_bytes[length-2] = two;
+	crc16_put(data_bytes + length - 2, checksum);
 
 //	if (check_crc(data_bytes, length+2) != 0) {
 //		error_print("CRC does not match\n");
@@ -1097,7 +2316,11 @@ int pb_make_dir_broadcast_packet(DIR_NODE *node, unsigned char *data_bytes, int
 /**
  * pb_make_file_broadcast_packet()
  *
- *  Returns packet in unsigned char *data_bytes
+ * Finish a file broadcast frame in data_bytes.  The caller has already read number_of_bytes_read
+ * bytes of the file into data_bytes after the space for the PB_FILE_HEADER.  The header is written
+ * in front of them and the CRC after them, so the file data is never copied.
+ *
+ *  Returns the length of the frame in unsigned char *data_bytes
 
 flags          A bit field as follows:
 
@@ -1112,7 +2335,8 @@ L              1    length field is present
 Of             1    offset is a byte offset from the beginning of the file.
                0    offset is a block number (not currently used).
 
-VV                  Two bit version identifier.  This version is 0.
+VV                  Two bit version identifier.  00 for a chunk of the file.  01 for a
+                    fountain repair symbol, when the offset is the symbol id.
 
 E              1    Last byte of frame is the last byte of the file.
                0    Not last.
@@ -1122,7 +2346,7 @@ E              1    Last byte of frame is the last byte of the file.
 *                   Reserved, must be 0.
  */
 int pb_make_file_broadcast_packet(HEADER *pfh, unsigned char *data_bytes,
-		unsigned char *buffer, int number_of_bytes_read, int offset, int chunk_includes_last_byte) {
+		int number_of_bytes_read, int offset, int chunk_includes_last_byte, int version) {
 	int length = 0;
 	PB_FILE_HEADER file_broadcast_header;
 
@@ -1130,40 +2354,33 @@ int pb_make_file_broadcast_packet(HEADER *pfh, unsigned char *data_bytes,
 	if (chunk_includes_last_byte) {
 		flag |= 1UL << E_BIT; // Set the E bit, this is the last chunk of this file
 	}
+	flag |= (version & 0b11) << VV_BIT;
 	file_broadcast_header.offset = offset;
 	file_broadcast_header.flags = flag;
 	file_broadcast_header.file_id = pfh->fileId;
 
-	/* Copy the bytes into the frame */
-	unsigned char *header = (unsigned char *)&file_broadcast_header;
-	for (int i=0; i<sizeof(PB_FILE_HEADER);i++ )
-		data_bytes[i] = header[i];
-	for (int i=0; i<number_of_bytes_read; i++)
-		data_bytes[i+sizeof(PB_FILE_HEADER)] = buffer[i];
+	memcpy(data_bytes, &file_broadcast_header, sizeof(PB_FILE_HEADER));
 
 	length = sizeof(PB_FILE_HEADER) + number_of_bytes_read +2;
-	int checksum = gen_crc(data_bytes, length-2);
+	uint16_t checksum = crc16(data_bytes, length-2);
 	//debug_print("crc: %04x\n",checksum);
-
-	/* Despite everything being little endian, the CRC needs to be in network byte order, or big endian */
-	unsigned char one = (unsigned char)(checksum & 0xff);
-	unsigned char two = (unsigned char)((checksum >> 8) & 0xff);
-	data_bytes[length-1] = one;
-	data_bytes[length-2] = two;
+	crc16_put(data_bytes + length - 2, checksum);
 
 	return length; // return length of header + pfh + crc
 }
 
 /**
- * Return true if this file is in use by the PB
+ * Return true if this file is in use by the PB on any port
  */
 int pb_is_file_in_use(uint32_t file_id) {
-    int i;
-    for (i=0; i < number_on_pb; i++) {
-    	if (pb_list[i].node != NULL)
-    		if (pb_list[i].node->pfh != NULL)
-    			if (pb_list[i].node->pfh->fileId == file_id)
-    				return true;
+    for (int port=0; port < MAX_PORTS; port++) {
+    	PB_ENTRY *list = pb_ports[port].list;
+    	for (int i=0; i < pb_ports[port].capacity; i++) {
+    		if (list[i].in_use && list[i].node != NULL)
+    			if (list[i].node->pfh != NULL)
+    				if (list[i].node->pfh->fileId == file_id)
+    					return true;
+    	}
     }
     return false;
 }
@@ -1176,40 +2393,41 @@ int pb_is_file_in_use(uint32_t file_id) {
 int test_pb_list() {
 	printf("##### TEST PB LIST\n");
 	int rc = EXIT_SUCCESS;
+	pb_set_scheduler(PB_SCHEDULER_RR); // This tests that the turn moves round the list after each action
 
 	char data[] = {0x25,0x9f,0x3d,0x63,0xff,0xff,0xff,0x7f};
 	DIR_DATE_PAIR * holes = (DIR_DATE_PAIR *)&data;
 
-	rc = pb_add_request("AC2CZ", PB_FILE_REQUEST_TYPE, NULL, 3, 0, NULL, 0);
+	rc = pb_add_request(callsign_intern("AC2CZ"), PB_FILE_REQUEST_TYPE, NULL, 3, 0, NULL, 0);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add callsign\n"); return EXIT_FAILURE; }
-	rc = pb_add_request("VE2XYZ", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0);
+	rc = pb_add_request(callsign_intern("VE2XYZ"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add callsign\n"); return EXIT_FAILURE; }
 	pb_debug_print_list();
-	if (strcmp(pb_list[0].callsign, "AC2CZ") != 0) {printf("** Mismatched callsign 0\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[1].callsign, "VE2XYZ") != 0) {printf("** Mismatched callsign 1\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].callsign_id != callsign_lookup("AC2CZ")) {printf("** Mismatched callsign 0\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(1)].callsign_id != callsign_lookup("VE2XYZ")) {printf("** Mismatched callsign 1\n"); return EXIT_FAILURE;}
 
 	// Now remove the head
 	debug_print("REMOVE HEAD\n");
-	rc = pb_remove_request(0);
+	rc = pb_remove_request(pb_slot_at(0));
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
 	pb_debug_print_list();
-	if (strcmp(pb_list[0].callsign, "VE2XYZ") != 0) {printf("** Mismatched callsign 0 after head removed\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].callsign_id != callsign_lookup("VE2XYZ")) {printf("** Mismatched callsign 0 after head removed\n"); return EXIT_FAILURE;}
 
 	debug_print("ADD two more Calls\n");
-	rc = pb_add_request("G0KLA", PB_FILE_REQUEST_TYPE, NULL, 3, 0, NULL, 0);
+	rc = pb_add_request(callsign_intern("G0KLA"), PB_FILE_REQUEST_TYPE, NULL, 3, 0, NULL, 0);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add callsign\n"); return EXIT_FAILURE; }
-	rc = pb_add_request("WA1QQQ", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0);
+	rc = pb_add_request(callsign_intern("WA1QQQ"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add callsign\n"); return EXIT_FAILURE; }
 	pb_debug_print_list();
 
-	rc = pb_remove_request(0);
+	rc = pb_remove_request(pb_slot_at(0));
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request 1\n"); return EXIT_FAILURE; }
-	rc = pb_remove_request(0);
+	rc = pb_remove_request(pb_slot_at(0));
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request 2\n"); return EXIT_FAILURE; }
-	rc = pb_remove_request(0);
+	rc = pb_remove_request(pb_slot_at(0));
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request 3\n"); return EXIT_FAILURE; }
 	// Test Remove when empty, should do nothing
-	rc = pb_remove_request(0);
+	rc = pb_remove_request(pb_slot_at(0));
 	if (rc != EXIT_FAILURE) {printf("** Did not receive error message for remove request 4\n"); return EXIT_FAILURE; }
 	rc = EXIT_SUCCESS; /* Reset rc after the failure test above*/
 
@@ -1220,32 +2438,35 @@ int test_pb_list() {
 	pfh.fileId = 3;
 	pfh.bodyOffset = 36;
 	pfh.fileSize = 175;
+	memset(&test_node, 0, sizeof(test_node));
 	test_node.pfh = &pfh;
 
 	// Test PB Full
 	debug_print("ADD Calls and test FULL\n");
-	if( pb_add_request("A1A", PB_DIR_REQUEST_TYPE, NULL, 0, 0, holes, 1) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("B1B", PB_FILE_REQUEST_TYPE, NULL, 3, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("C1C", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("D1D", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("E1E", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("F1F", PB_FILE_REQUEST_TYPE, &test_node, 3, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("G1G", PB_FILE_REQUEST_TYPE, NULL, 3, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("H1H", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("I1I", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("J1J", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
-	if( pb_add_request("K1K", PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_FAILURE) {debug_print("ERROR: Added call to FULL PB list\n");return EXIT_FAILURE; }
-
-	if (strcmp(pb_list[0].callsign, "A1A") != 0) {printf("** Mismatched callsign 0\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[1].callsign, "B1B") != 0) {printf("** Mismatched callsign 1\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[2].callsign, "C1C") != 0) {printf("** Mismatched callsign 2\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[3].callsign, "D1D") != 0) {printf("** Mismatched callsign 3\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[4].callsign, "E1E") != 0) {printf("** Mismatched callsign 4\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[5].callsign, "F1F") != 0) {printf("** Mismatched callsign 5\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[6].callsign, "G1G") != 0) {printf("** Mismatched callsign 6\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[7].callsign, "H1H") != 0) {printf("** Mismatched callsign 7\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[8].callsign, "I1I") != 0) {printf("** Mismatched callsign 8\n"); return EXIT_FAILURE;}
-	if (strcmp(pb_list[9].callsign, "J1J") != 0) {printf("** Mismatched callsign 9\n"); return EXIT_FAILURE;}
+	if( pb_add_request(callsign_intern("A1A"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, holes, 1) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("B1B"), PB_FILE_REQUEST_TYPE, NULL, 3, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("C1C"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("D1D"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("E1E"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("F1F"), PB_FILE_REQUEST_TYPE, &test_node, 3, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("G1G"), PB_FILE_REQUEST_TYPE, NULL, 3, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("H1H"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("I1I"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("J1J"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {debug_print("ERROR: Could not add call to PB list\n");return EXIT_FAILURE; }
+	if( pb_add_request(callsign_intern("K1K"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_FAILURE) {debug_print("ERROR: Added call to FULL PB list\n");return EXIT_FAILURE; }
+
+	if (pb->list[pb_slot_at(0)].callsign_id != callsign_lookup("A1A")) {printf("** Mismatched callsign 0\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(1)].callsign_id != callsign_lookup("B1B")) {printf("** Mismatched callsign 1\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(2)].callsign_id != callsign_lookup("C1C")) {printf("** Mismatched callsign 2\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(3)].callsign_id != callsign_lookup("D1D")) {printf("** Mismatched callsign 3\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(4)].callsign_id != callsign_lookup("E1E")) {printf("** Mismatched callsign 4\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(5)].callsign_id != callsign_lookup("F1F")) {printf("** Mismatched callsign 5\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(6)].callsign_id != callsign_lookup("G1G")) {printf("** Mismatched callsign 6\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(7)].callsign_id != callsign_lookup("H1H")) {printf("** Mismatched callsign 7\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(8)].callsign_id != callsign_lookup("I1I")) {printf("** Mismatched callsign 8\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(9)].callsign_id != callsign_lookup("J1J")) {printf("** Mismatched callsign 9\n"); return EXIT_FAILURE;}
+	if (pb_find_request(callsign_intern("F1F")) != pb_slot_at(5)) {printf("** Could not find F1F by callsign\n"); return EXIT_FAILURE;}
+	if (pb_find_request(callsign_intern("K1K")) != -1) {printf("** Found K1K when it is not on the PB\n"); return EXIT_FAILURE;}
 
 	pb_debug_print_list();
 	debug_print("TEST File 3 in use\n");
@@ -1257,53 +2478,93 @@ int test_pb_list() {
 	debug_print("Process Current Call\n");
 	if (pb_next_action() != EXIT_SUCCESS) { printf("** Could not take next PB action\n"); return EXIT_FAILURE; }
 	pb_debug_print_list();
-	debug_print("With current_station_on_pb = %d\n",current_station_on_pb);
-	if (strcmp(pb_list[current_station_on_pb].callsign, "B1B") != 0) {printf("** Mismatched callsign current call\n"); return EXIT_FAILURE;}
+	debug_print("With pb->current_station = %d\n",pb->current_station);
+	if (pb->list[pb->current_station].callsign_id != callsign_lookup("B1B")) {printf("** Mismatched callsign current call\n"); return EXIT_FAILURE;}
 
 //	debug_print("Remove head\n");
 //	// Remove 0 as though it was done
-//	rc = pb_remove_request(0); // Head
+//	rc = pb_remove_request(pb_slot_at(0)); // Head
 //	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-//	if (strcmp(pb_list[current_station_on_pb].callsign, "B1B") != 0) {printf("** Mismatched callsign current call after remove head\n"); return EXIT_FAILURE;}
+//	if (pb->list[pb->current_station].callsign_id != callsign_lookup("B1B")) {printf("** Mismatched callsign current call after remove head\n"); return EXIT_FAILURE;}
 
 	debug_print("Remove 3\n");
 	// Remove 3 as though it timed out
-	rc = pb_remove_request(3); // Now E1E
+	rc = pb_remove_request(pb_slot_at(3)); // Now E1E
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-	if (strcmp(pb_list[current_station_on_pb].callsign, "B1B") != 0) {printf("** Mismatched callsign current call after remove 3\n"); return EXIT_FAILURE;}
-    if (strcmp(pb_list[3].callsign, "F1F") != 0) {printf("** Mismatched callsign 3: %s\n",pb_list[3].callsign); return EXIT_FAILURE;}
+	if (pb->list[pb->current_station].callsign_id != callsign_lookup("B1B")) {printf("** Mismatched callsign current call after remove 3\n"); return EXIT_FAILURE;}
+    if (pb->list[pb_slot_at(3)].callsign_id != callsign_lookup("F1F")) {printf("** Mismatched callsign 3: %s\n",callsign_str(pb->list[pb_slot_at(3)].callsign_id)); return EXIT_FAILURE;}
+	if (pb_find_request(callsign_intern("E1E")) != -1) {printf("** Found E1E after it was removed\n"); return EXIT_FAILURE;}
 
 	 /* Also confirm that the node copied over correctly */
-	if (pb_list[3].node->pfh->fileId != 3) {printf("** Mismatched file id for entry 3\n"); return EXIT_FAILURE;}
-	if (pb_list[3].node->pfh->bodyOffset != 36) {printf("** Mismatched body offset for entry 3\n"); return EXIT_FAILURE;}
-	if (pb_list[3].node->pfh->fileSize != 175) {printf("** Mismatched file size of %d for entry 3\n",pb_list[3].node->pfh->fileSize); return EXIT_FAILURE;}
-	if (strcmp(pb_list[6].callsign, "I1I") != 0) {printf("** Mismatched callsign 6: %s\n",pb_list[6].callsign); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(3)].node->pfh->fileId != 3) {printf("** Mismatched file id for entry 3\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(3)].node->pfh->bodyOffset != 36) {printf("** Mismatched body offset for entry 3\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(3)].node->pfh->fileSize != 175) {printf("** Mismatched file size of %d for entry 3\n",pb->list[pb_slot_at(3)].node->pfh->fileSize); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(6)].callsign_id != callsign_lookup("I1I")) {printf("** Mismatched callsign 6: %s\n",callsign_str(pb->list[pb_slot_at(6)].callsign_id)); return EXIT_FAILURE;}
 
 	debug_print("Remove current station\n");
 	// Remove the current station, which is also the head, should advance to next one
-	rc = pb_remove_request(current_station_on_pb);
+	rc = pb_remove_request(pb->current_station);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-	if (strcmp(pb_list[current_station_on_pb].callsign, "C1C") != 0) {printf("** Mismatched callsign current call after remove current station\n"); return EXIT_FAILURE;}
+	if (pb->list[pb->current_station].callsign_id != callsign_lookup("C1C")) {printf("** Mismatched callsign current call after remove current station\n"); return EXIT_FAILURE;}
 
 	pb_debug_print_list();
 
 	debug_print("Remove 7 stations\n");
-	rc = pb_remove_request(current_station_on_pb);
+	rc = pb_remove_request(pb->current_station);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-	rc = pb_remove_request(current_station_on_pb);
+	rc = pb_remove_request(pb->current_station);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-	rc = pb_remove_request(current_station_on_pb);
+	rc = pb_remove_request(pb->current_station);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-	rc = pb_remove_request(current_station_on_pb);
+	rc = pb_remove_request(pb->current_station);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-	rc = pb_remove_request(current_station_on_pb);
+	rc = pb_remove_request(pb->current_station);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-	rc = pb_remove_request(current_station_on_pb);
+	rc = pb_remove_request(pb->current_station);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
-	rc = pb_remove_request(current_station_on_pb);
+	rc = pb_remove_request(pb->current_station);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove request\n"); return EXIT_FAILURE; }
 	pb_debug_print_list();
 
+	debug_print("Hole lists under churn\n");
+	/* Each station keeps its own hole list whatever order the others are removed in */
+	FILE_DATE_PAIR file_holes[3][2] = {{{10,1},{20,2}}, {{30,3},{40,4}}, {{50,5},{60,6}}};
+	char *calls[] = {"A1A", "B1B", "C1C"};
+	for (int round=0; round < 5; round++) {
+		for (int i=0; i < 3; i++)
+			if (pb_find_request(callsign_intern(calls[i])) == -1)
+				if (pb_add_request(callsign_intern(calls[i]), PB_FILE_REQUEST_TYPE, NULL, 3, 0, file_holes[i], 2) != EXIT_SUCCESS) {
+					printf("** Could not add %s with holes\n", calls[i]); return EXIT_FAILURE;
+				}
+		for (int i=0; i < 3; i++) {
+			FILE_DATE_PAIR *list = pb->list[pb_find_request(callsign_intern(calls[i]))].hole_list;
+			if (list[0].offset != file_holes[i][0].offset || list[1].length != file_holes[i][1].length) {
+				printf("** Hole list for %s overwritten\n", calls[i]); return EXIT_FAILURE;
+			}
+		}
+		pb_remove_request(pb_find_request(callsign_intern(calls[round % 3]))); // middle, tail and head in turn
+	}
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head);
+	if (pb_add_request(callsign_intern("A1A"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, holes, PB_HOLE_LIST_BYTES / sizeof(DIR_DATE_PAIR) + 1) != EXIT_FAILURE) {
+		printf("** Added a hole list that is too long\n"); return EXIT_FAILURE;
+	}
+
+	debug_print("Each port has its own PB\n");
+	int ports = g_number_of_ports;
+	g_number_of_ports = 2;
+	pb = &pb_ports[1];
+	pb->port = 1;
+	if (pb_port_init() != EXIT_SUCCESS) {printf("** Could not allocate PB for port 1\n"); return EXIT_FAILURE;}
+	if (pb_add_request(callsign_intern("AC2CZ"), PB_FILE_REQUEST_TYPE, NULL, 7, 0, NULL, 0) != EXIT_SUCCESS) {printf("** Could not add callsign on port 1\n"); rc = EXIT_FAILURE;}
+	if (pb_ports[0].number_on_pb != 0) {printf("** Port 0 PB changed by port 1\n"); rc = EXIT_FAILURE;}
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head);
+	pb = &pb_ports[0];
+	if (pb_find_request(callsign_intern("AC2CZ")) != -1) {printf("** Port 1 request found on port 0\n"); rc = EXIT_FAILURE;}
+	g_number_of_ports = ports;
+
+	pb_set_scheduler(g_pb_scheduler);
 	if (rc == EXIT_SUCCESS)
 		printf("##### TEST PB LIST: success\n");
 	else
@@ -1320,6 +2581,29 @@ int test_pb() {
 	if (dir_init("/tmp") != EXIT_SUCCESS) { printf("** Could not initialize the dir\n"); return EXIT_FAILURE; }
 	dir_load();
 
+	/* Check the cached DIR broadcast frames for the newest file */
+	DIR_DATE_PAIR all = {0, 0xFFFFFFFF};
+	DIR_NODE *newest = dir_get_pfh_by_date(all, NULL);
+	while (newest != NULL && newest->next != NULL)
+		newest = newest->next;
+	if (newest != NULL) {
+		int offset = 0, len = 0;
+		unsigned char *frame = NULL;
+		while (offset < newest->pfh->bodyOffset) {
+			frame = pb_get_dir_broadcast_frame(newest, &offset, &len);
+			if (frame == NULL) { printf("** Could not get DIR broadcast frame\n"); return EXIT_FAILURE; }
+		}
+		if (newest->bd_frames == NULL) { printf("** DIR broadcast frames not cached\n"); return EXIT_FAILURE; }
+		PB_DIR_HEADER *dir_header = (PB_DIR_HEADER *)frame;
+		if (!(dir_header->flags & (1 << E_BIT))) { printf("** E bit not set on last DIR frame\n"); return EXIT_FAILURE; }
+		if (!(dir_header->flags & (1 << N_BIT))) { printf("** N bit not set for newest file\n"); return EXIT_FAILURE; }
+		dir_invalidate_broadcast_frames(newest);
+		if (newest->bd_frames_gen == atomic_load(&newest->bd_gen)) { printf("** DIR broadcast frames not marked out of date\n"); return EXIT_FAILURE; }
+		offset = 0;
+		if (pb_get_dir_broadcast_frame(newest, &offset, &len) == NULL
+				|| newest->bd_frames_gen != atomic_load(&newest->bd_gen)) { printf("** DIR broadcast frames not rebuilt\n"); return EXIT_FAILURE; }
+	}
+
 	// Add AC2CZ with a DIR request
 	debug_print("ADD AC2CZ dir request\n");
 
@@ -1331,7 +2615,7 @@ int test_pb() {
 	if (num_of_holes != 1)  { printf("** Number of holes is wrong\n"); return EXIT_FAILURE; }
 	DIR_DATE_PAIR * holes = get_dir_holes_list(data);
 
-	rc = pb_add_request("AC2CZ", PB_DIR_REQUEST_TYPE, NULL, 0, 0, holes, num_of_holes);
+	rc = pb_add_request(callsign_intern("AC2CZ"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, holes, num_of_holes);
 	debug_print("List at start:\n");
 	pb_debug_print_list();
 
@@ -1343,7 +2627,7 @@ int test_pb() {
 
 	debug_print("List at end of actions:\n");
 	pb_debug_print_list();
-	if (number_on_pb > 0) { printf("** Request left on PB after processing it\n"); return EXIT_FAILURE; }
+	if (pb->number_on_pb > 0) { printf("** Request left on PB after processing it\n"); return EXIT_FAILURE; }
 
 	dir_free();
 
@@ -1362,10 +2646,10 @@ int test_pb_file() {
 		0xb4,0x40,0x61,0x03,0xbb,0x10,0x01,0x00,0x00,0x00,0xf4,0x00};
 
 	debug_print("ADD AC2CZ file request when no file available\n");
-	pb_handle_file_request("AC2CZ", data, sizeof(data));
+	pb_handle_file_request(callsign_intern("AC2CZ"), data, sizeof(data));
 	pb_debug_print_list();
 	/* Confirm not added to PB */
-	if (number_on_pb > 0) { printf("** Added to PB when no file available\n"); return EXIT_FAILURE; }
+	if (pb->number_on_pb > 0) { printf("** Added to PB when no file available\n"); return EXIT_FAILURE; }
 
 	mkdir("/tmp/pacsat",0777);
 
@@ -1373,18 +2657,42 @@ int test_pb_file() {
 	if (dir_init("/tmp") != EXIT_SUCCESS) { printf("** Could not initialize the dir\n"); return EXIT_FAILURE; }
 	dir_load();
 
-	pb_handle_file_request("AC2CZ", data, sizeof(data));
+	pb_handle_file_request(callsign_intern("AC2CZ"), data, sizeof(data));
 	pb_debug_print_list();
-	if (strcmp(pb_list[0].callsign, "AC2CZ") != 0) {printf("** Mismatched callsign AC2CZ\n"); return EXIT_FAILURE;}
-	if (pb_list[0].node->pfh->fileId != 1) {printf("** Mismatched file id\n"); return EXIT_FAILURE;}
-	if (pb_list[0].pb_type != PB_FILE_REQUEST_TYPE) {printf("** Mismatched req type\n"); return EXIT_FAILURE;}
-	if (pb_list[0].offset != 0) {printf("** Mismatched offset\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].callsign_id != callsign_lookup("AC2CZ")) {printf("** Mismatched callsign AC2CZ\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].node->pfh->fileId != 1) {printf("** Mismatched file id\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].pb_type != PB_FILE_REQUEST_TYPE) {printf("** Mismatched req type\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].offset != 0) {printf("** Mismatched offset\n"); return EXIT_FAILURE;}
+
+	debug_print("A request heard on port 1 is served from port 0\n");
+	pb_remove_request(pb_find_request(callsign_intern("AC2CZ")));
+	int ports = g_number_of_ports;
+	g_number_of_ports = 1;
+	pb_process_frame(1, callsign_intern("AC2CZ"), data, sizeof(data));
+	g_number_of_ports = ports;
+	if (pb != &pb_ports[0] || pb_find_request(callsign_intern("AC2CZ")) == -1) {printf("** Request on port 1 not served\n"); return EXIT_FAILURE;}
+
+	/* Stop requests for file 1 and then file 2 */
+	unsigned char stop1[] = {0x00,0xa0,0x8c,0xa6,0x66,0x40,0x40,0xf6,0x82,0x86,0x64,0x86,
+		0xb4,0x40,0x61,0x03,0xbb,0x11,0x01,0x00,0x00,0x00,0xf4,0x00};
+	unsigned char stop2[] = {0x00,0xa0,0x8c,0xa6,0x66,0x40,0x40,0xf6,0x82,0x86,0x64,0x86,
+		0xb4,0x40,0x61,0x03,0xbb,0x11,0x02,0x00,0x00,0x00,0xf4,0x00};
+	debug_print("STOP from a station that is not on the PB\n");
+	if (pb_handle_file_request(callsign_intern("G0KLA"), stop1, sizeof(stop1)) != EXIT_SUCCESS) {printf("** Stop failed for station not on PB\n"); return EXIT_FAILURE;}
+	if (pb->number_on_pb != 1) { printf("** Stop from another station removed the request\n"); return EXIT_FAILURE; }
+	debug_print("STOP for a different file\n");
+	if (pb_handle_file_request(callsign_intern("AC2CZ"), stop2, sizeof(stop2)) != EXIT_FAILURE) {printf("** Stop for the wrong file accepted\n"); return EXIT_FAILURE;}
+	if (pb->number_on_pb != 1) { printf("** Stop for the wrong file removed the request\n"); return EXIT_FAILURE; }
+	debug_print("STOP the file\n");
+	if (pb_handle_file_request(callsign_intern("AC2CZ"), stop1, sizeof(stop1)) != EXIT_SUCCESS) {printf("** Stop failed\n"); return EXIT_FAILURE;}
+	if (pb->number_on_pb != 0) { printf("** Request left on PB after it was stopped\n"); return EXIT_FAILURE; }
+	pb_handle_file_request(callsign_intern("AC2CZ"), data, sizeof(data));
 
 	/* One or two chunks to send the file */
 	if (pb_next_action() != EXIT_SUCCESS) { printf("** Could not take next PB action\n"); return EXIT_FAILURE; }
 	if (pb_next_action() != EXIT_SUCCESS) { printf("** Could not take next PB action\n"); return EXIT_FAILURE; }
 	pb_debug_print_list();
-	if (number_on_pb > 0) { printf("** Request left on PB after processing it\n"); return EXIT_FAILURE; }
+	if (pb->number_on_pb > 0) { printf("** Request left on PB after processing it\n"); return EXIT_FAILURE; }
 	//unsigned char data_bytes[AX25_MAX_DATA_LEN];
 
 	dir_free();
@@ -1410,14 +2718,14 @@ int test_pb_file_holes() {
 	if (dir_init("/tmp") != EXIT_SUCCESS) { printf("** Could not initialize the dir\n"); return EXIT_FAILURE; }
 	dir_load();
 
-	if (pb_handle_file_request("AC2CZ", data, sizeof(data))) { printf("** Could handle file hole request\n"); return EXIT_FAILURE;}
+	if (pb_handle_file_request(callsign_intern("AC2CZ"), data, sizeof(data))) { printf("** Could handle file hole request\n"); return EXIT_FAILURE;}
 	pb_debug_print_list();
-	if (strcmp(pb_list[0].callsign, "AC2CZ") != 0) {printf("** Mismatched callsign AC2CZ\n"); return EXIT_FAILURE;}
-	if (pb_list[0].node->pfh->fileId != 2) {printf("** Mismatched file id\n"); return EXIT_FAILURE;}
-	if (pb_list[0].pb_type != PB_FILE_REQUEST_TYPE) {printf("** Mismatched req type\n"); return EXIT_FAILURE;}
-	if (pb_list[0].hole_num != 2) {printf("** Mismatched hole_num\n"); return EXIT_FAILURE;}
-	if (pb_list[0].current_hole_num != 0) {printf("** Mismatched offset\n"); return EXIT_FAILURE;}
-	if (pb_list[0].offset != 0) {printf("** Mismatched offset\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].callsign_id != callsign_lookup("AC2CZ")) {printf("** Mismatched callsign AC2CZ\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].node->pfh->fileId != 2) {printf("** Mismatched file id\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].pb_type != PB_FILE_REQUEST_TYPE) {printf("** Mismatched req type\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].hole_num != 2) {printf("** Mismatched hole_num\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].current_hole_num != 0) {printf("** Mismatched offset\n"); return EXIT_FAILURE;}
+	if (pb->list[pb_slot_at(0)].offset != 0) {printf("** Mismatched offset\n"); return EXIT_FAILURE;}
 
 	if (rc == EXIT_SUCCESS)
 		printf("##### TEST PACSAT FILE HOLES: success\n");
@@ -1426,4 +2734,450 @@ int test_pb_file_holes() {
 	return rc;
 }
 
+int test_pb_normalize_holes() {
+	printf("##### TEST PB NORMALIZE HOLES:\n");
+	int rc = EXIT_SUCCESS;
+	FILE_DATE_PAIR out[10];
+
+	/* Unsorted, overlapping, a duplicate, a zero length hole and FFFF to the end of a 1000 byte file */
+	FILE_DATE_PAIR file_holes[6];
+	file_holes[0].offset = 500; file_holes[0].length = 0xFFFF;
+	file_holes[1].offset = 0; file_holes[1].length = 100;
+	file_holes[2].offset = 50; file_holes[2].length = 100;
+	file_holes[3].offset = 0; file_holes[3].length = 100;
+	file_holes[4].offset = 300; file_holes[4].length = 0;
+	file_holes[5].offset = 150; file_holes[5].length = 10;
+	int n = pb_normalize_file_holes(file_holes, 6, 1000, out, 10);
+	pb_debug_print_file_holes(out, n);
+	if (n != 2) {printf("** Expected 2 file holes but got %d\n", n); rc = EXIT_FAILURE; }
+	else {
+		if (out[0].offset != 0 || out[0].length != 160) {printf("** Wrong first file hole\n"); rc = EXIT_FAILURE; }
+		if (out[1].offset != 500 || out[1].length != 500) {printf("** Wrong second file hole\n"); rc = EXIT_FAILURE; }
+	}
+
+	/* Every hole is past the end of the file */
+	file_holes[0].offset = 1000; file_holes[0].length = 10;
+	n = pb_normalize_file_holes(file_holes, 1, 1000, out, 10);
+	if (n != 0) {printf("** Degenerate file hole list was accepted\n"); rc = EXIT_FAILURE; }
+
+	/* A merged hole longer than 0xFFFF is split */
+	file_holes[0].offset = 0; file_holes[0].length = 0xFFFF;
+	file_holes[1].offset = 0xFFFF; file_holes[1].length = 0xFFFF;
+	n = pb_normalize_file_holes(file_holes, 2, 100000, out, 10);
+	if (n != 2 || out[0].length != 0xFFFF || out[1].offset != 0xFFFF || out[1].length != 100000 - 0xFFFF) {
+		printf("** Long file hole not split correctly\n"); rc = EXIT_FAILURE; }
+
+	/* DIR holes.  Start after end is dropped.  Overlaps merge.  The end is left open for files uploaded later */
+	DIR_DATE_PAIR dir_holes[3];
+	DIR_DATE_PAIR dir_out[3];
+	dir_holes[0].start = 200; dir_holes[0].end = 100;
+	dir_holes[1].start = 0; dir_holes[1].end = 0x7fffffff;
+	dir_holes[2].start = 1000; dir_holes[2].end = 2000;
+	n = pb_normalize_dir_holes(dir_holes, 3, dir_out, 3);
+	uint32_t oldest, newest;
+	if (dir_get_time_range(&oldest, &newest) == EXIT_SUCCESS) {
+		if (n != 1 || dir_out[0].start != oldest || dir_out[0].end != 0x7fffffff) {printf("** Dir holes not clipped to the dir\n"); rc = EXIT_FAILURE; }
+		dir_holes[0].start = newest + 1; dir_holes[0].end = 0xFFFFFFFF;
+		n = pb_normalize_dir_holes(dir_holes, 1, dir_out, 3);
+		if (n != 1 || dir_out[0].start != newest || dir_out[0].end != 0xFFFFFFFF) {printf("** Open dir hole was closed\n"); rc = EXIT_FAILURE; }
+		/* Two requests for files newer than the dir merge into one open hole */
+		dir_holes[1].start = newest + 10; dir_holes[1].end = 0xFFFFFFFF;
+		n = pb_normalize_dir_holes(dir_holes, 2, dir_out, 3);
+		if (n != 1 || dir_out[0].start != newest || dir_out[0].end != 0xFFFFFFFF) {printf("** Open dir holes not merged\n"); rc = EXIT_FAILURE; }
+		/* A hole inside an open hole merges into it */
+		dir_holes[0].start = oldest; dir_holes[0].end = 0xFFFFFFFF;
+		dir_holes[1].start = oldest + 1; dir_holes[1].end = oldest + 2;
+		n = pb_normalize_dir_holes(dir_holes, 2, dir_out, 3);
+		if (n != 1 || dir_out[0].start != oldest || dir_out[0].end != 0xFFFFFFFF) {printf("** Hole inside open dir hole not merged\n"); rc = EXIT_FAILURE; }
+		dir_holes[1].start = 0; dir_holes[1].end = 0x7fffffff;
+		dir_holes[0].start = 200; dir_holes[0].end = 100;
+	} else {
+		if (n != 1 || dir_out[0].start != 0 || dir_out[0].end != 0x7fffffff) {printf("** Dir holes not merged\n"); rc = EXIT_FAILURE; }
+	}
+	n = pb_normalize_dir_holes(dir_holes, 1, dir_out, 3);
+	if (n != 0) {printf("** Degenerate dir hole list was accepted\n"); rc = EXIT_FAILURE; }
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST PB NORMALIZE HOLES: success\n");
+	else
+		printf("##### TEST PB NORMALIZE HOLES: fail\n");
+	return rc;
+}
+
+int test_pb_scheduler() {
+	printf("##### TEST PB SCHEDULER:\n");
+	int rc = EXIT_SUCCESS;
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head); // Clear anything left by earlier tests
+	pb_set_scheduler(PB_SCHEDULER_DRR);
+
+	DIR_NODE big_node, nearly_done_node;
+	HEADER big_pfh, nearly_done_pfh;
+	big_pfh.fileId = 10;
+	big_pfh.fileSize = 10000;
+	big_pfh.priority = 0;
+	big_node.pfh = &big_pfh;
+	nearly_done_pfh.fileId = 11;
+	nearly_done_pfh.fileSize = 1000;
+	nearly_done_pfh.priority = 2;
+	nearly_done_node.pfh = &nearly_done_pfh;
+
+	if (pb_add_request(callsign_intern("A1A"), PB_FILE_REQUEST_TYPE, &big_node, 10, 0, NULL, 0) != EXIT_SUCCESS) {printf("** Could not add A1A\n"); return EXIT_FAILURE; }
+	if (pb_add_request(callsign_intern("B1B"), PB_FILE_REQUEST_TYPE, &nearly_done_node, 11, 800, NULL, 0) != EXIT_SUCCESS) {printf("** Could not add B1B\n"); return EXIT_FAILURE; }
+	if (pb_add_request(callsign_intern("C1C"), PB_DIR_REQUEST_TYPE, NULL, 0, 0, NULL, 0) != EXIT_SUCCESS) {printf("** Could not add C1C\n"); return EXIT_FAILURE; }
+
+	int a = pb_find_request(callsign_intern("A1A"));
+	int b = pb_find_request(callsign_intern("B1B"));
+	int c = pb_find_request(callsign_intern("C1C"));
+	if (pb_remaining_bytes(b) != 200) {printf("** Wrong remaining bytes %d for B1B\n",pb_remaining_bytes(b)); rc = EXIT_FAILURE; }
+	if (pb_drr_weight(a) != 1) {printf("** Wrong weight %d for A1A\n",pb_drr_weight(a)); rc = EXIT_FAILURE; }
+	if (pb_drr_weight(b) != 5) {printf("** Wrong weight %d for B1B\n",pb_drr_weight(b)); rc = EXIT_FAILURE; }
+	if (pb_drr_weight(c) != 1 + PB_DRR_DIR_WEIGHT) {printf("** Wrong weight %d for C1C\n",pb_drr_weight(c)); rc = EXIT_FAILURE; }
+
+	/* Count the full frames each station sends in one turn */
+	int frame_bytes = PB_MAX_FRAME_BYTES;
+	int frames[3] = {0,0,0};
+	int slots[3] = {a, b, c};
+	for (int i=0; i < 3; i++) {
+		if (pb->current_station != slots[i]) {printf("** Station %d does not have the turn\n",i); rc = EXIT_FAILURE; break; }
+		do {
+			pb_scheduler->select();
+			pb_scheduler->charge(slots[i], frame_bytes);
+			frames[i]++;
+		} while (pb->current_station == slots[i] && frames[i] < 100);
+	}
+	debug_print("Frames per turn: %d %d %d\n", frames[0], frames[1], frames[2]);
+	if (frames[0] != pb_drr_quantum / frame_bytes) {printf("** A1A sent %d frames\n",frames[0]); rc = EXIT_FAILURE; }
+	if (frames[1] != 5 * pb_drr_quantum / frame_bytes) {printf("** B1B sent %d frames\n",frames[1]); rc = EXIT_FAILURE; }
+	if (frames[2] != 2 * pb_drr_quantum / frame_bytes) {printf("** C1C sent %d frames\n",frames[2]); rc = EXIT_FAILURE; }
+
+	pb_remove_request(a);
+	pb_remove_request(b);
+	pb_remove_request(c);
+	if (pb->number_on_pb != 0) {printf("** Requests left on the PB\n"); rc = EXIT_FAILURE; }
+	pb_set_scheduler(g_pb_scheduler);
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST PB SCHEDULER: success\n");
+	else
+		printf("##### TEST PB SCHEDULER: fail\n");
+	return rc;
+}
+
+int test_pb_idle() {
+	printf("##### TEST PB IDLE:\n");
+	int rc = EXIT_SUCCESS;
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head); // Clear anything left by earlier tests
+	memset(pb_popular_files, 0, sizeof(pb_popular_files));
+	memset(&pb_popular_dir, 0, sizeof(pb_popular_dir));
+	pb->idle_type = 0;
+	pb->idle_last_type = 0;
+	int saved_open = g_state_pb_open;
+	int saved_period = g_pb_idle_period_in_seconds;
+	g_state_pb_open = true;
+	g_pb_idle_period_in_seconds = 1;
+
+	time_t now = time(0);
+	/* Scores decay with time */
+	pb_note_file_request(3, now - 2 * PB_POPULARITY_HALF_LIFE_IN_SECONDS);
+	pb_note_file_request(2, now);
+	pb_note_file_request(1, now);
+	pb_note_file_request(1, now);
+	for (int i=0; i < PB_MAX_POPULAR_FILES; i++) {
+		pb_decay_score(&pb_popular_files[i], now);
+		if (pb_popular_files[i].file_id == 3 && pb_popular_files[i].score != PB_POPULARITY_REQUEST_SCORE / 4) {
+			printf("** Score did not decay: %d\n", pb_popular_files[i].score); rc = EXIT_FAILURE; }
+	}
+
+	mkdir("/tmp/pacsat",0777);
+	if (dir_init("/tmp") != EXIT_SUCCESS) { printf("** Could not initialize the dir\n"); return EXIT_FAILURE; }
+	dir_load();
+
+	/* The most popular file is broadcast first, one frame per period */
+	uint32_t frames = stats_get_file_count(1).frames;
+	pb->last_idle_time = 0;
+	if (pb_next_action() != EXIT_SUCCESS) { printf("** Could not take next PB action\n"); rc = EXIT_FAILURE; }
+	if (pb->idle_last_type != PB_FILE_REQUEST_TYPE || pb->idle_file_id != 1) { printf("** File 1 not chosen\n"); rc = EXIT_FAILURE; }
+	if (stats_get_file_count(1).frames != frames + 1) { printf("** Idle frame not sent\n"); rc = EXIT_FAILURE; }
+	pb_idle_action(pb->last_idle_time);
+	if (stats_get_file_count(1).frames != frames + 1) { printf("** Idle frames not rate limited\n"); rc = EXIT_FAILURE; }
+
+	/* Finish the file, then the DIR takes its turn */
+	pb_note_dir_request(now);
+	for (int i=0; i < 100 && pb->idle_type != 0; i++)
+		pb_idle_action(pb->last_idle_time + 1);
+	if (pb->idle_type != 0) { printf("** Idle file broadcast did not finish\n"); rc = EXIT_FAILURE; }
+	pb_idle_action(pb->last_idle_time + 1);
+	if (pb->idle_last_type != PB_DIR_REQUEST_TYPE) { printf("** Idle DIR broadcast not chosen\n"); rc = EXIT_FAILURE; }
+	for (int i=0; i < 100 && pb->idle_type != 0; i++)
+		pb_idle_action(pb->last_idle_time + 1);
+	if (pb->idle_type != 0) { printf("** Idle DIR broadcast did not finish\n"); rc = EXIT_FAILURE; }
+
+	/* A station on the PB comes first */
+	DIR_NODE node;
+	HEADER pfh;
+	pfh.fileId = 1;
+	pfh.fileSize = 1000;
+	node.pfh = &pfh;
+	pb_add_request(callsign_intern("AC2CZ"), PB_FILE_REQUEST_TYPE, &node, 1, 0, NULL, 0);
+	time_t last = pb->last_idle_time;
+	pb->last_idle_time = 0;
+	pb_next_action();
+	if (pb->last_idle_time != 0) { printf("** Idle broadcast sent with a station on the PB\n"); rc = EXIT_FAILURE; }
+	pb->last_idle_time = last;
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head);
+
+	dir_free();
+	g_state_pb_open = saved_open;
+	g_pb_idle_period_in_seconds = saved_period;
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST PB IDLE: success\n");
+	else
+		printf("##### TEST PB IDLE: fail\n");
+	return rc;
+}
+
+int test_pb_recent() {
+	printf("##### TEST PB RECENT:\n");
+	int rc = EXIT_SUCCESS;
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head); // Clear anything left by earlier tests
+	memset(pb->recent, 0, sizeof(pb->recent));
+	pb->recent_next = 0;
+	memset(pb->suppressed, 0, sizeof(pb->suppressed));
+	pb->suppressed_next = 0;
+	int saved_open = g_state_pb_open;
+	g_state_pb_open = true;
+	time_t now = time(0);
+
+	pb_recent_add(5, 0, 100, callsign_intern("AC2CZ"), now);
+	pb_recent_add(5, 100, 200, CALLSIGN_ID_NONE, now);
+	if (pb_recent_sent_until(5, 50, now) != 200) { printf("** Recent ranges not joined\n"); rc = EXIT_FAILURE; }
+	if (pb_recent_sent_until(5, 200, now) != 200) { printf("** Offset after the ranges skipped\n"); rc = EXIT_FAILURE; }
+	if (pb_recent_sent_until(6, 50, now) != 50) { printf("** Wrong file skipped\n"); rc = EXIT_FAILURE; }
+	if (pb_recent_sent_until(5, 50, now + g_pb_recent_window_in_seconds + 1) != 50) { printf("** Old range skipped\n"); rc = EXIT_FAILURE; }
+	FILE_DATE_PAIR hole = {50, 10};
+	if (!pb_recent_requested_again(callsign_intern("AC2CZ"), 5, &hole, 1, now)) { printf("** Re-request not found\n"); rc = EXIT_FAILURE; }
+	if (pb_recent_requested_again(callsign_intern("G0KLA"), 5, &hole, 1, now)) { printf("** Re-request for another station\n"); rc = EXIT_FAILURE; }
+
+	mkdir("/tmp/pacsat",0777);
+	if (dir_init("/tmp") != EXIT_SUCCESS) { printf("** Could not initialize the dir\n"); return EXIT_FAILURE; }
+	dir_load();
+	DIR_NODE *node = dir_get_node_by_id(1);
+	if (node == NULL) { printf("** No file 1 in the dir\n"); return EXIT_FAILURE; }
+
+	/* The hole is sent for G0KLA, then skipped for AC2CZ a moment later */
+	FILE_DATE_PAIR first = {0, 10};
+	uint32_t frames = stats_get_file_count(1).frames;
+	pb_add_request(callsign_intern("G0KLA"), PB_FILE_REQUEST_TYPE, node, 1, 0, &first, 1);
+	pb_next_action();
+	if (stats_get_file_count(1).frames != frames + 1) { printf("** Hole not sent\n"); rc = EXIT_FAILURE; }
+	if (pb->number_on_pb != 0) { printf("** Request left on the PB\n"); rc = EXIT_FAILURE; }
+	pb_add_request(callsign_intern("AC2CZ"), PB_FILE_REQUEST_TYPE, node, 1, 0, &first, 1);
+	pb_next_action();
+	if (stats_get_file_count(1).frames != frames + 1) { printf("** Recent hole sent again\n"); rc = EXIT_FAILURE; }
+	if (pb->number_on_pb != 0) { printf("** Skipped request left on the PB\n"); rc = EXIT_FAILURE; }
+
+	/* G0KLA asks again so it missed the frame */
+	pb_add_request(callsign_intern("G0KLA"), PB_FILE_REQUEST_TYPE, node, 1, 0, &first, 1);
+	if (pb_recent_requested_again(callsign_intern("G0KLA"), 1, &first, 1, time(0)))
+		pb->list[pb_find_request(callsign_intern("G0KLA"))].suppress_recent = false;
+	pb_next_action();
+	if (stats_get_file_count(1).frames != frames + 2) { printf("** Re-requested hole not sent\n"); rc = EXIT_FAILURE; }
+
+	/* The end of the file is sent for G0KLA then skipped for AC2CZ.  AC2CZ asks again so it missed the frame */
+	FILE_DATE_PAIR second = {pb_recent_sent_until(1, 0, time(0)), 10};
+	pb_add_request(callsign_intern("G0KLA"), PB_FILE_REQUEST_TYPE, node, 1, 0, &second, 1);
+	pb_next_action();
+	pb_add_request(callsign_intern("AC2CZ"), PB_FILE_REQUEST_TYPE, node, 1, 0, &second, 1);
+	pb_next_action();
+	if (stats_get_file_count(1).frames != frames + 3) { printf("** Hole not sent once for two stations\n"); rc = EXIT_FAILURE; }
+	pb_add_request(callsign_intern("AC2CZ"), PB_FILE_REQUEST_TYPE, node, 1, 0, &second, 1);
+	if (pb_recent_requested_again(callsign_intern("AC2CZ"), 1, &second, 1, time(0)))
+		pb->list[pb_find_request(callsign_intern("AC2CZ"))].suppress_recent = false;
+	pb_next_action();
+	if (stats_get_file_count(1).frames != frames + 4) { printf("** Hole re-requested by a second station not sent\n"); rc = EXIT_FAILURE; }
+	if (pb_recent_requested_again(callsign_intern("SM0ABC"), 1, &second, 1, time(0))) {
+		printf("** Re-request for a station that did not ask\n"); rc = EXIT_FAILURE; }
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head);
+
+	dir_free();
+	g_state_pb_open = saved_open;
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST PB RECENT: success\n");
+	else
+		printf("##### TEST PB RECENT: fail\n");
+	return rc;
+}
+
+int test_pb_fountain() {
+	printf("##### TEST PB FOUNTAIN:\n");
+	int rc = EXIT_SUCCESS;
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head); // Clear anything left by earlier tests
+	int saved_open = g_state_pb_open;
+	int saved_percent = g_pb_fountain_repair_percent;
+	g_state_pb_open = true;
+	g_pb_fountain_repair_percent = 400;
+	pb_fountain_next_symbol = 1;
+
+	/* File request for file 1 with the F bit set */
+	unsigned char data[] = {0x00,0xa0,0x8c,0xa6,0x66,0x40,0x40,0xf6,0x82,0x86,0x64,0x86,
+		0xb4,0x40,0x61,0x03,0xbb,0x30,0x01,0x00,0x00,0x00,0xf4,0x00};
+
+	mkdir("/tmp/pacsat",0777);
+	if (dir_init("/tmp") != EXIT_SUCCESS) { printf("** Could not initialize the dir\n"); return EXIT_FAILURE; }
+	dir_load();
+	if (pb_handle_file_request(callsign_intern("AC2CZ"), data, sizeof(data)) != EXIT_SUCCESS) { printf("** Request not added\n"); return EXIT_FAILURE; }
+	DIR_NODE *node = pb->list[pb_find_request(callsign_intern("AC2CZ"))].node;
+	int file_size = node->pfh->fileSize;
+	int k = fountain_num_blocks(file_size, PB_FILE_DEFAULT_BLOCK_SIZE);
+	if (pb->list[pb_find_request(callsign_intern("AC2CZ"))].fountain_symbols != k * 4) { printf("** Wrong number of repair symbols\n"); rc = EXIT_FAILURE; }
+
+	/* Decode the file from the repair symbols alone, as if every chunk was lost */
+	FOUNTAIN_DECODER dec;
+	fountain_decoder_init(&dec, node->pfh->fileId, file_size, PB_FILE_DEFAULT_BLOCK_SIZE);
+	int chunks = 0, symbols = 0;
+	while (pb->number_on_pb > 0 && chunks + symbols < k * 6) {
+		pb_next_action();
+		PB_FILE_HEADER *header = (PB_FILE_HEADER *)packet_buffer;
+		int version = (header->flags >> VV_BIT) & 0b11;
+		if (version == PB_FILE_VERSION_CHUNK) {
+			chunks++;
+		} else if (version == PB_FILE_VERSION_REPAIR) {
+			symbols++;
+			int len = sizeof(PB_FILE_HEADER) + PB_FILE_DEFAULT_BLOCK_SIZE;
+			if (crc16(packet_buffer, len) != ((packet_buffer[len] << 8) | packet_buffer[len + 1])) { printf("** Bad CRC on repair symbol\n"); rc = EXIT_FAILURE; }
+			if (header->flags & (1 << E_BIT)) { printf("** E bit set on repair symbol\n"); rc = EXIT_FAILURE; }
+			if (header->offset != symbols) { printf("** Wrong symbol id %d\n", header->offset); rc = EXIT_FAILURE; }
+			fountain_decoder_add_symbol(&dec, header->offset, packet_buffer + sizeof(PB_FILE_HEADER));
+		} else {
+			printf("** Unknown version %d\n", version); rc = EXIT_FAILURE;
+		}
+	}
+	if (chunks != k) { printf("** Sent %d chunks for %d blocks\n", chunks, k); rc = EXIT_FAILURE; }
+	if (symbols != k * 4) { printf("** Sent %d repair symbols, expected %d\n", symbols, k * 4); rc = EXIT_FAILURE; }
+	if (pb->number_on_pb != 0) { printf("** Request left on the PB\n"); rc = EXIT_FAILURE; }
+	if (!fountain_decoder_complete(&dec)) { printf("** File not decoded from repair symbols\n"); rc = EXIT_FAILURE; }
+	else {
+		char file_name_with_path[MAX_FILE_PATH_LEN];
+		dir_get_file_path_from_file_id(node->pfh->fileId, get_dir_folder(), file_name_with_path, MAX_FILE_PATH_LEN);
+		FILE *f = fopen(file_name_with_path, "rb");
+		unsigned char file_data[file_size];
+		if (f == NULL || fread(file_data, sizeof(char), file_size, f) != file_size) { printf("** Could not read file 1\n"); rc = EXIT_FAILURE; }
+		else if (memcmp(file_data, dec.blocks, file_size) != 0) { printf("** Decoded file does not match\n"); rc = EXIT_FAILURE; }
+		if (f != NULL) fclose(f);
+	}
+	fountain_decoder_free(&dec);
+
+	/* Without the F bit the file is sent once with no repair symbols */
+	data[17] = 0x10;
+	pb_handle_file_request(callsign_intern("AC2CZ"), data, sizeof(data));
+	if (pb->list[pb_find_request(callsign_intern("AC2CZ"))].fountain_symbols != 0) { printf("** Repair symbols without the F bit\n"); rc = EXIT_FAILURE; }
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head);
+
+	dir_free();
+	g_state_pb_open = saved_open;
+	g_pb_fountain_repair_percent = saved_percent;
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST PB FOUNTAIN: success\n");
+	else
+		printf("##### TEST PB FOUNTAIN: fail\n");
+	return rc;
+}
+
+int test_pb_progress() {
+	printf("##### TEST PB PROGRESS:\n");
+	int rc = EXIT_SUCCESS;
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head); // Clear anything left by earlier tests
+	memset(pb_progress, 0, sizeof(pb_progress));
+	int saved_open = g_state_pb_open;
+	g_state_pb_open = true;
+	pb_set_scheduler(PB_SCHEDULER_DRR);
+
+	DIR_NODE node;
+	HEADER pfh;
+	pfh.fileId = 20;
+	pfh.fileSize = 10000;
+	pfh.priority = 0;
+	node.pfh = &pfh;
+
+	/* A1A gets 80% of the file and then times out */
+	pb_add_request(callsign_intern("B1B"), PB_FILE_REQUEST_TYPE, &node, 20, 0, NULL, 0);
+	pb_add_request(callsign_intern("A1A"), PB_FILE_REQUEST_TYPE, &node, 20, 0, NULL, 0);
+	int a = pb_find_request(callsign_intern("A1A"));
+	pb->list[a].offset = 8000;
+	pb_progress_update(a);
+	pb_remove_request(a);
+	if (pb_progress_find(callsign_intern("A1A"), 20, false) == NULL) { printf("** Progress lost when the entry was removed\n"); rc = EXIT_FAILURE; }
+
+	/* It comes back for the rest and goes straight after the current station */
+	FILE_DATE_PAIR rest = {9000, 1000};
+	pb_add_request(callsign_intern("A1A"), PB_FILE_REQUEST_TYPE, &node, 20, 0, &rest, 1);
+	a = pb_find_request(callsign_intern("A1A"));
+	if (pb->list[pb->current_station].next != a) { printf("** Nearly complete station not served next\n"); rc = EXIT_FAILURE; }
+	if (pb_progress_percent(a) != 90) { printf("** Wrong progress %d%%\n", pb_progress_percent(a)); rc = EXIT_FAILURE; }
+	if (pb_drr_weight(a) != 3) { printf("** Wrong weight %d for A1A\n", pb_drr_weight(a)); rc = EXIT_FAILURE; }
+
+	/* It can finish in two turns, so it gets the airtime to finish in one */
+	int quantum = pb_drr_weight(a) * pb_drr_quantum;
+	int to_finish = 1000 + 6 * (sizeof(PB_FILE_HEADER) + 2 + PB_AX25_HEADER_BYTES);
+	pb->current_station = a;
+	pb->list[a].deficit = 0;
+	pb->list[a].turn_started = false;
+	pb_scheduler->select();
+	if (to_finish > quantum && to_finish <= PB_PROGRESS_FINISH_TURNS * quantum) {
+		if (pb->list[a].deficit != to_finish) { printf("** Turn of %d not sized to finish %d\n", pb->list[a].deficit, to_finish); rc = EXIT_FAILURE; }
+	} else if (pb->list[a].deficit != quantum) { printf("** Wrong turn %d\n", pb->list[a].deficit); rc = EXIT_FAILURE; }
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head);
+
+	/* With a real file, a nearly complete station that times out gets one more period */
+	mkdir("/tmp/pacsat",0777);
+	if (dir_init("/tmp") != EXIT_SUCCESS) { printf("** Could not initialize the dir\n"); return EXIT_FAILURE; }
+	dir_load();
+	DIR_NODE *file = dir_get_node_by_id(1);
+	if (file == NULL) { printf("** No file 1 in the dir\n"); return EXIT_FAILURE; }
+	int size = file->pfh->fileSize;
+	FILE_DATE_PAIR last = {size - 1, 1};
+	pb_add_request(callsign_intern("G0KLA"), PB_FILE_REQUEST_TYPE, file, 1, 0, &last, 1);
+	int g = pb_find_request(callsign_intern("G0KLA"));
+	pb->list[g].suppress_recent = false; // Earlier tests sent this file moments ago
+	timer_start(&pb_timer_wheel, &pb->list[g].session_timer, 0); /* Time it out on the next tick */
+	timer_wheel_advance(&pb_timer_wheel, pb_timer_wheel.tick * TIMER_TICK_MS);
+	if (!pb->list[g].in_use || !pb->list[g].extended || !timer_pending(&pb->list[g].session_timer)) {
+		printf("** Nearly complete station not given another period\n"); rc = EXIT_FAILURE; }
+	uint32_t frames = stats_get_file_count(1).frames;
+	pb_next_action();
+	if (stats_get_file_count(1).frames != frames + 1) { printf("** Nearly complete station dropped\n"); rc = EXIT_FAILURE; }
+	struct pb_progress *p = pb_progress_find(callsign_intern("G0KLA"), 1, false);
+	if (p == NULL || p->bytes_delivered != 1 || p->bytes_remaining != 0) { printf("** Ledger not updated\n"); rc = EXIT_FAILURE; }
+
+	/* A station that has barely started is removed */
+	pb_add_request(callsign_intern("AC2CZ"), PB_FILE_REQUEST_TYPE, file, 1, 0, NULL, 0);
+	int a2 = pb_find_request(callsign_intern("AC2CZ"));
+	timer_start(&pb_timer_wheel, &pb->list[a2].session_timer, 0);
+	timer_wheel_advance(&pb_timer_wheel, pb_timer_wheel.tick * TIMER_TICK_MS);
+	if (pb_find_request(callsign_intern("AC2CZ")) != -1 || pb->list[a2].in_use || timer_pending(&pb->list[a2].session_timer)) {
+		printf("** Timed out station not removed\n"); rc = EXIT_FAILURE; }
+	while (pb->number_on_pb > 0)
+		pb_remove_request(pb->head);
+
+	dir_free();
+	g_state_pb_open = saved_open;
+	pb_set_scheduler(g_pb_scheduler);
 
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST PB PROGRESS: success\n");
+	else
+		printf("##### TEST PB PROGRESS: fail\n");
+	return rc;
+}
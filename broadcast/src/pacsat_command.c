@@ -381,6 +381,7 @@ int pc_handle_command(char *from_callsign, unsigned char *data, int len) {
 				if (pfh_update_pacsat_header(node->pfh, get_dir_folder()) != EXIT_SUCCESS) {
 					debug_print("** Failed to re-write header in file.\n");
 				}
+				dir_invalidate_broadcast_frames(node); /* The PFH bytes on disk changed */
 				break;
 			}
 			case SWCmdPacsatDirMaintPeriod: {
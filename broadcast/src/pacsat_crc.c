@@ -0,0 +1,156 @@
+/*
+ * pacsat_crc.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * The CRC-16 that is appended to every DIR and FILE broadcast frame.
+ *
+ * This gives the same result as gen_crc() in iors_common but processes 8
+ * bytes at a time using slice-by-8 lookup tables.  Table k holds the CRC of
+ * a byte followed by k zero bytes, so the contribution of each of the 8
+ * bytes can be looked up independently and combined with xor.
+ *
+ * The CRC can be calculated in pieces by passing the result of one call to
+ * crc16_update() into the next.  That lets us calculate the CRC of a frame
+ * header and its data without first copying them into one buffer.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "debug.h"
+#include "crc.h"
+#include "pacsat_crc.h"
+
+/* Local variables */
+static uint16_t crc_table[8][256];
+
+/**
+ * crc16_init()
+ *
+ * Build the lookup tables.  This must be called before any CRC is calculated.
+ */
+void crc16_init() {
+	for (int i=0; i < 256; i++) {
+		uint16_t crc = (uint16_t)(i << 8);
+		for (int b=0; b < 8; b++)
+			crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ CRC16_POLY) : (uint16_t)(crc << 1);
+		crc_table[0][i] = crc;
+	}
+	for (int k=1; k < 8; k++)
+		for (int i=0; i < 256; i++) {
+			uint16_t prev = crc_table[k-1][i];
+			crc_table[k][i] = (uint16_t)(prev << 8) ^ crc_table[0][prev >> 8];
+		}
+}
+
+/**
+ * crc16_update()
+ *
+ * Continue a CRC calculation with len more bytes of data.  Pass 0 as the crc to start a
+ * new calculation.
+ *
+ * Returns the CRC of all of the bytes so far
+ *
+ */
+uint16_t crc16_update(uint16_t crc, const unsigned char *data, int len) {
+	while (len >= 8) {
+		crc = crc_table[7][data[0] ^ (crc >> 8)] ^ crc_table[6][data[1] ^ (crc & 0xff)]
+			^ crc_table[5][data[2]] ^ crc_table[4][data[3]]
+			^ crc_table[3][data[4]] ^ crc_table[2][data[5]]
+			^ crc_table[1][data[6]] ^ crc_table[0][data[7]];
+		data += 8;
+		len -= 8;
+	}
+	while (len-- > 0)
+		crc = (uint16_t)(crc << 8) ^ crc_table[0][(crc >> 8) ^ *data++];
+	return crc;
+}
+
+/**
+ * crc16()
+ *
+ * Returns the CRC of len bytes of data.
+ */
+uint16_t crc16(const unsigned char *data, int len) {
+	return crc16_update(0, data, len);
+}
+
+/**
+ * crc16_put()
+ *
+ * Store the CRC at the end of a frame.  Despite everything else being little endian, the CRC
+ * needs to be in network byte order, or big endian.
+ */
+void crc16_put(unsigned char *buffer, uint16_t crc) {
+	buffer[0] = (unsigned char)((crc >> 8) & 0xff);
+	buffer[1] = (unsigned char)(crc & 0xff);
+}
+
+/*********************************************************************************************
+ *
+ * SELF TESTS FOLLOW
+ *
+ */
+int test_crc16() {
+	printf("##### TEST CRC16:\n");
+	int rc = EXIT_SUCCESS;
+
+	/* The standard check value for CRC-16 XMODEM */
+	unsigned char check[] = "123456789";
+	if (crc16(check, 9) != 0x31C3) { printf("** Wrong check value: %04x\n", crc16(check, 9)); rc = EXIT_FAILURE; }
+
+	/* Compare with gen_crc for every length and alignment that a broadcast frame can have */
+	int max_len = 300; /* Longer than any broadcast frame */
+	unsigned char data[max_len + 8];
+	srand(1);
+	for (int i=0; i < sizeof(data); i++)
+		data[i] = (unsigned char)rand();
+	for (int start=0; start < 8; start++)
+		for (int len=0; len <= max_len; len++) {
+			uint16_t expected = (uint16_t)gen_crc(data + start, len);
+			if (crc16(data + start, len) != expected) {
+				printf("** CRC does not match gen_crc at start %d len %d\n", start, len);
+				rc = EXIT_FAILURE;
+				break;
+			}
+			/* Calculate it in two pieces */
+			int split = len / 3;
+			if (crc16_update(crc16(data + start, split), data + start + split, len - split) != expected) {
+				printf("** Incremental CRC does not match gen_crc at start %d len %d\n", start, len);
+				rc = EXIT_FAILURE;
+				break;
+			}
+		}
+
+	/* A frame with the CRC appended has a CRC of zero */
+	uint16_t crc = crc16(data, 100);
+	crc16_put(data + 100, crc);
+	if (crc16(data, 102) != 0) { printf("** CRC of frame with CRC is not zero\n"); rc = EXIT_FAILURE; }
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST CRC16: success\n");
+	else
+		printf("##### TEST CRC16: fail\n");
+	return rc;
+}
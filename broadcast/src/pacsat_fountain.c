@@ -0,0 +1,496 @@
+/*
+ * pacsat_fountain.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * Fountain coded file broadcasts.
+ *
+ * When many stations are each missing different chunks of a file, filling the
+ * holes for each of them in turn sends a lot of frames that most stations
+ * already have.  A repair symbol is the xor of a random set of the file's
+ * blocks, so it can fill a different hole for each station that hears it.
+ * Any K plus a few percent of the frames for a file of K blocks, systematic
+ * chunks or repair symbols, are enough to rebuild it.
+ *
+ * This is an LT code.  The number of blocks in a symbol comes from the robust
+ * soliton distribution and the blocks are picked with a PRNG seeded from the
+ * file id and the symbol id.  The symbol id is sent in the offset field of the
+ * file broadcast header, so the ground station can work out the same blocks.
+ * The block size is PB_FILE_DEFAULT_BLOCK_SIZE and the last block is padded
+ * with zeros.
+ *
+ * The decoder here is the reference for ground station software and is used
+ * by the self test.  It is a peeling decoder: a symbol that has only one
+ * unknown block left gives us that block, which may in turn reduce others.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "debug.h"
+#include "pacsat_fountain.h"
+
+/* Local variables */
+static double *soliton_cdf = NULL; /* Cumulative robust soliton distribution for soliton_k blocks */
+static int soliton_k = 0;
+
+/**
+ * fountain_ln()
+ *
+ * Natural log for the degree distribution, so that we do not need libm.
+ * x is scaled into [1,2) and the atanh series is used for the rest.
+ */
+static double fountain_ln(double x) {
+	int e = 0;
+	while (x >= 2) { x /= 2; e++; }
+	while (x < 1) { x *= 2; e--; }
+	double y = (x - 1) / (x + 1);
+	double y2 = y * y;
+	double sum = 0, term = y;
+	for (int n=1; n < 20; n += 2) {
+		sum += term / n;
+		term *= y2;
+	}
+	return 2 * sum + e * 0.69314718055994531;
+}
+
+static double fountain_sqrt(double x) {
+	if (x <= 0) return 0;
+	double r = x > 1 ? x : 1;
+	for (int i=0; i < 40; i++)
+		r = (r + x / r) / 2;
+	return r;
+}
+
+/**
+ * fountain_make_cdf()
+ *
+ * Build the robust soliton distribution for k blocks.  It is cached because every
+ * symbol for a file uses the same k.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if there is no memory
+ */
+static int fountain_make_cdf(int k) {
+	if (soliton_cdf != NULL && soliton_k == k) return EXIT_SUCCESS;
+	double *cdf = (double *)malloc((k + 1) * sizeof(double));
+	if (cdf == NULL) return EXIT_FAILURE;
+	free(soliton_cdf);
+	soliton_cdf = cdf;
+	soliton_k = k;
+
+	double r = FOUNTAIN_SOLITON_C * fountain_ln(k / FOUNTAIN_SOLITON_DELTA) * fountain_sqrt(k);
+	int spike = r > 0 ? (int)(k / r) : k;
+	if (spike < 1) spike = 1;
+	if (spike > k) spike = k;
+	double total = 0;
+	cdf[0] = 0;
+	for (int d=1; d <= k; d++) {
+		double p = (d == 1) ? 1.0 / k : 1.0 / ((double)d * (d - 1)); /* Ideal soliton */
+		if (d < spike)
+			p += r / ((double)d * k);
+		else if (d == spike)
+			p += r * fountain_ln(r / FOUNTAIN_SOLITON_DELTA) / k;
+		total += p;
+		cdf[d] = total;
+	}
+	for (int d=1; d <= k; d++)
+		cdf[d] /= total;
+	return EXIT_SUCCESS;
+}
+
+/**
+ * fountain_seed()
+ *
+ * Mix the file id and symbol id into a non zero seed for the xorshift PRNG
+ */
+static uint32_t fountain_seed(uint32_t file_id, uint32_t symbol_id) {
+	uint32_t h = file_id * 0x9E3779B1u ^ symbol_id * 0x85EBCA77u;
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return h == 0 ? 1 : h;
+}
+
+static uint32_t fountain_rand(uint32_t *state) {
+	uint32_t x = *state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+/**
+ * fountain_num_blocks()
+ *
+ * Returns the number of source blocks in a file
+ */
+int fountain_num_blocks(int file_size, int block_size) {
+	return (file_size + block_size - 1) / block_size;
+}
+
+/**
+ * fountain_neighbours()
+ *
+ * Work out which of the k blocks are xored together in a symbol.  The encoder and the
+ * decoder both call this, so it must only depend on the file id, the symbol id and k.
+ * neighbours must have space for k entries.
+ *
+ * Returns the number of blocks in the symbol or 0 if it could not be calculated
+ */
+int fountain_neighbours(uint32_t file_id, uint32_t symbol_id, int k, int *neighbours) {
+	if (k < 1) return 0;
+	if (fountain_make_cdf(k) != EXIT_SUCCESS) return 0;
+	uint32_t state = fountain_seed(file_id, symbol_id);
+
+	/* Pick the degree with a binary search of the distribution */
+	double u = fountain_rand(&state) / 4294967296.0;
+	int lo = 1, hi = k;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (soliton_cdf[mid] > u)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	int degree = lo;
+
+	if (degree * 2 > k) {
+		/* Most of the blocks.  Take the first degree of a partial shuffle */
+		for (int i=0; i < k; i++)
+			neighbours[i] = i;
+		for (int i=0; i < degree; i++) {
+			int j = i + fountain_rand(&state) % (k - i);
+			int tmp = neighbours[i];
+			neighbours[i] = neighbours[j];
+			neighbours[j] = tmp;
+		}
+	} else {
+		/* A few blocks.  Pick at random and reject repeats */
+		int n = 0;
+		while (n < degree) {
+			int b = fountain_rand(&state) % k;
+			int dup = false;
+			for (int i=0; i < n; i++)
+				if (neighbours[i] == b) { dup = true; break; }
+			if (!dup)
+				neighbours[n++] = b;
+		}
+	}
+	return degree;
+}
+
+/**
+ * fountain_encode_symbol()
+ *
+ * Read the blocks of a symbol from the open file f and xor them into symbol, which must
+ * hold block_size bytes.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the file could not be read
+ */
+int fountain_encode_symbol(FILE *f, int file_size, int block_size, uint32_t file_id, uint32_t symbol_id, unsigned char *symbol) {
+	int k = fountain_num_blocks(file_size, block_size);
+	int *neighbours = (int *)malloc(k * sizeof(int));
+	if (neighbours == NULL) return EXIT_FAILURE;
+	int degree = fountain_neighbours(file_id, symbol_id, k, neighbours);
+	if (degree == 0) {
+		free(neighbours);
+		return EXIT_FAILURE;
+	}
+	unsigned char block[block_size];
+	memset(symbol, 0, block_size);
+	for (int i=0; i < degree; i++) {
+		if (fseek(f, (long)neighbours[i] * block_size, SEEK_SET) != 0) {
+			free(neighbours);
+			return EXIT_FAILURE;
+		}
+		int n = fread(block, sizeof(char), block_size, f);
+		if (n <= 0) {
+			free(neighbours);
+			return EXIT_FAILURE;
+		}
+		for (int j=0; j < n; j++)
+			symbol[j] ^= block[j];
+	}
+	free(neighbours);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * fountain_decoder_init()
+ *
+ * Start to decode a file.  Call fountain_decoder_free() when done.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if there is no memory
+ */
+int fountain_decoder_init(FOUNTAIN_DECODER *dec, uint32_t file_id, int file_size, int block_size) {
+	memset(dec, 0, sizeof(FOUNTAIN_DECODER));
+	dec->file_id = file_id;
+	dec->file_size = file_size;
+	dec->block_size = block_size;
+	dec->k = fountain_num_blocks(file_size, block_size);
+	dec->blocks = (unsigned char *)calloc(dec->k, block_size);
+	dec->known = (unsigned char *)calloc(dec->k, 1);
+	if (dec->blocks == NULL || dec->known == NULL) {
+		fountain_decoder_free(dec);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * fountain_decoder_reduce()
+ *
+ * Xor the known blocks out of a pending symbol so only the unknown ones are left
+ */
+static void fountain_decoder_reduce(FOUNTAIN_DECODER *dec, struct fountain_symbol *sym) {
+	int i = 0;
+	while (i < sym->degree) {
+		int b = sym->neighbours[i];
+		if (dec->known[b]) {
+			unsigned char *block = dec->blocks + (long)b * dec->block_size;
+			for (int j=0; j < dec->block_size; j++)
+				sym->data[j] ^= block[j];
+			sym->neighbours[i] = sym->neighbours[--sym->degree];
+		} else {
+			i++;
+		}
+	}
+}
+
+static void fountain_decoder_set_block(FOUNTAIN_DECODER *dec, int b, unsigned char *data, int len) {
+	if (dec->known[b]) return;
+	unsigned char *block = dec->blocks + (long)b * dec->block_size;
+	memcpy(block, data, len);
+	memset(block + len, 0, dec->block_size - len);
+	dec->known[b] = true;
+	dec->num_known++;
+}
+
+/**
+ * fountain_decoder_peel()
+ *
+ * Use up the pending symbols that are down to one unknown block.  Each block found
+ * can reduce other symbols, so keep going until nothing changes.
+ */
+static void fountain_decoder_peel(FOUNTAIN_DECODER *dec) {
+	int progress = true;
+	while (progress) {
+		progress = false;
+		int i = 0;
+		while (i < dec->num_pending) {
+			struct fountain_symbol *sym = &dec->pending[i];
+			fountain_decoder_reduce(dec, sym);
+			if (sym->degree <= 1) {
+				if (sym->degree == 1) {
+					fountain_decoder_set_block(dec, sym->neighbours[0], sym->data, dec->block_size);
+					progress = true;
+				}
+				free(sym->data);
+				free(sym->neighbours);
+				dec->pending[i] = dec->pending[--dec->num_pending];
+			} else {
+				i++;
+			}
+		}
+	}
+}
+
+/**
+ * fountain_decoder_add_chunk()
+ *
+ * Add an ordinary file broadcast chunk.  Only chunks that hold exactly one block are
+ * used, which is all of them when the whole file is broadcast from the start.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the chunk is not a whole block
+ */
+int fountain_decoder_add_chunk(FOUNTAIN_DECODER *dec, int offset, unsigned char *data, int len) {
+	if (offset % dec->block_size != 0) return EXIT_FAILURE;
+	int b = offset / dec->block_size;
+	if (b >= dec->k) return EXIT_FAILURE;
+	if (len != dec->block_size && offset + len != dec->file_size) return EXIT_FAILURE;
+	fountain_decoder_set_block(dec, b, data, len);
+	fountain_decoder_peel(dec);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * fountain_decoder_add_symbol()
+ *
+ * Add a repair symbol, which holds block_size bytes.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if there is no memory
+ */
+int fountain_decoder_add_symbol(FOUNTAIN_DECODER *dec, uint32_t symbol_id, unsigned char *data) {
+	if (fountain_decoder_complete(dec)) return EXIT_SUCCESS;
+	if (dec->num_pending == dec->max_pending) {
+		int max = dec->max_pending == 0 ? 16 : dec->max_pending * 2;
+		struct fountain_symbol *pending = (struct fountain_symbol *)realloc(dec->pending, max * sizeof(struct fountain_symbol));
+		if (pending == NULL) return EXIT_FAILURE;
+		dec->pending = pending;
+		dec->max_pending = max;
+	}
+	struct fountain_symbol *sym = &dec->pending[dec->num_pending];
+	sym->neighbours = (int *)malloc(dec->k * sizeof(int));
+	sym->data = (unsigned char *)malloc(dec->block_size);
+	if (sym->neighbours == NULL || sym->data == NULL) {
+		free(sym->neighbours);
+		free(sym->data);
+		return EXIT_FAILURE;
+	}
+	memcpy(sym->data, data, dec->block_size);
+	sym->degree = fountain_neighbours(dec->file_id, symbol_id, dec->k, sym->neighbours);
+	dec->num_pending++;
+	fountain_decoder_peel(dec);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * fountain_decoder_complete()
+ *
+ * Returns true once every block is known.  The file is then the first file_size bytes of
+ * dec->blocks
+ */
+int fountain_decoder_complete(FOUNTAIN_DECODER *dec) {
+	return dec->num_known == dec->k;
+}
+
+void fountain_decoder_free(FOUNTAIN_DECODER *dec) {
+	for (int i=0; i < dec->num_pending; i++) {
+		free(dec->pending[i].data);
+		free(dec->pending[i].neighbours);
+	}
+	free(dec->pending);
+	free(dec->blocks);
+	free(dec->known);
+	dec->pending = NULL;
+	dec->blocks = NULL;
+	dec->known = NULL;
+	dec->num_pending = 0;
+	dec->max_pending = 0;
+}
+
+/*
+ *  SELF TESTS FOLLOW
+ */
+
+/**
+ * test_fountain_decode()
+ *
+ * Broadcast the systematic chunks of the file and then repair symbols, dropping each frame
+ * with probability loss_percent, until the decoder has the whole file.
+ *
+ * Returns the number of frames received or -1 if the file was not rebuilt correctly
+ */
+static int test_fountain_decode(FILE *f, unsigned char *file_data, int file_size, int block_size,
+		int send_systematic, int loss_percent, int *frames_sent) {
+	FOUNTAIN_DECODER dec;
+	if (fountain_decoder_init(&dec, 1234, file_size, block_size) != EXIT_SUCCESS) return -1;
+	int received = 0;
+	*frames_sent = 0;
+	if (send_systematic)
+		for (int offset=0; offset < file_size; offset += block_size) {
+			(*frames_sent)++;
+			if (rand() % 100 < loss_percent) continue;
+			int len = file_size - offset < block_size ? file_size - offset : block_size;
+			fountain_decoder_add_chunk(&dec, offset, file_data + offset, len);
+			received++;
+		}
+	unsigned char symbol[block_size];
+	uint32_t symbol_id = 1;
+	while (!fountain_decoder_complete(&dec) && *frames_sent < dec.k * 4) {
+		(*frames_sent)++;
+		if (fountain_encode_symbol(f, file_size, block_size, 1234, symbol_id, symbol) != EXIT_SUCCESS) break;
+		symbol_id++;
+		if (rand() % 100 < loss_percent) continue;
+		fountain_decoder_add_symbol(&dec, symbol_id - 1, symbol);
+		received++;
+	}
+	int ok = fountain_decoder_complete(&dec) && memcmp(dec.blocks, file_data, file_size) == 0;
+	fountain_decoder_free(&dec);
+	return ok ? received : -1;
+}
+
+int test_fountain() {
+	printf("##### TEST FOUNTAIN:\n");
+	int rc = EXIT_SUCCESS;
+	int block_size = 191;
+	int k = 50;
+	int file_size = k * block_size - 37;
+
+	/* The blocks in a symbol must be distinct, in range and the same every time */
+	int neighbours[k], again[k];
+	for (uint32_t id=1; id < 500; id++) {
+		int degree = fountain_neighbours(99, id, k, neighbours);
+		if (degree < 1 || degree > k) { printf("** Bad degree %d\n", degree); rc = EXIT_FAILURE; break; }
+		if (fountain_neighbours(99, id, k, again) != degree || memcmp(neighbours, again, degree * sizeof(int)) != 0) {
+			printf("** Symbol %d not repeatable\n", id); rc = EXIT_FAILURE; break;
+		}
+		for (int i=0; i < degree; i++) {
+			if (neighbours[i] < 0 || neighbours[i] >= k) { printf("** Block out of range\n"); rc = EXIT_FAILURE; }
+			for (int j=0; j < i; j++)
+				if (neighbours[i] == neighbours[j]) { printf("** Block repeated in symbol %d\n", id); rc = EXIT_FAILURE; }
+		}
+	}
+
+	unsigned char file_data[file_size];
+	srand(2);
+	for (int i=0; i < file_size; i++)
+		file_data[i] = (unsigned char)rand();
+	char *filename = "/tmp/pacsat_fountain_test.dat";
+	FILE *f = fopen(filename, "w+b");
+	if (f == NULL) { printf("** Could not create %s\n", filename); return EXIT_FAILURE; }
+	fwrite(file_data, sizeof(char), file_size, f);
+	fflush(f);
+
+	/* Repair symbols alone, with no loss */
+	int sent = 0;
+	int received = test_fountain_decode(f, file_data, file_size, block_size, false, 0, &sent);
+	if (received < 0) { printf("** Could not decode from repair symbols\n"); rc = EXIT_FAILURE; }
+	else debug_print("Repair symbols only: K=%d decoded from %d frames\n", k, received);
+
+	/* Loss simulation.  The systematic chunks go first, as they do on the PB, then repair symbols */
+	int trials = 5;
+	for (int loss=10; loss <= 30; loss += 10) {
+		int total_sent = 0, total_received = 0;
+		for (int t=0; t < trials; t++) {
+			received = test_fountain_decode(f, file_data, file_size, block_size, true, loss, &sent);
+			if (received < 0) { printf("** Could not decode with %d%% loss\n", loss); rc = EXIT_FAILURE; break; }
+			total_sent += sent;
+			total_received += received;
+		}
+		debug_print("Loss %d%%: K=%d average %d frames sent, %d received\n", loss, k,
+				total_sent / trials, total_received / trials);
+	}
+
+	fclose(f);
+	remove(filename);
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST FOUNTAIN: success\n");
+	else
+		printf("##### TEST FOUNTAIN: fail\n");
+	return rc;
+}
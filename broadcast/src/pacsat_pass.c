@@ -0,0 +1,331 @@
+/*
+ * pacsat_pass.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * Pass schedule and PB admission control.
+ *
+ * There is no point starting a large download that can not finish before
+ * loss of signal.  It uses airtime that could have finished smaller requests
+ * and the station has to start again next pass.  The pass schedule is a file
+ * of AOS and LOS times that is prepared on the ground and uploaded.  Each line
+ * holds the two times as unix seconds separated by a comma.  Lines that start
+ * with # are comments.
+ *
+ * When a request arrives during a scheduled pass we estimate how long it
+ * will take to send, given the bit rate and the stations that are already on
+ * the PB and sharing the downlink.  If it can not finish before LOS then the
+ * station is sent NO -1 straight away, so it can try again next pass and the
+ * PB is kept for the requests that can finish.  pb_admission_slack_percent in
+ * the state file scales the time that we think is left, so the estimate can
+ * be made more or less cautious.  Set it to 0 to admit every request.  With no
+ * schedule, or outside the scheduled passes, every request is admitted.
+ *
+ * pass_simulate() runs the same admission test against a trace of recorded
+ * requests, so the slack can be tuned on the ground.  Use the -s command
+ * line option.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "state_file.h"
+#include "debug.h"
+#include "pacsat_broadcast.h"
+#include "pacsat_stats.h"
+#include "pacsat_pass.h"
+
+#define PASS_FRAME_OVERHEAD_BYTES (sizeof(PB_FILE_HEADER) + 2 + PB_AX25_HEADER_BYTES)
+
+/* Local variables */
+static PASS_WINDOW pass_windows[PASS_MAX_WINDOWS];
+static int number_of_windows = 0;
+
+static int pass_compare_windows(const void *a, const void *b) {
+	const PASS_WINDOW *wa = (const PASS_WINDOW *)a;
+	const PASS_WINDOW *wb = (const PASS_WINDOW *)b;
+	if (wa->aos < wb->aos) return -1;
+	if (wa->aos > wb->aos) return 1;
+	return 0;
+}
+
+/**
+ * pass_load_schedule()
+ *
+ * Read the AOS/LOS windows from the pass schedule file.  Any schedule that was loaded before
+ * is replaced.  If the file does not exist then there is no schedule and every request is
+ * admitted.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the file could not be read
+ */
+int pass_load_schedule(char *filename) {
+	number_of_windows = 0;
+	FILE *file = fopen(filename, "r");
+	if (file == NULL) {
+		debug_print("No pass schedule in: %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	char line[MAX_CONFIG_LINE_LENGTH];
+	while (fgets(line, sizeof line, file) != NULL) {
+		if (line[0] == '#') continue;
+		long aos, los;
+		if (sscanf(line, "%ld,%ld", &aos, &los) != 2) continue;
+		if (los <= aos) {
+			error_print("Pass with LOS before AOS in schedule: %s", line);
+			continue;
+		}
+		if (number_of_windows == PASS_MAX_WINDOWS) {
+			error_print("Pass schedule has more than %d passes.  The rest are ignored\n", PASS_MAX_WINDOWS);
+			break;
+		}
+		pass_windows[number_of_windows].aos = aos;
+		pass_windows[number_of_windows].los = los;
+		number_of_windows++;
+	}
+	fclose(file);
+	qsort(pass_windows, number_of_windows, sizeof(PASS_WINDOW), pass_compare_windows);
+	debug_print("Loaded %d passes from: %s\n", number_of_windows, filename);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * pass_seconds_remaining()
+ *
+ * Returns the seconds until LOS if we are in a scheduled pass, otherwise -1
+ */
+int pass_seconds_remaining(time_t now) {
+	for (int i=0; i < number_of_windows; i++) {
+		if (pass_windows[i].aos > now) break;
+		if (now < pass_windows[i].los)
+			return (int)(pass_windows[i].los - now);
+	}
+	return -1;
+}
+
+/**
+ * pass_estimate_ms()
+ *
+ * Estimate how long it takes to broadcast bytes of a file when it shares the downlink with the
+ * stations already on the PB.  Each frame carries PB_FILE_DEFAULT_BLOCK_SIZE bytes of the file.
+ *
+ * Returns the estimate in milliseconds
+ */
+uint32_t pass_estimate_ms(int bytes, int stations_on_pb) {
+	if (bytes <= 0) return 0;
+	int frames = (bytes + PB_FILE_DEFAULT_BLOCK_SIZE - 1) / PB_FILE_DEFAULT_BLOCK_SIZE;
+	uint64_t ms = stats_airtime_ms(bytes + frames * PASS_FRAME_OVERHEAD_BYTES);
+	ms = ms * (stations_on_pb + 1);
+	return ms > UINT32_MAX ? UINT32_MAX : (uint32_t)ms;
+}
+
+/**
+ * pass_can_complete()
+ *
+ * Returns true if a request for bytes of a file should be admitted to the PB
+ */
+int pass_can_complete(time_t now, int bytes, int stations_on_pb) {
+	if (g_pb_admission_slack_percent <= 0) return true;
+	int remaining = pass_seconds_remaining(now);
+	if (remaining < 0) return true; // No scheduled pass, so we can not tell
+	uint64_t available_ms = (uint64_t)remaining * 1000 * g_pb_admission_slack_percent / 100;
+	return pass_estimate_ms(bytes, stations_on_pb) <= available_ms;
+}
+
+/**
+ * pass_simulate()
+ *
+ * Replay a trace of requests against the pass schedule and report how the admission control
+ * would have done.  Each line of the trace is the unix time of the request, the callsign and the
+ * number of bytes requested, separated by commas.  The lines must be in time order.
+ *
+ * The downlink is modeled at g_bit_rate with the PB sending one frame to each station in turn.
+ * Stations that are still on the PB at LOS did not finish.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the trace could not be read
+ */
+int pass_simulate(char *trace_filename, PASS_SIM_RESULT *result) {
+	memset(result, 0, sizeof(PASS_SIM_RESULT));
+	FILE *file = fopen(trace_filename, "r");
+	if (file == NULL) {
+		error_print("Could not open request trace: %s\n", trace_filename);
+		return EXIT_FAILURE;
+	}
+	int max_on_pb = g_max_pb_length < PASS_SIM_MAX_STATIONS ? g_max_pb_length : PASS_SIM_MAX_STATIONS;
+	if (max_on_pb < 1) max_on_pb = MAX_PB_LENGTH;
+	int remaining[PASS_SIM_MAX_STATIONS]; /* Bytes still to send for each station on the PB */
+	int sent[PASS_SIM_MAX_STATIONS];
+	int on_pb = 0;
+	int next = 0; /* The station whose turn it is */
+	double credit = 0; /* Bytes of airtime available and not yet used */
+	time_t clock = 0;
+
+	char line[MAX_CONFIG_LINE_LENGTH];
+	int more = true;
+	while (more) {
+		long t = 0;
+		char callsign[MAX_CALLSIGN_LEN];
+		int bytes = 0;
+		more = false;
+		while (fgets(line, sizeof line, file) != NULL) {
+			if (line[0] == '#') continue;
+			if (sscanf(line, "%ld,%9[^,],%d", &t, callsign, &bytes) == 3) {
+				more = true;
+				break;
+			}
+		}
+		if (clock == 0) clock = more ? t : 0;
+
+		/* Run the downlink up to the time of the next request, or to the end of the last pass */
+		time_t until = more ? t : (number_of_windows > 0 ? pass_windows[number_of_windows - 1].los : clock);
+		while (clock < until) {
+			int in_pass = pass_seconds_remaining(clock) > 0;
+			if (in_pass && on_pb > 0) {
+				credit += g_bit_rate / 8.0;
+				while (on_pb > 0) {
+					if (next >= on_pb) next = 0;
+					int chunk = remaining[next] < PB_FILE_DEFAULT_BLOCK_SIZE ? remaining[next] : PB_FILE_DEFAULT_BLOCK_SIZE;
+					int cost = chunk + PASS_FRAME_OVERHEAD_BYTES;
+					if (credit < cost) break;
+					credit -= cost;
+					remaining[next] -= chunk;
+					sent[next] += chunk;
+					if (remaining[next] <= 0) {
+						result->completed++;
+						on_pb--;
+						remaining[next] = remaining[on_pb];
+						sent[next] = sent[on_pb];
+					} else {
+						next++;
+					}
+				}
+			} else {
+				credit = 0;
+			}
+			clock++;
+			if (pass_seconds_remaining(clock) <= 0 && in_pass) {
+				/* LOS.  Anything left on the PB did not finish */
+				for (int i=0; i < on_pb; i++)
+					result->wasted_bytes += sent[i];
+				result->incomplete += on_pb;
+				on_pb = 0;
+			}
+		}
+		if (!more) break;
+
+		result->requests++;
+		if (pass_seconds_remaining(t) < 0) {
+			result->outside++;
+		} else if (on_pb == max_on_pb) {
+			result->rejected_full++;
+		} else if (!pass_can_complete(t, bytes, on_pb)) {
+			result->rejected_admission++;
+		} else {
+			result->admitted++;
+			remaining[on_pb] = bytes;
+			sent[on_pb] = 0;
+			on_pb++;
+		}
+	}
+	fclose(file);
+
+	printf("Requests: %d Outside passes: %d Rejected full: %d Rejected admission: %d\n",
+			result->requests, result->outside, result->rejected_full, result->rejected_admission);
+	printf("Admitted: %d Completed: %d Incomplete at LOS: %d Wasted bytes: %u\n",
+			result->admitted, result->completed, result->incomplete, result->wasted_bytes);
+	return EXIT_SUCCESS;
+}
+
+/*
+ *  SELF TESTS FOLLOW
+ */
+
+int test_pass() {
+	printf("##### TEST PASS SCHEDULE:\n");
+	int rc = EXIT_SUCCESS;
+	int saved_rate = g_bit_rate;
+	int saved_slack = g_pb_admission_slack_percent;
+	g_bit_rate = 1200;
+	g_pb_admission_slack_percent = 100;
+
+	/* Two 10 minute passes, listed out of order */
+	char *schedule = "/tmp/pacsat_pass_schedule.csv";
+	FILE *f = fopen(schedule, "w");
+	if (f == NULL) { printf("** Could not create %s\n", schedule); return EXIT_FAILURE; }
+	fprintf(f, "# AOS,LOS\n5000,5600\n1000,1600\n");
+	fclose(f);
+	if (pass_load_schedule(schedule) != EXIT_SUCCESS) { printf("** Could not load the schedule\n"); rc = EXIT_FAILURE; }
+
+	if (pass_seconds_remaining(999) != -1) { printf("** In a pass before AOS\n"); rc = EXIT_FAILURE; }
+	if (pass_seconds_remaining(1000) != 600) { printf("** Wrong time to LOS at AOS\n"); rc = EXIT_FAILURE; }
+	if (pass_seconds_remaining(5500) != 100) { printf("** Wrong time to LOS in second pass\n"); rc = EXIT_FAILURE; }
+	if (pass_seconds_remaining(1600) != -1) { printf("** In a pass at LOS\n"); rc = EXIT_FAILURE; }
+
+	/* 191 bytes is one frame of 219 bytes, about 1.46 seconds at 1200bps */
+	if (pass_estimate_ms(191, 0) != stats_airtime_ms(191 + sizeof(PB_FILE_HEADER) + 2 + PB_AX25_HEADER_BYTES)) { printf("** Wrong estimate for one frame\n"); rc = EXIT_FAILURE; }
+	if (pass_estimate_ms(191, 2) != 3 * pass_estimate_ms(191, 0)) { printf("** Estimate does not share the downlink\n"); rc = EXIT_FAILURE; }
+
+	/* 150k can not finish in 10 minutes at 1200bps, 10k can */
+	if (pass_can_complete(1000, 153600, 0)) { printf("** 150k admitted\n"); rc = EXIT_FAILURE; }
+	if (!pass_can_complete(1000, 10000, 0)) { printf("** 10k not admitted\n"); rc = EXIT_FAILURE; }
+	if (pass_can_complete(1550, 10000, 0)) { printf("** 10k admitted near LOS\n"); rc = EXIT_FAILURE; }
+	if (!pass_can_complete(3000, 153600, 0)) { printf("** Not admitted outside a pass\n"); rc = EXIT_FAILURE; }
+	g_pb_admission_slack_percent = 0;
+	if (!pass_can_complete(1000, 153600, 0)) { printf("** Not admitted with admission control off\n"); rc = EXIT_FAILURE; }
+	g_pb_admission_slack_percent = 100;
+
+	/* Simulate a trace.  The big request and the late one are refused, the rest finish */
+	char *trace = "/tmp/pacsat_pass_trace.csv";
+	f = fopen(trace, "w");
+	if (f == NULL) { printf("** Could not create %s\n", trace); return EXIT_FAILURE; }
+	fprintf(f, "# time,callsign,bytes\n");
+	fprintf(f, "900,W1AAA,1000\n");
+	fprintf(f, "1010,G0KLA,20000\n");
+	fprintf(f, "1020,AC2CZ,153600\n");
+	fprintf(f, "1030,VE2XYZ,5000\n");
+	fprintf(f, "1590,WA1QQQ,20000\n");
+	fprintf(f, "5010,N0AAA,30000\n");
+	fclose(f);
+	PASS_SIM_RESULT result;
+	if (pass_simulate(trace, &result) != EXIT_SUCCESS) { printf("** Simulation failed\n"); rc = EXIT_FAILURE; }
+	if (result.requests != 6) { printf("** Simulated %d requests\n", result.requests); rc = EXIT_FAILURE; }
+	if (result.outside != 1) { printf("** %d requests outside passes\n", result.outside); rc = EXIT_FAILURE; }
+	if (result.rejected_admission != 2) { printf("** %d requests refused\n", result.rejected_admission); rc = EXIT_FAILURE; }
+	if (result.completed != 3 || result.incomplete != 0) { printf("** %d completed %d incomplete\n", result.completed, result.incomplete); rc = EXIT_FAILURE; }
+
+	/* Without admission control the big request takes airtime and does not finish */
+	g_pb_admission_slack_percent = 0;
+	pass_simulate(trace, &result);
+	if (result.incomplete < 1 || result.wasted_bytes == 0) { printf("** Expected incomplete requests without admission control\n"); rc = EXIT_FAILURE; }
+
+	remove(schedule);
+	remove(trace);
+	number_of_windows = 0;
+	g_bit_rate = saved_rate;
+	g_pb_admission_slack_percent = saved_slack;
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST PASS SCHEDULE: success\n");
+	else
+		printf("##### TEST PASS SCHEDULE: fail\n");
+	return rc;
+}
@@ -0,0 +1,390 @@
+/*
+ * pacsat_readahead.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * Read ahead of the file broadcasts.
+ *
+ * Reading from the SD card can take a long time, and while the main loop
+ * waits for a read it can not process FTL0 frames or anything else.  So the
+ * PB asks for the next few chunks of each file it is sending and a worker
+ * thread reads them into a fixed pool of buffers.  The PB only sends a chunk
+ * once it is in memory.  If it is not there yet then ra_read() says so and the
+ * PB tries again on the next loop.
+ *
+ * A chunk stays in the pool after it is sent, because another station or the
+ * idle broadcast may want it.  When the pool is full, the chunks that were
+ * sent longest ago are replaced first, then the ones that were read longest ago.
+ * When a file or its PFH is rewritten on disk, ra_invalidate() drops its chunks
+ * so that the old bytes are not broadcast with the new ones.
+ *
+ * Until ra_start() is called, which is the case in the self tests, ra_read()
+ * just reads the file directly.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "debug.h"
+#include "str_util.h"
+#include "pacsat_broadcast.h"
+#include "pacsat_readahead.h"
+
+#define RA_FREE 0
+#define RA_WANTED 1 /* Waiting for the worker thread */
+#define RA_READING 2 /* The worker thread is reading it now.  It must not be replaced */
+#define RA_READY 3
+#define RA_FAILED 4
+
+struct ra_chunk {
+	int state;
+	uint32_t file_id;
+	int offset;
+	int len; /* Bytes read, which is less than a block at the end of the file */
+	int sent; /* True once the PB has sent it, so it can be replaced first */
+	int stale; /* The file changed while the worker thread was reading it, so the data is thrown away */
+	uint32_t last_used; /* Sequence number of the last time it was requested or read */
+	char filename[MAX_FILE_PATH_LEN];
+	unsigned char data[PB_FILE_DEFAULT_BLOCK_SIZE];
+};
+
+/* Local variables */
+static struct ra_chunk ra_pool[RA_POOL_SIZE];
+static uint32_t ra_sequence = 0;
+static int ra_running = false;
+static pthread_t ra_pthread;
+static pthread_mutex_t ra_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ra_cond = PTHREAD_COND_INITIALIZER;
+
+/**
+ * ra_read_file()
+ *
+ * Read a chunk straight from the disk.
+ *
+ * Returns the number of bytes read, or 0 if the file could not be read
+ */
+static int ra_read_file(char *filename, int offset, unsigned char *buffer, int len) {
+	FILE * f = fopen(filename, "r");
+	if (f == NULL) {
+		return 0;
+	}
+	if (fseek( f, offset, SEEK_SET ) != 0) {
+		fclose(f);
+		return 0;
+	}
+	int number_of_bytes_read = fread(buffer, sizeof(char), len, f);
+	fclose(f);
+	return number_of_bytes_read;
+}
+
+/* Call with the mutex held */
+static int ra_find(uint32_t file_id, int offset) {
+	for (int i=0; i < RA_POOL_SIZE; i++)
+		if (ra_pool[i].state != RA_FREE && ra_pool[i].file_id == file_id && ra_pool[i].offset == offset)
+			return i;
+	return -1;
+}
+
+/**
+ * ra_victim()
+ *
+ * Pick the buffer for a new chunk.  Call with the mutex held.
+ *
+ * Returns a free buffer, or the least recently used one that is not being read, or -1
+ * if every buffer is still waiting to be read
+ */
+static int ra_victim() {
+	int victim = -1;
+	for (int i=0; i < RA_POOL_SIZE; i++) {
+		if (ra_pool[i].state == RA_FREE) return i;
+		if (ra_pool[i].state != RA_READY && ra_pool[i].state != RA_FAILED) continue;
+		if (victim == -1
+				|| (ra_pool[i].sent && !ra_pool[victim].sent)
+				|| (ra_pool[i].sent == ra_pool[victim].sent && (int32_t)(ra_pool[i].last_used - ra_pool[victim].last_used) < 0))
+			victim = i;
+	}
+	return victim;
+}
+
+/* Call with the mutex held */
+static int ra_next_wanted() {
+	int next = -1;
+	for (int i=0; i < RA_POOL_SIZE; i++)
+		if (ra_pool[i].state == RA_WANTED
+				&& (next == -1 || (int32_t)(ra_pool[i].last_used - ra_pool[next].last_used) < 0))
+			next = i;
+	return next;
+}
+
+/**
+ * ra_process()
+ *
+ * The worker thread.  Read the wanted chunks in the order they were asked for.  The mutex
+ * is not held while we read from the disk.
+ */
+static void *ra_process(void * arg) {
+	char *name;
+	name = (char *) arg;
+	debug_print("Starting Thread: %s\n", name);
+	unsigned char buffer[PB_FILE_DEFAULT_BLOCK_SIZE];
+	char filename[MAX_FILE_PATH_LEN];
+
+	pthread_mutex_lock(&ra_mutex);
+	while (ra_running) {
+		int i = ra_next_wanted();
+		if (i == -1) {
+			pthread_cond_wait(&ra_cond, &ra_mutex);
+			continue;
+		}
+		ra_pool[i].state = RA_READING;
+		strlcpy(filename, ra_pool[i].filename, sizeof(filename));
+		int offset = ra_pool[i].offset;
+		pthread_mutex_unlock(&ra_mutex);
+
+		int len = ra_read_file(filename, offset, buffer, PB_FILE_DEFAULT_BLOCK_SIZE);
+
+		pthread_mutex_lock(&ra_mutex);
+		memcpy(ra_pool[i].data, buffer, len);
+		ra_pool[i].len = len;
+		if (ra_pool[i].stale)
+			ra_pool[i].state = RA_FREE;
+		else
+			ra_pool[i].state = len > 0 ? RA_READY : RA_FAILED;
+	}
+	pthread_mutex_unlock(&ra_mutex);
+	return NULL;
+}
+
+/**
+ * ra_start()
+ *
+ * Start the worker thread.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the thread could not be started
+ */
+int ra_start() {
+	pthread_mutex_lock(&ra_mutex);
+	memset(ra_pool, 0, sizeof(ra_pool));
+	ra_running = true;
+	pthread_mutex_unlock(&ra_mutex);
+	char *name = "PB Read Ahead Thread";
+	if (pthread_create(&ra_pthread, NULL, ra_process, (void*) name) != 0) {
+		ra_running = false;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * ra_stop()
+ *
+ * Stop the worker thread and wait for it to finish.  ra_read() goes back to reading directly.
+ */
+void ra_stop() {
+	pthread_mutex_lock(&ra_mutex);
+	if (!ra_running) {
+		pthread_mutex_unlock(&ra_mutex);
+		return;
+	}
+	ra_running = false;
+	pthread_cond_signal(&ra_cond);
+	pthread_mutex_unlock(&ra_mutex);
+	pthread_join(ra_pthread, NULL);
+}
+
+/**
+ * ra_prefetch()
+ *
+ * Ask for the chunk of a file at offset to be read into memory.  Nothing happens if it
+ * is already there or on its way, or if every buffer is waiting to be read.
+ *
+ * Returns EXIT_SUCCESS if the chunk is or will be in memory, otherwise EXIT_FAILURE
+ */
+int ra_prefetch(uint32_t file_id, char *filename, int offset) {
+	pthread_mutex_lock(&ra_mutex);
+	if (!ra_running) {
+		pthread_mutex_unlock(&ra_mutex);
+		return EXIT_FAILURE;
+	}
+	int i = ra_find(file_id, offset);
+	if (i == -1) {
+		i = ra_victim();
+		if (i == -1) {
+			pthread_mutex_unlock(&ra_mutex);
+			return EXIT_FAILURE;
+		}
+		ra_pool[i].state = RA_WANTED;
+		ra_pool[i].file_id = file_id;
+		ra_pool[i].offset = offset;
+		ra_pool[i].len = 0;
+		ra_pool[i].sent = false;
+		ra_pool[i].stale = false;
+		strlcpy(ra_pool[i].filename, filename, sizeof(ra_pool[i].filename));
+		pthread_cond_signal(&ra_cond);
+	}
+	ra_pool[i].last_used = ++ra_sequence;
+	pthread_mutex_unlock(&ra_mutex);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * ra_read()
+ *
+ * Copy up to len bytes of the chunk at offset into buffer.  If the chunk is not in memory
+ * then it is requested and RA_NOT_READY is returned, so the caller can try again later
+ * without waiting for the disk.
+ *
+ * Returns the number of bytes copied, 0 if the file could not be read, or RA_NOT_READY
+ */
+int ra_read(uint32_t file_id, char *filename, int offset, unsigned char *buffer, int len) {
+	if (len > PB_FILE_DEFAULT_BLOCK_SIZE)
+		len = PB_FILE_DEFAULT_BLOCK_SIZE;
+	pthread_mutex_lock(&ra_mutex);
+	if (!ra_running) {
+		pthread_mutex_unlock(&ra_mutex);
+		return ra_read_file(filename, offset, buffer, len);
+	}
+	int i = ra_find(file_id, offset);
+	if (i == -1 || ra_pool[i].state == RA_WANTED || ra_pool[i].state == RA_READING) {
+		pthread_mutex_unlock(&ra_mutex);
+		if (i == -1)
+			ra_prefetch(file_id, filename, offset);
+		return RA_NOT_READY;
+	}
+	int rc = 0;
+	if (ra_pool[i].state == RA_READY) {
+		rc = ra_pool[i].len < len ? ra_pool[i].len : len;
+		memcpy(buffer, ra_pool[i].data, rc);
+		ra_pool[i].sent = true;
+		ra_pool[i].last_used = ++ra_sequence;
+	} else {
+		ra_pool[i].state = RA_FREE; /* Failed.  Let the next request try the disk again */
+	}
+	pthread_mutex_unlock(&ra_mutex);
+	return rc;
+}
+
+/**
+ * ra_invalidate()
+ *
+ * Drop the chunks of a file from the pool because the file was rewritten or removed.  A chunk
+ * that is being read is thrown away when the read finishes.  Chunks that are still wanted are
+ * kept, because they will be read from the new file.
+ */
+void ra_invalidate(uint32_t file_id) {
+	pthread_mutex_lock(&ra_mutex);
+	for (int i=0; i < RA_POOL_SIZE; i++) {
+		if (ra_pool[i].state == RA_FREE || ra_pool[i].file_id != file_id) continue;
+		if (ra_pool[i].state == RA_READY || ra_pool[i].state == RA_FAILED)
+			ra_pool[i].state = RA_FREE;
+		else if (ra_pool[i].state == RA_READING)
+			ra_pool[i].stale = true;
+	}
+	pthread_mutex_unlock(&ra_mutex);
+}
+
+/*
+ *  SELF TESTS FOLLOW
+ */
+
+/* Wait for the worker thread to read a chunk.  Returns the result of ra_read() */
+static int test_ra_wait(uint32_t file_id, char *filename, int offset, unsigned char *buffer, int len) {
+	int rc = RA_NOT_READY;
+	for (int i=0; i < 500 && rc == RA_NOT_READY; i++) {
+		rc = ra_read(file_id, filename, offset, buffer, len);
+		if (rc == RA_NOT_READY)
+			usleep(1000);
+	}
+	return rc;
+}
+
+int test_readahead() {
+	printf("##### TEST READ AHEAD:\n");
+	int rc = EXIT_SUCCESS;
+	int block = PB_FILE_DEFAULT_BLOCK_SIZE;
+	int file_size = (RA_POOL_SIZE + 4) * block + 10;
+
+	unsigned char file_data[file_size];
+	for (int i=0; i < file_size; i++)
+		file_data[i] = (unsigned char)(i * 7 + 3);
+	char *filename = "/tmp/pacsat_readahead_test.dat";
+	FILE *f = fopen(filename, "wb");
+	if (f == NULL) { printf("** Could not create %s\n", filename); return EXIT_FAILURE; }
+	fwrite(file_data, sizeof(char), file_size, f);
+	fclose(f);
+
+	/* Without the thread the file is read directly */
+	unsigned char buffer[block];
+	if (ra_read(7, filename, block, buffer, block) != block || memcmp(buffer, file_data + block, block) != 0) {
+		printf("** Direct read failed\n"); rc = EXIT_FAILURE;
+	}
+
+	if (ra_start() != EXIT_SUCCESS) { printf("** Could not start the read ahead thread\n"); return EXIT_FAILURE; }
+
+	/* The first read is not ready, then the worker thread brings it in */
+	int n = ra_read(7, filename, 0, buffer, block);
+	if (n != RA_NOT_READY && n != block) { printf("** Unexpected result %d for first read\n", n); rc = EXIT_FAILURE; }
+	n = test_ra_wait(7, filename, 0, buffer, block);
+	if (n != block || memcmp(buffer, file_data, block) != 0) { printf("** Chunk not read ahead\n"); rc = EXIT_FAILURE; }
+
+	/* The short last chunk */
+	int last = (file_size / block) * block;
+	n = test_ra_wait(7, filename, last, buffer, block);
+	if (n != file_size - last || memcmp(buffer, file_data + last, n) != 0) { printf("** Last chunk wrong, %d bytes\n", n); rc = EXIT_FAILURE; }
+
+	/* Ask for more chunks than the pool holds.  Older chunks are replaced and read again when needed */
+	for (int c=0; c < RA_POOL_SIZE + 4; c++)
+		ra_prefetch(8, filename, c * block);
+	for (int c=0; c < RA_POOL_SIZE + 4; c++) {
+		n = test_ra_wait(8, filename, c * block, buffer, block);
+		int expected = file_size - c * block < block ? file_size - c * block : block;
+		if (n != expected || memcmp(buffer, file_data + c * block, n) != 0) { printf("** Chunk %d wrong after pool filled\n", c); rc = EXIT_FAILURE; break; }
+	}
+
+	/* When the file is rewritten the chunks in memory are dropped and the new bytes are read */
+	n = test_ra_wait(7, filename, 0, buffer, block);
+	for (int i=0; i < block; i++)
+		file_data[i] = (unsigned char)(i * 5 + 1);
+	f = fopen(filename, "r+b");
+	if (f == NULL) { printf("** Could not rewrite %s\n", filename); return EXIT_FAILURE; }
+	fwrite(file_data, sizeof(char), block, f);
+	fclose(f);
+	ra_invalidate(7);
+	n = test_ra_wait(7, filename, 0, buffer, block);
+	if (n != block || memcmp(buffer, file_data, block) != 0) { printf("** Old chunk read after the file was rewritten\n"); rc = EXIT_FAILURE; }
+
+	/* A file that can not be read fails, and is tried again on the next request */
+	n = test_ra_wait(9, "/tmp/pacsat_readahead_missing.dat", 0, buffer, block);
+	if (n != 0) { printf("** Missing file returned %d\n", n); rc = EXIT_FAILURE; }
+
+	ra_stop();
+	remove(filename);
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST READ AHEAD: success\n");
+	else
+		printf("##### TEST READ AHEAD: fail\n");
+	return rc;
+}
@@ -0,0 +1,441 @@
+/*
+ * pacsat_stats.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * Accounting of the frames and bytes that we transmit in each pass.
+ *
+ * Every frame we send is counted by its PID, by the kind of traffic, by the
+ * station it was sent for and by the file it carried.  The airtime is estimated
+ * from the bytes and the bit rate of the TNC.  This ignores bit stuffing and the
+ * TX delay, so it is a lower bound.
+ *
+ * A pass starts when we receive the first frame from a ground station and ends
+ * when we have heard nothing for stats_pass_idle_period_in_seconds.  The counts
+ * start from zero for each pass, so frames that were sent when no one was
+ * listening are not included.
+ *
+ * During a pass a BSTAT frame is broadcast every pb_bstat_period_in_seconds so
+ * that ground stations can calculate the efficiency of the broadcasts.  When the
+ * pass ends the totals are appended to the stats file.
+ *
+ * Frames are counted by the PB and FTL0 threads and received by the receive
+ * loop, so the counts are protected by stats_mutex.  It is recursive because
+ * the public functions call each other.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "state_file.h"
+#include "debug.h"
+#include "agw_tnc.h"
+#include "str_util.h"
+#include "pacsat_broadcast.h"
+#include "pacsat_stats.h"
+#include "pacsat_tx.h"
+
+/* Forward declarations */
+void stats_reset();
+int stats_send_bstat(time_t now);
+
+struct stats_station {
+	char callsign[MAX_CALLSIGN_LEN];
+	STATS_COUNT count;
+};
+
+struct stats_file {
+	uint32_t file_id;
+	STATS_COUNT count;
+};
+
+/* Local variables */
+static time_t pass_start_time = 0; /* Time the pass started or 0 if there is no pass in progress */
+static time_t last_rx_time = 0;
+static time_t last_bstat_time = 0;
+static uint32_t bytes_at_last_bstat = 0; /* Only send a BSTAT if we sent something since the last one */
+
+static STATS_COUNT total_count;
+static STATS_COUNT type_counts[STATS_NUMBER_OF_TYPES];
+static STATS_COUNT pid_counts[256];
+static struct stats_station station_counts[STATS_MAX_STATIONS];
+static int number_of_stations = 0;
+static STATS_COUNT other_stations_count;
+static struct stats_file file_counts[STATS_MAX_FILES];
+static int number_of_files = 0;
+static STATS_COUNT other_files_count;
+
+static char *type_names[] = {"DIR", "FILE", "PB", "FTL0", "BSTAT"};
+
+static pthread_mutex_t stats_mutex;
+static pthread_once_t stats_mutex_once = PTHREAD_ONCE_INIT;
+
+static void stats_mutex_init() {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&stats_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void stats_lock() {
+	pthread_once(&stats_mutex_once, stats_mutex_init);
+	pthread_mutex_lock(&stats_mutex);
+}
+
+static void stats_unlock() {
+	pthread_mutex_unlock(&stats_mutex);
+}
+
+/**
+ * stats_reset()
+ *
+ * Zero all of the counts ready for a new pass
+ */
+void stats_reset() {
+	stats_lock();
+	memset(&total_count, 0, sizeof(total_count));
+	memset(type_counts, 0, sizeof(type_counts));
+	memset(pid_counts, 0, sizeof(pid_counts));
+	memset(station_counts, 0, sizeof(station_counts));
+	memset(file_counts, 0, sizeof(file_counts));
+	memset(&other_stations_count, 0, sizeof(other_stations_count));
+	memset(&other_files_count, 0, sizeof(other_files_count));
+	number_of_stations = 0;
+	number_of_files = 0;
+	bytes_at_last_bstat = 0;
+	stats_unlock();
+}
+
+static void stats_add(STATS_COUNT *count, int bytes) {
+	count->frames++;
+	count->bytes += bytes;
+}
+
+/**
+ * stats_tx_frame()
+ *
+ * Count a frame that was sent to the TNC.  type is one of the STATS_TYPE values, pid is the
+ * AX25 PID and len is the length of the data in the frame.  callsign is the station the
+ * frame was sent for and file_id the file that it carried.  Pass NULL, an empty callsign or 0 if
+ * the frame was not for a particular station or file.
+ *
+ */
+void stats_tx_frame(int type, int pid, char *callsign, uint32_t file_id, int len) {
+	int bytes = len + PB_AX25_HEADER_BYTES;
+	stats_lock();
+	stats_add(&total_count, bytes);
+	if (type >= 0 && type < STATS_NUMBER_OF_TYPES)
+		stats_add(&type_counts[type], bytes);
+	stats_add(&pid_counts[pid & 0xff], bytes);
+
+	if (callsign != NULL && callsign[0] != 0) {
+		int i;
+		for (i=0; i < number_of_stations; i++)
+			if (strncmp(station_counts[i].callsign, callsign, MAX_CALLSIGN_LEN) == 0)
+				break;
+		if (i == number_of_stations && number_of_stations < STATS_MAX_STATIONS) {
+			strlcpy(station_counts[i].callsign, callsign, MAX_CALLSIGN_LEN);
+			number_of_stations++;
+		}
+		if (i < number_of_stations)
+			stats_add(&station_counts[i].count, bytes);
+		else
+			stats_add(&other_stations_count, bytes);
+	}
+
+	if (file_id != 0) {
+		int i;
+		for (i=0; i < number_of_files; i++)
+			if (file_counts[i].file_id == file_id)
+				break;
+		if (i == number_of_files && number_of_files < STATS_MAX_FILES) {
+			file_counts[i].file_id = file_id;
+			number_of_files++;
+		}
+		if (i < number_of_files)
+			stats_add(&file_counts[i].count, bytes);
+		else
+			stats_add(&other_files_count, bytes);
+	}
+	stats_unlock();
+}
+
+/**
+ * stats_rx_frame()
+ *
+ * Called when a frame is received from a ground station.  This starts a pass if one is not
+ * in progress and keeps the pass open.
+ */
+void stats_rx_frame(time_t now) {
+	stats_lock();
+	if (pass_start_time == 0) {
+		stats_reset();
+		pass_start_time = now;
+		last_bstat_time = now;
+		debug_print("STATS: Pass started\n");
+	}
+	last_rx_time = now;
+	stats_unlock();
+}
+
+/**
+ * stats_airtime_ms()
+ *
+ * Estimate the time in milliseconds to transmit this many bytes at the TNC bit rate.
+ */
+uint32_t stats_airtime_ms(uint32_t bytes) {
+	if (g_bit_rate <= 0) return 0;
+	return (uint32_t)(((uint64_t)bytes * 8 * 1000) / g_bit_rate);
+}
+
+/**
+ * stats_next_action()
+ *
+ * Called from the PB each time round the main loop.  Send the BSTAT when it is due and end
+ * the pass when we have not heard a station for a while.
+ */
+void stats_next_action(time_t now) {
+	stats_lock();
+	if (pass_start_time == 0) {
+		stats_unlock();
+		return;
+	}
+
+	if ((now - last_rx_time) > g_stats_pass_idle_period_in_seconds) {
+		stats_end_pass(now);
+		stats_unlock();
+		return;
+	}
+
+	if ((now - last_bstat_time) > g_pb_bstat_period_in_seconds) {
+		last_bstat_time = now;
+		if (total_count.bytes != bytes_at_last_bstat) {
+			if (stats_send_bstat(now) != EXIT_SUCCESS)
+				error_print("Could not send BSTAT to TNC \n");
+		}
+	}
+	stats_unlock();
+}
+
+/**
+ * stats_make_bstat_str()
+ *
+ * Build the text of the BSTAT frame.  This gives the length of the pass so far, the
+ * frames, bytes and estimated airtime sent, and the bytes sent for each kind of traffic.
+ */
+void stats_make_bstat_str(char *buffer, int len, time_t now) {
+	stats_lock();
+	long pass_seconds = (pass_start_time == 0) ? 0 : (long)(now - pass_start_time);
+	snprintf(buffer, len, "Pass:%lds Frames:%u Bytes:%u Air:%ums DIR:%u FILE:%u PB:%u FTL0:%u",
+			pass_seconds, total_count.frames, total_count.bytes, stats_airtime_ms(total_count.bytes),
+			type_counts[STATS_TYPE_DIR].bytes, type_counts[STATS_TYPE_FILE].bytes,
+			type_counts[STATS_TYPE_PB_STATUS].bytes, type_counts[STATS_TYPE_FTL0].bytes);
+	stats_unlock();
+}
+
+/**
+ * stats_send_bstat()
+ *
+ * Transmit the BSTAT frame from the broadcast callsign on each port.  The totals are for all
+ * of the ports.
+ *
+ * Returns EXIT_SUCCESS unless it was unable to send the frame to the TNC
+ *
+ */
+int stats_send_bstat(time_t now) {
+	char buffer[AX25_MAX_DATA_LEN];
+	stats_make_bstat_str(buffer, sizeof(buffer), now);
+	int rc = EXIT_SUCCESS;
+	int len = strlen(buffer);
+	int sent = g_run_self_test ? 1 : 0;
+	if (!g_run_self_test)
+		for (int port=0; port < g_number_of_ports; port++) {
+			if (tx_queue_raw_packet(port, TX_CLASS_BULK, g_broadcast_callsign, BSTAT, PID_NO_PROTOCOL, (unsigned char *)buffer, len) == EXIT_SUCCESS)
+				sent++;
+			else
+				rc = EXIT_FAILURE;
+		}
+	stats_lock();
+	for (int i=0; i < sent; i++)
+		stats_tx_frame(STATS_TYPE_BSTAT, PID_NO_PROTOCOL, NULL, 0, len);
+	bytes_at_last_bstat = total_count.bytes;
+	stats_unlock();
+	return rc;
+}
+
+/**
+ * stats_end_pass()
+ *
+ * The pass is over.  Append the totals to the stats file.  Each pass writes a PASS record
+ * followed by TYPE, PID, STATION and FILE records.  All of the records start with the
+ * record name and the start time of the pass so they can be grouped together.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the file could not be written
+ *
+ */
+int stats_end_pass(time_t now) {
+	stats_lock();
+	if (pass_start_time == 0) {
+		stats_unlock();
+		return EXIT_SUCCESS;
+	}
+	long start = (long)pass_start_time;
+	pass_start_time = 0;
+	debug_print("STATS: Pass ended after %lds with %u frames and %u bytes\n", (long)(now - start),
+			total_count.frames, total_count.bytes);
+
+	FILE *f = fopen(g_stats_file_path, "a");
+	if (f == NULL) {
+		error_print("Could not open stats file %s\n", g_stats_file_path);
+		stats_unlock();
+		return EXIT_FAILURE;
+	}
+	fprintf(f, "PASS,%ld,%ld,%ld,%u,%u,%u\n", start, (long)now, (long)(now - start),
+			total_count.frames, total_count.bytes, stats_airtime_ms(total_count.bytes));
+	for (int i=0; i < STATS_NUMBER_OF_TYPES; i++)
+		fprintf(f, "TYPE,%ld,%s,%u,%u\n", start, type_names[i], type_counts[i].frames, type_counts[i].bytes);
+	for (int i=0; i < 256; i++)
+		if (pid_counts[i].frames > 0)
+			fprintf(f, "PID,%ld,%02x,%u,%u\n", start, i, pid_counts[i].frames, pid_counts[i].bytes);
+	for (int i=0; i < number_of_stations; i++)
+		fprintf(f, "STATION,%ld,%s,%u,%u\n", start, station_counts[i].callsign,
+				station_counts[i].count.frames, station_counts[i].count.bytes);
+	if (other_stations_count.frames > 0)
+		fprintf(f, "STATION,%ld,OTHER,%u,%u\n", start, other_stations_count.frames, other_stations_count.bytes);
+	for (int i=0; i < number_of_files; i++)
+		fprintf(f, "FILE,%ld,%04x,%u,%u\n", start, file_counts[i].file_id,
+				file_counts[i].count.frames, file_counts[i].count.bytes);
+	if (other_files_count.frames > 0)
+		fprintf(f, "FILE,%ld,OTHER,%u,%u\n", start, other_files_count.frames, other_files_count.bytes);
+	int rc = (fclose(f) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+	stats_unlock();
+	return rc;
+}
+
+STATS_COUNT stats_get_type_count(int type) {
+	STATS_COUNT count = {0, 0};
+	if (type < 0 || type >= STATS_NUMBER_OF_TYPES) return count;
+	stats_lock();
+	count = type_counts[type];
+	stats_unlock();
+	return count;
+}
+
+STATS_COUNT stats_get_station_count(char *callsign) {
+	STATS_COUNT count = {0, 0};
+	stats_lock();
+	for (int i=0; i < number_of_stations; i++)
+		if (strncmp(station_counts[i].callsign, callsign, MAX_CALLSIGN_LEN) == 0)
+			count = station_counts[i].count;
+	stats_unlock();
+	return count;
+}
+
+STATS_COUNT stats_get_file_count(uint32_t file_id) {
+	STATS_COUNT count = {0, 0};
+	stats_lock();
+	for (int i=0; i < number_of_files; i++)
+		if (file_counts[i].file_id == file_id)
+			count = file_counts[i].count;
+	stats_unlock();
+	return count;
+}
+
+/**
+ * stats_get_pass_start()
+ *
+ * Returns the time the current pass started or 0 if there is no pass in progress
+ */
+time_t stats_get_pass_start() {
+	stats_lock();
+	time_t start = pass_start_time;
+	stats_unlock();
+	return start;
+}
+
+/*********************************************************************************************
+ *
+ * SELF TESTS FOLLOW
+ *
+ */
+int test_stats() {
+	printf("##### TEST STATS:\n");
+	int rc = EXIT_SUCCESS;
+	time_t now = 1000;
+
+	stats_end_pass(now); // Close any pass that is open
+	stats_rx_frame(now);
+	stats_tx_frame(STATS_TYPE_DIR, PID_DIRECTORY, "AC2CZ", 1, 100);
+	stats_tx_frame(STATS_TYPE_FILE, PID_FILE, "AC2CZ", 2, 200);
+	stats_tx_frame(STATS_TYPE_FILE, PID_FILE, "G0KLA", 2, 200);
+	stats_tx_frame(STATS_TYPE_PB_STATUS, PID_NO_PROTOCOL, NULL, 0, 50);
+
+	STATS_COUNT c = stats_get_type_count(STATS_TYPE_FILE);
+	if (c.frames != 2 || c.bytes != 2 * (200 + PB_AX25_HEADER_BYTES)) { printf("** Wrong FILE count\n"); rc = EXIT_FAILURE; }
+	c = stats_get_station_count("AC2CZ");
+	if (c.frames != 2 || c.bytes != 300 + 2 * PB_AX25_HEADER_BYTES) { printf("** Wrong station count\n"); rc = EXIT_FAILURE; }
+	c = stats_get_file_count(2);
+	if (c.frames != 2) { printf("** Wrong file count\n"); rc = EXIT_FAILURE; }
+	if (total_count.frames != 4) { printf("** Wrong total frames\n"); rc = EXIT_FAILURE; }
+
+	int saved_rate = g_bit_rate;
+	g_bit_rate = 1200;
+	if (stats_airtime_ms(150) != 1000) { printf("** Wrong airtime %d\n", stats_airtime_ms(150)); rc = EXIT_FAILURE; }
+	g_bit_rate = saved_rate;
+
+	char buffer[AX25_MAX_DATA_LEN];
+	stats_make_bstat_str(buffer, sizeof(buffer), now + 10);
+	debug_print("BSTAT: %s\n", buffer);
+	if (strncmp(buffer, "Pass:10s Frames:4 ", 18) != 0) { printf("** Wrong BSTAT string\n"); rc = EXIT_FAILURE; }
+
+	/* Still in the pass when we are idle for less than the period */
+	stats_next_action(now + g_stats_pass_idle_period_in_seconds);
+	if (pass_start_time == 0) { printf("** Pass ended too soon\n"); rc = EXIT_FAILURE; }
+
+	char saved_path[MAX_FILE_PATH_LEN];
+	strlcpy(saved_path, g_stats_file_path, sizeof(saved_path));
+	mkdir("/tmp/pacsat",0777);
+	strlcpy(g_stats_file_path, "/tmp/pacsat/test_stats.csv", sizeof(g_stats_file_path));
+	remove(g_stats_file_path);
+	stats_next_action(now + g_stats_pass_idle_period_in_seconds + 1);
+	if (pass_start_time != 0) { printf("** Pass did not end\n"); rc = EXIT_FAILURE; }
+	FILE *f = fopen(g_stats_file_path, "r");
+	if (f == NULL) { printf("** Stats file not written\n"); rc = EXIT_FAILURE; }
+	else {
+		char line[MAX_CONFIG_LINE_LENGTH];
+		if (fgets(line, sizeof(line), f) == NULL || strncmp(line, "PASS,1000,", 10) != 0) {
+			printf("** Wrong PASS record in stats file\n"); rc = EXIT_FAILURE; }
+		fclose(f);
+	}
+	strlcpy(g_stats_file_path, saved_path, sizeof(g_stats_file_path));
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST STATS: success\n");
+	else
+		printf("##### TEST STATS: fail\n");
+	return rc;
+}
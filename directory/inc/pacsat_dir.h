@@ -23,24 +23,54 @@
 #ifndef PACSAT_DIR_H_
 #define PACSAT_DIR_H_
 
+#include <stdatomic.h>
 #include "pacsat_header.h"
 #include "pacsat_broadcast.h"
 
+#define DIR_MAX_READERS 8 /* Threads that can read the directory with dir_epoch_enter() */
+
 /*
  * We implement the directory as a doubly linked list.  Most operations involve traversing the list
  * in order to retrieve dir fills. When we add items they are near the end of the list (updated
  * files), so we search backwards to find the insertion point.
  *
  * Each dir_node stores the full packsat header together with the list pointers
+ *
+ * The PB caches the DIR broadcast frames for a node in bd_frames.  The frames depend on the
+ * neighbors of the node, so bd_gen is incremented whenever the neighbors change and the PB
+ * builds the frames again if they were made for an older bd_gen.
+ *
+ * A node that is removed from the list is not freed straight away, because a reader may still
+ * be looking at it.  It is freed once every reader has left the epoch it was removed in and
+ * nothing holds a reference to it.
  */
 struct dir_node {
 	HEADER * pfh;
 	struct dir_node *next;
 	struct dir_node *prev;
+	unsigned char *bd_frames; /* Cached DIR broadcast frames for this PFH or NULL if not built.  Owned by the PB */
+	int bd_frames_num; /* The number of frames in bd_frames */
+	unsigned int bd_frames_gen; /* The bd_gen that bd_frames was built for */
+	atomic_uint bd_gen; /* Incremented when the neighbors change */
+	atomic_int refs; /* References held with dir_node_hold() */
+	atomic_int removed; /* True once the node is no longer in the list */
+	unsigned int retire_epoch; /* The epoch the node was removed in */
+	struct dir_node *retired_next; /* The list of removed nodes waiting to be freed */
 };
 typedef struct dir_node DIR_NODE;
 
+/* Readers follow the list pointers with these so they see a node only after it is complete */
+static inline DIR_NODE *dir_next_node(DIR_NODE *p) { return __atomic_load_n(&p->next, __ATOMIC_ACQUIRE); }
+static inline DIR_NODE *dir_prev_node(DIR_NODE *p) { return __atomic_load_n(&p->prev, __ATOMIC_ACQUIRE); }
+
 int dir_init(char *folder);
+void dir_epoch_enter();
+void dir_epoch_exit();
+void dir_write_lock();
+void dir_write_unlock();
+void dir_node_hold(DIR_NODE *node);
+void dir_node_release(DIR_NODE *node);
+int dir_node_removed(DIR_NODE *node);
 char *get_data_folder();
 char *get_dir_folder();
 char *get_upload_folder();
@@ -57,7 +87,9 @@ int dir_load();
 int dir_validate_file(HEADER *pfh, char *filename);
 void dir_free();
 DIR_NODE * dir_add_pfh(HEADER * new_pfh, char *filename);
+void dir_invalidate_broadcast_frames(DIR_NODE *node);
 DIR_NODE * dir_get_pfh_by_date(DIR_DATE_PAIR pair, DIR_NODE *p);
+int dir_get_time_range(uint32_t *oldest, uint32_t *newest);
 DIR_NODE * dir_get_pfh_by_folder_id(char *folder, DIR_NODE *p);
 DIR_NODE * dir_get_node_by_id(int file_id);
 void dir_maintenance();
@@ -65,6 +97,7 @@ void dir_file_queue_check(time_t now, char * folder, uint8_t file_type, char * d
 
 int test_pacsat_dir();
 int test_pacsat_dir_one();
+int test_dir_epoch();
 int make_big_test_dir();
 
 #endif /* PACSAT_DIR_H_ */
@@ -40,6 +40,23 @@
  * The creation of the packets that are sent to the ground is handled by the pacsat
  * broadcast (pb) module.
  *
+ * The PB reads the directory while FTL0 adds uploaded files and the directory thread
+ * adds queued files and purges old ones.  Only one thread changes the list at a time.
+ * Anything that adds to, removes from or reloads the list must hold the write lock.
+ * dir_maintenance(), dir_file_queue_check() and dir_next_file_number() take it themselves.
+ *
+ * Readers do not take a lock.  They call dir_epoch_enter() before they look at the list
+ * and dir_epoch_exit() when they are done.  A writer links a new node in only after it is
+ * complete and a removed node keeps its next pointer, so a reader that is part way along
+ * the list when it changes still reaches the end.  Removed nodes are put on a retired list.
+ * Each time the write lock is released the global epoch moves on if every reader has seen
+ * the current one, and a retired node is freed once the epoch is two past the one it was
+ * removed in.  No reader can still be looking at it by then.
+ *
+ * A reader that keeps a node after it calls dir_epoch_exit(), like a request on the PB,
+ * must hold it with dir_node_hold().  The node is not freed while it is held, but it may be
+ * removed from the list, so check dir_node_removed() before following its pointers.
+ *
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -51,6 +68,7 @@
 #include <unistd.h>
 #include <dirent.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include <fcntl.h>
 #include <errno.h>
@@ -63,6 +81,7 @@
 #include "pacsat_dir.h"
 #include "pacsat_header.h"
 #include "pacsat_broadcast.h"
+#include "pacsat_readahead.h"
 #include "ftl0.h"
 #include "str_util.h"
 #include "debug.h"
@@ -89,7 +108,156 @@ static char upload_folder[MAX_FILE_PATH_LEN]; // Directory path of the upload fo
 static char txt_folder[MAX_FILE_PATH_LEN]; // Directory path of the txt folder
 //static uint32_t next_file_id = 0; // This is incremented when we add files for upload.  Initialized when dir loaded.
 unsigned char pfh_byte_buffer[MAX_PFH_LENGTH]; // needs to be bigger than largest header but does not need to be the whole file
+static pthread_mutex_t dir_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint dir_epoch = 1; // The global epoch.  Never 0, which marks a free reader slot
+static atomic_uint dir_reader_epochs[DIR_MAX_READERS]; // The epoch each reader entered in, or 0
+static __thread int dir_reader_slot = -1; // This thread's slot in dir_reader_epochs
+static __thread int dir_reader_depth = 0; // dir_epoch_enter() calls that have not exited
+static DIR_NODE *dir_retired = NULL; // Removed nodes that are waiting to be freed.  Only changed with the write lock held
 
+static void dir_reclaim();
+
+/**
+ * dir_epoch_enter()
+ *
+ * Call before reading the directory list or the nodes in it.  Nodes seen after this are not
+ * freed until dir_epoch_exit() is called.  Calls can be nested and a thread that is inside
+ * an epoch can also take the write lock.
+ */
+void dir_epoch_enter() {
+	if (dir_reader_depth++ > 0) return;
+	unsigned int epoch = atomic_load(&dir_epoch);
+	while (dir_reader_slot < 0) {
+		for (int i=0; i < DIR_MAX_READERS; i++) {
+			unsigned int free_slot = 0;
+			if (atomic_compare_exchange_strong(&dir_reader_epochs[i], &free_slot, epoch)) {
+				dir_reader_slot = i;
+				break;
+			}
+		}
+		if (dir_reader_slot < 0) {
+			/* Wait for a reader to exit.  This should not happen unless DIR_MAX_READERS is too small */
+			error_print("** More than %d threads are reading the directory\n", DIR_MAX_READERS);
+			usleep(1000);
+		}
+	}
+	/* A writer may have moved the epoch on before it saw our slot.  Then we must be in the new one */
+	unsigned int now;
+	while ((now = atomic_load(&dir_epoch)) != epoch) {
+		epoch = now;
+		atomic_store(&dir_reader_epochs[dir_reader_slot], epoch);
+	}
+}
+
+/**
+ * dir_epoch_exit()
+ *
+ * Call when finished reading the directory.  Pointers to nodes must not be used after this
+ * unless the node is held with dir_node_hold().
+ */
+void dir_epoch_exit() {
+	if (dir_reader_depth <= 0) return;
+	if (--dir_reader_depth > 0) return;
+	atomic_store(&dir_reader_epochs[dir_reader_slot], 0);
+	dir_reader_slot = -1;
+}
+
+/**
+ * dir_write_lock()
+ *
+ * Hold this while changing the directory list.  It waits until no other thread is changing
+ * it but does not wait for readers.  Call dir_write_unlock() when done.  It is not recursive.
+ */
+void dir_write_lock() {
+	pthread_mutex_lock(&dir_write_mutex);
+}
+
+/**
+ * dir_write_unlock()
+ *
+ * Release the write lock.  Removed nodes that no reader can still see are freed first.
+ */
+void dir_write_unlock() {
+	dir_reclaim();
+	pthread_mutex_unlock(&dir_write_mutex);
+}
+
+/**
+ * dir_node_hold()
+ *
+ * Keep a node after dir_epoch_exit().  The node is not freed until dir_node_release() is
+ * called.  node may be NULL.
+ */
+void dir_node_hold(DIR_NODE *node) {
+	if (node != NULL)
+		atomic_fetch_add(&node->refs, 1);
+}
+
+void dir_node_release(DIR_NODE *node) {
+	if (node != NULL)
+		atomic_fetch_sub(&node->refs, 1);
+}
+
+/**
+ * dir_node_removed()
+ *
+ * Returns true if the node is no longer in the directory list
+ */
+int dir_node_removed(DIR_NODE *node) {
+	return atomic_load(&node->removed);
+}
+
+/**
+ * dir_retire_node()
+ *
+ * Put a node that was removed from the list on the retired list.  Call with the write lock held.
+ */
+static void dir_retire_node(DIR_NODE *node) {
+	atomic_store(&node->removed, true);
+	node->retire_epoch = atomic_load(&dir_epoch);
+	node->retired_next = dir_retired;
+	dir_retired = node;
+}
+
+static void dir_free_node(DIR_NODE *node) {
+	if (node->bd_frames != NULL)
+		free(node->bd_frames);
+	free(node->pfh);
+	free(node);
+}
+
+/**
+ * dir_reclaim()
+ *
+ * Move the epoch on if every reader is in the current one, at most twice, then free the retired
+ * nodes that were removed two or more epochs ago and are not held.  Call with the write lock held.
+ */
+static void dir_reclaim() {
+	if (dir_retired == NULL) return;
+	unsigned int epoch = atomic_load(&dir_epoch);
+	for (int n=0; n < 2; n++) {
+		int all_current = true;
+		for (int i=0; i < DIR_MAX_READERS; i++) {
+			unsigned int reader_epoch = atomic_load(&dir_reader_epochs[i]);
+			if (reader_epoch != 0 && reader_epoch != epoch)
+				all_current = false;
+		}
+		if (!all_current) break;
+		epoch++;
+		if (epoch == 0) epoch = 1;
+		atomic_store(&dir_epoch, epoch);
+	}
+	DIR_NODE **pp = &dir_retired;
+	while (*pp != NULL) {
+		DIR_NODE *node = *pp;
+		if (epoch - node->retire_epoch >= 2 && atomic_load(&node->refs) == 0) {
+			*pp = node->retired_next;
+			dir_free_node(node);
+		} else {
+			pp = &node->retired_next;
+		}
+	}
+}
 
 int dir_make_dir(char * folder) {
 	struct stat st = {0};
@@ -207,9 +375,11 @@ uint32_t dir_get_file_id_from_filename(char *file_name) {
  *
  */
 int dir_next_file_number() {
-	g_dir_next_file_number++;
+	dir_write_lock();
+	int id = ++g_dir_next_file_number;
 	save_state();
-	return g_dir_next_file_number;
+	dir_write_unlock();
+	return id;
 }
 
 /**
@@ -251,6 +421,16 @@ char *get_txt_folder() {
 	return txt_folder; // We can return this because it is static
 }
 
+/**
+ * dir_publish()
+ *
+ * Store a list pointer so that a reader that loads it with dir_next_node() or
+ * dir_prev_node() also sees everything written to the node before it.
+ */
+static inline void dir_publish(DIR_NODE **link, DIR_NODE *node) {
+	__atomic_store_n(link, node, __ATOMIC_RELEASE);
+}
+
 /**
  * insert_after()
  * Insert new_node after node p in the linked list.
@@ -260,13 +440,30 @@ char *get_txt_folder() {
  */
 void insert_after(DIR_NODE *p, DIR_NODE *new_node) {
 	assert(p != NULL);
-	new_node->next = p->next; // which may be null if at end of list
+	DIR_NODE *next = p->next; // which may be null if at end of list
+	new_node->next = next;
 	new_node->prev = p;
-	if (p->next == NULL) // we are at the end of the list
-		dir_tail = new_node;
+	dir_publish(&p->next, new_node);
+	if (next == NULL) // we are at the end of the list
+		dir_publish(&dir_tail, new_node);
 	else
-		p->next->prev = new_node;
-	p->next = new_node;
+		dir_publish(&next->prev, new_node);
+}
+
+/**
+ * insert_at_head()
+ * Insert new_node at the head of the list, which may be empty
+ *
+ */
+static void insert_at_head(DIR_NODE *new_node) {
+	DIR_NODE *next = dir_head;
+	new_node->next = next;
+	new_node->prev = NULL;
+	dir_publish(&dir_head, new_node);
+	if (next == NULL)
+		dir_publish(&dir_tail, new_node);
+	else
+		dir_publish(&next->prev, new_node);
 }
 
 /**
@@ -284,7 +481,8 @@ void insert_after(DIR_NODE *p, DIR_NODE *new_node) {
  * is discarded.
  * To update an item correctly, remove it from the list, set the upload_time to zero and then call this routine to insert it at the end.
  *
- * If the upload_time was modified then the pacsat file header is resaved to disk
+ * If the upload_time was modified then the pacsat file header is resaved to disk before
+ * the node is linked into the list, so readers never see a node that could not be saved.
  *
  * New files have their expiry time set to zero.  This means that expiry is based on the upload time.
  * We use this system so it is possible to change the expiry time for all files at once.  i.e. if we
@@ -296,34 +494,47 @@ void insert_after(DIR_NODE *p, DIR_NODE *new_node) {
  *
  */
 DIR_NODE * dir_add_pfh(HEADER *new_pfh, char *filename) {
-	int resave = false;
 	DIR_NODE *new_node = (DIR_NODE *)malloc(sizeof(DIR_NODE));
+	if (new_node == NULL) return NULL; // ERROR
 	new_node->pfh = new_pfh;
+	new_node->next = NULL;
+	new_node->prev = NULL;
+	new_node->bd_frames = NULL;
+	new_node->bd_frames_num = 0;
+	new_node->bd_frames_gen = 0;
+	atomic_init(&new_node->bd_gen, 0);
+	atomic_init(&new_node->refs, 0);
+	atomic_init(&new_node->removed, false);
+	new_node->retire_epoch = 0;
+	new_node->retired_next = NULL;
 	time_t now = time(0); // Get the system time in seconds since the epoch
-	if (new_node == NULL) return NULL; // ERROR
-	if (dir_head == NULL) { // This is a new list
-		dir_head = new_node;
-		dir_tail = new_node;
-		if (new_pfh->uploadTime == 0) {
-			new_pfh->uploadTime = now;
-			//debug_print("Resave new PFH at head of list\n");
-			new_pfh->expireTime = 0; /* This means use the upload time to calculate expiry */
-			resave = true;
-		}
-		new_node->next = NULL;
-		new_node->prev = NULL;
-	} else if (new_pfh->uploadTime == 0){
+	if (new_pfh->uploadTime == 0){
 		/* Insert this at the end of the list as the newest item.  Make sure it has a unique upload time */
-		if (dir_tail->pfh->uploadTime >= now) {
+		if (dir_tail != NULL && dir_tail->pfh->uploadTime >= now) {
 			/* We have added more than one file within 1 second.  Add this at the next available second. */
 			new_pfh->uploadTime = dir_tail->pfh->uploadTime+1;
 		} else {
 			new_pfh->uploadTime = now;
 		}
 		new_pfh->expireTime = 0; /* This means use the upload time to calculate expiry */
-		insert_after(dir_tail, new_node);
-		//debug_print("Resave new PFH with upload time 0\n");
-		resave = true;
+
+		// Now re-save the file with the new time, this recalculates the checksums
+		char file_name_with_path[MAX_FILE_PATH_LEN];
+		dir_get_file_path_from_file_id(new_pfh->fileId, get_dir_folder(), file_name_with_path, MAX_FILE_PATH_LEN);
+		int rc = dir_fs_update_header(file_name_with_path, new_pfh);
+		if (rc != EXIT_SUCCESS) {
+			// we could not save this
+			error_print("** Could not update the header for %s to dir\n",filename);
+			free(new_node);
+			return NULL;
+		}
+		ra_invalidate(new_pfh->fileId); /* The PFH bytes on disk changed */
+		if (dir_tail == NULL)
+			insert_at_head(new_node);
+		else
+			insert_after(dir_tail, new_node);
+	} else if (dir_head == NULL) { // This is a new list
+		insert_at_head(new_node);
 	} else {
 		/* Insert this at the right point, searching from the back*/
 		DIR_NODE *p = dir_tail;
@@ -337,75 +548,73 @@ DIR_NODE * dir_add_pfh(HEADER *new_pfh, char *filename) {
 				insert_after(p, new_node);
 				break;
 			} else if (p == dir_head) {
-				// Insert at the head of the list
-				new_node->next = p;
-				p->prev = new_node;
-				new_node->prev = NULL;
-				dir_head = new_node;
+				insert_at_head(new_node);
 				break;
 			}
 			p = p->prev;
 		}
 	}
-	// Now re-save the file with the new time if it changed, this recalculates the checksums
-	if (resave) {
-    	char file_name_with_path[MAX_FILE_PATH_LEN];
-    	dir_get_file_path_from_file_id(new_node->pfh->fileId, get_dir_folder(), file_name_with_path, MAX_FILE_PATH_LEN);
-
-		int rc = dir_fs_update_header(file_name_with_path, new_node->pfh);
-
-		if (rc != EXIT_SUCCESS) {
-			// we could not save this
-			error_print("** Could not update the header for %s to dir\n",filename);
-			dir_delete_node(new_node);
-			return NULL;
-		} else {
-			//debug_print("Saved:");
-			//pfh_debug_print(new_node->pfh);
-		}
-	}
+	/* The neighbors now have a different t_old or t_new and the previous tail loses its N bit */
+	dir_invalidate_broadcast_frames(new_node->prev);
+	dir_invalidate_broadcast_frames(new_node->next);
 	return new_node;
 }
 
+/**
+ * dir_invalidate_broadcast_frames()
+ *
+ * Mark the DIR broadcast frames that the PB cached for this node as out of date.  The
+ * PB builds them again the next time they are needed.  Call this after the neighbors of
+ * the node change or when its PFH is rewritten.  node may be NULL.
+ *
+ */
+void dir_invalidate_broadcast_frames(DIR_NODE *node) {
+	if (node == NULL) return;
+	atomic_fetch_add(&node->bd_gen, 1);
+}
+
 /**
  * dir_delete_node()
  *
- * Remove an entry from the dir linked list and free the memory held by the node
- * and the pacsat file header.
+ * Remove an entry from the dir linked list.  The node and the pacsat file header are
+ * freed once no reader can still be using them.  The node keeps its own next and prev
+ * pointers so that a reader that is on it can carry on along the list.
  *
- * The files on disk are not removed.
+ * The files on disk are not removed, but the chunks that were read ahead for the PB are.
  *
  */
 void dir_delete_node(DIR_NODE *node) {
 	if (node == NULL) return;
 	if (node->prev == NULL && node->next == NULL) {
 		// special case of only one item
-		dir_head = NULL;
-		dir_tail = NULL;
+		dir_publish(&dir_head, NULL);
+		dir_publish(&dir_tail, NULL);
 	} else if (node->prev == NULL) {
 		// special case removing the head of the list
-		dir_head = node->next;
-		node->next->prev = NULL;
+		dir_publish(&dir_head, node->next);
+		dir_publish(&node->next->prev, NULL);
 	} else if (node->next == NULL) {
 		// special case removing the tail of the list
-		dir_tail = node->prev;
-		node->prev->next = NULL;
+		dir_publish(&dir_tail, node->prev);
+		dir_publish(&node->prev->next, NULL);
 
 	} else {
-		node->next->prev = node->prev;
-		node->prev->next = node->next;
+		dir_publish(&node->next->prev, node->prev);
+		dir_publish(&node->prev->next, node->next);
 	}
+	dir_invalidate_broadcast_frames(node->prev);
+	dir_invalidate_broadcast_frames(node->next);
+	ra_invalidate(node->pfh->fileId);
 	//debug_print("REMOVED: ");
 	pfh_debug_print(node->pfh);
-	free(node->pfh);
-	free(node);
+	dir_retire_node(node);
 }
 
 /**
  * dir_free()
  *
- * Remove all entries from the dir linked list and free all the
- * memory held by the list and the pacsat file headers.
+ * Remove all entries from the dir linked list.  The memory held by the list and the pacsat
+ * file headers is freed once no reader can still be using it.
  */
 void dir_free() {
 	DIR_NODE *p = dir_head;
@@ -596,11 +805,11 @@ DIR_NODE * dir_get_pfh_by_date(DIR_DATE_PAIR pair, DIR_NODE *p ) {
 	if (p == NULL) {
 		/* Then we are starting the search from the head.  TODO - could later optimize if search from head or tail */
 		search_from_head = true;
-		p = dir_head;
+		p = __atomic_load_n(&dir_head, __ATOMIC_ACQUIRE);
 	}
 	while (p != NULL) {
 		DIR_NODE *node = p;
-		p = p->next;
+		p = dir_next_node(p);
 		if (node->pfh->uploadTime >= pair.start && node->pfh->uploadTime <= pair.end)
 			return node;
 		if (search_from_head) {
@@ -619,6 +828,23 @@ DIR_NODE * dir_get_pfh_by_date(DIR_DATE_PAIR pair, DIR_NODE *p ) {
 	return NULL;
 }
 
+/**
+ * dir_get_time_range()
+ *
+ * Return the upload times of the oldest and newest files in the directory.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the directory is empty
+ *
+ */
+int dir_get_time_range(uint32_t *oldest, uint32_t *newest) {
+	DIR_NODE *head = __atomic_load_n(&dir_head, __ATOMIC_ACQUIRE);
+	DIR_NODE *tail = __atomic_load_n(&dir_tail, __ATOMIC_ACQUIRE);
+	if (head == NULL || tail == NULL) return EXIT_FAILURE;
+	*oldest = head->pfh->uploadTime;
+	*newest = tail->pfh->uploadTime;
+	return EXIT_SUCCESS;
+}
+
 /**
  * Given a folder return the first pfh after this node
  *
@@ -627,11 +853,11 @@ DIR_NODE * dir_get_pfh_by_folder_id(char *folder, DIR_NODE *p ) {
 
 	if (p == NULL) {
 		/* Then we are starting the search from the head.  TODO - could later optimize if search from head or tail */
-		p = dir_head;
+		p = __atomic_load_n(&dir_head, __ATOMIC_ACQUIRE);
 	}
 	while (p != NULL) {
 		DIR_NODE *node = p;
-		p = p->next;
+		p = dir_next_node(p);
 		if (pfh_contains_keyword(node->pfh, folder))
 			return node;
 	}
@@ -647,11 +873,11 @@ DIR_NODE * dir_get_pfh_by_folder_id(char *folder, DIR_NODE *p ) {
  *
  */
 DIR_NODE * dir_get_node_by_id(int file_id) {
-	DIR_NODE *p = dir_head;
+	DIR_NODE *p = __atomic_load_n(&dir_head, __ATOMIC_ACQUIRE);
 	while (p != NULL) {
 		if (p->pfh->fileId == file_id)
 			return p;
-		p = p->next;
+		p = dir_next_node(p);
 	}
 	return NULL;
 }
@@ -719,10 +945,19 @@ int cp(const char *from, const char *to)
     return -1;
 }
 
+static void dir_maintenance_locked(time_t now);
+
 /**
  * Perform maintenance on the next node in the directory
  */
 void dir_maintenance(time_t now) {
+	dir_write_lock();
+	dir_maintenance_locked(now);
+	dir_write_unlock();
+}
+
+/* Call with the write lock held */
+static void dir_maintenance_locked(time_t now) {
 	if (dir_head == NULL) return;
 
 	if (dir_maint_node == NULL)
@@ -734,7 +969,7 @@ void dir_maintenance(time_t now) {
 		return;
 	}
 
-	if (pb_is_file_in_use(dir_maint_node->pfh->fileId)) {
+	if (atomic_load(&dir_maint_node->refs) > 0) {
 		// This file is currently being broadcast then skip it until next time
 		dir_maint_node = dir_maint_node->next;
 		return;
@@ -848,7 +1083,9 @@ void dir_file_queue_check(time_t now, char * folder, uint8_t file_type, char * d
 				continue;
 			}
 
+			dir_write_lock();
 			rc = dir_load_pacsat_file(psf_name);
+			dir_write_unlock();
 			if (rc != EXIT_SUCCESS) {
 				debug_print("May need to remove potentially corrupt file from queue: %s\n", file_name);
 				continue;
@@ -1202,3 +1439,117 @@ int test_pacsat_dir() {
 		printf("##### TEST PACSAT DIR: fail\n");
 	return rc;
 }
+
+static int dir_test_retired_count() {
+	int c = 0;
+	for (DIR_NODE *p = dir_retired; p != NULL; p = p->retired_next)
+		c++;
+	return c;
+}
+
+/* Add a node that is only in memory.  The upload time is set so nothing is saved to disk */
+static DIR_NODE *dir_test_add(uint32_t file_id) {
+	HEADER *pfh = (HEADER *)calloc(1, sizeof(HEADER));
+	if (pfh == NULL) return NULL;
+	pfh->fileId = file_id;
+	pfh->uploadTime = file_id * 10;
+	DIR_NODE *node = dir_add_pfh(pfh, "test");
+	if (node == NULL) free(pfh);
+	return node;
+}
+
+#define DIR_TEST_EPOCH_LOOPS 5000
+static atomic_int dir_test_stop;
+static atomic_int dir_test_errors;
+
+/* Walk the list again and again while the main thread changes it */
+static void *dir_test_reader(void *arg) {
+	while (!atomic_load(&dir_test_stop)) {
+		dir_epoch_enter();
+		uint32_t last = 0;
+		DIR_NODE *p = __atomic_load_n(&dir_head, __ATOMIC_ACQUIRE);
+		while (p != NULL) {
+			if (p->pfh->uploadTime != p->pfh->fileId * 10 || p->pfh->uploadTime <= last)
+				atomic_fetch_add(&dir_test_errors, 1);
+			last = p->pfh->uploadTime;
+			p = dir_next_node(p);
+		}
+		dir_epoch_exit();
+	}
+	return NULL;
+}
+
+int test_dir_epoch() {
+	printf("##### TEST DIR EPOCH:\n");
+	int rc = EXIT_SUCCESS;
+	dir_write_lock();
+	dir_free();
+	dir_write_unlock();
+	int retired = dir_test_retired_count();
+
+	DIR_NODE *a = dir_test_add(1);
+	DIR_NODE *b = dir_test_add(2);
+	DIR_NODE *c = dir_test_add(3);
+	if (a == NULL || b == NULL || c == NULL) { printf("** Could not add test nodes\n"); return EXIT_FAILURE; }
+
+	/* A reader is on b when it is removed.  It can still follow b to c and b is not freed */
+	dir_epoch_enter();
+	DIR_NODE *node = dir_get_node_by_id(2);
+	dir_write_lock();
+	dir_delete_node(b);
+	dir_write_unlock();
+	if (a->next != c || c->prev != a) { printf("** b not removed from the list\n"); rc = EXIT_FAILURE; }
+	if (!dir_node_removed(node) || dir_next_node(node) != c) { printf("** Removed node lost its place\n"); rc = EXIT_FAILURE; }
+	for (int i=0; i < 3; i++) {
+		dir_write_lock();
+		dir_write_unlock();
+	}
+	if (dir_test_retired_count() != retired + 1) { printf("** Node freed while a reader could see it\n"); rc = EXIT_FAILURE; }
+
+	/* Held after the reader exits, so it is still not freed */
+	dir_node_hold(node);
+	dir_epoch_exit();
+	for (int i=0; i < 3; i++) {
+		dir_write_lock();
+		dir_write_unlock();
+	}
+	if (dir_test_retired_count() != retired + 1) { printf("** Node freed while it was held\n"); rc = EXIT_FAILURE; }
+
+	/* Released, so it is freed the next time the write lock is released */
+	dir_node_release(node);
+	dir_write_lock();
+	dir_write_unlock();
+	if (dir_test_retired_count() != retired) { printf("** Node not freed after release\n"); rc = EXIT_FAILURE; }
+
+	/* A reader walks the list while nodes are added and removed */
+	atomic_store(&dir_test_stop, false);
+	atomic_store(&dir_test_errors, 0);
+	pthread_t reader;
+	if (pthread_create(&reader, NULL, dir_test_reader, NULL) != EXIT_SUCCESS) {
+		printf("** Could not start reader thread\n");
+		return EXIT_FAILURE;
+	}
+	for (uint32_t i=0; i < DIR_TEST_EPOCH_LOOPS; i++) {
+		dir_write_lock();
+		dir_test_add(10 + i);
+		if (i % 3 == 0) dir_delete_node(dir_head);
+		else if (i % 3 == 1) dir_delete_node(dir_tail->prev);
+		dir_write_unlock();
+	}
+	atomic_store(&dir_test_stop, true);
+	pthread_join(reader, NULL);
+	if (atomic_load(&dir_test_errors) != 0) { printf("** Reader saw %d bad nodes\n", atomic_load(&dir_test_errors)); rc = EXIT_FAILURE; }
+
+	dir_write_lock();
+	dir_free();
+	dir_write_unlock();
+	dir_write_lock();
+	dir_write_unlock();
+	if (dir_test_retired_count() != retired) { printf("** Retired nodes not freed\n"); rc = EXIT_FAILURE; }
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST DIR EPOCH: success\n");
+	else
+		printf("##### TEST DIR EPOCH: fail\n");
+	return rc;
+}
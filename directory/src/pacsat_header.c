@@ -52,6 +52,7 @@
 #include "config.h"
 #include "pacsat_header.h"
 #include "pacsat_dir.h"
+#include "pacsat_readahead.h"
 #include "str_util.h"
 
 /* Forward declarations */
@@ -441,7 +442,8 @@ int pfh_generate_header_bytes(HEADER *pfh, int body_size, unsigned char *header_
  *
  * Update the header in a PACSAT file.  This will recalculate any checksums and
  * save the new bytes to the start of the file.  All fields except the header
- * checksum need to be correct.
+ * checksum need to be correct.  Chunks of the old file that were read ahead for
+ * the PB are dropped.
  *
  * TODO - this does not preserve PFH fields that we do not know about. But it does
  * allow 5 arbitrary fields that the ground station can add.  If more unknown fields are
@@ -511,6 +513,7 @@ int pfh_update_pacsat_header(HEADER *pfh, char *dir_folder) {
 	if (rename(tmp_filename, in_filename) != EXIT_SUCCESS) {
 		return EXIT_FAILURE;
 	}
+	ra_invalidate(pfh->fileId);
 	return EXIT_SUCCESS;
 }
 
@@ -23,6 +23,8 @@
 #ifndef FTL0_H_
 #define FTL0_H_
 
+#include "pacsat_callsign.h"
+
 #define MAX_UPLINK_LIST_LENGTH 4
 #define MAX_IN_PROCESS_FILE_UPLOADS 10
 #define TIMER_T3_PERIOD_IN_SECONDS 30 // this is 1/10th the Direwolf timeout of 300s
@@ -123,16 +125,17 @@ typedef struct {
 
 /* This stores the details of an in process file upload */
 typedef struct InProcessFileUpload {
-    char callsign[MAX_CALLSIGN_LEN]; /* The callsign of the stations that initiated the upload */
+    CALLSIGN_ID callsign_id; /* The station that initiated the upload */
     uint32_t file_id; /* The file id that was allocated by the dir.  A standard function calculates the tmp file name on disk */
     uint32_t length;  /* The promised length of the file given by the station when it requested the upload */
     uint32_t offset;  /* The offset at the end of the latest block uploaded */
     uint32_t request_time; /* The date/time that this upload was requested */
 } InProcessFileUpload_t;
 
-int ftl0_connection_received(char *from_callsign, char *to_callsign, int channel, int incomming, unsigned char * data);
-int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsigned char *data, int len);
-int ftl0_disconnected(char *from_callsign, char *to_callsign, unsigned char *data, int len);
+int ftl0_connection_received(CALLSIGN_ID from_id, CALLSIGN_ID to_id, int channel, int incomming, unsigned char * data);
+int ftl0_process_data(CALLSIGN_ID from_id, CALLSIGN_ID to_id, int channel, unsigned char *data, int len);
+int ftl0_disconnected(CALLSIGN_ID from_id, CALLSIGN_ID to_id, int channel, unsigned char *data, int len);
+void ftl0_init();
 int ftl0_next_action();
 
 int ftl0_get_file_upload_record(uint32_t file_id, InProcessFileUpload_t * file_upload_record);
@@ -29,6 +29,7 @@
 #include <sys/statvfs.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <stddef.h>
 #include <dirent.h>
 
 /* Program Include files */
@@ -39,6 +40,10 @@
 #include "pacsat_header.h"
 #include "pacsat_dir.h"
 #include "ftl0.h"
+#include "pacsat_stats.h"
+#include "pacsat_tx.h"
+#include "pacsat_trace.h"
+#include "pacsat_timer.h"
 #include "pacsat_dir.h"
 #include "iors_command.h"
 
@@ -46,12 +51,13 @@
 struct ftl0_state_machine_t {
 	int state; /* File Upload state machine state */
 	int channel; /* The receiver that is being used to receive this data */
-	char callsign[MAX_CALLSIGN_LEN];
+	CALLSIGN_ID callsign_id;
 	uint32_t file_id; /* File id of the file being uploaded */
 	uint32_t offset;
 	uint32_t length;
-	time_t request_time; /* The time the request was received for timeout purposes */
-	time_t TIMER_T3; /* This is our own T3 timer because direwolf is set at 300seconds.  We want to expire stations much faster if nothing heard */
+	time_t request_time; /* The time the request was received */
+	TIMER t3_timer; /* This is our own T3 timer because direwolf is set at 300seconds.  We want to expire stations much faster if nothing heard */
+	TIMER session_timer; /* Expires after g_uplink_max_period_for_client_in_seconds */
 };
 
 /**
@@ -60,15 +66,24 @@ struct ftl0_state_machine_t {
  * It stores the callsign and the status of the upload.
  * This is a static block of memory that exists throughout the duration of the program to
  * keep track of stations on the Uplink.
+ *
+ * Each radio port has its own uplink list and status, so a station on one port does not
+ * take a place on the uplink of another.  The upload table is shared by all ports.
  */
-static struct ftl0_state_machine_t uplink_list[MAX_UPLINK_LIST_LENGTH];
+struct ftl0_port {
+	int port; /* The AGW radio port, which is the channel for connected mode frames */
+	struct ftl0_state_machine_t uplink_list[MAX_UPLINK_LIST_LENGTH];
+	int number_on_uplink; /* This keeps track of how many stations are connected */
+	int current_station_on_uplink; /* This keeps track of which station we will send data to next */
+	TIMER status_timer;
+};
 
-static InProcessFileUpload_t upload_table[MAX_IN_PROCESS_FILE_UPLOADS];
+static struct ftl0_port ftl0_ports[MAX_PORTS];
+static struct ftl0_port *ul = &ftl0_ports[0]; /* The port for the frame or action being processed */
+static TIMER_WHEEL ftl0_timer_wheel; /* The timers for all ports.  Only used by the FTL0 thread */
 
-static int number_on_uplink = 0; /* This keeps track of how many stations are connected */
-static int current_station_on_uplink = 0; /* This keeps track of which station we will send data to next */
+static InProcessFileUpload_t upload_table[MAX_IN_PROCESS_FILE_UPLOADS];
 
-time_t last_uplink_status_time;
 time_t last_uplink_frames_queued_time;
 char * ftl0_packet_type_names[] = {
 		"DATA",
@@ -98,7 +113,7 @@ char * ftl0_packet_type_names[] = {
 
 /* Forward declarations */
 int ftl0_send_status();
-int ftl0_add_request(char *from_callsign, int channel, int file_id);
+int ftl0_add_request(CALLSIGN_ID from_id, int channel, int file_id);
 int ftl0_remove_request(int pos);
 void ftl0_make_list_str(char *buffer, int len);
 void ftl0_debug_print_list();
@@ -117,6 +132,10 @@ int ftl0_parse_packet_type(unsigned char * data);
 int ftl0_parse_packet_length(unsigned char * data);
 int ftl0_clear_upload_table();
 int ftl0_remove_upload_file(uint32_t file_id);
+static void ftl0_select_port(int channel);
+static void ftl0_status_expired(TIMER *timer, void *arg, uint64_t now_ms);
+static void ftl0_t3_expired(TIMER *timer, void *arg, uint64_t now_ms);
+static void ftl0_session_expired(TIMER *timer, void *arg, uint64_t now_ms);
 
 /**
  * ftl0_send_status()
@@ -132,9 +151,11 @@ int ftl0_send_status() {
 //		unsigned char shut[] = "Shut: ABCD";
 //		int rc = send_raw_packet(g_bbs_callsign, BBSTAT, PID_NO_PROTOCOL, shut, sizeof(shut));
 //		return rc;
-	} else 	if (number_on_uplink == MAX_UPLINK_LIST_LENGTH) {
+	} else 	if (ul->number_on_uplink == MAX_UPLINK_LIST_LENGTH) {
 		unsigned char full[] = "Full: A";
-		int rc = send_raw_packet(g_bbs_callsign, BBSTAT, PID_NO_PROTOCOL, full, sizeof(full));
+		int rc = tx_queue_raw_packet(ul->port, TX_CLASS_BULK, g_bbs_callsign, BBSTAT, PID_NO_PROTOCOL, full, sizeof(full));
+		if (rc == EXIT_SUCCESS)
+			stats_tx_frame(STATS_TYPE_FTL0, PID_NO_PROTOCOL, NULL, 0, sizeof(full));
 		return rc;
 	} else  {
 		char buffer[256];
@@ -145,7 +166,9 @@ int ftl0_send_status() {
 		ftl0_make_list_str(buffer, sizeof(buffer));
 		unsigned char command[strlen(buffer)]; // now put the list in a buffer of the right size
 		strlcpy((char *)command, (char *)buffer,sizeof(command));
-		int rc = send_raw_packet(g_bbs_callsign, CALL, PID_NO_PROTOCOL, command, sizeof(command));
+		int rc = tx_queue_raw_packet(ul->port, TX_CLASS_BULK, g_bbs_callsign, CALL, PID_NO_PROTOCOL, command, sizeof(command));
+		if (rc == EXIT_SUCCESS)
+			stats_tx_frame(STATS_TYPE_FTL0, PID_NO_PROTOCOL, NULL, 0, sizeof(command));
 		return rc;
 	}
 }
@@ -163,28 +186,33 @@ int ftl0_send_status() {
  * returns EXIT_SUCCESS it it succeeds or EXIT_FAILURE if the PB is shut or full
  *
  */
-int ftl0_add_request(char *from_callsign, int channel, int file_id) {
+int ftl0_add_request(CALLSIGN_ID from_id, int channel, int file_id) {
 	if (!g_state_uplink_open) return EXIT_FAILURE;
-	if (number_on_uplink == MAX_UPLINK_LIST_LENGTH) {
+	if (ul->number_on_uplink == MAX_UPLINK_LIST_LENGTH) {
 		return EXIT_FAILURE; // Uplink full
 	}
 
 	/* Each station can only be on the Uplink once, so reject if the callsign is already in the list */
-	for (int i=0; i < number_on_uplink; i++) {
-		if ((strcmp(uplink_list[i].callsign, from_callsign) == 0)) {
+	for (int i=0; i < ul->number_on_uplink; i++) {
+		if (ul->uplink_list[i].callsign_id == from_id) {
 			return EXIT_FAILURE; // Station is already on the PB
 		}
 	}
 
-	strlcpy(uplink_list[number_on_uplink].callsign, from_callsign, MAX_CALLSIGN_LEN);
-	uplink_list[number_on_uplink].state = UL_CMD_OK;
-	uplink_list[number_on_uplink].channel = channel;
-	uplink_list[number_on_uplink].file_id = file_id;
-	uplink_list[number_on_uplink].offset = 0;
-	uplink_list[number_on_uplink].length = 0;
-	uplink_list[number_on_uplink].request_time = time(0);
-
-	number_on_uplink++;
+	callsign_hold(from_id);
+	ul->uplink_list[ul->number_on_uplink].callsign_id = from_id;
+	ul->uplink_list[ul->number_on_uplink].state = UL_CMD_OK;
+	ul->uplink_list[ul->number_on_uplink].channel = channel;
+	ul->uplink_list[ul->number_on_uplink].file_id = file_id;
+	ul->uplink_list[ul->number_on_uplink].offset = 0;
+	ul->uplink_list[ul->number_on_uplink].length = 0;
+	ul->uplink_list[ul->number_on_uplink].request_time = time(0);
+	timer_init(&ul->uplink_list[ul->number_on_uplink].t3_timer, ftl0_t3_expired, ul);
+	timer_init(&ul->uplink_list[ul->number_on_uplink].session_timer, ftl0_session_expired, ul);
+	timer_start(&ftl0_timer_wheel, &ul->uplink_list[ul->number_on_uplink].session_timer,
+			tx_now_ms() + (uint64_t)g_uplink_max_period_for_client_in_seconds * 1000);
+
+	ul->number_on_uplink++;
 
 	return EXIT_SUCCESS;
 }
@@ -203,36 +231,41 @@ int ftl0_add_request(char *from_callsign, int channel, int file_id) {
  */
 int ftl0_remove_request(int pos) {
 	//time_t now = time(0);
-	//int duration = (int)(now - uplink_list[pos].request_time);
-	//debug_print("SESSION TIME: %s connected for %d seconds\n",uplink_list[number_on_uplink].callsign, duration);
-	if (number_on_uplink == 0) return EXIT_FAILURE;
-	if (pos >= number_on_uplink) return EXIT_FAILURE;
-	if (pos != number_on_uplink-1) {
+	//int duration = (int)(now - ul->uplink_list[pos].request_time);
+	//debug_print("SESSION TIME: %s connected for %d seconds\n",callsign_str(ul->uplink_list[ul->number_on_uplink].callsign_id), duration);
+	if (ul->number_on_uplink == 0) return EXIT_FAILURE;
+	if (pos >= ul->number_on_uplink) return EXIT_FAILURE;
+	callsign_release(ul->uplink_list[pos].callsign_id);
+	timer_stop(&ul->uplink_list[pos].t3_timer);
+	timer_stop(&ul->uplink_list[pos].session_timer);
+	if (pos != ul->number_on_uplink-1) {
 
 		/* Remove the item and shuffle all the other items to the left */
-		for (int i = pos + 1; i < number_on_uplink; i++) {
-			strlcpy(uplink_list[i-1].callsign, uplink_list[i].callsign, MAX_CALLSIGN_LEN);
-			uplink_list[i-1].state = uplink_list[i].state;
-			uplink_list[i-1].channel = uplink_list[i].channel;
-			uplink_list[i-1].file_id = uplink_list[i].file_id;
-			uplink_list[i-1].request_time = uplink_list[i].request_time;
+		for (int i = pos + 1; i < ul->number_on_uplink; i++) {
+			ul->uplink_list[i-1].callsign_id = ul->uplink_list[i].callsign_id;
+			ul->uplink_list[i-1].state = ul->uplink_list[i].state;
+			ul->uplink_list[i-1].channel = ul->uplink_list[i].channel;
+			ul->uplink_list[i-1].file_id = ul->uplink_list[i].file_id;
+			ul->uplink_list[i-1].request_time = ul->uplink_list[i].request_time;
+			timer_move(&ul->uplink_list[i-1].t3_timer, &ul->uplink_list[i].t3_timer);
+			timer_move(&ul->uplink_list[i-1].session_timer, &ul->uplink_list[i].session_timer);
 		}
 	}
 
-	number_on_uplink--;
+	ul->number_on_uplink--;
 
 	/* We have to update the station we will next send data to.
 	 * If a station earlier in the list was removed, then this decrements by one.
 	 * If a station later in the list was remove we do nothing.
 	 * If the current station was removed then we do nothing because we are already
 	 * pointing to the next station, unless we are at the end of the list */
-	if (pos < current_station_on_uplink) {
-		current_station_on_uplink--;
-		if (current_station_on_uplink < 0)
-			current_station_on_uplink = 0;
-	} else if (pos == current_station_on_uplink) {
-		if (current_station_on_uplink >= number_on_uplink)
-			current_station_on_uplink = 0;
+	if (pos < ul->current_station_on_uplink) {
+		ul->current_station_on_uplink--;
+		if (ul->current_station_on_uplink < 0)
+			ul->current_station_on_uplink = 0;
+	} else if (pos == ul->current_station_on_uplink) {
+		if (ul->current_station_on_uplink >= ul->number_on_uplink)
+			ul->current_station_on_uplink = 0;
 	}
 	return EXIT_SUCCESS;
 }
@@ -250,12 +283,12 @@ void ftl0_make_list_str(char *buffer, int len) {
 	else
 		strlcpy(buffer, "Open: ", len);
 
-	if (number_on_uplink == 0)
+	if (ul->number_on_uplink == 0)
 		strlcat(buffer, "A.", len);
 	else {
 		strlcat(buffer, "A ", len);
-		for (int i=0; i < number_on_uplink; i++) {
-			strlcat(buffer, uplink_list[i].callsign, len);
+		for (int i=0; i < ul->number_on_uplink; i++) {
+			strlcat(buffer, callsign_str(ul->uplink_list[i].callsign_id), len);
 			strlcat(buffer, " ", len);
 		}
 //		// TODO - this does not print the right callsigns against the right channels!
@@ -268,19 +301,19 @@ void ftl0_debug_print_list() {
 	char buffer[256];
 	ftl0_make_list_str(buffer, sizeof(buffer));
 	debug_print("%s\n",buffer);
-	for (int i=0; i < number_on_uplink; i++) {
+	for (int i=0; i < ul->number_on_uplink; i++) {
 		ftl0_debug_print_list_item(i);
 	}
 }
 
 void ftl0_debug_print_list_item(int i) {
-	debug_print("--%s Ch:%d File:%d State: %d",uplink_list[i].callsign,uplink_list[i].channel,uplink_list[i].file_id,
-			uplink_list[i].state);
+	debug_print("--%s Ch:%d File:%d State: %d",callsign_str(ul->uplink_list[i].callsign_id),ul->uplink_list[i].channel,ul->uplink_list[i].file_id,
+			ul->uplink_list[i].state);
 	char buf[30];
 	time_t now = time(0);
-	int duration = (int)(now - uplink_list[i].request_time);
+	int duration = (int)(now - ul->uplink_list[i].request_time);
 	debug_print(" for %d secs ",duration);
-	time_t since = uplink_list[i].request_time;
+	time_t since = ul->uplink_list[i].request_time;
 	strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", gmtime(&since));
 	debug_print(" since:%s\n", buf);
 }
@@ -328,12 +361,14 @@ If the clock is not set then we refuse logins as uploaded files can corrupt the
  * other stations can see who has logged in??
  *
  */
-int ftl0_connection_received(char *from_callsign, char *to_callsign, int channel, int incomming, unsigned char * data) {
+int ftl0_connection_received(CALLSIGN_ID from_id, CALLSIGN_ID to_id, int channel, int incomming, unsigned char * data) {
+	char *from_callsign = callsign_str(from_id);
 	//debug_print("Connection for File Upload from: %s\n",from_callsign);
+	ftl0_select_port(channel);
 
 	/* Add the request, which initializes their uplink state machine. At this point we don't know the
 	 * file number, offset or dir node */
-	int rc = ftl0_add_request(from_callsign, channel, 0);
+	int rc = ftl0_add_request(from_id, channel, 0);
 	if (rc != EXIT_SUCCESS){
 		/* We could not add this request, either full or already on the uplink.  Disconnect. */
 		ftl0_disconnect(from_callsign, channel);
@@ -363,12 +398,15 @@ int ftl0_connection_received(char *from_callsign, char *to_callsign, int channel
 
 	rc = ftl0_make_packet(data_bytes, (unsigned char *)&login_data, sizeof(login_data), frame_type);
 
-	rc = tnc_send_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(login_data)+2);
+	rc = tx_queue_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(login_data)+2);
+	if (rc == EXIT_SUCCESS)
+		stats_tx_frame(STATS_TYPE_FTL0, PID_NO_PROTOCOL, from_callsign, 0, sizeof(login_data)+2);
 	if (rc != EXIT_SUCCESS) {
 		error_print("Could not send FTL0 LOGIN packet to TNC \n");
 		return EXIT_FAILURE;
 	}
-	uplink_list[current_station_on_uplink].TIMER_T3 = time(0); /* Start T3 */
+	/* Start T3 for the station we just added */
+	timer_start(&ftl0_timer_wheel, &ul->uplink_list[ul->number_on_uplink - 1].t3_timer, tx_now_ms() + TIMER_T3_PERIOD_IN_SECONDS * 1000);
 	return EXIT_SUCCESS;
 }
 
@@ -379,13 +417,27 @@ int ftl0_connection_received(char *from_callsign, char *to_callsign, int channel
  */
 void ftl0_disconnect(char *to_callsign, int channel) {
 	debug_print("Disconnecting: %s\n", to_callsign);
-	tnc_diconnect(g_bbs_callsign, to_callsign, channel);
+	trace_disconnect(g_bbs_callsign, to_callsign, channel);
+}
+
+/**
+ * ftl0_select_port()
+ *
+ * Select the uplink list for the radio port that a frame was received on.  Connected mode
+ * frames from the TNC carry the port as their channel.  A receiver can hear stations on a port
+ * that we can not send UI frames on, so they use the list for port 0.  The station keeps its
+ * real channel, which its connected mode frames are sent on.
+ */
+static void ftl0_select_port(int channel) {
+	if (channel < 0 || channel >= g_number_of_ports)
+		channel = 0;
+	ul = &ftl0_ports[channel];
 }
 
-int ftl0_get_list_number_by_callsign(char *from_callsign) {
+int ftl0_get_list_number_by_callsign(CALLSIGN_ID from_id) {
 	int selected_station = -1; /* The station that this event is for */
-	for (int i=0; i < number_on_uplink; i++) {
-		if (strncasecmp(from_callsign, uplink_list[i].callsign, MAX_CALLSIGN_LEN) == 0) {
+	for (int i=0; i < ul->number_on_uplink; i++) {
+		if (ul->uplink_list[i].callsign_id == from_id) {
 			selected_station = i;
 			break;
 		}
@@ -399,37 +451,40 @@ int ftl0_get_list_number_by_callsign(char *from_callsign) {
  * We only receive this if the TNC has disconnected.  Remove the station
  * from the uplink list if they are still on it.
  */
-int ftl0_disconnected(char *from_callsign, char *to_callsign, unsigned char *data, int len) {
-	int selected_station = ftl0_get_list_number_by_callsign(from_callsign); /* The station that this event is for */
+int ftl0_disconnected(CALLSIGN_ID from_id, CALLSIGN_ID to_id, int channel, unsigned char *data, int len) {
+	ftl0_select_port(channel);
+	int selected_station = ftl0_get_list_number_by_callsign(from_id); /* The station that this event is for */
 
 	if (selected_station == -1) {
-		debug_print("Ignoring disconnect from %s as they are not in the list uplink\n", from_callsign);
+		debug_print("Ignoring disconnect from %s as they are not in the list uplink\n", callsign_str(from_id));
 		return EXIT_SUCCESS; /* Ignored, this station is not on the uplink */
 	}
 	int rc = ftl0_remove_request(selected_station);
 	return rc;
 }
 
-int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsigned char *data, int len) {
+int ftl0_process_data(CALLSIGN_ID from_id, CALLSIGN_ID to_id, int channel, unsigned char *data, int len) {
+	char *from_callsign = callsign_str(from_id);
 //	if (strncasecmp(to_callsign, g_broadcast_callsign, MAX_CALLSIGN_LEN) == 0) {
 //		// this was sent to the Broadcast Callsign
 //		debug_print("Broadcast Request - Ignored\n");
 //		return EXIT_SUCCESS;
 //	}
-	if (strncasecmp(to_callsign, g_bbs_callsign, MAX_CALLSIGN_LEN) != 0) return EXIT_SUCCESS;
+	if (to_id != g_bbs_callsign_id) return EXIT_SUCCESS;
 		// this was sent another Callsign
+	ftl0_select_port(channel);
 
 	/* Now process the next station if there is one and take its action */
-	if (number_on_uplink == 0) return EXIT_SUCCESS; // nothing to do
+	if (ul->number_on_uplink == 0) return EXIT_SUCCESS; // nothing to do
 
-	int selected_station = ftl0_get_list_number_by_callsign(from_callsign); /* The station that this event is for */
+	int selected_station = ftl0_get_list_number_by_callsign(from_id); /* The station that this event is for */
 
 	if (selected_station == -1) {
 		debug_print("Ignoring data from %s as they are not in the list uplink\n", from_callsign);
 		return EXIT_SUCCESS; /* Ignored, this station is not on the uplink */
 	}
 
-	uplink_list[selected_station].TIMER_T3 = time(0); /* Restart T3 */
+	timer_start(&ftl0_timer_wheel, &ul->uplink_list[selected_station].t3_timer, tx_now_ms() + TIMER_T3_PERIOD_IN_SECONDS * 1000); /* Restart T3 */
 
 
 	int ftl0_type = ftl0_parse_packet_type(data);
@@ -439,7 +494,7 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 			/* We likely could not send the error.  Something serious has gone wrong.
 			 * Not much we can do as we are going to offload the request anyway */
 		}
-		ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+		ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 		ftl0_remove_request(selected_station);
 	}
 
@@ -448,14 +503,14 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 	int err = ER_NONE;
 	int ftl0_length = 0;
 
-	switch (uplink_list[selected_station].state) {
+	switch (ul->uplink_list[selected_station].state) {
 	case UL_UNINIT:
-		//debug_print("%s: UNINIT - %s\n",uplink_list[selected_station].callsign, ftl0_packet_type_names[ftl0_type]);
+		//debug_print("%s: UNINIT - %s\n",callsign_str(ul->uplink_list[selected_station].callsign_id), ftl0_packet_type_names[ftl0_type]);
 
 		break;
 
 	case UL_CMD_OK:
-		//debug_print("%s: UL_CMD_OK - %s\n",uplink_list[selected_station].callsign, ftl0_packet_type_names[ftl0_type]);
+		//debug_print("%s: UL_CMD_OK - %s\n",callsign_str(ul->uplink_list[selected_station].callsign_id), ftl0_packet_type_names[ftl0_type]);
 
 		/* Process the EVENT through the UPLINK STATE MACHINE */
 		switch (ftl0_type) {
@@ -467,19 +522,19 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 				if (rc != EXIT_SUCCESS) {
 					/* We likely could not send the error.  Something serious has gone wrong.
 					 * But the best we can do is remove the station and return the error code. */
-					ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+					ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 					ftl0_remove_request(selected_station);
 				}
 				// If we sent error successfully then we stay in state UL_CMD_OK and the station can try another file
 				return rc;
 			}
 			// We move to state UL_DATA_RX
-			uplink_list[selected_station].state = UL_DATA_RX;
+			ul->uplink_list[selected_station].state = UL_DATA_RX;
 			break;
 		case UPLOAD_CMD :
 			if (g_state_uplink_open != FTL0_STATE_OPEN) {
 				rc = ftl0_send_err(from_callsign, channel, ER_ILL_FORMED_CMD);
-				ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+				ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 				ftl0_remove_request(selected_station);
 			}
 			/* if OK to upload send UL_GO_RESP.  We determine if it is OK by checking if we have space
@@ -497,18 +552,18 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 				if (rc != EXIT_SUCCESS) {
 					/* We likely could not send the error.  Something serious has gone wrong.
 					 * But the best we can do is remove the station and return the error code. */
-					ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+					ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 					ftl0_remove_request(selected_station);
 				}
 				// If we sent error successfully then we stay in state UL_CMD_OK and the station can try another file
 				return rc;
 			}
 			// We move to state UL_DATA_RX
-			uplink_list[selected_station].state = UL_DATA_RX;
+			ul->uplink_list[selected_station].state = UL_DATA_RX;
 			break;
 
 		default:
-			ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+			ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 			ftl0_remove_request(selected_station);
 			return EXIT_SUCCESS; // don't increment or change the current station
 			break;
@@ -517,11 +572,11 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 		break;
 
 	case UL_DATA_RX:
-		//debug_print("%s: UL_DATA_RX - %s\n",uplink_list[selected_station].callsign, ftl0_packet_type_names[ftl0_type]);
+		//debug_print("%s: UL_DATA_RX - %s\n",callsign_str(ul->uplink_list[selected_station].callsign_id), ftl0_packet_type_names[ftl0_type]);
 
 		switch (ftl0_type) {
 		case DATA :
-//			debug_print("%s: UL_DATA_RX - DATA RECEIVED\n",uplink_list[selected_station].callsign);
+//			debug_print("%s: UL_DATA_RX - DATA RECEIVED\n",callsign_str(ul->uplink_list[selected_station].callsign_id));
 			err = ftl0_process_data_cmd(selected_station, from_callsign, channel, data, len);
 			if (err != ER_NONE) {
 				rc = ftl0_send_nak(from_callsign, channel, err);
@@ -529,16 +584,16 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 					/* We likely could not send the error.  Something serious has gone wrong.
 					 * But the best we can do is remove the station and return the error code. */
 				}
-				ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+				ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 				ftl0_remove_request(selected_station);
 				return rc;
 			}
-			uplink_list[selected_station].state = UL_DATA_RX;
+			ul->uplink_list[selected_station].state = UL_DATA_RX;
 			// Update the upload record in case nothing else is received
 			InProcessFileUpload_t file_upload_record;
-			if (ftl0_get_file_upload_record(uplink_list[selected_station].file_id, &file_upload_record) == EXIT_SUCCESS) {
+			if (ftl0_get_file_upload_record(ul->uplink_list[selected_station].file_id, &file_upload_record) == EXIT_SUCCESS) {
 				file_upload_record.request_time = time(0); // this is updated when we receive data
-				file_upload_record.offset = uplink_list[selected_station].offset;
+				file_upload_record.offset = ul->uplink_list[selected_station].offset;
 				if (ftl0_update_file_upload_record(&file_upload_record) != EXIT_SUCCESS) {
 					debug_print("Unable to update upload record\n");
 					// do not treat this as fatal because the file can still be uploaded
@@ -546,7 +601,7 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 			}
 			break;
 		case AUTH_DATA_END :
-			//debug_print("%s: UL_DATA_RX - AUTH DATA END RECEIVED\n",uplink_list[selected_station].callsign);
+			//debug_print("%s: UL_DATA_RX - AUTH DATA END RECEIVED\n",callsign_str(ul->uplink_list[selected_station].callsign_id));
 			err = ftl0_process_auth_data_end_cmd(selected_station, from_callsign, channel, data, len);
 			if (err != ER_NONE) {
 				rc = ftl0_send_nak(from_callsign, channel, err);
@@ -554,17 +609,17 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 				debug_print(" *** SENDING ACK *** \n");
 				rc = ftl0_send_ack(from_callsign, channel);
 			}
-			uplink_list[selected_station].state = UL_CMD_OK;
+			ul->uplink_list[selected_station].state = UL_CMD_OK;
 			if (rc != EXIT_SUCCESS) {
 				/*  We likely could not send the error.  Something serious has gone wrong.
 				 * But the best we can do is remove the station and return the error code. */
-				ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+				ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 				ftl0_remove_request(selected_station);
 			}
 			return rc;
 			break;
 		case DATA_END :
-			//debug_print("%s: UL_DATA_RX - DATA END RECEIVED\n",uplink_list[selected_station].callsign);
+			//debug_print("%s: UL_DATA_RX - DATA END RECEIVED\n",callsign_str(ul->uplink_list[selected_station].callsign_id));
 			ftl0_length = ftl0_parse_packet_length(data);
 			if (ftl0_length != 0) {
 				err = ER_BAD_HEADER; /* This will cause a NAK to be sent as the data is corrupt in some way */
@@ -577,17 +632,17 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 				debug_print(" *** SENDING ACK *** \n");
 				rc = ftl0_send_ack(from_callsign, channel);
 			}
-			uplink_list[selected_station].state = UL_CMD_OK;
+			ul->uplink_list[selected_station].state = UL_CMD_OK;
 			if (rc != EXIT_SUCCESS) {
 				/*  We likely could not send the error.  Something serious has gone wrong.
 				 * But the best we can do is remove the station and return the error code. */
-				ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+				ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 				ftl0_remove_request(selected_station);
 			}
 			return rc;
 			break;
 		default:
-			ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+			ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 			ftl0_remove_request(selected_station);
 			return EXIT_SUCCESS; // don't increment or change the current station
 			break;
@@ -596,8 +651,8 @@ int ftl0_process_data(char *from_callsign, char *to_callsign, int channel, unsig
 		break;
 
 	case UL_ABORT:
-		debug_print("%s: UL_ABORT - %s\n",uplink_list[selected_station].callsign, ftl0_packet_type_names[ftl0_type]);
-		ftl0_disconnect(uplink_list[selected_station].callsign, uplink_list[selected_station].channel);
+		debug_print("%s: UL_ABORT - %s\n",callsign_str(ul->uplink_list[selected_station].callsign_id), ftl0_packet_type_names[ftl0_type]);
+		ftl0_disconnect(callsign_str(ul->uplink_list[selected_station].callsign_id), ul->uplink_list[selected_station].channel);
 		ftl0_remove_request(selected_station);
 		return EXIT_SUCCESS; // don't increment or change the current station
 		break;
@@ -615,7 +670,9 @@ int ftl0_send_err(char *from_callsign, int channel, int err) {
 
 	int rc = ftl0_make_packet(data_bytes, (unsigned char *)&err_info, sizeof(err_info), frame_type);
 
-	rc = tnc_send_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(data_bytes));
+	rc = tx_queue_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(data_bytes));
+	if (rc == EXIT_SUCCESS)
+		stats_tx_frame(STATS_TYPE_FTL0, PID_NO_PROTOCOL, from_callsign, 0, sizeof(data_bytes));
 	if (rc != EXIT_SUCCESS) {
 		error_print("Could not send FTL0 ERR packet to TNC \n");
 		return EXIT_FAILURE;
@@ -629,7 +686,9 @@ int ftl0_send_ack(char *from_callsign, int channel) {
 
 	int rc = ftl0_make_packet(data_bytes, (unsigned char *)NULL, 0, frame_type);
 
-	rc = tnc_send_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(data_bytes));
+	rc = tx_queue_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(data_bytes));
+	if (rc == EXIT_SUCCESS)
+		stats_tx_frame(STATS_TYPE_FTL0, PID_NO_PROTOCOL, from_callsign, 0, sizeof(data_bytes));
 	if (rc != EXIT_SUCCESS) {
 		error_print("Could not send FTL0 ACK packet to TNC \n");
 		return EXIT_FAILURE;
@@ -646,7 +705,9 @@ int ftl0_send_nak(char *from_callsign, int channel, int err) {
 
 	int rc = ftl0_make_packet(data_bytes, (unsigned char *)&err_info, sizeof(err_info), frame_type);
 
-	rc = tnc_send_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(data_bytes));
+	rc = tx_queue_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(data_bytes));
+	if (rc == EXIT_SUCCESS)
+		stats_tx_frame(STATS_TYPE_FTL0, PID_NO_PROTOCOL, from_callsign, 0, sizeof(data_bytes));
 	if (rc != EXIT_SUCCESS) {
 		error_print("Could not send FTL0 NAK packet to TNC \n");
 		return EXIT_FAILURE;
@@ -655,7 +716,7 @@ int ftl0_send_nak(char *from_callsign, int channel, int err) {
 }
 
 int ftl0_process_auth_upload_cmd(int selected_station, char *from_callsign, int channel, unsigned char *data, int len) {
-	//struct ftl0_state_machine_t *state = &uplink_list[selected_station];
+	//struct ftl0_state_machine_t *state = &ul->uplink_list[selected_station];
 
 	int ftl0_length = ftl0_parse_packet_length(data);
 	if (ftl0_length != sizeof(FTL0_AUTH_UPLOAD_CMD))
@@ -698,7 +759,7 @@ file.
 
  */
 int ftl0_process_upload_cmd(int selected_station, char *from_callsign, int channel, unsigned char *data, int len) {
-	struct ftl0_state_machine_t *state = &uplink_list[selected_station];
+	struct ftl0_state_machine_t *state = &ul->uplink_list[selected_station];
 
 	FTL0_UPLOAD_CMD *upload_cmd = (FTL0_UPLOAD_CMD *)(data); /* Point to the data just past the header */
 
@@ -761,7 +822,7 @@ int ftl0_process_upload_cmd(int selected_station, char *from_callsign, int chann
 
 		/* Store in an upload table record.  The state will now contain all the details */
 		InProcessFileUpload_t file_upload_record;
-		strlcpy(file_upload_record.callsign,state->callsign, sizeof(file_upload_record.callsign));
+		file_upload_record.callsign_id = state->callsign_id;
 		file_upload_record.file_id = state->file_id;
 		file_upload_record.length = state->length;
 		file_upload_record.request_time = state->request_time;
@@ -828,7 +889,7 @@ int ftl0_process_upload_cmd(int selected_station, char *from_callsign, int chann
 				return ER_BAD_CONTINUE;
 			}
 			/* If this file does not belong to this callsign then reject */
-			if (strcmp(upload_record.callsign, state->callsign) != 0) {
+			if (upload_record.callsign_id != state->callsign_id) {
 				debug_print("Callsign does not match - BAD CONTINUE\n");
 				return ER_BAD_CONTINUE;
 			}
@@ -868,7 +929,9 @@ int ftl0_process_upload_cmd(int selected_station, char *from_callsign, int chann
 		debug_print("Could not make FTL0 UL GO packet \n");
 		return ER_ILL_FORMED_CMD; // TODO This will cause err 1 to be sent and the station to be offloaded.  Is that right..
 	}
-	rc = tnc_send_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(data_bytes));
+	rc = tx_queue_connected_data(g_bbs_callsign, from_callsign, channel, data_bytes, sizeof(data_bytes));
+	if (rc == EXIT_SUCCESS)
+		stats_tx_frame(STATS_TYPE_FTL0, PID_NO_PROTOCOL, from_callsign, 0, sizeof(data_bytes));
 	if (rc != EXIT_SUCCESS) {
 		error_print("Could not send FTL0 UL GO packet to TNC \n");
 		return ER_ILL_FORMED_CMD; //  This will cause err 1 to be sent and the station to be offloaded.  Is that right..
@@ -897,7 +960,7 @@ int ftl0_process_data_cmd(int selected_station, char *from_callsign, int channel
 	unsigned char * data_bytes = (unsigned char *)data + 2; /* Point to the data just past the header */
 
 	char tmp_filename[MAX_FILE_PATH_LEN];
-	dir_get_upload_file_path_from_file_id(uplink_list[selected_station].file_id, tmp_filename, MAX_FILE_PATH_LEN);
+	dir_get_upload_file_path_from_file_id(ul->uplink_list[selected_station].file_id, tmp_filename, MAX_FILE_PATH_LEN);
 	//debug_print("Saving data to file: %s\n",tmp_filename);
 	FILE * f = fopen(tmp_filename, "ab"); /* Open the file for append of data to the end */
 	if (f == NULL) {
@@ -912,8 +975,8 @@ int ftl0_process_data_cmd(int selected_station, char *from_callsign, int channel
 	}
 	fclose(f);
 
-	uplink_list[selected_station].offset += ftl0_length;
-	if (uplink_list[selected_station].offset > uplink_list[selected_station].length) {
+	ul->uplink_list[selected_station].offset += ftl0_length;
+	if (ul->uplink_list[selected_station].offset > ul->uplink_list[selected_station].length) {
 		debug_print("User tried to upload more bytes than were reserved for the file: %s\n",tmp_filename);
 		return ER_NO_ROOM; // The user has tried to upload more bytes than reserved for this file
 	}
@@ -939,7 +1002,7 @@ int ftl0_process_auth_data_end_cmd(int selected_station, char *from_callsign, in
 
 int ftl0_process_data_end_cmd(int selected_station, char *from_callsign, int channel, uint16_t header_check, uint16_t body_check) {
 	char tmp_filename[MAX_FILE_PATH_LEN];
-	dir_get_upload_file_path_from_file_id(uplink_list[selected_station].file_id, tmp_filename, MAX_FILE_PATH_LEN);
+	dir_get_upload_file_path_from_file_id(ul->uplink_list[selected_station].file_id, tmp_filename, MAX_FILE_PATH_LEN);
 
 	/* We can't call dir_load_pacsat_file() here because we want to check the tmp file but then
 	 * add the file after we rename it. So we validate it first. */
@@ -981,14 +1044,16 @@ int ftl0_process_data_end_cmd(int selected_station, char *from_callsign, int cha
            is sent.
 	 */
 	char new_filename[MAX_FILE_PATH_LEN];
-	dir_get_file_path_from_file_id(uplink_list[selected_station].file_id, get_dir_folder(), new_filename, MAX_FILE_PATH_LEN);
+	dir_get_file_path_from_file_id(ul->uplink_list[selected_station].file_id, get_dir_folder(), new_filename, MAX_FILE_PATH_LEN);
 	if (rename(tmp_filename, new_filename) == EXIT_SUCCESS) {
 //		char file_id_str[5];
-//		snprintf(file_id_str, 4, "%d",uplink_list[selected_station].file_id);
+//		snprintf(file_id_str, 4, "%d",ul->uplink_list[selected_station].file_id);
 //		strlcpy(pfh->fileName, file_id_str, sizeof(pfh->fileName));
 //		strlcpy(pfh->fileExt, PSF_FILE_EXT, sizeof(pfh->fileExt));
 
+		dir_write_lock();
 		DIR_NODE *p = dir_add_pfh(pfh, new_filename);
+		dir_write_unlock();
 		if (p == NULL) {
 			error_print("** Could not add %s to dir\n",new_filename);
 			free(pfh);
@@ -1009,6 +1074,22 @@ int ftl0_process_data_end_cmd(int selected_station, char *from_callsign, int cha
 	return ER_NONE;
 }
 
+/**
+ * ftl0_init()
+ *
+ * Start the timer wheel and the status timer of each port.  The number of ports is only
+ * read at startup.
+ */
+void ftl0_init() {
+	uint64_t now_ms = tx_now_ms();
+	timer_wheel_init(&ftl0_timer_wheel, now_ms);
+	for (int p=0; p < g_number_of_ports; p++) {
+		ftl0_ports[p].port = p;
+		timer_init(&ftl0_ports[p].status_timer, ftl0_status_expired, &ftl0_ports[p]);
+		timer_start(&ftl0_timer_wheel, &ftl0_ports[p].status_timer, now_ms + (uint64_t)g_uplink_status_period_in_seconds * 1000);
+	}
+}
+
 /*
  *
  * ftl0_next_action
@@ -1016,65 +1097,65 @@ int ftl0_process_data_end_cmd(int selected_station, char *from_callsign, int cha
  * This handles periodic actions like timeout.  It does not tick the state machine,
  * that is event driven and is handled by received frames above.
  *
- * Returns EXIT_SUCCESS, unless something goes badly wrong, such as we can not send data to
- * the TNC
+ * The status and the timeouts of every station are timers on the wheel, so each one is
+ * handled when it expires, whichever port or position on the uplink list it is for.
+ *
+ * Returns EXIT_SUCCESS
  *
  */
 int ftl0_next_action() {
-	int rc = EXIT_SUCCESS;
-
-	/* First see if we need to send the status */
-	time_t now = time(0);
-	if (last_uplink_status_time == 0) last_uplink_status_time = now; // initialize at start
-	if (now - last_uplink_status_time > g_uplink_status_period_in_seconds) {
-		// then send the status
-		rc = ftl0_send_status();
-		if (rc != EXIT_SUCCESS) {
-			error_print("Could not send PB status to TNC \n");
-		}
-		//ftl0_debug_print_list();
-		last_uplink_status_time = now;
-
-	}
-
-	/* Print debug info to the console */
-//	if (now - last_uplink_frames_queued_time > 5) {
-//		//			char buffer[256];
-//		//			ftl0_make_list_str(buffer, sizeof(buffer));
-//		//			debug_print("%s\n", buffer);
-//		ftl0_debug_print_list();
-//		last_uplink_frames_queued_time = now;
-//	}
+	timer_wheel_advance(&ftl0_timer_wheel, tx_now_ms());
+	ul = &ftl0_ports[0];
+	return EXIT_SUCCESS;
+}
 
-	if (number_on_uplink == 0) return EXIT_SUCCESS; // nothing to do
-
-	if (uplink_list[current_station_on_uplink].TIMER_T3 > 0) {
-		/* Timer is running */
-		if (now - uplink_list[current_station_on_uplink].TIMER_T3 > TIMER_T3_PERIOD_IN_SECONDS) {
-			/* Timer T3 Expired - disconnect station */
-			debug_print("%s: T3 TIMEOUT\n",uplink_list[current_station_on_uplink].callsign);
-			ftl0_disconnect(uplink_list[current_station_on_uplink].callsign, uplink_list[current_station_on_uplink].channel);
-			ftl0_remove_request(current_station_on_uplink);
-			/* If we removed a station then we don't want/need to increment the current station pointer */
-			uplink_list[current_station_on_uplink].TIMER_T3 = 0; /* stop the timer */
-			return EXIT_SUCCESS;
-		}
+/**
+ * ftl0_status_expired()
+ *
+ * Send the status of the uplink for the port in arg and start the timer for the next one.
+ */
+static void ftl0_status_expired(TIMER *timer, void *arg, uint64_t now_ms) {
+	ul = (struct ftl0_port *)arg;
+	if (ftl0_send_status() != EXIT_SUCCESS) {
+		error_print("Could not send PB status to TNC \n");
 	}
+	timer_start(&ftl0_timer_wheel, timer, now_ms + (uint64_t)g_uplink_status_period_in_seconds * 1000);
+}
 
-	if (now - uplink_list[current_station_on_uplink].request_time > g_uplink_max_period_for_client_in_seconds) {
-		/* This station has exceeded the time allowed on the PB */
-		debug_print("%s: UPLINK TIMEOUT\n",uplink_list[current_station_on_uplink].callsign);
-		ftl0_disconnect(uplink_list[current_station_on_uplink].callsign, uplink_list[current_station_on_uplink].channel);
-		ftl0_remove_request(current_station_on_uplink);
-		/* If we removed a station then we don't want/need to increment the current station pointer */
-		return EXIT_SUCCESS;
-	}
+/**
+ * ftl0_timer_station()
+ *
+ * Select the port in arg and return the position on its uplink list of the entry that
+ * holds the timer at offset in the entry.
+ */
+static int ftl0_timer_station(TIMER *timer, void *arg, size_t offset) {
+	ul = (struct ftl0_port *)arg;
+	struct ftl0_state_machine_t *entry = (struct ftl0_state_machine_t *)((char *)timer - offset);
+	return entry - ul->uplink_list;
+}
 
-	current_station_on_uplink++;
-	if (current_station_on_uplink == number_on_uplink)
-		current_station_on_uplink = 0;
+/**
+ * ftl0_t3_expired()
+ *
+ * Nothing has been heard from the station for TIMER_T3_PERIOD_IN_SECONDS.  Disconnect it.
+ */
+static void ftl0_t3_expired(TIMER *timer, void *arg, uint64_t now_ms) {
+	int i = ftl0_timer_station(timer, arg, offsetof(struct ftl0_state_machine_t, t3_timer));
+	debug_print("%s: T3 TIMEOUT\n",callsign_str(ul->uplink_list[i].callsign_id));
+	ftl0_disconnect(callsign_str(ul->uplink_list[i].callsign_id), ul->uplink_list[i].channel);
+	ftl0_remove_request(i);
+}
 
-	return rc;
+/**
+ * ftl0_session_expired()
+ *
+ * The station has exceeded the time allowed on the uplink.  Disconnect it.
+ */
+static void ftl0_session_expired(TIMER *timer, void *arg, uint64_t now_ms) {
+	int i = ftl0_timer_station(timer, arg, offsetof(struct ftl0_state_machine_t, session_timer));
+	debug_print("%s: UPLINK TIMEOUT\n",callsign_str(ul->uplink_list[i].callsign_id));
+	ftl0_disconnect(callsign_str(ul->uplink_list[i].callsign_id), ul->uplink_list[i].channel);
+	ftl0_remove_request(i);
 }
 
 /**
@@ -1125,10 +1206,12 @@ int ftl0_parse_packet_length(unsigned char * data) {
 
 int ftl0_on_the_uplink_now(uint32_t file_id) {
 	int j;
-	for (j=0; j < number_on_uplink; j++) {
-		if (uplink_list[j].state != UL_UNINIT)
-			if (uplink_list[j].file_id == file_id)
-				return true;
+	for (int p=0; p < g_number_of_ports; p++) {
+		for (j=0; j < ftl0_ports[p].number_on_uplink; j++) {
+			if (ftl0_ports[p].uplink_list[j].state != UL_UNINIT)
+				if (ftl0_ports[p].uplink_list[j].file_id == file_id)
+					return true;
+		}
 	}
 	return false;
 }
@@ -1147,6 +1230,8 @@ int ftl0_raw_get_file_upload_record(uint32_t slot, InProcessFileUpload_t * file_
  */
 int ftl0_raw_set_file_upload_record(uint32_t slot, InProcessFileUpload_t * file_upload_record) {
 	if (slot >= MAX_IN_PROCESS_FILE_UPLOADS) return EXIT_FAILURE;
+	callsign_hold(file_upload_record->callsign_id);
+	callsign_release(upload_table[slot].callsign_id);
 	upload_table[slot] = *file_upload_record;
     ftl0_save_upload_table(); // if this fails we ignore it as it is not fatal
     return EXIT_SUCCESS;
@@ -1260,7 +1345,7 @@ int ftl0_remove_file_upload_record(uint32_t id) {
     tmp_file_upload_record.file_id = 0;
     tmp_file_upload_record.length = 0;
     tmp_file_upload_record.request_time = 0;
-    tmp_file_upload_record.callsign[0] = 0;
+    tmp_file_upload_record.callsign_id = CALLSIGN_ID_NONE;
     tmp_file_upload_record.offset = 0;
 
     int i;
@@ -1314,7 +1399,8 @@ int ftl0_clear_upload_table() {
     	upload_table[i].file_id = 0;
     	upload_table[i].length = 0;
     	upload_table[i].request_time = 0;
-    	upload_table[i].callsign[0] = 0;
+    	callsign_release(upload_table[i].callsign_id);
+    	upload_table[i].callsign_id = CALLSIGN_ID_NONE;
     	upload_table[i].offset = 0;
     }
     return EXIT_SUCCESS;
@@ -1354,7 +1440,8 @@ int ftl0_load_upload_table() {
 
 		token = strtok(NULL, search);
 		//debug_print(" , %s",token);
-		strlcpy(upload_table[i].callsign, token,sizeof(upload_table[i].callsign));
+		callsign_release(upload_table[i].callsign_id);
+		upload_table[i].callsign_id = (strcmp(token, "NONE") == 0) ? CALLSIGN_ID_NONE : callsign_intern(token);
 
 		token = strtok(NULL, search);
 		token[strcspn(token,"\n")] = 0; // Remove the nul termination to get rid of the new line
@@ -1386,11 +1473,12 @@ int ftl0_save_upload_table() {
 	}
 
 	for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
-		if (upload_table[i].callsign[0] == 0)
-			strlcpy(upload_table[i].callsign, "NONE",sizeof(upload_table[i].callsign));
+		char *callsign = "NONE";
+		if (upload_table[i].callsign_id != CALLSIGN_ID_NONE)
+			callsign = callsign_str(upload_table[i].callsign_id);
 
 		snprintf(buf, MAX_CONFIG_LINE_LENGTH, "%d,%d,%d,%s,%d\n",upload_table[i].file_id,upload_table[i].length,upload_table[i].request_time
-				,upload_table[i].callsign,upload_table[i].offset);
+				,callsign,upload_table[i].offset);
 		rc = fputs(buf, file);
 		if (rc == EOF) {
 			debug_print("ERROR: Writing upload table. Error: %d\n",rc);
@@ -1427,7 +1515,7 @@ int ftl0_debug_list_upload_table() {
         }
         if (rec.file_id != 0) {
             uint32_t now = time(0);
-            debug_print("%d- File: %04x by %s length: %d offset: %d for %d seconds\n",i, rec.file_id, rec.callsign, rec.length, rec.offset, now-rec.request_time);
+            debug_print("%d- File: %04x by %s length: %d offset: %d for %d seconds\n",i, rec.file_id, callsign_str(rec.callsign_id), rec.length, rec.offset, now-rec.request_time);
         }
     }
     uint32_t space = ftl0_get_space_reserved_by_upload_table();
@@ -1451,7 +1539,7 @@ void ftl0_maintenance(time_t now, char *upload_folder) {
     blank_file_upload_record.file_id = 0;
     blank_file_upload_record.length = 0;
     blank_file_upload_record.request_time = 0;
-    blank_file_upload_record.callsign[0] = 0;
+    blank_file_upload_record.callsign_id = CALLSIGN_ID_NONE;
     blank_file_upload_record.offset = 0;
 
     for (i=0; i < MAX_IN_PROCESS_FILE_UPLOADS; i++) {
@@ -1464,7 +1552,7 @@ void ftl0_maintenance(time_t now, char *upload_folder) {
         		int32_t age = now-rec.request_time;
         		if (age > g_ftl0_max_upload_age_in_seconds) {
         			debug_print("REMOVING RECORD: %d- File: %04x by %s length: %d offset: %d for %ld seconds\n",i,
-        					rec.file_id, rec.callsign, rec.length, rec.offset, now-rec.request_time);
+        					rec.file_id, callsign_str(rec.callsign_id), rec.length, rec.offset, now-rec.request_time);
         			if (ftl0_raw_set_file_upload_record(i, &blank_file_upload_record) == EXIT_SUCCESS) {
         				ftl0_remove_upload_file(rec.file_id);
         			} else {
@@ -1541,7 +1629,7 @@ int test_ftl0_upload_table() {
 
     /* Test core set/get functions */
     InProcessFileUpload_t file_upload_record;
-    strlcpy(file_upload_record.callsign,"G0KLA", sizeof(file_upload_record.callsign));
+    file_upload_record.callsign_id = callsign_intern("G0KLA");
     file_upload_record.file_id = 9;
     file_upload_record.length = 12345;
     file_upload_record.request_time = 1692394562;
@@ -1556,14 +1644,14 @@ int test_ftl0_upload_table() {
     if (record.file_id != file_upload_record.file_id)  {  debug_print("Wrong file id - FAILED\n"); return EXIT_FAILURE; }
     if (record.length != file_upload_record.length)  {  debug_print("Wrong length - FAILED\n"); return EXIT_FAILURE; }
     if (record.request_time != file_upload_record.request_time)  {  debug_print("Wrong request_time - FAILED\n"); return EXIT_FAILURE; }
-    if (strcmp(record.callsign, file_upload_record.callsign) != 0)  {  debug_print("Wrong callsign - FAILED\n"); return EXIT_FAILURE; }
+    if (record.callsign_id != file_upload_record.callsign_id)  {  debug_print("Wrong callsign - FAILED\n"); return EXIT_FAILURE; }
 
     uint32_t space = ftl0_get_space_reserved_by_upload_table();
     if (space != file_upload_record.length)  {  debug_print("Wrong table space - FAILED\n"); return EXIT_FAILURE; }
 
     /* Now test adding by file id */
     InProcessFileUpload_t file_upload_record2;
-    strlcpy(file_upload_record2.callsign,"AC2CZ", sizeof(file_upload_record.callsign));
+    file_upload_record2.callsign_id = callsign_intern("AC2CZ");
     file_upload_record2.file_id = 1010;
     file_upload_record2.length = 659;
     file_upload_record2.request_time = 1692394562+1;
@@ -1578,7 +1666,7 @@ int test_ftl0_upload_table() {
     if (record2.length != file_upload_record2.length)  {  debug_print("Wrong length for record 2 - FAILED\n"); return EXIT_FAILURE; }
     if (record2.offset != file_upload_record2.offset)  {  debug_print("Wrong offset for record 2 - FAILED\n"); return EXIT_FAILURE; }
     if (record2.request_time != file_upload_record2.request_time)  {  debug_print("Wrong request_time for record 2 - FAILED\n"); return EXIT_FAILURE; }
-    if (strcmp(record2.callsign, file_upload_record2.callsign) != 0)  {  debug_print("Wrong callsign for record 2 - FAILED\n"); return EXIT_FAILURE; }
+    if (record2.callsign_id != file_upload_record2.callsign_id)  {  debug_print("Wrong callsign for record 2 - FAILED\n"); return EXIT_FAILURE; }
 
     /* Test update */
     record2.offset = 98;
@@ -1591,11 +1679,11 @@ int test_ftl0_upload_table() {
     if (record_up.length != file_upload_record2.length)  {  debug_print("Wrong length for record_up - FAILED\n"); return EXIT_FAILURE; }
     if (record_up.offset != 98)  {  debug_print("Wrong offset for record_up - FAILED\n"); return EXIT_FAILURE; }
     if (record_up.request_time != file_upload_record2.request_time)  {  debug_print("Wrong request_time for record_up - FAILED\n"); return EXIT_FAILURE; }
-    if (strcmp(record_up.callsign, file_upload_record2.callsign) != 0)  {  debug_print("Wrong callsign for record_up - FAILED\n"); return EXIT_FAILURE; }
+    if (record_up.callsign_id != file_upload_record2.callsign_id)  {  debug_print("Wrong callsign for record_up - FAILED\n"); return EXIT_FAILURE; }
 
     /* Test add duplicate file id - error */
     InProcessFileUpload_t file_upload_record3;
-    strlcpy(file_upload_record3.callsign,"VE2TCP", sizeof(file_upload_record.callsign));
+    file_upload_record3.callsign_id = callsign_intern("VE2TCP");
     file_upload_record3.file_id = 1010;
     file_upload_record3.length = 6539;
     file_upload_record3.request_time = 1692394562+2;
@@ -1605,7 +1693,7 @@ int test_ftl0_upload_table() {
 
     /* Now test that we replace the oldest if all slots are full.  Currently we have added two records. */
     InProcessFileUpload_t tmp_file_upload_record;
-    strlcpy(tmp_file_upload_record.callsign,"D0MMY", sizeof(file_upload_record.callsign));
+    tmp_file_upload_record.callsign_id = callsign_intern("D0MMY");
     tmp_file_upload_record.length = 123;
     int j;
     for (j=0; j < MAX_IN_PROCESS_FILE_UPLOADS; j++) {
@@ -1629,7 +1717,7 @@ int test_ftl0_upload_table() {
     if (record4.file_id != (100 + MAX_IN_PROCESS_FILE_UPLOADS-2))  {  debug_print("Wrong second oldest file id - FAILED\n"); return EXIT_FAILURE; }
     if (record4.length != 123)  {  debug_print("Wrong length - FAILED\n"); return EXIT_FAILURE; }
     if (record4.request_time != 1692394562 + 3 + MAX_IN_PROCESS_FILE_UPLOADS-2)  {  debug_print("Wrong oldest request_time - FAILED\n"); return EXIT_FAILURE; }
-    if (strcmp(record4.callsign, "D0MMY") != 0)  {  debug_print("Wrong oldest callsign - FAILED\n"); return EXIT_FAILURE; }
+    if (record4.callsign_id != callsign_lookup("D0MMY"))  {  debug_print("Wrong oldest callsign - FAILED\n"); return EXIT_FAILURE; }
 
     /* Now clear an upload record as though it completes or is purged */
     if (ftl0_remove_file_upload_record(105) != EXIT_SUCCESS)  {  debug_print("Could not remove record for id 105 - FAILED\n"); return EXIT_FAILURE; }
@@ -1640,7 +1728,7 @@ int test_ftl0_upload_table() {
     /* Now add a new record and it should go exactly in that empty slot.  Record 105 was the 6th record added above
      * and only slot 0 and 5 were full.  So it should be in slot 6  */
     InProcessFileUpload_t file_upload_record6;
-    strlcpy(file_upload_record6.callsign,"VE2TCP", sizeof(file_upload_record.callsign));
+    file_upload_record6.callsign_id = callsign_intern("VE2TCP");
     file_upload_record6.file_id = 0x9990;
     file_upload_record6.length = 123999;
     file_upload_record6.request_time = 999;
@@ -1739,53 +1827,83 @@ int test_ftl0_list() {
 	printf("##### TEST FTL0 LIST\n");
 	int rc = EXIT_SUCCESS;
 
-	rc = ftl0_add_request("AC2CZ", 0,3);
+	rc = ftl0_add_request(callsign_intern("AC2CZ"), 0,3);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add uplink request AC2CZ for file 3\n"); return EXIT_FAILURE; }
-	rc = ftl0_add_request("G0KLA", 0, 2);
+	rc = ftl0_add_request(callsign_intern("G0KLA"), 0, 2);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add uplink request G0KLA for file 2\n"); return EXIT_FAILURE; }
-	rc = ftl0_add_request("VE2XYZ", 0, 1);
+	rc = ftl0_add_request(callsign_intern("VE2XYZ"), 0, 1);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add uplink request ve2xyz for file 1\n"); return EXIT_FAILURE; }
-	rc = ftl0_add_request("W1ABC", 0, 11);
+	rc = ftl0_add_request(callsign_intern("W1ABC"), 0, 11);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add uplink request W1ABC for file 11\n"); return EXIT_FAILURE; }
 	debug_print("TEST FULL\n");
-	rc = ftl0_add_request("G1XCX", 0, 22);
+	rc = ftl0_add_request(callsign_intern("G1XCX"), 0, 22);
 	if (rc == EXIT_SUCCESS) {printf("** Added uplink request when full\n"); return EXIT_FAILURE; }
 
 	ftl0_debug_print_list();
-	if (strcmp(uplink_list[0].callsign, "AC2CZ") != 0) {printf("** Mismatched callsign AC2CZ\n"); return EXIT_FAILURE;}
-	if (uplink_list[0].file_id != 3) {printf("** Mismatched file_id 3\n"); return EXIT_FAILURE;}
-	if (uplink_list[0].channel != 0) {printf("** Mismatched channel 0\n"); return EXIT_FAILURE;}
-	if (uplink_list[0].state != UL_CMD_OK) {printf("** Mismatched state 0\n"); return EXIT_FAILURE;}
-	if (strcmp(uplink_list[1].callsign, "G0KLA") != 0) {printf("** Mismatched callsign G0KLA\n"); return EXIT_FAILURE;}
-	if (strcmp(uplink_list[2].callsign, "VE2XYZ") != 0) {printf("** Mismatched callsign VE2XYZ\n"); return EXIT_FAILURE;}
-	if (strcmp(uplink_list[3].callsign, "W1ABC") != 0) {printf("** Mismatched callsign W1ABC\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[0].callsign_id != callsign_lookup("AC2CZ")) {printf("** Mismatched callsign AC2CZ\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[0].file_id != 3) {printf("** Mismatched file_id 3\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[0].channel != 0) {printf("** Mismatched channel 0\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[0].state != UL_CMD_OK) {printf("** Mismatched state 0\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[1].callsign_id != callsign_lookup("G0KLA")) {printf("** Mismatched callsign G0KLA\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[2].callsign_id != callsign_lookup("VE2XYZ")) {printf("** Mismatched callsign VE2XYZ\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[3].callsign_id != callsign_lookup("W1ABC")) {printf("** Mismatched callsign W1ABC\n"); return EXIT_FAILURE;}
 
-	current_station_on_uplink = 3;
+	ul->current_station_on_uplink = 3;
 
 	debug_print("REMOVE a middle item\n");
 	rc = ftl0_remove_request(2);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove middle uplink request\n"); return EXIT_FAILURE; }
-	if (strcmp(uplink_list[2].callsign, "W1ABC") != 0) {printf("** Mismatched callsign W1ABC\n"); return EXIT_FAILURE;}
-	if (current_station_on_uplink != 2) {printf("** Mismatched current_station_on_uplink, expected 2\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[2].callsign_id != callsign_lookup("W1ABC")) {printf("** Mismatched callsign W1ABC\n"); return EXIT_FAILURE;}
+	if (ul->current_station_on_uplink != 2) {printf("** Mismatched current_station_on_uplink, expected 2\n"); return EXIT_FAILURE;}
 
 	debug_print("REMOVE last item\n");
 	rc = ftl0_remove_request(2);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove last uplink request\n"); return EXIT_FAILURE; }
-	if (strcmp(uplink_list[0].callsign, "AC2CZ") != 0) {printf("** Mismatched callsign AC2CZ\n"); return EXIT_FAILURE;}
-	if (strcmp(uplink_list[1].callsign, "G0KLA") != 0) {printf("** Mismatched callsign G0KLA\n"); return EXIT_FAILURE;}
-	if (strcmp(uplink_list[2].callsign, "W1ABC") != 0) {printf("** Mismatched callsign W1ABC\n"); return EXIT_FAILURE;}
-	if (current_station_on_uplink != 0) {printf("** Mismatched current_station_on_uplink, expected 0\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[0].callsign_id != callsign_lookup("AC2CZ")) {printf("** Mismatched callsign AC2CZ\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[1].callsign_id != callsign_lookup("G0KLA")) {printf("** Mismatched callsign G0KLA\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[2].callsign_id != callsign_lookup("W1ABC")) {printf("** Mismatched callsign W1ABC\n"); return EXIT_FAILURE;}
+	if (ul->current_station_on_uplink != 0) {printf("** Mismatched current_station_on_uplink, expected 0\n"); return EXIT_FAILURE;}
 
 	// Add another
-	rc = ftl0_add_request("G1XCX", 0, 22);
+	rc = ftl0_add_request(callsign_intern("G1XCX"), 0, 22);
 	if (rc != EXIT_SUCCESS) {printf("** Could not add uplink request G1XCX for file 22\n"); return EXIT_FAILURE; }
 
 	debug_print("REMOVE Head\n");
 	rc = ftl0_remove_request(0);
 	if (rc != EXIT_SUCCESS) {printf("** Could not remove First uplink request\n"); return EXIT_FAILURE; }
-	if (strcmp(uplink_list[0].callsign, "G0KLA") != 0) {printf("** Mismatched callsign G0KLA\n"); return EXIT_FAILURE;}
-	if (strcmp(uplink_list[1].callsign, "G1XCX") != 0) {printf("** Mismatched callsign G1XCX\n"); return EXIT_FAILURE;}
-	if (current_station_on_uplink != 0) {printf("** Mismatched current_station_on_uplink, expected 0\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[0].callsign_id != callsign_lookup("G0KLA")) {printf("** Mismatched callsign G0KLA\n"); return EXIT_FAILURE;}
+	if (ul->uplink_list[1].callsign_id != callsign_lookup("G1XCX")) {printf("** Mismatched callsign G1XCX\n"); return EXIT_FAILURE;}
+	if (ul->current_station_on_uplink != 0) {printf("** Mismatched current_station_on_uplink, expected 0\n"); return EXIT_FAILURE;}
+
+	debug_print("Each port has its own list\n");
+	int ports = g_number_of_ports;
+	g_number_of_ports = 2;
+	ftl0_select_port(1);
+	if (ftl0_add_request(callsign_intern("G0KLA"), 1, 5) != EXIT_SUCCESS) {printf("** Could not add G0KLA to port 1\n"); rc = EXIT_FAILURE;}
+	if (ul->number_on_uplink != 1) {printf("** Wrong number on port 1 uplink\n"); rc = EXIT_FAILURE;}
+	if (!ftl0_on_the_uplink_now(5)) {printf("** File 5 on port 1 not found on the uplink\n"); rc = EXIT_FAILURE;}
+	ftl0_remove_request(0);
+	ftl0_select_port(0);
+	if (ul->number_on_uplink != 2) {printf("** Port 0 uplink changed by port 1\n"); rc = EXIT_FAILURE;}
+	g_number_of_ports = 1;
+	ftl0_select_port(1);
+	if (ul != &ftl0_ports[0]) {printf("** Port 1 did not use the port 0 list\n"); rc = EXIT_FAILURE;}
+	g_number_of_ports = ports;
+
+	debug_print("A station times out when it is not the current station\n");
+	int on_uplink = ul->number_on_uplink;
+	if (ftl0_add_request(callsign_intern("AC2CZ"), 0, 6) != EXIT_SUCCESS) {printf("** Could not add AC2CZ\n"); rc = EXIT_FAILURE;}
+	if (ftl0_add_request(callsign_intern("G4ABC"), 0, 7) != EXIT_SUCCESS) {printf("** Could not add G4ABC\n"); rc = EXIT_FAILURE;}
+	timer_start(&ftl0_timer_wheel, &ul->uplink_list[on_uplink].t3_timer, 0); /* Time out on the next tick */
+	timer_wheel_advance(&ftl0_timer_wheel, ftl0_timer_wheel.tick * TIMER_TICK_MS);
+	if (ul->number_on_uplink != on_uplink + 1 || ftl0_get_list_number_by_callsign(callsign_lookup("AC2CZ")) != -1) {
+		printf("** AC2CZ did not time out\n"); rc = EXIT_FAILURE;}
+	if (ul->uplink_list[on_uplink].callsign_id != callsign_lookup("G4ABC") || !timer_pending(&ul->uplink_list[on_uplink].session_timer)
+			|| timer_pending(&ul->uplink_list[on_uplink + 1].session_timer)) {
+		printf("** Session timer did not move with G4ABC\n"); rc = EXIT_FAILURE;}
+	ftl0_remove_request(on_uplink);
+	if (ftl0_timer_wheel.count != g_number_of_ports + on_uplink) {
+		printf("** Expected %d timers but have %d\n", g_number_of_ports + on_uplink, ftl0_timer_wheel.count); rc = EXIT_FAILURE;}
 
 	ftl0_next_action();
 
@@ -0,0 +1,105 @@
+/*
+ * agw_emulator.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef AGW_EMULATOR_H_
+#define AGW_EMULATOR_H_
+
+#include <stdint.h>
+#include "config.h"
+#include "agw_tnc.h"
+#include "ax25_tools.h"
+
+#define EMU_MAX_STATIONS 32 /* Ground stations in a script */
+#define EMU_QUEUE_LEN 128 /* Frames waiting for the virtual uplink or downlink */
+#define EMU_MAX_FRAME_LEN (AX25_MAX_DATA_LEN + sizeof(AX25_HEADER))
+#define EMU_MAX_FILE_SIZE (1024 * 1024) /* Largest file a station can download */
+#define EMU_BLOCK_SIZE 244 /* Block size sent in requests */
+#define EMU_UPLOAD_BLOCK_SIZE 200 /* Bytes in each FTL0 DATA packet */
+#define EMU_RETRY_MS 15000 /* A station asks again if it hears nothing for its request for this long */
+#define EMU_MAX_REQUESTS 10 /* A station gives up after this many requests */
+#define EMU_FRAME_OVERHEAD_BYTES 4 /* Flags and FCS added to each frame on the air */
+#define EMU_DEFAULT_DURATION 600 /* Seconds the benchmark runs for if the script does not say */
+
+#define EMU_ACTION_DIR 1
+#define EMU_ACTION_FILE 2
+#define EMU_ACTION_UPLOAD 3
+
+#define EMU_WAITING 0
+#define EMU_ACTIVE 1
+#define EMU_DONE 2
+#define EMU_FAILED 3
+
+/* A scripted ground station */
+struct emu_station {
+	int start; /* Seconds after pacsat connects that the station makes its request */
+	char callsign[MAX_CALLSIGN_LEN];
+	int action;
+	uint32_t file_id; /* The file to download */
+	char path[MAX_FILE_PATH_LEN]; /* The PACSAT file to upload */
+	int state;
+	int requests; /* Requests sent, including the first */
+	int rejected; /* NO responses */
+	uint64_t started_ms;
+	uint64_t finished_ms;
+	uint64_t last_heard_ms; /* The last frame that helped this request */
+	uint64_t last_request_ms;
+	/* Downloads */
+	unsigned char *have; /* A bit for each byte of the file that has been received */
+	uint32_t file_size; /* 0 until the last chunk of the file is heard */
+	uint32_t unique_bytes;
+	uint32_t duplicate_bytes;
+	int dir_pfhs; /* Directory headers heard in full */
+	/* Uploads */
+	unsigned char *upload;
+	uint32_t upload_len;
+};
+typedef struct emu_station EMU_STATION;
+
+/* A frame on its way across the virtual uplink or downlink */
+struct emu_frame {
+	struct t_agw_header header;
+	unsigned char data[EMU_MAX_FRAME_LEN];
+	uint64_t done_ms; /* When the last bit is on the air */
+};
+typedef struct emu_frame EMU_FRAME;
+
+struct emu_queue {
+	EMU_FRAME frames[EMU_QUEUE_LEN];
+	int head;
+	int count;
+	uint64_t busy_until_ms; /* The channel is busy until the last frame queued is sent */
+	int overflow; /* Frames dropped because the queue was full */
+};
+typedef struct emu_queue EMU_QUEUE;
+
+/* The settings read from the script */
+struct emu_settings {
+	int bit_rate;
+	int loss_percent; /* Chance that a UI frame is not heard */
+	uint32_t seed;
+	int duration; /* Seconds */
+};
+typedef struct emu_settings EMU_SETTINGS;
+
+int emu_load_script(char *filename);
+int emu_run(char *script_filename, int port);
+int test_agw_emulator();
+
+#endif /* AGW_EMULATOR_H_ */
@@ -43,14 +43,38 @@ extern int g_serial_fd; // file handle for the serial port for Rig control
 #define DIGI_CALLSIGN "digi_callsign"
 #define MAX_FRAMES_IN_TX_BUFFER "max_frames_in_tx_buffer"
 #define CONFIG_UPLOAD_TABLE_PATH "upload_table_path"
+#define MAX_PB_LENGTH_KEY "max_pb_length"
+#define PB_SCHEDULER_KEY "pb_scheduler"
+#define PB_DRR_QUANTUM_KEY "pb_drr_quantum"
+#define STATS_FILE_PATH_KEY "stats_file_path"
+#define TX_TARGET_LATENCY_KEY "tx_target_latency_ms"
+#define PASS_SCHEDULE_PATH_KEY "pass_schedule_path"
+#define RX_BATCH_BUDGET_KEY "rx_batch_budget"
+#define NUMBER_OF_PORTS_KEY "number_of_ports"
+
+#define RX_DEFAULT_BATCH_BUDGET 16 /* Received frames processed back to back before the periodic work runs */
+#define MAX_PORTS 4 /* AGW radio ports.  Each has its own PB, uplink list and TX pacing */
+#define TNC_UI_PORTS 1 /* Ports the AGW library can send UI frames on.  number_of_ports is limited to this */
 
 extern int g_bit_rate;		   /* the bit rate of the TNC - 1200 4800 9600 - this is only used to calculate delays.  Change actual value in DireWolf) */
 extern char g_bbs_callsign[MAX_CALLSIGN_LEN];
 extern char g_broadcast_callsign[MAX_CALLSIGN_LEN];
 extern char g_digi_callsign[MAX_CALLSIGN_LEN];
-extern int g_max_frames_in_tx_buffer;
+extern int g_max_frames_in_tx_buffer; /* the starting TX window.  It is then adjusted by the TX pacing */
 extern char g_upload_table_path[MAX_FILE_PATH_LEN];
+extern int g_max_pb_length; /* the number of stations that can be on the PB at one time.  Only read at startup */
+extern char g_pb_scheduler[MAX_CONFIG_LINE_LENGTH]; /* rr or drr.  Only read at startup */
+extern int g_pb_drr_quantum; /* bytes of airtime given to a station each turn by the drr scheduler */
+extern char g_stats_file_path[MAX_FILE_PATH_LEN]; /* the per pass statistics are appended to this file */
+extern int g_tx_target_latency_ms; /* the TX window shrinks if frames take longer than this to get on the air */
+extern char g_pass_schedule_path[MAX_FILE_PATH_LEN]; /* AOS,LOS times of the passes, used for PB admission control */
+extern int g_rx_batch_budget; /* the most received frames processed before the PB, FTL0 and maintenance get a turn */
+extern int g_number_of_ports; /* the AGW radio ports we use, from port 0.  Only read at startup */
 
 void load_config(char *filename);
+void config_read_lock();
+void config_read_unlock();
+void config_write_lock();
+void config_write_unlock();
 
 #endif /* CONFIG_H_ */
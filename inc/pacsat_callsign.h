@@ -0,0 +1,44 @@
+/*
+ * pacsat_callsign.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_CALLSIGN_H_
+#define PACSAT_CALLSIGN_H_
+
+#include <stdint.h>
+#include "common_config.h"
+
+#define CALLSIGN_TABLE_SIZE 4096 /* Callsigns that can be interned.  Must be a power of 2 */
+#define CALLSIGN_ID_NONE 0 /* Not a callsign, or every id is held */
+
+typedef uint16_t CALLSIGN_ID;
+
+extern CALLSIGN_ID g_bbs_callsign_id;
+extern CALLSIGN_ID g_broadcast_callsign_id;
+
+void callsign_init();
+CALLSIGN_ID callsign_intern(char *callsign);
+CALLSIGN_ID callsign_lookup(char *callsign);
+void callsign_hold(CALLSIGN_ID id);
+void callsign_release(CALLSIGN_ID id);
+char * callsign_str(CALLSIGN_ID id);
+int callsign_count();
+int test_callsign();
+
+#endif /* PACSAT_CALLSIGN_H_ */
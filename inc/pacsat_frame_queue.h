@@ -0,0 +1,62 @@
+/*
+ * pacsat_frame_queue.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_FRAME_QUEUE_H_
+#define PACSAT_FRAME_QUEUE_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "common_config.h"
+#include "agw_tnc.h"
+#include "ax25_tools.h"
+#include "pacsat_callsign.h"
+
+#define FQ_LEN 32 /* Frames that can wait in each queue.  Must be a power of 2 */
+#define FQ_CONNECTED_WAIT_MS 5000 /* How long the receive loop waits for room for a connected mode frame */
+#define FQ_MAX_DATA_LEN (AX25_MAX_DATA_LEN + sizeof(AX25_HEADER)) /* Monitored frames include the AX25 header */
+
+/* A copy of a frame from the receive buffer.  The TNC listen thread reuses its buffer, so the
+ * frame must be copied before it is passed to another thread */
+struct fq_frame {
+	struct t_agw_header header;
+	CALLSIGN_ID from_id; /* Interned by the receive loop.  The thread that processes the frame releases it */
+	CALLSIGN_ID to_id;
+	unsigned char data[FQ_MAX_DATA_LEN];
+};
+typedef struct fq_frame FQ_FRAME;
+
+/* A queue with one thread that puts frames and one thread that gets them */
+struct frame_queue {
+	atomic_uint head; /* The next frame to get.  Only changed by the thread that gets frames */
+	atomic_uint tail; /* Where the next frame is put.  Only changed by the thread that puts frames */
+	uint32_t dropped; /* Frames that did not fit */
+	FQ_FRAME frames[FQ_LEN];
+};
+typedef struct frame_queue FRAME_QUEUE;
+
+void fq_init(FRAME_QUEUE *queue);
+int fq_put(FRAME_QUEUE *queue, struct t_agw_frame_ptr *frame, CALLSIGN_ID from_id, CALLSIGN_ID to_id);
+int fq_put_wait(FRAME_QUEUE *queue, struct t_agw_frame_ptr *frame, CALLSIGN_ID from_id, CALLSIGN_ID to_id, int max_wait_ms);
+FQ_FRAME * fq_peek(FRAME_QUEUE *queue);
+void fq_pop(FRAME_QUEUE *queue);
+int fq_len(FRAME_QUEUE *queue);
+int test_frame_queue();
+
+#endif /* PACSAT_FRAME_QUEUE_H_ */
@@ -0,0 +1,63 @@
+/*
+ * pacsat_timer.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_TIMER_H_
+#define PACSAT_TIMER_H_
+
+#include <stdint.h>
+
+#define TIMER_TICK_MS 100 /* Timers expire on a tick of the wheel */
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS) /* Slots in each level of the wheel */
+#define TIMER_SLOT_MASK (TIMER_SLOTS - 1)
+#define TIMER_LEVELS 4 /* 64^4 ticks, which is about 19 days.  Later timers expire then */
+#define TIMER_MAX_TICKS (1 << (TIMER_SLOT_BITS * TIMER_LEVELS))
+
+typedef struct timer TIMER;
+typedef struct timer_wheel TIMER_WHEEL;
+typedef void (*TIMER_CALLBACK)(TIMER *timer, void *arg, uint64_t now_ms);
+
+/* A timer is embedded in the structure that it times, so starting one never allocates memory */
+struct timer {
+	TIMER *next; /* In the slot of the wheel, which is a circular list */
+	TIMER *prev;
+	TIMER_WHEEL *wheel; /* The wheel the timer is on while it is pending */
+	uint64_t expires; /* The tick that the timer expires on */
+	TIMER_CALLBACK callback;
+	void *arg;
+	int pending; /* True while the timer is on a wheel */
+};
+
+struct timer_wheel {
+	TIMER slots[TIMER_LEVELS][TIMER_SLOTS]; /* The head of the list for each slot */
+	uint64_t tick; /* The next tick to process */
+	int count; /* Pending timers, so an empty wheel can skip ahead */
+};
+
+void timer_wheel_init(TIMER_WHEEL *wheel, uint64_t now_ms);
+void timer_init(TIMER *timer, TIMER_CALLBACK callback, void *arg);
+void timer_start(TIMER_WHEEL *wheel, TIMER *timer, uint64_t expires_ms);
+void timer_stop(TIMER *timer);
+int timer_pending(TIMER *timer);
+void timer_move(TIMER *to, TIMER *from);
+void timer_wheel_advance(TIMER_WHEEL *wheel, uint64_t now_ms);
+int test_timer_wheel();
+
+#endif /* PACSAT_TIMER_H_ */
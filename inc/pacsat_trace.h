@@ -0,0 +1,80 @@
+/*
+ * pacsat_trace.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_TRACE_H_
+#define PACSAT_TRACE_H_
+
+#include <stdint.h>
+#include "agw_tnc.h"
+
+#define TRACE_MAGIC "PTRC"
+#define TRACE_VERSION 1
+#define TRACE_RX 'R' /* A frame received from the TNC */
+#define TRACE_TX 'T' /* A frame sent to the TNC */
+#define TRACE_MAX_STATIONS 32 /* Stations waiting for a response that we measure the latency for */
+#define TRACE_MAX_DATA_LEN 2048
+
+struct trace_file_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t start_time; /* Unix time when the recording started */
+} __attribute__ ((__packed__));
+typedef struct trace_file_header TRACE_FILE_HEADER;
+
+/* Each frame in the trace is this header followed by data_len bytes */
+struct trace_record {
+	uint32_t time_ms; /* Since the recording started */
+	char direction; /* TRACE_RX or TRACE_TX */
+	char data_kind; /* The AGW frame kind */
+	uint8_t pid;
+	uint8_t port;
+	char call_from[10];
+	char call_to[10];
+	uint16_t data_len;
+} __attribute__ ((__packed__));
+typedef struct trace_record TRACE_RECORD;
+
+/* The results of a replay */
+struct trace_stats {
+	uint32_t rx_frames; /* Frames fed to the receive loop */
+	uint32_t recorded_tx_frames; /* Frames that were sent when the trace was recorded */
+	uint32_t tx_frames; /* Frames sent during the replay, which were captured */
+	uint32_t responses; /* Frames sent to a station that was waiting for a response */
+	uint64_t total_latency_ms;
+	uint32_t max_latency_ms;
+};
+typedef struct trace_stats TRACE_STATS;
+
+int trace_record_open(char *filename);
+int trace_replay_open(char *filename);
+void trace_close();
+int trace_replaying();
+void trace_received(struct t_agw_frame_ptr *frame, uint64_t now_ms);
+void trace_sent(int port, char data_kind, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len, uint64_t now_ms);
+int trace_read_next(uint32_t *time_ms, struct t_agw_header *header, unsigned char *data);
+int trace_send_raw_packet(int port, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len);
+int trace_send_connected_data(char *from_callsign, char *to_callsign, int channel, unsigned char *bytes, int len);
+int trace_disconnect(char *from_callsign, char *to_callsign, int channel);
+void trace_get_stats(TRACE_STATS *stats);
+void trace_print_report(uint32_t elapsed_ms);
+int test_trace();
+
+#endif /* PACSAT_TRACE_H_ */
@@ -0,0 +1,56 @@
+/*
+ * pacsat_tx.h
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#ifndef PACSAT_TX_H_
+#define PACSAT_TX_H_
+
+#include <stdint.h>
+
+#define TX_MIN_WINDOW 1 /* Always allow at least one frame to be queued in the TNC */
+#define TX_MAX_WINDOW 16 /* Never queue more frames than this in the TNC */
+#define TX_MAX_OUTSTANDING 64 /* Frames we keep track of until they are confirmed */
+#define TX_DEFAULT_TARGET_LATENCY_MS 3000 /* A frame should be on the air this soon after we queue it */
+#define TX_CONFIRM_TIMEOUT_FACTOR 4 /* Assume a frame was sent if it is not confirmed after this many times the target latency */
+
+/* Transmit classes in priority order.  A class is only sent when the ones above it are empty, except
+ * that connected mode frames do not wait for UI frames that are waiting for the window */
+#define TX_CLASS_CONTROL 0 /* OK and NO responses */
+#define TX_CLASS_CONNECTED 1 /* All connected mode FTL0 frames, in the order they were queued.  Never dropped */
+#define TX_CLASS_BULK 2 /* Status frames.  The PB sends its broadcasts after these */
+#define TX_NUMBER_OF_CLASSES 3
+#define TX_QUEUE_LEN 16 /* Frames that can wait in each class */
+
+void tx_init();
+uint64_t tx_now_ms();
+int tx_send_raw_packet(int port, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len);
+int tx_queue_raw_packet(int port, int tx_class, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len);
+int tx_queue_connected_data(char *from_callsign, char *to_callsign, int channel, unsigned char *bytes, int len);
+void tx_next_action(uint64_t now_ms);
+int tx_get_queue_len(int port, int tx_class);
+void tx_frame_sent(int port, int len, uint64_t now_ms);
+void tx_frame_confirmed(int port, uint64_t now_ms);
+int tx_busy(int port, uint64_t now_ms);
+int tx_get_window(int port);
+int tx_get_frames_queued(int port);
+uint32_t tx_get_queued_airtime_ms(int port);
+int test_tx_pacing();
+int test_tx_queue();
+
+#endif /* PACSAT_TX_H_ */
@@ -39,6 +39,12 @@
 #define FTL0_MAX_FILE_SIZE "ftl0_max_file_size"
 #define FTL0_MAX_UPLOAD_AGE_IN_IN_SECONDS "ftl0_max_upload_age_in_seconds"
 #define STATE_PACSAT_LOG_LEVEL "pacsat_log_level"
+#define PB_BSTAT_PERIOD_IN_SECONDS "pb_bstat_period_in_seconds"
+#define STATS_PASS_IDLE_PERIOD_IN_SECONDS "stats_pass_idle_period_in_seconds"
+#define PB_IDLE_PERIOD_IN_SECONDS "pb_idle_period_in_seconds"
+#define PB_RECENT_WINDOW_IN_SECONDS "pb_recent_window_in_seconds"
+#define PB_FOUNTAIN_REPAIR_PERCENT "pb_fountain_repair_percent"
+#define PB_ADMISSION_SLACK_PERCENT "pb_admission_slack_percent"
 
 extern int g_state_pb_open;
 extern int g_state_uplink_open;
@@ -54,6 +60,12 @@ extern int g_dir_next_file_number;
 extern int g_ftl0_max_file_size;
 extern int g_ftl0_max_upload_age_in_seconds;
 extern int g_state_pacsat_log_level;
+extern int g_pb_bstat_period_in_seconds;
+extern int g_stats_pass_idle_period_in_seconds;
+extern int g_pb_idle_period_in_seconds;
+extern int g_pb_recent_window_in_seconds;
+extern int g_pb_fountain_repair_percent;
+extern int g_pb_admission_slack_percent;
 
 void load_state(char *filename);
 void save_state();
@@ -0,0 +1,968 @@
+/*
+ * agw_emulator.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * A stand in for Direwolf and the radio, so the PB and FTL0 can be load tested
+ * on the bench.  It is started with "pacsat -e script" and listens on the AGW
+ * port.  A second copy of pacsat, started normally, connects to it as if it
+ * was the TNC.
+ *
+ * It speaks the part of the AGW protocol that pacsat uses.  Callsigns are
+ * registered with 'X', 'k' and 'm' turn on monitoring and raw UI frames are sent
+ * with 'K'.  Each 'K' frame takes its airtime on a virtual downlink at the
+ * script bit rate and is then confirmed with a 'T' frame.  Connected mode
+ * frames arrive with 'C', 'D' and 'd'.
+ *
+ * The script lists ground stations and when they start.  Each one makes a DIR
+ * request, a FILE request or an FTL0 upload.  They hear the broadcasts through a
+ * loss model that drops each UI frame with the script loss_percent, using a
+ * seeded random number so that a run can be repeated.  A station that hears
+ * nothing for its request for EMU_RETRY_MS asks again, with a hole list for a
+ * file.  Connected mode frames are not lost, but a frame that would have been
+ * lost takes its airtime twice, as AX25 would send it again.
+ *
+ * A script looks like this:
+ *
+ *   # Settings
+ *   bit_rate=9600
+ *   loss_percent=5
+ *   seed=1
+ *   duration=600
+ *   # seconds,callsign,dir|file|upload,file id or upload path
+ *   0,G0KLA,dir
+ *   5,AC2CZ,file,1a2
+ *   10,VE2XYZ,upload,/home/pi/test.act
+ *
+ * When every station has finished, or the duration has passed, the emulator
+ * prints how much was sent and how well each station did, and exits.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "state_file.h"
+#include "debug.h"
+#include "str_util.h"
+#include "pacsat_tx.h"
+#include "pacsat_broadcast.h"
+#include "ftl0.h"
+#include "agw_emulator.h"
+
+/* Forward declarations */
+static void emu_uplink(char kind, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len, uint64_t now_ms);
+
+/* Local variables */
+static EMU_SETTINGS emu_settings;
+static EMU_STATION emu_stations[EMU_MAX_STATIONS];
+static int emu_number_of_stations = 0;
+static EMU_QUEUE emu_downlink; /* Frames from pacsat to the ground */
+static EMU_QUEUE emu_uplink_queue; /* Frames from the ground to pacsat */
+static int emu_client = -1; /* The socket pacsat is connected on */
+static int emu_monitor_raw = false; /* Set by 'k'.  UI frames are only passed to pacsat once it asks for them */
+static uint32_t emu_random_state = 1;
+static uint64_t emu_start_ms = 0;
+
+/* Totals for the report */
+static uint32_t emu_downlink_frames = 0;
+static uint32_t emu_downlink_bytes = 0;
+static uint32_t emu_dir_bytes = 0;
+static uint32_t emu_file_bytes = 0;
+static uint32_t emu_downlink_airtime_ms = 0;
+static uint32_t emu_uplink_frames = 0;
+static uint32_t emu_uplink_lost = 0;
+static uint32_t emu_retransmissions = 0;
+
+/**
+ * emu_random()
+ *
+ * A small xorshift generator.  It is seeded from the script so a run can be repeated.
+ */
+static uint32_t emu_random() {
+	uint32_t x = emu_random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	emu_random_state = x;
+	return x;
+}
+
+static void emu_seed(uint32_t seed) {
+	emu_random_state = (seed == 0) ? 1 : seed;
+}
+
+/* Returns true if the loss model drops this frame */
+static int emu_lost() {
+	if (emu_settings.loss_percent <= 0) return false;
+	return (emu_random() % 100) < emu_settings.loss_percent;
+}
+
+/**
+ * emu_airtime_ms()
+ *
+ * Return the time a frame of len bytes takes to send at the script bit rate.
+ */
+static uint32_t emu_airtime_ms(int len) {
+	if (emu_settings.bit_rate <= 0) return 0;
+	return (uint32_t)(((uint64_t)(len + EMU_FRAME_OVERHEAD_BYTES) * 8 * 1000) / emu_settings.bit_rate);
+}
+
+/**
+ * emu_load_script()
+ *
+ * Read the settings and the ground stations from the script.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the script could not be read
+ */
+int emu_load_script(char *filename) {
+	emu_settings.bit_rate = g_bit_rate;
+	emu_settings.loss_percent = 0;
+	emu_settings.seed = 1;
+	emu_settings.duration = EMU_DEFAULT_DURATION;
+	for (int i=0; i < emu_number_of_stations; i++) {
+		free(emu_stations[i].have);
+		free(emu_stations[i].upload);
+	}
+	memset(emu_stations, 0, sizeof(emu_stations));
+	emu_number_of_stations = 0;
+
+	FILE *file = fopen(filename, "r");
+	if (file == NULL) {
+		error_print("Could not open emulator script: %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	char line[MAX_CONFIG_LINE_LENGTH];
+	while (fgets(line, sizeof line, file) != NULL) {
+		if (line[0] == '#') continue;
+		char key[MAX_CONFIG_LINE_LENGTH];
+		int value;
+		if (sscanf(line, "%[^=\n]=%d", key, &value) == 2) {
+			if (strcmp(key, "bit_rate") == 0)
+				emu_settings.bit_rate = value;
+			else if (strcmp(key, "loss_percent") == 0)
+				emu_settings.loss_percent = value;
+			else if (strcmp(key, "seed") == 0)
+				emu_settings.seed = value;
+			else if (strcmp(key, "duration") == 0)
+				emu_settings.duration = value;
+			else
+				error_print("Unknown key in %s file: %s\n", filename, key);
+			continue;
+		}
+
+		int start;
+		char callsign[MAX_CALLSIGN_LEN];
+		char action[16];
+		char arg[MAX_FILE_PATH_LEN] = "";
+		if (sscanf(line, "%d,%9[^,],%15[^,\n],%255[^\n]", &start, callsign, action, arg) < 3) continue;
+		if (emu_number_of_stations == EMU_MAX_STATIONS) {
+			error_print("Script has more than %d stations.  The rest are ignored\n", EMU_MAX_STATIONS);
+			break;
+		}
+		EMU_STATION *station = &emu_stations[emu_number_of_stations];
+		station->start = start;
+		strlcpy(station->callsign, callsign, sizeof(station->callsign));
+		if (strcmp(action, "dir") == 0) {
+			station->action = EMU_ACTION_DIR;
+		} else if (strcmp(action, "file") == 0) {
+			station->action = EMU_ACTION_FILE;
+			station->file_id = strtol(arg, NULL, 16);
+		} else if (strcmp(action, "upload") == 0) {
+			station->action = EMU_ACTION_UPLOAD;
+			strlcpy(station->path, arg, sizeof(station->path));
+		} else {
+			error_print("Unknown action for %s in script: %s\n", callsign, action);
+			continue;
+		}
+		emu_number_of_stations++;
+	}
+	fclose(file);
+	emu_seed(emu_settings.seed);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * emu_queue_put()
+ *
+ * Put a frame on a virtual channel.  It is sent after the frames already queued, so it is
+ * done when the channel has been busy for its airtime after them.  extra_ms is added for a
+ * retransmission.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the queue is full or the frame is too long
+ */
+static int emu_queue_put(EMU_QUEUE *queue, struct t_agw_header *header, unsigned char *data, uint64_t now_ms, uint32_t extra_ms) {
+	if (queue->count == EMU_QUEUE_LEN || header->data_len < 0 || header->data_len > EMU_MAX_FRAME_LEN) {
+		queue->overflow++;
+		return EXIT_FAILURE;
+	}
+	EMU_FRAME *frame = &queue->frames[(queue->head + queue->count) % EMU_QUEUE_LEN];
+	frame->header = *header;
+	memcpy(frame->data, data, header->data_len);
+	uint64_t start = queue->busy_until_ms > now_ms ? queue->busy_until_ms : now_ms;
+	frame->done_ms = start + emu_airtime_ms(header->data_len) + extra_ms;
+	queue->busy_until_ms = frame->done_ms;
+	queue->count++;
+	return EXIT_SUCCESS;
+}
+
+/* Returns the frame at the front of the queue if it has finished sending, or NULL */
+static EMU_FRAME *emu_queue_done(EMU_QUEUE *queue, uint64_t now_ms) {
+	if (queue->count == 0) return NULL;
+	EMU_FRAME *frame = &queue->frames[queue->head];
+	if (frame->done_ms > now_ms) return NULL;
+	return frame;
+}
+
+static void emu_queue_pop(EMU_QUEUE *queue) {
+	if (queue->count == 0) return;
+	queue->head = (queue->head + 1) % EMU_QUEUE_LEN;
+	queue->count--;
+}
+
+/**
+ * emu_write_all()
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the socket closed
+ */
+static int emu_write_all(int fd, void *buffer, int len) {
+	unsigned char *p = buffer;
+	while (len > 0) {
+		int n = write(fd, p, len);
+		if (n <= 0) return EXIT_FAILURE;
+		p += n;
+		len -= n;
+	}
+	return EXIT_SUCCESS;
+}
+
+static int emu_read_all(int fd, void *buffer, int len) {
+	unsigned char *p = buffer;
+	while (len > 0) {
+		int n = read(fd, p, len);
+		if (n <= 0) return EXIT_FAILURE;
+		p += n;
+		len -= n;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * emu_send_to_client()
+ *
+ * Send an AGW frame to pacsat.
+ */
+static int emu_send_to_client(char kind, char *from_callsign, char *to_callsign, int pid, unsigned char *data, int len) {
+	if (emu_client < 0) return EXIT_SUCCESS; /* The self test has no client */
+	struct t_agw_header header;
+	memset(&header, 0, sizeof(header));
+	header.data_kind = kind;
+	header.pid = pid;
+	strlcpy(header.call_from, from_callsign, sizeof(header.call_from));
+	strlcpy(header.call_to, to_callsign, sizeof(header.call_to));
+	header.data_len = len;
+	if (emu_write_all(emu_client, &header, sizeof(header)) != EXIT_SUCCESS) return EXIT_FAILURE;
+	if (len > 0)
+		return emu_write_all(emu_client, data, len);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * emu_encode_address()
+ *
+ * Put a callsign into an AX25 address field.  Each character is shifted left one bit and the
+ * SSID goes in the seventh byte.
+ */
+static void emu_encode_address(unsigned char *address, char *callsign, int last) {
+	char call[MAX_CALLSIGN_LEN];
+	int ssid = 0;
+	strlcpy(call, callsign, sizeof(call));
+	char *dash = strchr(call, '-');
+	if (dash != NULL) {
+		ssid = atoi(dash + 1);
+		*dash = 0;
+	}
+	int len = strlen(call);
+	for (int i=0; i < 6; i++)
+		address[i] = (i < len ? toupper((unsigned char)call[i]) : ' ') << 1;
+	address[6] = 0x60 | ((ssid & 0x0f) << 1) | (last ? 1 : 0);
+}
+
+/**
+ * emu_make_ui_frame()
+ *
+ * Make the data of a 'K' frame, which is the AX25 header followed by the info bytes.
+ *
+ * Returns the length of the frame or 0 if it is too long
+ */
+static int emu_make_ui_frame(unsigned char *frame, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len) {
+	if (len + sizeof(AX25_HEADER) > EMU_MAX_FRAME_LEN) return 0;
+	AX25_HEADER *header = (AX25_HEADER *)frame;
+	header->flag = 0; /* The TNC port */
+	emu_encode_address(header->dest, to_callsign, false);
+	emu_encode_address(header->src, from_callsign, true);
+	header->control = 0x03; /* UI frame */
+	header->pid = pid;
+	memcpy(frame + sizeof(AX25_HEADER), bytes, len);
+	return len + sizeof(AX25_HEADER);
+}
+
+/**
+ * emu_uplink()
+ *
+ * A ground station sends a frame.  It reaches pacsat once it has been sent on the virtual uplink.
+ * UI frames pass through the loss model when they arrive.
+ */
+static void emu_uplink(char kind, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len, uint64_t now_ms) {
+	struct t_agw_header header;
+	unsigned char data[EMU_MAX_FRAME_LEN];
+	memset(&header, 0, sizeof(header));
+	header.data_kind = kind;
+	header.pid = pid;
+	strlcpy(header.call_from, from_callsign, sizeof(header.call_from));
+	strlcpy(header.call_to, to_callsign, sizeof(header.call_to));
+	if (kind == 'K') {
+		header.data_len = emu_make_ui_frame(data, from_callsign, to_callsign, pid, bytes, len);
+		if (header.data_len == 0) return;
+	} else {
+		if (len > EMU_MAX_FRAME_LEN) return;
+		memcpy(data, bytes, len);
+		header.data_len = len;
+	}
+	uint32_t extra_ms = 0;
+	if (kind != 'K' && emu_lost()) {
+		extra_ms = emu_airtime_ms(len);
+		emu_retransmissions++;
+	}
+	if (emu_queue_put(&emu_uplink_queue, &header, data, now_ms, extra_ms) != EXIT_SUCCESS)
+		error_print("Emulator uplink queue full, frame from %s dropped\n", from_callsign);
+}
+
+/* Bit map of the bytes of a file that a station has */
+static int emu_has_byte(EMU_STATION *station, uint32_t offset) {
+	return (station->have[offset / 8] >> (offset % 8)) & 1;
+}
+
+/**
+ * emu_file_holes()
+ *
+ * Make the hole list for a file that a station has only part of.  If the station has not heard
+ * the end of the file then the last hole runs past the end and pacsat clips it.
+ *
+ * Returns the number of holes
+ */
+static int emu_file_holes(EMU_STATION *station, FILE_DATE_PAIR *holes, int max_holes) {
+	uint32_t end = station->file_size;
+	if (end == 0) {
+		/* Find the end of what we have */
+		for (uint32_t i=0; i < EMU_MAX_FILE_SIZE; i++)
+			if (emu_has_byte(station, i)) end = i + 1;
+	}
+	int num = 0;
+	uint32_t i = 0;
+	while (i < end && num < max_holes) {
+		if (emu_has_byte(station, i)) {
+			i++;
+			continue;
+		}
+		uint32_t start = i;
+		while (i < end && !emu_has_byte(station, i) && i - start < 0xFFFF)
+			i++;
+		holes[num].offset = start;
+		holes[num].length = i - start;
+		num++;
+	}
+	if (station->file_size == 0 && num < max_holes) {
+		holes[num].offset = end;
+		holes[num].length = 0xFFFF;
+		num++;
+	}
+	return num;
+}
+
+/**
+ * emu_send_request()
+ *
+ * Send the request for a download station, or start the connection for an upload.
+ */
+static void emu_send_request(EMU_STATION *station, uint64_t now_ms) {
+	unsigned char request[MAX_PB_HOLES_LIST_BYTES + sizeof(FILE_REQ_HEADER)];
+	station->requests++;
+	station->last_request_ms = now_ms;
+	switch (station->action) {
+	case EMU_ACTION_DIR: {
+		DIR_REQ_HEADER *header = (DIR_REQ_HEADER *)request;
+		header->flags = 0x10; /* Fill request */
+		header->block_size = EMU_BLOCK_SIZE;
+		DIR_DATE_PAIR *pair = (DIR_DATE_PAIR *)(request + sizeof(DIR_REQ_HEADER));
+		pair->start = 0;
+		pair->end = 0x7FFFFFFF;
+		emu_uplink('K', station->callsign, g_broadcast_callsign, PID_DIRECTORY, request, sizeof(DIR_REQ_HEADER) + sizeof(DIR_DATE_PAIR), now_ms);
+		break;
+	}
+	case EMU_ACTION_FILE: {
+		FILE_REQ_HEADER *header = (FILE_REQ_HEADER *)request;
+		header->file_id = station->file_id;
+		header->block_size = EMU_BLOCK_SIZE;
+		int num_of_holes = 0;
+		if (station->unique_bytes == 0) {
+			header->flags = 0x10 | PB_START_SENDING_FILE;
+		} else {
+			header->flags = 0x10 | PB_FILE_HOLE_LIST;
+			num_of_holes = emu_file_holes(station, (FILE_DATE_PAIR *)(request + sizeof(FILE_REQ_HEADER)),
+					MAX_PB_HOLES_LIST_BYTES / sizeof(FILE_DATE_PAIR));
+		}
+		emu_uplink('K', station->callsign, g_broadcast_callsign, PID_FILE, request,
+				sizeof(FILE_REQ_HEADER) + num_of_holes * sizeof(FILE_DATE_PAIR), now_ms);
+		break;
+	}
+	case EMU_ACTION_UPLOAD: {
+		char connected[MAX_CONFIG_LINE_LENGTH];
+		snprintf(connected, sizeof(connected), "*** CONNECTED To Station %s\r", station->callsign);
+		emu_uplink('C', station->callsign, g_bbs_callsign, 0, (unsigned char *)connected, strlen(connected) + 1, now_ms);
+		break;
+	}
+	}
+}
+
+static void emu_finish(EMU_STATION *station, int state, uint64_t now_ms) {
+	station->state = state;
+	station->finished_ms = now_ms;
+	debug_print("EMU: %s %s after %d ms\n", station->callsign, state == EMU_DONE ? "finished" : "failed",
+			(int)(now_ms - station->started_ms));
+}
+
+/**
+ * emu_hear_file_frame()
+ *
+ * A download station hears a file broadcast.  The bytes it did not have are marked and it is
+ * done once it has every byte up to the last chunk.
+ */
+static void emu_hear_file_frame(EMU_STATION *station, unsigned char *bytes, int len, uint64_t now_ms) {
+	if (len < (int)sizeof(PB_FILE_HEADER) + 2) return;
+	PB_FILE_HEADER *header = (PB_FILE_HEADER *)bytes;
+	if (header->file_id != station->file_id) return;
+	if (((header->flags >> VV_BIT) & 0b11) != PB_FILE_VERSION_CHUNK) return; /* Repair symbols are not decoded here */
+	int data_len = len - sizeof(PB_FILE_HEADER) - 2;
+	uint32_t offset = header->offset;
+	if (offset + data_len > EMU_MAX_FILE_SIZE) return;
+	station->last_heard_ms = now_ms;
+	for (uint32_t i=offset; i < offset + data_len; i++) {
+		if (emu_has_byte(station, i)) {
+			station->duplicate_bytes++;
+		} else {
+			station->have[i / 8] |= 1 << (i % 8);
+			station->unique_bytes++;
+		}
+	}
+	if (header->flags & (1 << E_BIT))
+		station->file_size = offset + data_len;
+	if (station->file_size != 0 && station->unique_bytes == station->file_size)
+		emu_finish(station, EMU_DONE, now_ms);
+}
+
+/**
+ * emu_hear_ftl0()
+ *
+ * An upload station gets an FTL0 packet from pacsat and sends the next step of the upload.
+ */
+static void emu_hear_ftl0(EMU_STATION *station, unsigned char *data, int len, uint64_t now_ms) {
+	if (len < 2) return;
+	station->last_heard_ms = now_ms;
+	unsigned char packet[EMU_UPLOAD_BLOCK_SIZE + 2];
+	int type = data[1] & 0b00011111;
+	switch (type) {
+	case LOGIN_RESP: {
+		FTL0_UPLOAD_CMD cmd;
+		cmd.continue_file_no = 0;
+		cmd.file_length = station->upload_len;
+		packet[0] = sizeof(cmd);
+		packet[1] = UPLOAD_CMD;
+		memcpy(packet + 2, &cmd, sizeof(cmd));
+		emu_uplink('D', station->callsign, g_bbs_callsign, 0, packet, sizeof(cmd) + 2, now_ms);
+		break;
+	}
+	case UL_GO_RESP: {
+		if (len < 2 + (int)sizeof(FTL0_UL_GO_DATA)) return;
+		FTL0_UL_GO_DATA go;
+		memcpy(&go, data + 2, sizeof(go));
+		for (uint32_t offset = go.byte_offset; offset < station->upload_len; offset += EMU_UPLOAD_BLOCK_SIZE) {
+			int block = station->upload_len - offset;
+			if (block > EMU_UPLOAD_BLOCK_SIZE) block = EMU_UPLOAD_BLOCK_SIZE;
+			packet[0] = block & 0xff;
+			packet[1] = DATA | ((block >> 8) << 5);
+			memcpy(packet + 2, station->upload + offset, block);
+			emu_uplink('D', station->callsign, g_bbs_callsign, 0, packet, block + 2, now_ms);
+		}
+		packet[0] = 0;
+		packet[1] = DATA_END;
+		emu_uplink('D', station->callsign, g_bbs_callsign, 0, packet, 2, now_ms);
+		break;
+	}
+	case UL_ACK_RESP:
+		emu_finish(station, EMU_DONE, now_ms);
+		emu_uplink('d', station->callsign, g_bbs_callsign, 0, NULL, 0, now_ms);
+		break;
+	case UL_ERROR_RESP:
+	case UL_NAK_RESP:
+		error_print("EMU: Upload from %s refused with error %d\n", station->callsign, len > 2 ? data[2] : 0);
+		emu_finish(station, EMU_FAILED, now_ms);
+		emu_uplink('d', station->callsign, g_bbs_callsign, 0, NULL, 0, now_ms);
+		break;
+	}
+}
+
+/**
+ * emu_deliver_downlink()
+ *
+ * A frame from pacsat has been sent on the virtual downlink.  Each station that hears it
+ * through the loss model acts on it.
+ */
+static void emu_deliver_downlink(EMU_FRAME *frame, uint64_t now_ms) {
+	struct t_agw_header *header = &frame->header;
+	emu_downlink_frames++;
+	emu_downlink_bytes += header->data_len;
+	emu_downlink_airtime_ms += emu_airtime_ms(header->data_len);
+
+	if (header->data_kind == 'K') {
+		if (header->data_len < (int)sizeof(AX25_HEADER)) return;
+		AX25_HEADER *ax25 = (AX25_HEADER *)frame->data;
+		unsigned char *bytes = frame->data + sizeof(AX25_HEADER);
+		int len = header->data_len - sizeof(AX25_HEADER);
+		if (ax25->pid == PID_DIRECTORY) emu_dir_bytes += header->data_len;
+		if (ax25->pid == PID_FILE) emu_file_bytes += header->data_len;
+		for (int i=0; i < emu_number_of_stations; i++) {
+			EMU_STATION *station = &emu_stations[i];
+			if (station->state != EMU_ACTIVE) continue;
+			if (emu_lost()) continue;
+			if (strncasecmp(header->call_to, station->callsign, MAX_CALLSIGN_LEN) == 0) {
+				/* OK or NO for our request */
+				if (len >= 2 && strncmp((char *)bytes, "NO", 2) == 0)
+					station->rejected++;
+				continue;
+			}
+			if (strncasecmp(header->call_to, QST, MAX_CALLSIGN_LEN) != 0) continue;
+			if (station->action == EMU_ACTION_FILE && ax25->pid == PID_FILE) {
+				emu_hear_file_frame(station, bytes, len, now_ms);
+			} else if (station->action == EMU_ACTION_DIR && ax25->pid == PID_DIRECTORY && len >= (int)sizeof(PB_DIR_HEADER)) {
+				PB_DIR_HEADER *dir_header = (PB_DIR_HEADER *)bytes;
+				station->last_heard_ms = now_ms;
+				if (dir_header->flags & (1 << E_BIT)) {
+					station->dir_pfhs++;
+					if (dir_header->flags & (1 << N_BIT))
+						emu_finish(station, EMU_DONE, now_ms);
+				}
+			}
+		}
+	} else {
+		/* Connected mode frames for an upload station */
+		for (int i=0; i < emu_number_of_stations; i++) {
+			EMU_STATION *station = &emu_stations[i];
+			if (station->state != EMU_ACTIVE || station->action != EMU_ACTION_UPLOAD) continue;
+			if (strncasecmp(header->call_to, station->callsign, MAX_CALLSIGN_LEN) != 0) continue;
+			if (header->data_kind == 'D')
+				emu_hear_ftl0(station, frame->data, header->data_len, now_ms);
+			else if (header->data_kind == 'd')
+				emu_finish(station, EMU_FAILED, now_ms);
+		}
+	}
+}
+
+/**
+ * emu_process_client_frame()
+ *
+ * Act on a frame that pacsat sent to the TNC.
+ */
+static void emu_process_client_frame(struct t_agw_header *header, unsigned char *data, uint64_t now_ms) {
+	switch (header->data_kind) {
+	case 'X': { // Register a callsign
+		unsigned char registered = 1;
+		emu_send_to_client('X', header->call_from, "", 0, &registered, 1);
+		break;
+	}
+	case 'k': // Raw monitoring
+		emu_monitor_raw = !emu_monitor_raw;
+		break;
+	case 'm': // Monitoring of connected frames
+		break;
+	case 'y': { // Frames outstanding
+		int outstanding = emu_downlink.count;
+		emu_send_to_client('y', "", "", 0, (unsigned char *)&outstanding, sizeof(outstanding));
+		break;
+	}
+	case 'K': // Raw UI frame to send
+		header->data_kind = 'K';
+		if (emu_queue_put(&emu_downlink, header, data, now_ms, 0) != EXIT_SUCCESS)
+			error_print("Emulator downlink queue full, frame to %s dropped\n", header->call_to);
+		break;
+	case 'D': { // Connected mode data
+		uint32_t extra_ms = 0;
+		if (emu_lost()) {
+			extra_ms = emu_airtime_ms(header->data_len);
+			emu_retransmissions++;
+		}
+		if (emu_queue_put(&emu_downlink, header, data, now_ms, extra_ms) != EXIT_SUCCESS)
+			error_print("Emulator downlink queue full, frame to %s dropped\n", header->call_to);
+		break;
+	}
+	case 'd': // Disconnect a station
+		emu_queue_put(&emu_downlink, header, data, now_ms, 0);
+		break;
+	default:
+		debug_print("EMU: Ignoring '%c' frame from pacsat\n", header->data_kind);
+		break;
+	}
+}
+
+/**
+ * emu_next_action()
+ *
+ * Start the stations whose time has come, send the frames that have finished on the virtual
+ * channels and ask again for requests that have gone quiet.
+ */
+static void emu_next_action(uint64_t now_ms) {
+	for (int i=0; i < emu_number_of_stations; i++) {
+		EMU_STATION *station = &emu_stations[i];
+		if (station->state == EMU_WAITING && now_ms >= emu_start_ms + (uint64_t)station->start * 1000) {
+			if (station->action == EMU_ACTION_UPLOAD && station->upload == NULL) {
+				station->started_ms = now_ms;
+				emu_finish(station, EMU_FAILED, now_ms);
+				continue;
+			}
+			station->state = EMU_ACTIVE;
+			station->started_ms = now_ms;
+			station->last_heard_ms = now_ms;
+			emu_send_request(station, now_ms);
+		} else if (station->state == EMU_ACTIVE) {
+			uint64_t last = station->last_heard_ms > station->last_request_ms ? station->last_heard_ms : station->last_request_ms;
+			if (now_ms - last > EMU_RETRY_MS) {
+				if (station->requests >= EMU_MAX_REQUESTS || station->action == EMU_ACTION_UPLOAD)
+					emu_finish(station, EMU_FAILED, now_ms);
+				else
+					emu_send_request(station, now_ms);
+			}
+		}
+	}
+
+	EMU_FRAME *frame;
+	while ((frame = emu_queue_done(&emu_uplink_queue, now_ms)) != NULL) {
+		emu_uplink_frames++;
+		if (frame->header.data_kind == 'K' && emu_lost()) {
+			emu_uplink_lost++;
+		} else if (frame->header.data_kind != 'K' || emu_monitor_raw) {
+			emu_send_to_client(frame->header.data_kind, frame->header.call_from, frame->header.call_to,
+					frame->header.pid, frame->data, frame->header.data_len);
+		}
+		emu_queue_pop(&emu_uplink_queue);
+	}
+	while ((frame = emu_queue_done(&emu_downlink, now_ms)) != NULL) {
+		if (frame->header.data_kind == 'K') {
+			/* Confirm that it was sent */
+			emu_send_to_client('T', frame->header.call_from, frame->header.call_to, frame->header.pid,
+					frame->data, frame->header.data_len);
+		}
+		emu_deliver_downlink(frame, now_ms);
+		emu_queue_pop(&emu_downlink);
+	}
+}
+
+/* Returns true when every station has finished and nothing is waiting to be sent */
+static int emu_all_finished() {
+	for (int i=0; i < emu_number_of_stations; i++)
+		if (emu_stations[i].state == EMU_WAITING || emu_stations[i].state == EMU_ACTIVE) return false;
+	return emu_downlink.count == 0 && emu_uplink_queue.count == 0;
+}
+
+/**
+ * emu_print_report()
+ *
+ * Print the totals for the run and the result for each station.
+ */
+static void emu_print_report(uint64_t now_ms) {
+	uint32_t elapsed_ms = now_ms - emu_start_ms;
+	if (elapsed_ms == 0) elapsed_ms = 1;
+	uint32_t delivered = 0;
+	printf("AGW emulator: %d bps, %d%% loss, seed %d, ran for %d s\n", emu_settings.bit_rate,
+			emu_settings.loss_percent, emu_settings.seed, elapsed_ms / 1000);
+	printf("Downlink: %d frames, %d bytes (DIR %d, FILE %d), busy %d%% of the time, %d retransmitted\n",
+			emu_downlink_frames, emu_downlink_bytes, emu_dir_bytes, emu_file_bytes,
+			(int)((uint64_t)emu_downlink_airtime_ms * 100 / elapsed_ms), emu_retransmissions);
+	printf("Uplink: %d frames, %d lost\n", emu_uplink_frames, emu_uplink_lost);
+	printf("%-10s %-6s %-8s %8s %8s %8s %6s %6s %8s\n", "Station", "Action", "Result", "Time ms", "Bytes",
+			"Dup", "Reqs", "NO", "PFHs");
+	for (int i=0; i < emu_number_of_stations; i++) {
+		EMU_STATION *station = &emu_stations[i];
+		char *action = station->action == EMU_ACTION_DIR ? "dir" : station->action == EMU_ACTION_FILE ? "file" : "upload";
+		char *result = station->state == EMU_DONE ? "done" : station->state == EMU_FAILED ? "failed"
+				: station->state == EMU_ACTIVE ? "active" : "waiting";
+		uint32_t time_ms = 0;
+		if (station->state == EMU_DONE || station->state == EMU_FAILED)
+			time_ms = station->finished_ms - station->started_ms;
+		uint32_t bytes = station->action == EMU_ACTION_UPLOAD ? (station->state == EMU_DONE ? station->upload_len : 0) : station->unique_bytes;
+		delivered += bytes;
+		printf("%-10s %-6s %-8s %8d %8d %8d %6d %6d %8d\n", station->callsign, action, result, time_ms, bytes,
+				station->duplicate_bytes, station->requests, station->rejected, station->dir_pfhs);
+	}
+	printf("Goodput: %d bytes/s of file data delivered\n", (int)((uint64_t)delivered * 1000 / elapsed_ms));
+}
+
+/**
+ * emu_prepare_stations()
+ *
+ * Allocate the map of received bytes for the download stations and read the files that the
+ * upload stations send into memory, so the disk does not slow the run.  An upload station
+ * whose file can not be read fails when it starts.
+ */
+static void emu_prepare_stations() {
+	for (int i=0; i < emu_number_of_stations; i++) {
+		EMU_STATION *station = &emu_stations[i];
+		if (station->action == EMU_ACTION_FILE) {
+			station->have = (unsigned char *)calloc(EMU_MAX_FILE_SIZE / 8, 1);
+			if (station->have == NULL)
+				station->state = EMU_FAILED;
+		} else if (station->action == EMU_ACTION_UPLOAD) {
+			FILE *file = fopen(station->path, "rb");
+			if (file == NULL) {
+				error_print("EMU: Could not open %s for %s\n", station->path, station->callsign);
+				continue;
+			}
+			fseek(file, 0, SEEK_END);
+			long len = ftell(file);
+			fseek(file, 0, SEEK_SET);
+			if (len > 0)
+				station->upload = (unsigned char *)malloc(len);
+			if (station->upload != NULL && fread(station->upload, 1, len, file) == len) {
+				station->upload_len = len;
+			} else {
+				error_print("EMU: Could not read %s for %s\n", station->path, station->callsign);
+				free(station->upload);
+				station->upload = NULL;
+			}
+			fclose(file);
+		}
+	}
+}
+
+/**
+ * emu_run()
+ *
+ * Load the script, wait for pacsat to connect on port and run the stations until they have all
+ * finished or the duration has passed.  The report is printed at the end.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the script could not be loaded or the port opened
+ */
+int emu_run(char *script_filename, int port) {
+	if (emu_load_script(script_filename) != EXIT_SUCCESS) return EXIT_FAILURE;
+	emu_prepare_stations();
+
+	int server = socket(AF_INET, SOCK_STREAM, 0);
+	if (server < 0) {
+		error_print("Emulator could not open a socket\n");
+		return EXIT_FAILURE;
+	}
+	int on = 1;
+	setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	struct sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	address.sin_port = htons(port);
+	if (bind(server, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(server, 1) != 0) {
+		error_print("Emulator could not listen on port %d\n", port);
+		close(server);
+		return EXIT_FAILURE;
+	}
+	printf("AGW emulator waiting for pacsat on port %d with %d stations\n", port, emu_number_of_stations);
+	emu_client = accept(server, NULL, NULL);
+	close(server);
+	if (emu_client < 0) {
+		error_print("Emulator could not accept the connection\n");
+		return EXIT_FAILURE;
+	}
+
+	emu_start_ms = tx_now_ms();
+	uint64_t now_ms = emu_start_ms;
+	unsigned char *data = (unsigned char *)malloc(EMU_MAX_FRAME_LEN);
+	if (data == NULL) return EXIT_FAILURE;
+	while (now_ms - emu_start_ms < (uint64_t)emu_settings.duration * 1000) {
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(emu_client, &read_fds);
+		struct timeval timeout = {0, 10000}; // 10ms
+		int ready = select(emu_client + 1, &read_fds, NULL, NULL, &timeout);
+		now_ms = tx_now_ms();
+		if (ready > 0) {
+			struct t_agw_header header;
+			if (emu_read_all(emu_client, &header, sizeof(header)) != EXIT_SUCCESS) {
+				debug_print("EMU: pacsat disconnected\n");
+				break;
+			}
+			if (header.data_len < 0 || header.data_len > EMU_MAX_FRAME_LEN
+					|| emu_read_all(emu_client, data, header.data_len) != EXIT_SUCCESS) {
+				error_print("EMU: Bad frame from pacsat\n");
+				break;
+			}
+			emu_process_client_frame(&header, data, now_ms);
+		}
+		emu_next_action(now_ms);
+		if (emu_number_of_stations > 0 && emu_all_finished()) break;
+	}
+	free(data);
+	close(emu_client);
+	emu_client = -1;
+	emu_print_report(now_ms);
+	return EXIT_SUCCESS;
+}
+
+/*********************************************************************************************
+ *
+ * SELF TESTS FOLLOW
+ *
+ */
+
+/* Make the bytes of a file broadcast for the test stations */
+static int emu_test_file_frame(unsigned char *frame, uint32_t file_id, int offset, int len, int last) {
+	PB_FILE_HEADER *header = (PB_FILE_HEADER *)frame;
+	header->flags = last ? (1 << E_BIT) : 0;
+	header->file_id = file_id;
+	header->file_type = 0;
+	header->offset = offset;
+	memset(frame + sizeof(PB_FILE_HEADER), 0xAA, len + 2);
+	return sizeof(PB_FILE_HEADER) + len + 2;
+}
+
+int test_agw_emulator() {
+	printf("##### TEST AGW EMULATOR:\n");
+	int rc = EXIT_SUCCESS;
+
+	char *script = "/tmp/pacsat_emu_script.csv";
+	FILE *f = fopen(script, "w");
+	if (f == NULL) { printf("** Could not create %s\n", script); return EXIT_FAILURE; }
+	fprintf(f, "# Test script\nbit_rate=1200\nloss_percent=30\nseed=7\nduration=60\n");
+	fprintf(f, "# seconds,callsign,action,argument\n0,G0KLA,dir\n5,AC2CZ,file,1a2\n10,VE2XYZ,upload,/tmp/pacsat_emu_missing.act\n");
+	fclose(f);
+	if (emu_load_script(script) != EXIT_SUCCESS) { printf("** Could not load the script\n"); return EXIT_FAILURE; }
+	if (emu_settings.bit_rate != 1200 || emu_settings.loss_percent != 30 || emu_settings.seed != 7 || emu_settings.duration != 60) {
+		printf("** Settings not read from the script\n"); rc = EXIT_FAILURE;
+	}
+	if (emu_number_of_stations != 3) { printf("** Expected 3 stations but read %d\n", emu_number_of_stations); return EXIT_FAILURE; }
+	if (emu_stations[1].action != EMU_ACTION_FILE || emu_stations[1].file_id != 0x1a2 || emu_stations[1].start != 5
+			|| strcmp(emu_stations[1].callsign, "AC2CZ") != 0) { printf("** File station not read\n"); rc = EXIT_FAILURE; }
+	if (emu_stations[2].action != EMU_ACTION_UPLOAD || strcmp(emu_stations[2].path, "/tmp/pacsat_emu_missing.act") != 0) {
+		printf("** Upload station not read\n"); rc = EXIT_FAILURE;
+	}
+	emu_prepare_stations();
+	if (emu_stations[1].have == NULL || emu_stations[2].upload != NULL) { printf("** Stations not prepared\n"); rc = EXIT_FAILURE; }
+
+	/* 150 bytes on the air at 1200 bps is one second */
+	if (emu_airtime_ms(146) != 1000) { printf("** Wrong airtime %d\n", emu_airtime_ms(146)); rc = EXIT_FAILURE; }
+
+	/* The same seed loses the same frames */
+	int lost[100];
+	int number_lost = 0;
+	emu_seed(7);
+	for (int i=0; i < 100; i++) {
+		lost[i] = emu_lost();
+		number_lost += lost[i];
+	}
+	emu_seed(7);
+	for (int i=0; i < 100; i++)
+		if (emu_lost() != lost[i]) { printf("** Loss model not repeatable at %d\n", i); rc = EXIT_FAILURE; break; }
+	if (number_lost < 10 || number_lost > 50) { printf("** Lost %d of 100 frames at 30%%\n", number_lost); rc = EXIT_FAILURE; }
+	emu_settings.loss_percent = 0;
+	for (int i=0; i < 100; i++)
+		if (emu_lost()) { printf("** Frame lost with no loss\n"); rc = EXIT_FAILURE; break; }
+
+	/* Frames queue behind each other on a channel */
+	EMU_QUEUE *queue = &emu_downlink;
+	memset(queue, 0, sizeof(EMU_QUEUE));
+	struct t_agw_header header;
+	unsigned char data[EMU_MAX_FRAME_LEN];
+	memset(&header, 0, sizeof(header));
+	memset(data, 0, sizeof(data));
+	header.data_kind = 'K';
+	header.data_len = 146;
+	emu_queue_put(queue, &header, data, 0, 0);
+	emu_queue_put(queue, &header, data, 0, 0);
+	if (emu_queue_done(queue, 999) != NULL) { printf("** Frame done before its airtime\n"); rc = EXIT_FAILURE; }
+	if (emu_queue_done(queue, 1000) == NULL) { printf("** Frame not done after its airtime\n"); rc = EXIT_FAILURE; }
+	emu_queue_pop(queue);
+	if (emu_queue_done(queue, 1999) != NULL || emu_queue_done(queue, 2000) == NULL) { printf("** Second frame not sent after the first\n"); rc = EXIT_FAILURE; }
+	emu_queue_pop(queue);
+	queue->busy_until_ms = 0;
+
+	/* A file station fills in its holes */
+	EMU_STATION *station = &emu_stations[1];
+	station->state = EMU_ACTIVE;
+	unsigned char frame[EMU_MAX_FRAME_LEN];
+	int len = emu_test_file_frame(frame, 0x1a2, 0, 100, false);
+	emu_hear_file_frame(station, frame, len, 0);
+	len = emu_test_file_frame(frame, 0x1a2, 200, 50, true);
+	emu_hear_file_frame(station, frame, len, 0);
+	len = emu_test_file_frame(frame, 0x999, 100, 100, false);
+	emu_hear_file_frame(station, frame, len, 0); /* Another file */
+	FILE_DATE_PAIR holes[4];
+	int num_of_holes = emu_file_holes(station, holes, 4);
+	if (station->file_size != 250 || num_of_holes != 1 || holes[0].offset != 100 || holes[0].length != 100) {
+		printf("** Wrong holes: size %d, %d holes\n", station->file_size, num_of_holes); rc = EXIT_FAILURE;
+	}
+	len = emu_test_file_frame(frame, 0x1a2, 0, 10, false);
+	emu_hear_file_frame(station, frame, len, 0);
+	if (station->duplicate_bytes != 10 || station->unique_bytes != 150) { printf("** Wrong byte counts\n"); rc = EXIT_FAILURE; }
+	len = emu_test_file_frame(frame, 0x1a2, 100, 100, false);
+	emu_hear_file_frame(station, frame, len, 0);
+	if (station->state != EMU_DONE) { printf("** File station not done\n"); rc = EXIT_FAILURE; }
+
+	/* The DIR station sends its request when it starts and is done when it hears the newest PFH */
+	emu_start_ms = 0;
+	emu_monitor_raw = true;
+	emu_next_action(0);
+	if (emu_stations[0].state != EMU_ACTIVE || emu_uplink_queue.count != 1) { printf("** DIR station did not start\n"); rc = EXIT_FAILURE; }
+	unsigned char bytes[sizeof(PB_DIR_HEADER) + 2];
+	memset(bytes, 0, sizeof(bytes));
+	PB_DIR_HEADER *dir_header = (PB_DIR_HEADER *)bytes;
+	dir_header->flags = (1 << E_BIT) | (1 << N_BIT);
+	strlcpy(header.call_from, g_broadcast_callsign, sizeof(header.call_from));
+	strlcpy(header.call_to, QST, sizeof(header.call_to));
+	header.data_len = emu_make_ui_frame(data, g_broadcast_callsign, QST, PID_DIRECTORY, bytes, sizeof(bytes));
+	emu_process_client_frame(&header, data, 0);
+	emu_next_action(10000);
+	if (emu_stations[0].state != EMU_DONE || emu_stations[0].dir_pfhs != 1) { printf("** DIR station not done\n"); rc = EXIT_FAILURE; }
+	if (emu_uplink_queue.count != 0 || emu_downlink.count != 0) { printf("** Frames left on the channels\n"); rc = EXIT_FAILURE; }
+
+	/* The upload station fails because its file is missing */
+	emu_next_action(10000);
+	if (emu_stations[2].state != EMU_FAILED) { printf("** Upload station with no file did not fail\n"); rc = EXIT_FAILURE; }
+	if (!emu_all_finished()) { printf("** Stations not finished\n"); rc = EXIT_FAILURE; }
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST AGW EMULATOR: success\n");
+	else
+		printf("##### TEST AGW EMULATOR: fail\n");
+	return rc;
+}
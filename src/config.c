@@ -26,10 +26,51 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "config.h"
 #include "str_util.h"
 
+/* Local variables */
+static pthread_rwlock_t config_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static atomic_int config_writer_waiting = 0;
+
+/**
+ * config_read_lock()
+ *
+ * The PB, FTL0 and directory threads hold this while they use the config and state globals,
+ * so that a reload does not change them part way through.  A thread takes it once around
+ * each pass of its loop.  It is not recursive.  New readers wait while a reload is waiting,
+ * so the reload is not held off by the threads taking it in turn.
+ */
+void config_read_lock() {
+	while (atomic_load(&config_writer_waiting))
+		usleep(1000);
+	pthread_rwlock_rdlock(&config_rwlock);
+}
+
+void config_read_unlock() {
+	pthread_rwlock_unlock(&config_rwlock);
+}
+
+/**
+ * config_write_lock()
+ *
+ * Hold this while the config, state or pass schedule is reloaded.  It waits until the other
+ * threads have finished their current pass.  Call config_write_unlock() when done.
+ */
+void config_write_lock() {
+	atomic_store(&config_writer_waiting, true);
+	pthread_rwlock_wrlock(&config_rwlock);
+	atomic_store(&config_writer_waiting, false);
+}
+
+void config_write_unlock() {
+	pthread_rwlock_unlock(&config_rwlock);
+}
+
 void load_config(char *filename) {
 	char *key;
 	char *value;
@@ -42,7 +83,8 @@ void load_config(char *filename) {
 
 			/* Token will point to the part before the =
 			 * Using strtok safe here because we do not have multiple delimiters and
-			 * no other threads started at this time. */
+			 * no other threads started at this time, or on a reload they are held by
+			 * config_write_lock(). */
 			key = strtok(line, search);
 
 			// Token will point to the part after the =.
@@ -66,6 +108,35 @@ void load_config(char *filename) {
 					g_max_frames_in_tx_buffer = n;
 				} else if (strcmp(key, CONFIG_UPLOAD_TABLE_PATH) == 0) {
 					strlcpy(g_upload_table_path, value,sizeof(g_upload_table_path));
+				} else if (strcmp(key, MAX_PB_LENGTH_KEY) == 0) {
+					int n = atoi(value);
+					g_max_pb_length = n;
+				} else if (strcmp(key, PB_SCHEDULER_KEY) == 0) {
+					strlcpy(g_pb_scheduler, value,sizeof(g_pb_scheduler));
+				} else if (strcmp(key, TX_TARGET_LATENCY_KEY) == 0) {
+					int n = atoi(value);
+					g_tx_target_latency_ms = n;
+				} else if (strcmp(key, STATS_FILE_PATH_KEY) == 0) {
+					strlcpy(g_stats_file_path, value,sizeof(g_stats_file_path));
+				} else if (strcmp(key, PASS_SCHEDULE_PATH_KEY) == 0) {
+					strlcpy(g_pass_schedule_path, value,sizeof(g_pass_schedule_path));
+				} else if (strcmp(key, RX_BATCH_BUDGET_KEY) == 0) {
+					int n = atoi(value);
+					if (n < 1) n = 1;
+					g_rx_batch_budget = n;
+				} else if (strcmp(key, NUMBER_OF_PORTS_KEY) == 0) {
+					int n = atoi(value);
+					if (n < 1) n = 1;
+					if (n > MAX_PORTS) n = MAX_PORTS;
+					if (n > TNC_UI_PORTS) {
+						/* The PB, status and replies for the other ports would all go out on port 0 */
+						error_print("Can not use %d ports.  The TNC library only sends UI frames on port 0\n", n);
+						n = TNC_UI_PORTS;
+					}
+					g_number_of_ports = n;
+				} else if (strcmp(key, PB_DRR_QUANTUM_KEY) == 0) {
+					int n = atoi(value);
+					g_pb_drr_quantum = n;
 				} else {
 					error_print("Unknown key in %s file: %s\n",filename, key);
 				}
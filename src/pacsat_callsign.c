@@ -0,0 +1,351 @@
+/*
+ * pacsat_callsign.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * A table of the callsigns we have heard, so that each can be referred to
+ * by a small integer id.
+ *
+ * The receive loop interns the callsign of each frame that it passes to the
+ * PB or FTL0 once, and from then on the lists compare and index stations by
+ * id.  Callsigns are stored in upper case and an SSID of -0 is dropped, so
+ * G0KLA, g0kla and G0KLA-0 are the same station.  The string is only needed
+ * again when we send a frame or print the callsign.
+ *
+ * Each id has a count of the references to it.  callsign_intern() returns
+ * an id with a reference for the caller, and the PB, FTL0 and the upload
+ * table take a reference with callsign_hold() for each station they keep
+ * and give it back with callsign_release().  An id with no references
+ * keeps its callsign, so a station that is heard again gets the same id,
+ * until the table is full.  Then the id that was released longest ago is
+ * given to the new callsign.  So frames from many stations, spoofed
+ * callsigns included, can not fill the table.  The lists that hold ids are
+ * limited in size, max_pb_length included, so there is always an id that can
+ * be reclaimed.
+ *
+ * Callsigns are added under callsign_mutex.  The string for an id is
+ * written before the id is returned, and ids are passed to the other
+ * threads through the frame queues, so callsign_str() needs no lock for an
+ * id that the caller holds.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "debug.h"
+#include "str_util.h"
+#include "pacsat_callsign.h"
+
+#define CALLSIGN_HASH_SIZE (2 * CALLSIGN_TABLE_SIZE) /* Keep the hash no more than half full */
+
+CALLSIGN_ID g_bbs_callsign_id = CALLSIGN_ID_NONE;
+CALLSIGN_ID g_broadcast_callsign_id = CALLSIGN_ID_NONE;
+
+static char callsign_names[CALLSIGN_TABLE_SIZE][MAX_CALLSIGN_LEN]; /* Indexed by id.  Id 0 is not used */
+static CALLSIGN_ID callsign_hash[CALLSIGN_HASH_SIZE]; /* The first id in each hash chain or CALLSIGN_ID_NONE */
+static CALLSIGN_ID callsign_hash_next[CALLSIGN_TABLE_SIZE]; /* The next id in the same hash chain */
+static int callsign_refs[CALLSIGN_TABLE_SIZE]; /* References to each id */
+/* Ids with no references, oldest first.  Id 0 is the head of this circular list */
+static CALLSIGN_ID callsign_unused_next[CALLSIGN_TABLE_SIZE];
+static CALLSIGN_ID callsign_unused_prev[CALLSIGN_TABLE_SIZE];
+static int callsign_next_id = 1;
+static int callsign_full_reported = false;
+static pthread_mutex_t callsign_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * callsign_normalize()
+ *
+ * Copy the callsign into normalized in upper case without an SSID of -0.
+ *
+ * Returns the length of the normalized callsign, which is 0 if it is empty
+ */
+static int callsign_normalize(char *callsign, char *normalized) {
+	int len = 0;
+	while (len < MAX_CALLSIGN_LEN - 1 && callsign[len] != 0 && callsign[len] != ' ') {
+		normalized[len] = toupper((unsigned char)callsign[len]);
+		len++;
+	}
+	if (len > 2 && normalized[len - 2] == '-' && normalized[len - 1] == '0')
+		len -= 2;
+	normalized[len] = 0;
+	return len;
+}
+
+/**
+ * callsign_hash_of()
+ *
+ * Returns the hash chain for a normalized callsign
+ */
+static int callsign_hash_of(char *normalized) {
+	unsigned int hash = 5381;
+	for (int i=0; normalized[i] != 0; i++)
+		hash = ((hash << 5) + hash) + (unsigned char)normalized[i];
+	return hash & (CALLSIGN_HASH_SIZE - 1);
+}
+
+/**
+ * callsign_find()
+ *
+ * Call with callsign_mutex held.
+ *
+ * Returns the id of this normalized callsign or CALLSIGN_ID_NONE if it is not in the table
+ */
+static CALLSIGN_ID callsign_find(char *normalized) {
+	CALLSIGN_ID id = callsign_hash[callsign_hash_of(normalized)];
+	while (id != CALLSIGN_ID_NONE && strcmp(callsign_names[id], normalized) != 0)
+		id = callsign_hash_next[id];
+	return id;
+}
+
+/**
+ * callsign_unused_remove()
+ *
+ * Take an id off the list of ids with no references.  Call with callsign_mutex held.
+ */
+static void callsign_unused_remove(CALLSIGN_ID id) {
+	callsign_unused_next[callsign_unused_prev[id]] = callsign_unused_next[id];
+	callsign_unused_prev[callsign_unused_next[id]] = callsign_unused_prev[id];
+}
+
+/**
+ * callsign_reclaim()
+ *
+ * Take the id that has had no references for longest out of the table so that it can be
+ * given to a new callsign.  Call with callsign_mutex held.
+ *
+ * Returns the id or CALLSIGN_ID_NONE if every id is held
+ */
+static CALLSIGN_ID callsign_reclaim() {
+	CALLSIGN_ID id = callsign_unused_next[CALLSIGN_ID_NONE];
+	if (id == CALLSIGN_ID_NONE) return CALLSIGN_ID_NONE;
+	callsign_unused_remove(id);
+	CALLSIGN_ID *link = &callsign_hash[callsign_hash_of(callsign_names[id])];
+	while (*link != id)
+		link = &callsign_hash_next[*link];
+	*link = callsign_hash_next[id];
+	return id;
+}
+
+/**
+ * callsign_init()
+ *
+ * Intern our own callsigns.  Call after the config is loaded or reloaded, because the ids of
+ * other stations are kept and only our callsigns may change.
+ */
+void callsign_init() {
+	CALLSIGN_ID id = callsign_intern(g_bbs_callsign);
+	if (id != CALLSIGN_ID_NONE) {
+		callsign_release(g_bbs_callsign_id);
+		g_bbs_callsign_id = id;
+	}
+	id = callsign_intern(g_broadcast_callsign);
+	if (id != CALLSIGN_ID_NONE) {
+		callsign_release(g_broadcast_callsign_id);
+		g_broadcast_callsign_id = id;
+	}
+}
+
+/**
+ * callsign_intern()
+ *
+ * Add the callsign to the table if it is not already there and take a reference to it.
+ * The caller gives the reference back with callsign_release().
+ *
+ * Returns the id of the callsign, or CALLSIGN_ID_NONE if it is empty or every id is held
+ */
+CALLSIGN_ID callsign_intern(char *callsign) {
+	char normalized[MAX_CALLSIGN_LEN];
+	if (callsign == NULL || callsign_normalize(callsign, normalized) == 0) return CALLSIGN_ID_NONE;
+	pthread_mutex_lock(&callsign_mutex);
+	CALLSIGN_ID id = callsign_find(normalized);
+	if (id == CALLSIGN_ID_NONE) {
+		if (callsign_next_id < CALLSIGN_TABLE_SIZE)
+			id = callsign_next_id++;
+		else
+			id = callsign_reclaim();
+		if (id != CALLSIGN_ID_NONE) {
+			strlcpy(callsign_names[id], normalized, MAX_CALLSIGN_LEN);
+			int hash = callsign_hash_of(normalized);
+			callsign_hash_next[id] = callsign_hash[hash];
+			callsign_hash[hash] = id;
+			callsign_refs[id] = 0;
+		} else if (!callsign_full_reported) {
+			/* Should not happen because the lists that hold ids are smaller than the table */
+			error_print("Every callsign id is held, ignoring %s\n", normalized);
+			callsign_full_reported = true;
+		}
+	} else if (callsign_refs[id] == 0) {
+		callsign_unused_remove(id);
+	}
+	if (id != CALLSIGN_ID_NONE)
+		callsign_refs[id]++;
+	pthread_mutex_unlock(&callsign_mutex);
+	return id;
+}
+
+/**
+ * callsign_hold()
+ *
+ * Take another reference to an id that the caller already holds, for a station that is kept
+ * on a list.
+ */
+void callsign_hold(CALLSIGN_ID id) {
+	if (id == CALLSIGN_ID_NONE || id >= CALLSIGN_TABLE_SIZE) return;
+	pthread_mutex_lock(&callsign_mutex);
+	if (callsign_refs[id] == 0)
+		callsign_unused_remove(id);
+	callsign_refs[id]++;
+	pthread_mutex_unlock(&callsign_mutex);
+}
+
+/**
+ * callsign_release()
+ *
+ * Give back a reference to an id.  When it has no references the id can be reclaimed for
+ * another callsign, the one released longest ago first.
+ */
+void callsign_release(CALLSIGN_ID id) {
+	if (id == CALLSIGN_ID_NONE || id >= CALLSIGN_TABLE_SIZE) return;
+	pthread_mutex_lock(&callsign_mutex);
+	if (callsign_refs[id] > 0) {
+		callsign_refs[id]--;
+		if (callsign_refs[id] == 0) {
+			/* Add to the end of the unused list, which is just before the head */
+			CALLSIGN_ID last = callsign_unused_prev[CALLSIGN_ID_NONE];
+			callsign_unused_next[last] = id;
+			callsign_unused_prev[id] = last;
+			callsign_unused_next[id] = CALLSIGN_ID_NONE;
+			callsign_unused_prev[CALLSIGN_ID_NONE] = id;
+		}
+	} else {
+		error_print("Callsign %s released more times than it was held\n", callsign_names[id]);
+	}
+	pthread_mutex_unlock(&callsign_mutex);
+}
+
+/**
+ * callsign_lookup()
+ *
+ * Find a callsign without adding it.  Used for the destination of a frame, which is often
+ * a callsign that is not for us.
+ *
+ * Returns the id of the callsign or CALLSIGN_ID_NONE if it has not been interned
+ */
+CALLSIGN_ID callsign_lookup(char *callsign) {
+	char normalized[MAX_CALLSIGN_LEN];
+	if (callsign == NULL || callsign_normalize(callsign, normalized) == 0) return CALLSIGN_ID_NONE;
+	pthread_mutex_lock(&callsign_mutex);
+	CALLSIGN_ID id = callsign_find(normalized);
+	pthread_mutex_unlock(&callsign_mutex);
+	return id;
+}
+
+/**
+ * callsign_str()
+ *
+ * Returns the normalized callsign for an id, or an empty string for CALLSIGN_ID_NONE
+ */
+char * callsign_str(CALLSIGN_ID id) {
+	if (id >= CALLSIGN_TABLE_SIZE) return callsign_names[CALLSIGN_ID_NONE];
+	return callsign_names[id];
+}
+
+/**
+ * callsign_count()
+ *
+ * Returns the number of callsigns in the table, held or not
+ */
+int callsign_count() {
+	pthread_mutex_lock(&callsign_mutex);
+	int count = callsign_next_id - 1;
+	pthread_mutex_unlock(&callsign_mutex);
+	return count;
+}
+
+/*********************************************************************************************
+ *
+ * SELF TESTS FOLLOW
+ *
+ */
+
+int test_callsign() {
+	printf("##### TEST CALLSIGN:\n");
+	int rc = EXIT_SUCCESS;
+
+	if (g_broadcast_callsign_id == CALLSIGN_ID_NONE || g_bbs_callsign_id == CALLSIGN_ID_NONE) {
+		printf("** Our callsigns are not interned\n"); rc = EXIT_FAILURE; }
+	if (callsign_lookup(g_broadcast_callsign) != g_broadcast_callsign_id) {
+		printf("** Broadcast callsign not found\n"); rc = EXIT_FAILURE; }
+
+	int count = callsign_count();
+	CALLSIGN_ID id = callsign_intern("zz9zz");
+	if (id == CALLSIGN_ID_NONE) { printf("** Could not intern ZZ9ZZ\n"); rc = EXIT_FAILURE; }
+	if (callsign_intern("ZZ9ZZ") != id || callsign_intern("ZZ9ZZ-0") != id || callsign_lookup("zz9zz-0") != id) {
+		printf("** Same station has a different id\n"); rc = EXIT_FAILURE; }
+	if (strcmp(callsign_str(id), "ZZ9ZZ") != 0) { printf("** Wrong callsign %s for id\n", callsign_str(id)); rc = EXIT_FAILURE; }
+	CALLSIGN_ID id2 = callsign_intern("ZZ9ZZ-10");
+	if (id2 == id || id2 == CALLSIGN_ID_NONE) { printf("** SSID not a different station\n"); rc = EXIT_FAILURE; }
+	if (strcmp(callsign_str(id2), "ZZ9ZZ-10") != 0) { printf("** Wrong callsign %s for SSID\n", callsign_str(id2)); rc = EXIT_FAILURE; }
+	if (callsign_count() != count + 2) { printf("** Expected %d callsigns but have %d\n", count + 2, callsign_count()); rc = EXIT_FAILURE; }
+
+	if (callsign_lookup("ZZ8ZZ") != CALLSIGN_ID_NONE) { printf("** Found callsign that was not interned\n"); rc = EXIT_FAILURE; }
+	if (callsign_count() != count + 2) { printf("** Lookup added a callsign\n"); rc = EXIT_FAILURE; }
+	if (callsign_intern("") != CALLSIGN_ID_NONE) { printf("** Interned empty callsign\n"); rc = EXIT_FAILURE; }
+	if (strcmp(callsign_str(CALLSIGN_ID_NONE), "") != 0) { printf("** No callsign is not empty\n"); rc = EXIT_FAILURE; }
+	callsign_release(id);
+	callsign_release(id);
+	callsign_release(id);
+	callsign_release(id2);
+
+	/* A station heard again keeps its id while the table has room */
+	id = callsign_intern("ZZ9ZZ");
+	callsign_release(id);
+	if (callsign_intern("ZZ9ZZ") != id) { printf("** Released station got a new id\n"); rc = EXIT_FAILURE; }
+	callsign_release(id);
+
+	/* Many more stations than fit in the table are heard once each.  Held ids are not reclaimed */
+	CALLSIGN_ID held = callsign_intern("HELD1");
+	char callsign[MAX_CALLSIGN_LEN];
+	for (int i=0; i < CALLSIGN_TABLE_SIZE + 100; i++) {
+		snprintf(callsign, sizeof(callsign), "T%d", i);
+		CALLSIGN_ID t = callsign_intern(callsign);
+		if (t == CALLSIGN_ID_NONE || strcmp(callsign_str(t), callsign) != 0) {
+			printf("** Station %s not interned when the table is full\n", callsign); rc = EXIT_FAILURE; break; }
+		if (t == held || t == g_bbs_callsign_id || t == g_broadcast_callsign_id) {
+			printf("** Held id given to %s\n", callsign); rc = EXIT_FAILURE; break; }
+		callsign_release(t);
+	}
+	if (callsign_lookup("HELD1") != held || strcmp(callsign_str(held), "HELD1") != 0) { printf("** Held callsign lost\n"); rc = EXIT_FAILURE; }
+	if (callsign_lookup(g_bbs_callsign) != g_bbs_callsign_id) { printf("** BBS callsign lost\n"); rc = EXIT_FAILURE; }
+	if (callsign_lookup("T0") != CALLSIGN_ID_NONE) { printf("** Oldest station not reclaimed\n"); rc = EXIT_FAILURE; }
+	if (callsign_count() != CALLSIGN_TABLE_SIZE - 1) { printf("** Table has %d callsigns\n", callsign_count()); rc = EXIT_FAILURE; }
+	callsign_release(held);
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST CALLSIGN: success\n");
+	else
+		printf("##### TEST CALLSIGN: fail\n");
+	return rc;
+}
@@ -0,0 +1,280 @@
+/*
+ * pacsat_frame_queue.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * Queues that pass received frames from the receive loop to the PB and FTL0
+ * threads.
+ *
+ * Each queue has exactly one thread that puts frames and one that gets them,
+ * so it needs no lock.  The head is only written by the thread that gets
+ * frames and the tail only by the thread that puts them.  A frame is copied
+ * in before the tail is moved past it, and the other thread only reads the
+ * frame after it sees the new tail, so it always sees the whole frame.  In the
+ * same way a slot is only reused after the head has moved past it.
+ *
+ * If the PB queue is full the frame is dropped and counted.  The ground station
+ * will send the request again.  Connected mode frames have already been acked
+ * by the TNC, so a lost frame would leave a hole in an upload.  They are put
+ * with fq_put_wait(), which holds up the receive loop until the FTL0 thread
+ * has made room.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "debug.h"
+#include "pacsat_frame_queue.h"
+
+/**
+ * fq_init()
+ *
+ * Empty the queue.  Call before the threads that use it are started.
+ */
+void fq_init(FRAME_QUEUE *queue) {
+	atomic_init(&queue->head, 0);
+	atomic_init(&queue->tail, 0);
+	queue->dropped = 0;
+}
+
+/* Copy a frame onto the end of the queue if there is room.  Returns EXIT_SUCCESS or EXIT_FAILURE */
+static int fq_insert(FRAME_QUEUE *queue, struct t_agw_frame_ptr *frame, CALLSIGN_ID from_id, CALLSIGN_ID to_id) {
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_acquire);
+	if (tail - head == FQ_LEN)
+		return EXIT_FAILURE;
+	FQ_FRAME *entry = &queue->frames[tail & (FQ_LEN - 1)];
+	entry->header = *frame->header;
+	entry->from_id = from_id;
+	entry->to_id = to_id;
+	memcpy(entry->data, frame->data, frame->header->data_len);
+	atomic_store_explicit(&queue->tail, tail + 1, memory_order_release);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * fq_put()
+ *
+ * Copy a frame and the ids of its callsigns onto the end of the queue.  Only one thread may
+ * put frames on a queue.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the queue is full or the frame is too long
+ */
+int fq_put(FRAME_QUEUE *queue, struct t_agw_frame_ptr *frame, CALLSIGN_ID from_id, CALLSIGN_ID to_id) {
+	int len = frame->header->data_len;
+	if (len < 0 || len > FQ_MAX_DATA_LEN || fq_insert(queue, frame, from_id, to_id) != EXIT_SUCCESS) {
+		queue->dropped++;
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * fq_put_wait()
+ *
+ * Copy a frame onto the end of the queue like fq_put(), but if the queue is full wait up to
+ * max_wait_ms for the thread that gets frames to make room.  Used for frames that must not be
+ * lost.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the queue stayed full or the frame is too long
+ */
+int fq_put_wait(FRAME_QUEUE *queue, struct t_agw_frame_ptr *frame, CALLSIGN_ID from_id, CALLSIGN_ID to_id, int max_wait_ms) {
+	int len = frame->header->data_len;
+	if (len < 0 || len > FQ_MAX_DATA_LEN) {
+		queue->dropped++;
+		return EXIT_FAILURE;
+	}
+	int waited_ms = 0;
+	while (fq_insert(queue, frame, from_id, to_id) != EXIT_SUCCESS) {
+		if (waited_ms >= max_wait_ms) {
+			queue->dropped++;
+			return EXIT_FAILURE;
+		}
+		usleep(1000);
+		waited_ms++;
+	}
+	return EXIT_SUCCESS;
+}
+
+/**
+ * fq_peek()
+ *
+ * Only the thread that gets frames may call this.  The frame stays valid until fq_pop() is
+ * called.
+ *
+ * Returns the frame at the front of the queue, or NULL if the queue is empty
+ */
+FQ_FRAME * fq_peek(FRAME_QUEUE *queue) {
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+	if (head == tail) return NULL;
+	return &queue->frames[head & (FQ_LEN - 1)];
+}
+
+/**
+ * fq_pop()
+ *
+ * Remove the frame at the front of the queue once it has been processed.
+ */
+void fq_pop(FRAME_QUEUE *queue) {
+	unsigned int head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+	unsigned int tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+	if (head == tail) return;
+	atomic_store_explicit(&queue->head, head + 1, memory_order_release);
+}
+
+int fq_len(FRAME_QUEUE *queue) {
+	return atomic_load(&queue->tail) - atomic_load(&queue->head);
+}
+
+/*********************************************************************************************
+ *
+ * SELF TESTS FOLLOW
+ *
+ */
+#define FQ_TEST_FRAMES 10000
+
+static FRAME_QUEUE test_queue;
+
+/* Get frames slowly, as if each one was written to the SD card */
+static void *fq_test_slow_consumer(void *arg) {
+	uint32_t *received = (uint32_t *)arg;
+	while (*received < 4 * FQ_LEN) {
+		FQ_FRAME *f = fq_peek(&test_queue);
+		if (f == NULL) continue;
+		usleep(2000);
+		if (f->header.data_kind == 'D' && f->data[0] == (*received & 0xff))
+			(*received)++;
+		fq_pop(&test_queue);
+	}
+	return NULL;
+}
+
+/* Put numbered frames on the test queue as fast as it will take them */
+static void *fq_test_producer(void *arg) {
+	struct t_agw_header header;
+	unsigned char data[8];
+	struct t_agw_frame_ptr frame;
+	memset(&header, 0, sizeof(header));
+	frame.header = &header;
+	frame.data = data;
+	for (uint32_t i=0; i < FQ_TEST_FRAMES; i++) {
+		header.data_kind = 'K';
+		header.data_len = sizeof(uint32_t) + (i % 4);
+		memset(data, i & 0xff, sizeof(data));
+		memcpy(data, &i, sizeof(uint32_t));
+		while (fq_put(&test_queue, &frame, CALLSIGN_ID_NONE, CALLSIGN_ID_NONE) != EXIT_SUCCESS)
+			test_queue.dropped = 0;
+	}
+	return NULL;
+}
+
+int test_frame_queue() {
+	printf("##### TEST FRAME QUEUE:\n");
+	int rc = EXIT_SUCCESS;
+	fq_init(&test_queue);
+
+	/* Fill the queue and check the next frame is dropped */
+	struct t_agw_header header;
+	unsigned char data[FQ_MAX_DATA_LEN + 1];
+	struct t_agw_frame_ptr frame;
+	memset(&header, 0, sizeof(header));
+	memset(data, 0, sizeof(data));
+	frame.header = &header;
+	frame.data = data;
+	if (fq_peek(&test_queue) != NULL) { printf("** Frame in empty queue\n"); rc = EXIT_FAILURE; }
+	for (int i=0; i < FQ_LEN; i++) {
+		header.data_len = 1;
+		data[0] = i;
+		if (fq_put(&test_queue, &frame, CALLSIGN_ID_NONE, CALLSIGN_ID_NONE) != EXIT_SUCCESS) { printf("** Could not put frame %d\n", i); rc = EXIT_FAILURE; }
+	}
+	if (fq_put(&test_queue, &frame, CALLSIGN_ID_NONE, CALLSIGN_ID_NONE) == EXIT_SUCCESS) { printf("** Put frame in full queue\n"); rc = EXIT_FAILURE; }
+	if (test_queue.dropped != 1) { printf("** Dropped frame not counted\n"); rc = EXIT_FAILURE; }
+	if (fq_len(&test_queue) != FQ_LEN) { printf("** Wrong queue length %d\n", fq_len(&test_queue)); rc = EXIT_FAILURE; }
+	for (int i=0; i < FQ_LEN; i++) {
+		FQ_FRAME *f = fq_peek(&test_queue);
+		if (f == NULL || f->data[0] != i) { printf("** Frame %d out of order\n", i); rc = EXIT_FAILURE; break; }
+		fq_pop(&test_queue);
+	}
+	if (fq_peek(&test_queue) != NULL) { printf("** Queue not empty\n"); rc = EXIT_FAILURE; }
+	header.data_len = FQ_MAX_DATA_LEN + 1;
+	if (fq_put(&test_queue, &frame, CALLSIGN_ID_NONE, CALLSIGN_ID_NONE) == EXIT_SUCCESS) { printf("** Put frame that is too long\n"); rc = EXIT_FAILURE; }
+
+	/* Connected mode data waits for room while the FTL0 thread is slow, so no frame is dropped */
+	fq_init(&test_queue);
+	uint32_t received = 0;
+	pthread_t consumer;
+	if (pthread_create(&consumer, NULL, fq_test_slow_consumer, &received) != EXIT_SUCCESS) {
+		printf("** Could not start consumer thread\n");
+		return EXIT_FAILURE;
+	}
+	header.data_kind = 'D';
+	header.data_len = 1;
+	for (int i=0; i < 4 * FQ_LEN; i++) {
+		data[0] = i;
+		if (fq_put_wait(&test_queue, &frame, CALLSIGN_ID_NONE, CALLSIGN_ID_NONE, 1000) != EXIT_SUCCESS) {
+			printf("** Data frame %d dropped\n", i); rc = EXIT_FAILURE; }
+	}
+	pthread_join(consumer, NULL);
+	if (received != 4 * FQ_LEN || test_queue.dropped != 0) {
+		printf("** Received %d of %d data frames\n", received, 4 * FQ_LEN); rc = EXIT_FAILURE; }
+
+	/* If nothing makes room then it gives up */
+	for (int i=0; i < FQ_LEN; i++)
+		fq_put(&test_queue, &frame, CALLSIGN_ID_NONE, CALLSIGN_ID_NONE);
+	if (fq_put_wait(&test_queue, &frame, CALLSIGN_ID_NONE, CALLSIGN_ID_NONE, 10) == EXIT_SUCCESS || test_queue.dropped != 1) {
+		printf("** Put frame in full queue after waiting\n"); rc = EXIT_FAILURE; }
+
+	/* Another thread puts frames while this one gets them.  Every frame arrives whole and in order */
+	fq_init(&test_queue);
+	pthread_t producer;
+	if (pthread_create(&producer, NULL, fq_test_producer, NULL) != EXIT_SUCCESS) {
+		printf("** Could not start producer thread\n");
+		return EXIT_FAILURE;
+	}
+	uint32_t expected = 0;
+	while (expected < FQ_TEST_FRAMES) {
+		FQ_FRAME *f = fq_peek(&test_queue);
+		if (f == NULL) continue;
+		uint32_t n;
+		memcpy(&n, f->data, sizeof(uint32_t));
+		int len = f->header.data_len;
+		if (n != expected || len != sizeof(uint32_t) + (n % 4)
+				|| (len > sizeof(uint32_t) && f->data[len - 1] != (n & 0xff))) {
+			/* Keep getting frames so that the producer can finish */
+			if (rc == EXIT_SUCCESS) printf("** Expected frame %d but got %d\n", expected, n);
+			rc = EXIT_FAILURE;
+		}
+		fq_pop(&test_queue);
+		expected++;
+	}
+	pthread_join(producer, NULL);
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST FRAME QUEUE: success\n");
+	else
+		printf("##### TEST FRAME QUEUE: fail\n");
+	return rc;
+}
@@ -39,6 +39,17 @@
 #include "pacsat_header.h"
 #include "pacsat_dir.h"
 #include "pacsat_broadcast.h"
+#include "pacsat_stats.h"
+#include "pacsat_crc.h"
+#include "pacsat_fountain.h"
+#include "pacsat_readahead.h"
+#include "pacsat_pass.h"
+#include "pacsat_tx.h"
+#include "pacsat_callsign.h"
+#include "pacsat_timer.h"
+#include "pacsat_frame_queue.h"
+#include "agw_emulator.h"
+#include "pacsat_trace.h"
 #include "ftl0.h"
 #include "iors_log.h"
 #include "keyfile.h"
@@ -49,6 +60,11 @@
 void help(void);
 void signal_exit (int sig);
 void signal_load_config (int sig);
+static void reload_config_if_requested();
+void process_frame(struct t_agw_frame_ptr *frame, int frame_num);
+void *pb_thread_process(void * arg);
+void *ftl0_thread_process(void * arg);
+void *dir_thread_process(void * arg);
 
 /*
  *  GLOBAL VARIABLES defined here.  They are declared in config.h
@@ -68,6 +84,14 @@ int g_max_frames_in_tx_buffer = 2;
 int g_serial_fd = -1;
 
 char g_upload_table_path[MAX_FILE_PATH_LEN] = "pacsat_upload_table.dat";
+int g_max_pb_length = MAX_PB_LENGTH;
+char g_pb_scheduler[MAX_CONFIG_LINE_LENGTH] = PB_SCHEDULER_DRR;
+int g_pb_drr_quantum = PB_DRR_DEFAULT_QUANTUM;
+char g_stats_file_path[MAX_FILE_PATH_LEN] = "pacsat_stats.csv";
+int g_tx_target_latency_ms = TX_DEFAULT_TARGET_LATENCY_MS;
+char g_pass_schedule_path[MAX_FILE_PATH_LEN] = "pacsat_pass_schedule.csv";
+int g_rx_batch_budget = RX_DEFAULT_BATCH_BUDGET;
+int g_number_of_ports = 1;
 
 /* These global variables are in the state file and are resaved when changed.  These default values are
  * overwritten when the state file is loaded */
@@ -82,6 +106,12 @@ int g_dir_maintenance_period_in_seconds = 5; // check one node after this delay
 int g_ftl0_maintenance_period_in_seconds = 60; // check after this delay
 int g_file_queue_check_period_in_seconds = 5; // check after this delay
 int g_state_pacsat_log_level = INFO_LOG;
+int g_pb_bstat_period_in_seconds = 60; // send BSTAT this often during a pass
+int g_stats_pass_idle_period_in_seconds = 300; // the pass is over when we hear nothing for this long
+int g_pb_idle_period_in_seconds = 2; // send one idle broadcast frame this often when the PB is empty.  0 to disable
+int g_pb_recent_window_in_seconds = 10; // holes broadcast this recently are not sent again.  0 to disable
+int g_pb_fountain_repair_percent = 25; // repair symbols sent after a file when the station sets the F bit, as a percent of its blocks.  0 to disable
+int g_pb_admission_slack_percent = 100; // requests are refused if they can not finish in this percent of the time left in the pass.  0 to disable
 
 int g_dir_next_file_number = 1; // this is updated from the state file and then when the dir is loaded
 int g_ftl0_max_file_size = 153600; // 150k max file size
@@ -89,13 +119,16 @@ int g_ftl0_max_upload_age_in_seconds = 5 * 24 * 60 * 60; // 5 days
 
 /* Local variables */
 pthread_t tnc_listen_pthread;
+pthread_t pb_pthread;
+pthread_t ftl0_pthread;
+pthread_t dir_pthread;
+static FRAME_QUEUE pb_frame_queue; /* Requests from the receive loop to the PB thread */
+static FRAME_QUEUE ftl0_frame_queue; /* Connected mode frames from the receive loop to the FTL0 thread */
+static volatile sig_atomic_t reload_config_requested = false; /* Set by SIGHUP */
 int g_run_self_test = false;
 int frame_queue_status_known = false;
 char config_file_name[MAX_FILE_PATH_LEN] = "pi_pacsat.config";
 char data_folder_path[MAX_FILE_PATH_LEN] = "./pacsat";
-time_t last_dir_maint_time;
-time_t last_ftl0_maint_time;
-time_t last_file_queue_check_time;
 
 
 /**
@@ -107,23 +140,311 @@ void help(void) {
 			"-h,--help                        help\n"
 			"-c,--config                      use config file specified\n"
 			"-d,--dir                         use this data directory, rather than default\n"
+			"-e,--emulate                     act as the AGW TNC for another pacsat and run the station script specified\n"
 			"-k,--key                         use this command key file, rather than default\n"
+			"-p,--replay                      process the frames from the trace file specified instead of the TNC and exit\n"
+			"-r,--record                      record the frames to and from the TNC in the trace file specified\n"
+			"-s,--simulate                    replay the request trace file specified against the pass schedule and exit\n"
 			"-t,--test                        Run self test functions and exit\n"
 			"-v,--verbose                     print additional status and progress messages\n"
+			"-x,--speed                       replay this many times faster than recorded.  0 for as fast as possible\n"
 	);
 	exit(EXIT_SUCCESS);
 }
 
 void signal_exit (int sig) {
 	debug_print (" Signal received, exiting ...\n");
+	trace_close();
 	// TODO - unregister the callsign and close connection to AGW
 	log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, 0);
 	exit (0);
 }
 
+/**
+ * signal_load_config()
+ *
+ * SIGHUP asks for the config to be reloaded.  This only sets a flag, because loading it takes
+ * locks that the interrupted thread could hold.  The receive loop does the reload.
+ */
 void signal_load_config (int sig) {
+	reload_config_requested = true;
+}
+
+/**
+ * reload_config_if_requested()
+ *
+ * Reload the config, state and pass schedule if SIGHUP was received.  Called from the
+ * receive loop.  The PB, FTL0 and directory threads read these globals, so they are held
+ * with the config lock until the reload is done.
+ */
+static void reload_config_if_requested() {
+	if (!reload_config_requested) return;
+	reload_config_requested = false;
+	config_write_lock();
 	load_config(config_file_name);
+	callsign_init();
 	load_state("pacsat.state");
+	pass_load_schedule(g_pass_schedule_path);
+	config_write_unlock();
+}
+
+/**
+ * process_frame()
+ *
+ * Process one frame that the TNC listen thread received.  Confirms from the TNC are handled
+ * straight away.  Requests for the PB and connected mode frames for FTL0 are copied onto the
+ * queue for that thread.  frame_num is the position of the frame in the receive buffer and is
+ * only used for debug output.
+ */
+void process_frame(struct t_agw_frame_ptr *frame, int frame_num) {
+	switch (frame->header->data_kind) {
+	case 'X': // Response to callsign registration
+		debug_print("Set BBS Callsign: %s:\n",frame->header->call_from);
+		break;
+	case 'T': // Response to sending a UI frame
+		/* The T frame is a confirm that a frame was sent.  We use this event to decrement how many
+		 * frames are outstanding.  We actually increase the frame counter whenever we send a UI frame.
+		 * We can still get a bit ahead of ourselves and end up with more frames queued than expected. */
+		tx_frame_confirmed(frame->header->portx, tx_now_ms());
+
+//		tnc_frames_queued();
+		break;
+	case 'y': // Response to query of number of frames outstanding -- but this does not work with DireWolf
+		//process_frames_queued (frame->data, frame->header->data_len);
+		break;
+	case 'S': // Supervisory frame.  Only received if monitoring with 'm'.  Only needed for debugging
+		break;
+	case 'K': // Monitored frame
+//		debug_print("FRM:%d:",frame_num);
+//		print_header(frame->header);
+//		print_data(frame->data, frame->header->data_len);
+//		debug_print("| %d bytes\n", frame->header->data_len);
+
+		/* Only send Broadcast UI frames to the PB */
+		if (callsign_lookup(frame->header->call_to) == g_broadcast_callsign_id) {
+			stats_rx_frame(time(0));
+			CALLSIGN_ID from_id = callsign_intern(frame->header->call_from);
+			if (from_id == CALLSIGN_ID_NONE) break;
+			if (fq_put(&pb_frame_queue, frame, from_id, g_broadcast_callsign_id) != EXIT_SUCCESS) {
+				error_print("PB queue full, frame from %s dropped\n", frame->header->call_from);
+				callsign_release(from_id);
+			}
+		}
+		break;
+	case 'C': // Connected to a station
+	case 'D': // Data from a connected station
+		stats_rx_frame(time(0));
+		CALLSIGN_ID from_id = callsign_intern(frame->header->call_from);
+		if (from_id == CALLSIGN_ID_NONE) break;
+		/* The TNC has acked this frame, so it must not be lost.  If the FTL0 thread can not make room
+		 * then the station is disconnected, and it will start the upload again */
+		if (fq_put_wait(&ftl0_frame_queue, frame, from_id, callsign_lookup(frame->header->call_to),
+				FQ_CONNECTED_WAIT_MS) != EXIT_SUCCESS) {
+			error_print("FTL0 queue full, disconnecting %s\n", frame->header->call_from);
+			callsign_release(from_id);
+			trace_disconnect(g_bbs_callsign, frame->header->call_from, frame->header->portx);
+		}
+		break;
+	case 'd': // Disconnect from the TNC
+		debug_print("*** DISC from other TNC:%d:",frame_num);
+		print_header(frame->header);
+		print_data(frame->data, frame->header->data_len);
+		debug_print("\n");
+		from_id = callsign_intern(frame->header->call_from);
+		if (from_id == CALLSIGN_ID_NONE) break;
+		if (fq_put_wait(&ftl0_frame_queue, frame, from_id, callsign_lookup(frame->header->call_to),
+				FQ_CONNECTED_WAIT_MS) != EXIT_SUCCESS) {
+			error_print("FTL0 queue full, disconnect from %s dropped\n", frame->header->call_from);
+			callsign_release(from_id);
+		}
+		break;
+	}
+}
+
+/**
+ * replay_trace()
+ *
+ * Pass the received frames from the trace to process_frame() in place of the TNC.  With speed 1
+ * the frames arrive with their recorded timing, with a higher speed they arrive that many times
+ * faster and with speed 0 as fast as they can be processed.  The report is printed once the PB
+ * and FTL0 threads have emptied their queues.
+ *
+ * Returns EXIT_SUCCESS
+ */
+static int replay_trace(int speed) {
+	struct t_agw_header header;
+	unsigned char data[TRACE_MAX_DATA_LEN];
+	struct t_agw_frame_ptr frame;
+	frame.header = &header;
+	frame.data = data;
+	uint64_t start_ms = tx_now_ms();
+	uint32_t time_ms;
+	int frame_num = 0;
+	while (trace_read_next(&time_ms, &header, data) == EXIT_SUCCESS) {
+		if (speed > 0) {
+			uint64_t due_ms = start_ms + time_ms / speed;
+			while (tx_now_ms() < due_ms) {
+				tx_next_action(tx_now_ms());
+				usleep(1000);
+			}
+		}
+		trace_received(&frame, tx_now_ms());
+		process_frame(&frame, frame_num);
+		tx_next_action(tx_now_ms());
+		reload_config_if_requested();
+		frame_num++;
+		if (frame_num == MAX_RX_QUEUE_LEN)
+			frame_num=0;
+	}
+	while (fq_len(&pb_frame_queue) > 0 || fq_len(&ftl0_frame_queue) > 0) {
+		tx_next_action(tx_now_ms());
+		usleep(1000);
+	}
+	trace_print_report(tx_now_ms() - start_ms);
+	trace_close();
+	return EXIT_SUCCESS;
+}
+
+/**
+ * ftl0_process_frame()
+ *
+ * Pass a connected mode frame from the FTL0 queue to the uplink state machines.
+ */
+static void ftl0_process_frame(FQ_FRAME *frame) {
+	switch (frame->header.data_kind) {
+	case 'C': // Connected to a station
+//		debug_print("CON:");
+//		print_header(&frame->header);
+//		print_data(frame->data, frame->header.data_len);
+//		debug_print("\n");
+
+		if (strncmp((char *)frame->data, "*** CONNECTED To Station", 24) == 0) {
+			// Incoming: Other station initiated the connect request.
+			ftl0_connection_received (frame->from_id, frame->to_id, frame->header.portx, 1, frame->data);
+		}
+		else if (strncmp((char *)frame->data, "*** CONNECTED With Station", 26) == 0) {
+			// Outgoing: Other station accepted my connect request.
+			ftl0_connection_received (frame->from_id, frame->to_id, frame->header.portx, 0, frame->data);
+		}
+		break;
+
+	case 'D': // Data from a connected station
+		// TODO - we might want to block signals here so we don't exit in the middle of a file write
+//		debug_print("DATA:");
+//		print_header(&frame->header);
+//		print_data(frame->data, frame->header.data_len);
+//		debug_print("\n");
+		ftl0_process_data(frame->from_id, frame->to_id, frame->header.portx, frame->data, frame->header.data_len);
+		break;
+
+	case 'd': // Disconnect from the TNC
+		ftl0_disconnected(frame->from_id, frame->to_id, frame->header.portx, frame->data, frame->header.data_len);
+		break;
+	}
+}
+
+/**
+ * pb_thread_process()
+ *
+ * The PB thread.  Process the requests that the receive loop queued, then make the next
+ * broadcast.  The PB reads the directory inside an epoch, so a node it is looking at is not
+ * freed.  It also holds the directory write lock while it processes a request, because a
+ * command can reload the directory.  Each pass holds the config read lock.
+ */
+void *pb_thread_process(void * arg) {
+	while (1) {
+		int frames_processed = 0;
+		FQ_FRAME *frame;
+		config_read_lock();
+		dir_epoch_enter();
+		while (frames_processed < g_rx_batch_budget && (frame = fq_peek(&pb_frame_queue)) != NULL) {
+			dir_write_lock();
+			pb_process_frame(frame->header.portx, frame->from_id, frame->data, frame->header.data_len);
+			dir_write_unlock();
+			callsign_release(frame->from_id); /* Taken by the receive loop */
+			fq_pop(&pb_frame_queue);
+			frames_processed++;
+		}
+
+		pb_next_action();
+		dir_epoch_exit();
+		config_read_unlock();
+
+		if (frames_processed == 0)
+			usleep(10000); // sleep 10ms
+	}
+	return NULL;
+}
+
+/**
+ * ftl0_thread_process()
+ *
+ * The FTL0 thread.  Process the connected mode frames that the receive loop queued and run the
+ * uplink state machines.  Uploaded files are written to disk here, so a slow write does not
+ * hold up the broadcasts, and a slow broadcast does not hold up an ACK.  Each pass holds the
+ * config read lock.
+ */
+void *ftl0_thread_process(void * arg) {
+	time_t last_ftl0_maint_time = 0;
+	while (1) {
+		int frames_processed = 0;
+		FQ_FRAME *frame;
+		config_read_lock();
+		while (frames_processed < g_rx_batch_budget && (frame = fq_peek(&ftl0_frame_queue)) != NULL) {
+			ftl0_process_frame(frame);
+			callsign_release(frame->from_id); /* Taken by the receive loop */
+			fq_pop(&ftl0_frame_queue);
+			frames_processed++;
+		}
+
+		ftl0_next_action();
+
+		time_t now = time(0);
+		if (last_ftl0_maint_time == 0) last_ftl0_maint_time = now; // Initialize at startup
+		if ((now - last_ftl0_maint_time) > g_ftl0_maintenance_period_in_seconds) {
+			last_ftl0_maint_time = now;
+			char *path = get_upload_folder();
+			ftl0_maintenance(now, path);
+		}
+		config_read_unlock();
+
+		if (frames_processed == 0)
+			usleep(10000); // sleep 10ms
+	}
+	return NULL;
+}
+
+/**
+ * dir_thread_process()
+ *
+ * The directory thread.  Purge old files from the directory and add the files that other
+ * processes put in the queue folders.  Compressing a queued file can take several seconds.
+ * Each pass holds the config read lock.
+ */
+void *dir_thread_process(void * arg) {
+	time_t last_dir_maint_time = 0;
+	time_t last_file_queue_check_time = 0;
+	while (1) {
+		config_read_lock();
+		time_t now = time(0);
+
+		if (last_dir_maint_time == 0) last_dir_maint_time = now; // Initialize at startup
+		if ((now - last_dir_maint_time) > g_dir_maintenance_period_in_seconds) {
+			last_dir_maint_time = now;
+			dir_maintenance(now);
+		}
+		if (last_file_queue_check_time == 0) last_file_queue_check_time = now; // Initialize at startup
+		if ((now - last_file_queue_check_time) > g_file_queue_check_period_in_seconds) {
+			last_file_queue_check_time = now;
+			dir_file_queue_check(now, get_wod_folder(), PFH_TYPE_WL, "WOD");
+			dir_file_queue_check(now, get_senwod_folder(), PFH_TYPE_SEN_WOD, "SENWOD");
+			dir_file_queue_check(now, get_log_folder(), PFH_TYPE_AL, "LOG");
+			dir_file_queue_check(now, get_txt_folder(), PFH_TYPE_ASCII, "TXT");
+		}
+		config_read_unlock();
+		sleep(1);
+	}
+	return NULL;
 }
 
 int main(int argc, char *argv[]) {
@@ -140,16 +461,26 @@ int main(int argc, char *argv[]) {
 			{"config", required_argument, NULL, 'c'},
 			{"test", no_argument, NULL, 't'},
 			{"verbose", no_argument, NULL, 'v'},
+			{"simulate", required_argument, NULL, 's'},
+			{"emulate", required_argument, NULL, 'e'},
+			{"record", required_argument, NULL, 'r'},
+			{"replay", required_argument, NULL, 'p'},
+			{"speed", required_argument, NULL, 'x'},
 			{NULL, 0, NULL, 0},
 	};
 
 	int more_help = false;
 	char command_key_file[MAX_FILE_PATH_LEN];
+	char simulate_trace_file[MAX_FILE_PATH_LEN] = "";
+	char emulate_script_file[MAX_FILE_PATH_LEN] = "";
+	char record_trace_file[MAX_FILE_PATH_LEN] = "";
+	char replay_trace_file[MAX_FILE_PATH_LEN] = "";
+	int replay_speed = 1;
 	strlcpy(config_file_name, "pacsat.config", sizeof(config_file_name));
 
 	while (1) {
 		int c;
-		if ((c = getopt_long(argc, argv, "htvc:d:k:", long_option, NULL)) < 0)
+		if ((c = getopt_long(argc, argv, "htvc:d:k:s:e:r:p:x:", long_option, NULL)) < 0)
 			break;
 		switch (c) {
 		case 'h': // help
@@ -170,6 +501,21 @@ int main(int argc, char *argv[]) {
 		case 'k': // key file
 			strlcpy(command_key_file, optarg, sizeof(command_key_file));
 			break;
+		case 's': // request trace to simulate
+			strlcpy(simulate_trace_file, optarg, sizeof(simulate_trace_file));
+			break;
+		case 'e': // station script for the TNC emulator
+			strlcpy(emulate_script_file, optarg, sizeof(emulate_script_file));
+			break;
+		case 'r': // trace file to record
+			strlcpy(record_trace_file, optarg, sizeof(record_trace_file));
+			break;
+		case 'p': // trace file to replay
+			strlcpy(replay_trace_file, optarg, sizeof(replay_trace_file));
+			break;
+		case 'x': // replay speed
+			replay_speed = atoi(optarg);
+			break;
 		}
 	}
 
@@ -185,7 +531,20 @@ int main(int argc, char *argv[]) {
 
 	/* Load configuration from the config file */
 	load_config(config_file_name);
+	callsign_init();
 	load_state("pacsat.state");
+	pass_load_schedule(g_pass_schedule_path);
+
+	if (simulate_trace_file[0] != 0) {
+		PASS_SIM_RESULT result;
+		rc = pass_simulate(simulate_trace_file, &result);
+		exit(rc);
+	}
+
+	if (emulate_script_file[0] != 0) {
+		rc = emu_run(emulate_script_file, AGW_PORT);
+		exit(rc);
+	}
 
 	char log_path[MAX_FILE_PATH_LEN];
 	//make_dir_path(get_folder_str(FolderLog), data_folder_path, data_folder_path, log_path);
@@ -197,21 +556,39 @@ int main(int argc, char *argv[]) {
 	log_set_level(g_state_pacsat_log_level);
 	log_alog1(INFO_LOG, g_log_filename, ALOG_FS_STARTUP, 0);
 
-	rc = tnc_connect("127.0.0.1", AGW_PORT, g_bit_rate, g_max_frames_in_tx_buffer);
-	if (rc != EXIT_SUCCESS) {
-		error_print("\n Error : Could not connect to TNC on port: %d\n",IORS_PORT);
-		log_err(g_log_filename, IORS_ERR_FS_TNC_FAILURE);
+	/* Allocate the PB list.  The size comes from the config file so this must follow load_config() */
+	if (pb_init() != EXIT_SUCCESS) {
+		error_print("FATAL. Could not allocate the PB list\n");
 		log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, EXIT_FAILURE);
 		exit(EXIT_FAILURE);
 	}
+	ftl0_init();
+	tx_init();
+
+	/* A replay takes the place of the TNC, so we do not connect to it */
+	if (replay_trace_file[0] != 0) {
+		if (trace_replay_open(replay_trace_file) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+	} else if (record_trace_file[0] != 0) {
+		if (trace_record_open(record_trace_file) != EXIT_SUCCESS) exit(EXIT_FAILURE);
+	}
 
-	rc = tnc_start_monitoring('k'); // k monitors raw frames, required to process UI frames
-	rc = tnc_start_monitoring('m'); // monitors connected frames, also required to monitor T frames to manage the TX frame queue
-	if (rc != EXIT_SUCCESS) {
-		error_print("\n Error : Could not monitor TNC \n");
-		log_err(g_log_filename, IORS_ERR_FS_TNC_FAILURE);
-		log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, EXIT_FAILURE);
-		exit(EXIT_FAILURE);
+	if (!trace_replaying()) {
+		rc = tnc_connect("127.0.0.1", AGW_PORT, g_bit_rate, g_max_frames_in_tx_buffer);
+		if (rc != EXIT_SUCCESS) {
+			error_print("\n Error : Could not connect to TNC on port: %d\n",IORS_PORT);
+			log_err(g_log_filename, IORS_ERR_FS_TNC_FAILURE);
+			log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, EXIT_FAILURE);
+			exit(EXIT_FAILURE);
+		}
+
+		rc = tnc_start_monitoring('k'); // k monitors raw frames, required to process UI frames
+		rc = tnc_start_monitoring('m'); // monitors connected frames, also required to monitor T frames to manage the TX frame queue
+		if (rc != EXIT_SUCCESS) {
+			error_print("\n Error : Could not monitor TNC \n");
+			log_err(g_log_filename, IORS_ERR_FS_TNC_FAILURE);
+			log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, EXIT_FAILURE);
+			exit(EXIT_FAILURE);
+		}
 	}
 
 	if (g_run_self_test) {
@@ -236,6 +613,12 @@ int main(int argc, char *argv[]) {
 
 		rc = test_pacsat_dir();
 		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_dir_epoch();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_crc16();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_fountain();
+		if (rc != EXIT_SUCCESS) exit(rc);
 		rc = test_pb_list();
 		if (rc != EXIT_SUCCESS) exit(rc);
 		rc = test_pb();
@@ -244,6 +627,38 @@ int main(int argc, char *argv[]) {
 		if (rc != EXIT_SUCCESS) exit(rc);
 		rc = test_pb_file_holes();
 		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_pb_normalize_holes();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_pb_scheduler();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_pb_idle();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_pb_recent();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_pb_fountain();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_pb_progress();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_readahead();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_frame_queue();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_callsign();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_timer_wheel();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_agw_emulator();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_trace();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_pass();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_stats();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_tx_pacing();
+		if (rc != EXIT_SUCCESS) exit(rc);
+		rc = test_tx_queue();
+		if (rc != EXIT_SUCCESS) exit(rc);
 
 		rc = test_ftl0_upload_table();
 		if (rc != EXIT_SUCCESS) exit(rc);
@@ -252,47 +667,78 @@ int main(int argc, char *argv[]) {
 		exit (rc);
 	}
 
-	/**
-	 * Register the callsign that will accept connection requests.
-	 */
-	rc = tnc_register_callsign(g_bbs_callsign);
-	if (rc != EXIT_SUCCESS) {
-		error_print("\n Error : Could not register callsign with TNC \n");
-		//TODO - split call and ssid!
-		log_alog2(ERR_LOG, g_log_filename, ALOG_IORS_ERR, g_bbs_callsign, 0, IORS_ERR_FS_TNC_FAILURE);
-		log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, EXIT_FAILURE);
-		exit(EXIT_FAILURE);
+	if (!trace_replaying()) {
+		/**
+		 * Register the callsign that will accept connection requests.
+		 */
+		rc = tnc_register_callsign(g_bbs_callsign);
+		if (rc != EXIT_SUCCESS) {
+			error_print("\n Error : Could not register callsign with TNC \n");
+			//TODO - split call and ssid!
+			log_alog2(ERR_LOG, g_log_filename, ALOG_IORS_ERR, g_bbs_callsign, 0, IORS_ERR_FS_TNC_FAILURE);
+			log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, EXIT_FAILURE);
+			exit(EXIT_FAILURE);
+		}
+
+		/**
+		 * Start a thread to listen to the TNC.  This will write all received frames into
+		 * a circular buffer.  This thread runs in the background and is always ready to
+		 * receive data from the TNC.
+		 *
+		 * The receive loop reads frames from the buffer and processes
+		 * them when we have time.
+		 */
+		char *name = "TNC Listen Thread";
+		rc = pthread_create( &tnc_listen_pthread, NULL, tnc_listen_process, (void*) name);
+		if (rc != EXIT_SUCCESS) {
+			error_print("FATAL. Could not start the TNC listen thread.\n");
+			log_err(g_log_filename, IORS_ERR_TNC_FAILURE);
+			log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, rc);
+			exit(rc);
+		}
 	}
 
+	/* Initialize the directory */
+	if (dir_init(data_folder_path) != EXIT_SUCCESS) { error_print("** Could not initialize the dir\n"); return EXIT_FAILURE; }
+	dir_load();
+    key_load(command_key_file);
+
 	/**
-	 * Start a thread to listen to the TNC.  This will write all received frames into
-	 * a circular buffer.  This thread runs in the background and is always ready to
-	 * receive data from the TNC.
-	 *
-	 * The receive loop reads frames from the buffer and processes
-	 * them when we have time.
+	 * Start a thread to read the file broadcasts from disk ahead of time, so that a slow
+	 * read does not hold up the receive loop.
 	 */
-	char *name = "TNC Listen Thread";
-	rc = pthread_create( &tnc_listen_pthread, NULL, tnc_listen_process, (void*) name);
+	rc = ra_start();
 	if (rc != EXIT_SUCCESS) {
-		error_print("FATAL. Could not start the TNC listen thread.\n");
-		log_err(g_log_filename, IORS_ERR_TNC_FAILURE);
+		error_print("FATAL. Could not start the PB read ahead thread.\n");
 		log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, rc);
 		exit(rc);
 	}
 
-	/* Initialize the directory */
-	if (dir_init(data_folder_path) != EXIT_SUCCESS) { error_print("** Could not initialize the dir\n"); return EXIT_FAILURE; }
-	dir_load();
-    key_load(command_key_file);
-
 	init_commanding();
 	ftl0_load_upload_table();
 
+	/**
+	 * Start a thread each for the PB, the FTL0 uplink and the directory, so that slow disk
+	 * operations in one do not hold up the others.  The receive loop passes frames to the PB
+	 * and FTL0 threads on a queue each.
+	 */
+	fq_init(&pb_frame_queue);
+	fq_init(&ftl0_frame_queue);
+	rc = pthread_create(&pb_pthread, NULL, pb_thread_process, NULL);
+	if (rc == EXIT_SUCCESS)
+		rc = pthread_create(&ftl0_pthread, NULL, ftl0_thread_process, NULL);
+	if (rc == EXIT_SUCCESS)
+		rc = pthread_create(&dir_pthread, NULL, dir_thread_process, NULL);
+	if (rc != EXIT_SUCCESS) {
+		error_print("FATAL. Could not start the PB, FTL0 and directory threads.\n");
+		log_alog1(INFO_LOG, g_log_filename, ALOG_FS_SHUTDOWN, rc);
+		exit(rc);
+	}
+
 	/**
 	 * RECEIVE LOOP
-	 * Each time there is a new frame available in the receive buffer, process it.
-	 * We expect only these types of frames:
+	 * Each time there is a new frame available in the receive buffer, pass it to the thread
+	 * that processes it.  We expect only these types of frames:
 	 *
 	 * DIR REQUEST
 	 * New DIR requests are added to the Pacsat Broadcast (PB) queue unless it is full
@@ -307,106 +753,34 @@ int main(int argc, char *argv[]) {
 	 * CONNECTED DATA
 	 * Data that is passed to the Uplink State Machine.
 	 *
+	 * DIR and FILE REQUESTS go to the PB thread and the others go to the FTL0 thread.  The
+	 * receive loop also confirms the frames that the TNC has sent and releases the TX queues.
+	 *
 	 */
+	if (trace_replaying())
+		exit(replay_trace(replay_speed));
+
 	int frame_num = 0;
 	while(1) {
-		struct t_agw_frame_ptr frame;
-		int rc = get_next_frame(frame_num, &frame);
-
-		if (rc == EXIT_SUCCESS) {
+		/* Drain the frames that are waiting in the receive buffer before releasing the TX queues.
+		 * The budget stops a busy uplink from holding up the TX pacing. */
+		int frames_processed = 0;
+		while (frames_processed < g_rx_batch_budget) {
+			struct t_agw_frame_ptr frame;
+			if (get_next_frame(frame_num, &frame) != EXIT_SUCCESS)
+				break;
+			trace_received(&frame, tx_now_ms());
+			process_frame(&frame, frame_num);
+			frames_processed++;
 			frame_num++;
 			if (frame_num == MAX_RX_QUEUE_LEN)
 				frame_num=0;
-
-			switch (frame.header->data_kind) {
-			case 'X': // Response to callsign registration
-				debug_print("Set BBS Callsign: %s:\n",frame.header->call_from);
-				break;
-			case 'T': // Response to sending a UI frame
-				/* The T frame is a confirm that a frame was sent.  We use this event to decrement how many
-				 * frames are outstanding.  We actually increase the frame counter whenever we send a UI frame.
-				 * We can still get a bit ahead of ourselves and end up with more frames queued than expected. */
-				if (g_common_frames_queued)
-					g_common_frames_queued--;
-
-//				tnc_frames_queued();
-				break;
-			case 'y': // Response to query of number of frames outstanding -- but this does not work with DireWolf
-				//process_frames_queued (frame.data, frame.header->data_len);
-				break;
-			case 'S': // Supervisory frame.  Only received if monitoring with 'm'.  Only needed for debugging
-				break;
-			case 'K': // Monitored frame
-//				debug_print("FRM:%d:",frame_num);
-//				print_header(frame.header);
-//				print_data(frame.data, frame.header->data_len);
-//				debug_print("| %d bytes\n", frame.header->data_len);
-
-				/* Only send Broadcast UI frames to the PB */
-				if (strncasecmp(frame.header->call_to, g_broadcast_callsign, MAX_CALLSIGN_LEN) == 0)
-					pb_process_frame (frame.header->call_from, frame.header->call_to, frame.data, frame.header->data_len);
-				break;
-			case 'C': // Connected to a station
-//				debug_print("CON:%d:",frame_num);
-//				print_header(frame.header);
-//				print_data(frame.data, frame.header->data_len);
-//				debug_print("\n");
-
-				if (strncmp((char *)frame.data, "*** CONNECTED To Station", 24) == 0) {
-					// Incoming: Other station initiated the connect request.
-					ftl0_connection_received (frame.header->call_from, frame.header->call_to, frame.header->portx, 1, frame.data);
-				}
-				else if (strncmp((char *)frame.data, "*** CONNECTED With Station", 26) == 0) {
-					// Outgoing: Other station accepted my connect request.
-					ftl0_connection_received (frame.header->call_from, frame.header->call_to, frame.header->portx, 0, frame.data);
-				}
-				break;
-
-			case 'D': // Data from a connected station
-				// TODO - we might want to block signals here so we don't exit in the middle of a file write
-//				debug_print("DATA:%d:",frame_num);
-//				print_header(frame.header);
-//				print_data(frame.data, frame.header->data_len);
-//				debug_print("\n");
-				ftl0_process_data(frame.header->call_from, frame.header->call_to, frame.header->portx, frame.data, frame.header->data_len);
-				break;
-
-			case 'd': // Disconnect from the TNC
-				debug_print("*** DISC from other TNC:%d:",frame_num);
-				print_header(frame.header);
-				print_data(frame.data, frame.header->data_len);
-				debug_print("\n");
-				ftl0_disconnected(frame.header->call_from, frame.header->call_to, frame.data, frame.header->data_len);
-				break;
-			}
-		} else {
-			usleep(10000); // sleep 10ms
 		}
+		if (frames_processed == 0)
+			usleep(10000); // sleep 10ms
 
-		pb_next_action();
-		ftl0_next_action();
-
-		uint32_t now = time(0);
-
-		if (last_dir_maint_time == 0) last_dir_maint_time = now; // Initialize at startup
-		if ((now - last_dir_maint_time) > g_dir_maintenance_period_in_seconds) {
-			last_dir_maint_time = now;
-			dir_maintenance(now);
-		}
-		if (last_ftl0_maint_time == 0) last_ftl0_maint_time = now; // Initialize at startup
-		if ((now - last_ftl0_maint_time) > g_ftl0_maintenance_period_in_seconds) {
-			last_ftl0_maint_time = now;
-			char *path = get_upload_folder();
-			ftl0_maintenance(now, path);
-		}
-		if (last_file_queue_check_time == 0) last_file_queue_check_time = now; // Initialize at startup
-		if ((now - last_file_queue_check_time) > g_file_queue_check_period_in_seconds) {
-			last_file_queue_check_time = now;
-			dir_file_queue_check(now, get_wod_folder(), PFH_TYPE_WL, "WOD");
-			dir_file_queue_check(now, get_senwod_folder(), PFH_TYPE_SEN_WOD, "SENWOD");
-			dir_file_queue_check(now, get_log_folder(), PFH_TYPE_AL, "LOG");
-			dir_file_queue_check(now, get_txt_folder(), PFH_TYPE_ASCII, "TXT");
-		}
+		tx_next_action(tx_now_ms());
+		reload_config_if_requested();
 	}
 
 
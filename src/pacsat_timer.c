@@ -0,0 +1,364 @@
+/*
+ * pacsat_timer.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * A hierarchical timer wheel for the FTL0 and PB timeouts and the status
+ * broadcasts.
+ *
+ * Each level of the wheel has TIMER_SLOTS slots.  A timer that expires in
+ * the next TIMER_SLOTS ticks goes in the slot for its tick on level 0.  Later
+ * timers go on a higher level, where each slot covers TIMER_SLOTS times as
+ * many ticks as a slot on the level below.  When level 0 wraps, the timers in
+ * the next slot of level 1 are moved down, and so on up the levels.  Starting,
+ * stopping and expiring a timer are O(1) however many timers there are, and
+ * each timer is moved down at most TIMER_LEVELS - 1 times.
+ *
+ * A timer expires on the first tick at or after its expiry time, so it is
+ * never early and is at most TIMER_TICK_MS late, as long as the wheel is
+ * advanced that often.
+ *
+ * A wheel has no lock.  Each thread has its own wheel and only starts and
+ * stops the timers on it from that thread.  The callbacks run from
+ * timer_wheel_advance() and can start and stop any timer on the wheel,
+ * including the one that expired.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "debug.h"
+#include "pacsat_timer.h"
+
+/**
+ * timer_list_init()
+ *
+ * Make head an empty circular list
+ */
+static void timer_list_init(TIMER *head) {
+	head->next = head;
+	head->prev = head;
+}
+
+/**
+ * timer_unlink()
+ *
+ * Take the timer off the list it is on.  The count of the wheel is not changed.
+ */
+static void timer_unlink(TIMER *timer) {
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = NULL;
+	timer->prev = NULL;
+}
+
+/**
+ * timer_link()
+ *
+ * Put the timer in the slot for its expiry tick.  A timer that has already expired
+ * goes in the slot for the next tick to process.  The count of the wheel is not
+ * changed.
+ */
+static void timer_link(TIMER_WHEEL *wheel, TIMER *timer) {
+	if (timer->expires < wheel->tick)
+		timer->expires = wheel->tick;
+	if (timer->expires - wheel->tick >= TIMER_MAX_TICKS)
+		timer->expires = wheel->tick + TIMER_MAX_TICKS - 1;
+
+	uint64_t delta = timer->expires - wheel->tick;
+	int level = 0;
+	while (level < TIMER_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * TIMER_SLOT_BITS)))
+		level++;
+	int index = (timer->expires >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+
+	TIMER *head = &wheel->slots[level][index];
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+/**
+ * timer_list_take()
+ *
+ * Move all of the timers from the list at head onto the empty list at list
+ */
+static void timer_list_take(TIMER *head, TIMER *list) {
+	if (head->next == head) {
+		timer_list_init(list);
+		return;
+	}
+	list->next = head->next;
+	list->prev = head->prev;
+	list->next->prev = list;
+	list->prev->next = list;
+	timer_list_init(head);
+}
+
+/**
+ * timer_cascade()
+ *
+ * Move the timers in a slot of a higher level to the slots where they now belong,
+ * which is on a lower level because their expiry is closer.
+ */
+static void timer_cascade(TIMER_WHEEL *wheel, int level, int index) {
+	TIMER list;
+	timer_list_take(&wheel->slots[level][index], &list);
+	while (list.next != &list) {
+		TIMER *timer = list.next;
+		timer_unlink(timer);
+		timer_link(wheel, timer);
+	}
+}
+
+/**
+ * timer_wheel_init()
+ *
+ * Empty the wheel and set its time.  Call before any timer is started on it.
+ */
+void timer_wheel_init(TIMER_WHEEL *wheel, uint64_t now_ms) {
+	for (int level=0; level < TIMER_LEVELS; level++)
+		for (int i=0; i < TIMER_SLOTS; i++)
+			timer_list_init(&wheel->slots[level][i]);
+	wheel->tick = now_ms / TIMER_TICK_MS;
+	wheel->count = 0;
+}
+
+/**
+ * timer_init()
+ *
+ * Set the function that is called with arg when the timer expires.  The timer
+ * must not be pending.
+ */
+void timer_init(TIMER *timer, TIMER_CALLBACK callback, void *arg) {
+	timer->next = NULL;
+	timer->prev = NULL;
+	timer->wheel = NULL;
+	timer->expires = 0;
+	timer->callback = callback;
+	timer->arg = arg;
+	timer->pending = false;
+}
+
+/**
+ * timer_start()
+ *
+ * Start the timer so that it expires at expires_ms, on the same clock as the
+ * wheel is advanced with.  If the timer is already pending then it is restarted.
+ */
+void timer_start(TIMER_WHEEL *wheel, TIMER *timer, uint64_t expires_ms) {
+	timer_stop(timer);
+	/* Round up, so the timer does not expire before expires_ms */
+	timer->expires = (expires_ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	timer->wheel = wheel;
+	timer->pending = true;
+	timer_link(wheel, timer);
+	wheel->count++;
+}
+
+/**
+ * timer_stop()
+ *
+ * Stop the timer if it is pending.  The callback will not be called.
+ */
+void timer_stop(TIMER *timer) {
+	if (!timer->pending) return;
+	timer_unlink(timer);
+	timer->wheel->count--;
+	timer->wheel = NULL;
+	timer->pending = false;
+}
+
+/**
+ * timer_pending()
+ *
+ * Returns true if the timer has been started and has not expired or been stopped
+ */
+int timer_pending(TIMER *timer) {
+	return timer->pending;
+}
+
+/**
+ * timer_move()
+ *
+ * Move a timer to another place in memory, for example when the entry that holds it is
+ * copied to another position in a list.  The timer at to is stopped first.  A pending
+ * timer takes the place of from on its wheel, so it expires at the same time, and from
+ * is left stopped.
+ */
+void timer_move(TIMER *to, TIMER *from) {
+	if (to == from) return;
+	timer_stop(to);
+	to->wheel = from->wheel;
+	to->expires = from->expires;
+	to->callback = from->callback;
+	to->arg = from->arg;
+	to->pending = from->pending;
+	if (from->pending) {
+		to->next = from->next;
+		to->prev = from->prev;
+		to->next->prev = to;
+		to->prev->next = to;
+		from->next = NULL;
+		from->prev = NULL;
+		from->wheel = NULL;
+		from->pending = false;
+	}
+}
+
+/**
+ * timer_wheel_advance()
+ *
+ * Process the ticks up to now_ms and call the callback of each timer that expired.  If
+ * the wheel has not been advanced for a while then the timers that expired in that time
+ * are all called now, in the order they expired.
+ *
+ */
+void timer_wheel_advance(TIMER_WHEEL *wheel, uint64_t now_ms) {
+	uint64_t target = now_ms / TIMER_TICK_MS;
+	while (wheel->tick <= target) {
+		if (wheel->count == 0) {
+			/* Nothing can expire, so there is no need to process each tick */
+			wheel->tick = target + 1;
+			break;
+		}
+		int index = wheel->tick & TIMER_SLOT_MASK;
+		if (index == 0) {
+			/* Level 0 has wrapped, so bring down the timers for the next TIMER_SLOTS ticks */
+			for (int level=1; level < TIMER_LEVELS; level++) {
+				int level_index = (wheel->tick >> (level * TIMER_SLOT_BITS)) & TIMER_SLOT_MASK;
+				timer_cascade(wheel, level, level_index);
+				if (level_index != 0) break;
+			}
+		}
+
+		/* Take the expired timers first.  A timer started by a callback goes on the next tick */
+		TIMER expired;
+		timer_list_take(&wheel->slots[0][index], &expired);
+		wheel->tick++;
+		while (expired.next != &expired) {
+			TIMER *timer = expired.next;
+			timer_unlink(timer);
+			timer->pending = false;
+			timer->wheel = NULL;
+			wheel->count--;
+			if (timer->callback != NULL)
+				timer->callback(timer, timer->arg, now_ms);
+		}
+	}
+}
+
+/*********************************************************************************************
+ *
+ * SELF TESTS FOLLOW
+ *
+ */
+
+#define TEST_TIMERS 6
+
+static uint64_t test_fired_ms[TEST_TIMERS];
+static int test_fired_count[TEST_TIMERS];
+static TIMER_WHEEL test_wheel;
+
+static void test_timer_expired(TIMER *timer, void *arg, uint64_t now_ms) {
+	int i = (int)(intptr_t)arg;
+	test_fired_ms[i] = now_ms;
+	test_fired_count[i]++;
+}
+
+static void test_timer_periodic(TIMER *timer, void *arg, uint64_t now_ms) {
+	test_timer_expired(timer, arg, now_ms);
+	if (test_fired_count[(intptr_t)arg] < 5)
+		timer_start(&test_wheel, timer, now_ms + 1000);
+}
+
+int test_timer_wheel() {
+	printf("##### TEST TIMER WHEEL:\n");
+	int rc = EXIT_SUCCESS;
+	TIMER timers[TEST_TIMERS];
+	uint64_t expiry[TEST_TIMERS] = {250, 30000, 600000, 86400000, 5000, 0};
+	uint64_t start = 1000000;
+
+	timer_wheel_init(&test_wheel, start);
+	for (int i=0; i < TEST_TIMERS; i++) {
+		test_fired_ms[i] = 0;
+		test_fired_count[i] = 0;
+		timer_init(&timers[i], test_timer_expired, (void *)(intptr_t)i);
+	}
+	/* One timer on each level, a timer that is stopped and a periodic timer */
+	for (int i=0; i < 5; i++)
+		timer_start(&test_wheel, &timers[i], start + expiry[i]);
+	timer_stop(&timers[4]);
+	if (timer_pending(&timers[4]) || !timer_pending(&timers[3])) { printf("** Wrong pending state\n"); rc = EXIT_FAILURE; }
+	timer_init(&timers[5], test_timer_periodic, (void *)(intptr_t)5);
+	timer_start(&test_wheel, &timers[5], start + 1000);
+
+	/* Advance a tick at a time for a day.  Each timer expires on the first tick at or after its expiry */
+	for (uint64_t now = start; now <= start + expiry[3] + 1000; now += TIMER_TICK_MS) {
+		timer_wheel_advance(&test_wheel, now);
+		for (int i=0; i < 4; i++)
+			if (test_fired_count[i] == 0 && now >= start + expiry[i]) {
+				printf("** Timer %d did not expire at %ld\n", i, (long)expiry[i]); rc = EXIT_FAILURE;
+				test_fired_count[i] = -1;
+			}
+	}
+	for (int i=0; i < 4; i++) {
+		if (test_fired_count[i] != 1) { printf("** Timer %d expired %d times\n", i, test_fired_count[i]); rc = EXIT_FAILURE; }
+		if (test_fired_ms[i] < start + expiry[i] || test_fired_ms[i] >= start + expiry[i] + TIMER_TICK_MS) {
+			printf("** Timer %d expired at %ld not %ld\n", i, (long)(test_fired_ms[i] - start), (long)expiry[i]); rc = EXIT_FAILURE; }
+	}
+	if (test_fired_count[4] != 0) { printf("** Stopped timer expired\n"); rc = EXIT_FAILURE; }
+	if (test_fired_count[5] != 5 || test_fired_ms[5] != start + 5000) {
+		printf("** Periodic timer expired %d times, last at %ld\n", test_fired_count[5], (long)(test_fired_ms[5] - start)); rc = EXIT_FAILURE; }
+	if (test_wheel.count != 0) { printf("** %d timers left on the wheel\n", test_wheel.count); rc = EXIT_FAILURE; }
+
+	/* A moved timer keeps its expiry and the old one is stopped */
+	start = start + expiry[3] + 10000;
+	timer_wheel_advance(&test_wheel, start);
+	test_fired_count[0] = 0;
+	test_fired_count[1] = 0;
+	timer_start(&test_wheel, &timers[0], start + 700);
+	timer_stop(&timers[1]);
+	timer_move(&timers[1], &timers[0]);
+	if (timer_pending(&timers[0]) || !timer_pending(&timers[1])) { printf("** Timer not moved\n"); rc = EXIT_FAILURE; }
+	timer_wheel_advance(&test_wheel, start + 600);
+	if (test_fired_count[0] != 0) { printf("** Moved timer expired early\n"); rc = EXIT_FAILURE; }
+	timer_wheel_advance(&test_wheel, start + 700);
+	if (test_fired_count[0] != 1 || timer_pending(&timers[1])) { printf("** Moved timer did not expire\n"); rc = EXIT_FAILURE; }
+
+	/* When the wheel is not advanced for an hour, the timers that expired are all called */
+	test_fired_count[2] = 0;
+	test_fired_count[3] = 0;
+	timer_start(&test_wheel, &timers[2], start + 5000);
+	timer_start(&test_wheel, &timers[3], start + 7200000);
+	timer_wheel_advance(&test_wheel, start + 3600000);
+	if (test_fired_count[2] != 1 || test_fired_count[3] != 0) { printf("** Wrong timers expired after a gap\n"); rc = EXIT_FAILURE; }
+	timer_stop(&timers[3]);
+	if (test_wheel.count != 0) { printf("** Stopped timer left on the wheel\n"); rc = EXIT_FAILURE; }
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST TIMER WHEEL: success\n");
+	else
+		printf("##### TEST TIMER WHEEL: fail\n");
+	return rc;
+}
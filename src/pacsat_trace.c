@@ -0,0 +1,425 @@
+/*
+ * pacsat_trace.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * Record and replay of the frames that pass between pacsat and the TNC.
+ *
+ * When recording, every frame received from the TNC and every frame sent to it
+ * is written to a binary trace file with the time in ms since the recording
+ * started.  The file is a TRACE_FILE_HEADER followed by a TRACE_RECORD and the
+ * data for each frame.
+ *
+ * When replaying, the receive loop reads the received frames from the trace
+ * instead of the TNC and passes them to process_frame() as before.  All frames
+ * to the TNC go through the trace_send functions, which capture them instead
+ * of sending them while a replay is running.  The time from a request to the
+ * first frame sent back to that station is measured, so that builds can be
+ * compared on the same pass.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "debug.h"
+#include "agw_tnc.h"
+#include "str_util.h"
+#include "pacsat_tx.h"
+#include "pacsat_trace.h"
+
+/* A station that sent a frame and has not had a response yet */
+struct trace_waiting {
+	char callsign[MAX_CALLSIGN_LEN];
+	uint64_t rx_ms;
+};
+
+/* Local variables */
+static FILE *trace_file = NULL;
+static int trace_recording = false;
+static int trace_replay = false;
+static uint64_t trace_start_ms = 0;
+static TRACE_STATS trace_stats;
+static struct trace_waiting trace_waiting[TRACE_MAX_STATIONS];
+static int trace_number_waiting = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void trace_reset() {
+	memset(&trace_stats, 0, sizeof(trace_stats));
+	trace_number_waiting = 0;
+}
+
+/**
+ * trace_record_open()
+ *
+ * Start recording the frames to and from the TNC in filename.  An existing file is
+ * overwritten.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the file could not be written
+ */
+int trace_record_open(char *filename) {
+	trace_close();
+	pthread_mutex_lock(&trace_mutex);
+	trace_file = fopen(filename, "wb");
+	if (trace_file == NULL) {
+		pthread_mutex_unlock(&trace_mutex);
+		error_print("Could not open trace file %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	TRACE_FILE_HEADER header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+	header.version = TRACE_VERSION;
+	header.start_time = time(0);
+	if (fwrite(&header, sizeof(header), 1, trace_file) != 1) {
+		fclose(trace_file);
+		trace_file = NULL;
+		pthread_mutex_unlock(&trace_mutex);
+		error_print("Could not write trace file %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	trace_reset();
+	trace_start_ms = tx_now_ms();
+	trace_recording = true;
+	pthread_mutex_unlock(&trace_mutex);
+	debug_print("Recording frames to %s\n", filename);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * trace_replay_open()
+ *
+ * Open a trace to replay.  From now on the frames sent to the TNC are captured and not sent.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the file is not a trace
+ */
+int trace_replay_open(char *filename) {
+	trace_close();
+	pthread_mutex_lock(&trace_mutex);
+	trace_file = fopen(filename, "rb");
+	if (trace_file == NULL) {
+		pthread_mutex_unlock(&trace_mutex);
+		error_print("Could not open trace file %s\n", filename);
+		return EXIT_FAILURE;
+	}
+	TRACE_FILE_HEADER header;
+	if (fread(&header, sizeof(header), 1, trace_file) != 1
+			|| memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0 || header.version != TRACE_VERSION) {
+		fclose(trace_file);
+		trace_file = NULL;
+		pthread_mutex_unlock(&trace_mutex);
+		error_print("%s is not a trace file\n", filename);
+		return EXIT_FAILURE;
+	}
+	trace_reset();
+	trace_start_ms = tx_now_ms();
+	trace_replay = true;
+	pthread_mutex_unlock(&trace_mutex);
+	debug_print("Replaying frames from %s\n", filename);
+	return EXIT_SUCCESS;
+}
+
+/**
+ * trace_close()
+ *
+ * Stop recording or replaying.  The recording is flushed to disk.
+ */
+void trace_close() {
+	pthread_mutex_lock(&trace_mutex);
+	if (trace_file != NULL)
+		fclose(trace_file);
+	trace_file = NULL;
+	trace_recording = false;
+	trace_replay = false;
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+int trace_replaying() {
+	return trace_replay;
+}
+
+/* Write one frame to the recording.  The caller holds trace_mutex */
+static void trace_write(char direction, char data_kind, char *from_callsign, char *to_callsign, int pid, int port,
+		unsigned char *bytes, int len, uint64_t now_ms) {
+	if (!trace_recording || len < 0 || len > TRACE_MAX_DATA_LEN) return;
+	TRACE_RECORD record;
+	memset(&record, 0, sizeof(record));
+	record.time_ms = (uint32_t)(now_ms - trace_start_ms);
+	record.direction = direction;
+	record.data_kind = data_kind;
+	record.pid = pid;
+	record.port = port;
+	strlcpy(record.call_from, from_callsign, sizeof(record.call_from));
+	strlcpy(record.call_to, to_callsign, sizeof(record.call_to));
+	record.data_len = len;
+	if (fwrite(&record, sizeof(record), 1, trace_file) != 1
+			|| (len > 0 && fwrite(bytes, len, 1, trace_file) != 1)) {
+		error_print("Could not write to the trace file, recording stopped\n");
+		fclose(trace_file);
+		trace_file = NULL;
+		trace_recording = false;
+	}
+}
+
+/**
+ * trace_received()
+ *
+ * Called by the receive loop for each frame from the TNC.  The frame is recorded and a station
+ * that sent a request or connected mode data is timed until we send it a frame.
+ */
+void trace_received(struct t_agw_frame_ptr *frame, uint64_t now_ms) {
+	struct t_agw_header *header = frame->header;
+	pthread_mutex_lock(&trace_mutex);
+	trace_write(TRACE_RX, header->data_kind, header->call_from, header->call_to, header->pid, header->portx,
+			frame->data, header->data_len, now_ms);
+	if (trace_replay) {
+		trace_stats.rx_frames++;
+		if (header->data_kind == 'K' || header->data_kind == 'C' || header->data_kind == 'D') {
+			int i;
+			for (i=0; i < trace_number_waiting; i++)
+				if (strncasecmp(trace_waiting[i].callsign, header->call_from, MAX_CALLSIGN_LEN) == 0) break;
+			if (i == trace_number_waiting && trace_number_waiting < TRACE_MAX_STATIONS) {
+				strlcpy(trace_waiting[i].callsign, header->call_from, MAX_CALLSIGN_LEN);
+				trace_waiting[i].rx_ms = now_ms;
+				trace_number_waiting++;
+			}
+		}
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+/**
+ * trace_sent()
+ *
+ * Called for each frame sent to the TNC.  The frame is recorded and the latency is measured if
+ * the station it is sent to was waiting for a response.
+ */
+void trace_sent(int port, char data_kind, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len, uint64_t now_ms) {
+	pthread_mutex_lock(&trace_mutex);
+	trace_write(TRACE_TX, data_kind, from_callsign, to_callsign, pid, port, bytes, len, now_ms);
+	if (trace_replay) {
+		trace_stats.tx_frames++;
+		for (int i=0; i < trace_number_waiting; i++) {
+			if (strncasecmp(trace_waiting[i].callsign, to_callsign, MAX_CALLSIGN_LEN) == 0) {
+				uint32_t latency_ms = (uint32_t)(now_ms - trace_waiting[i].rx_ms);
+				trace_stats.responses++;
+				trace_stats.total_latency_ms += latency_ms;
+				if (latency_ms > trace_stats.max_latency_ms)
+					trace_stats.max_latency_ms = latency_ms;
+				trace_waiting[i] = trace_waiting[trace_number_waiting - 1];
+				trace_number_waiting--;
+				break;
+			}
+		}
+	}
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+/**
+ * trace_read_next()
+ *
+ * Read the next received frame from the trace being replayed.  Frames that were sent are
+ * counted and skipped.  data must have room for TRACE_MAX_DATA_LEN bytes.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE at the end of the trace
+ */
+int trace_read_next(uint32_t *time_ms, struct t_agw_header *header, unsigned char *data) {
+	pthread_mutex_lock(&trace_mutex);
+	int rc = EXIT_FAILURE;
+	TRACE_RECORD record;
+	while (trace_replay && trace_file != NULL && fread(&record, sizeof(record), 1, trace_file) == 1) {
+		if (record.data_len > TRACE_MAX_DATA_LEN
+				|| (record.data_len > 0 && fread(data, record.data_len, 1, trace_file) != 1)) {
+			error_print("Trace file is truncated\n");
+			break;
+		}
+		if (record.direction == TRACE_TX) {
+			trace_stats.recorded_tx_frames++;
+			continue;
+		}
+		memset(header, 0, sizeof(struct t_agw_header));
+		header->portx = record.port;
+		header->data_kind = record.data_kind;
+		header->pid = record.pid;
+		memcpy(header->call_from, record.call_from, sizeof(header->call_from));
+		memcpy(header->call_to, record.call_to, sizeof(header->call_to));
+		header->data_len = record.data_len;
+		*time_ms = record.time_ms;
+		rc = EXIT_SUCCESS;
+		break;
+	}
+	pthread_mutex_unlock(&trace_mutex);
+	return rc;
+}
+
+/**
+ * trace_send_raw_packet()
+ *
+ * Send a UI frame to the TNC, or capture it during a replay.  All UI frames go through here.
+ * The AGW library does not take a port for UI frames yet and sends them all on port 0, so the
+ * port is only recorded in the trace.  load_config() limits number_of_ports to TNC_UI_PORTS
+ * until it can.
+ *
+ * Returns EXIT_SUCCESS unless it was unable to send the frame to the TNC
+ */
+int trace_send_raw_packet(int port, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len) {
+	trace_sent(port, 'K', from_callsign, to_callsign, pid, bytes, len, tx_now_ms());
+	if (trace_replay) return EXIT_SUCCESS;
+	return send_raw_packet(from_callsign, to_callsign, pid, bytes, len);
+}
+
+/**
+ * trace_send_connected_data()
+ *
+ * Send connected mode data to the TNC, or capture it during a replay.
+ *
+ * Returns EXIT_SUCCESS unless it was unable to send the frame to the TNC
+ */
+int trace_send_connected_data(char *from_callsign, char *to_callsign, int channel, unsigned char *bytes, int len) {
+	trace_sent(channel, 'D', from_callsign, to_callsign, 0, bytes, len, tx_now_ms());
+	if (trace_replay) return EXIT_SUCCESS;
+	return tnc_send_connected_data(from_callsign, to_callsign, channel, bytes, len);
+}
+
+/**
+ * trace_disconnect()
+ *
+ * Ask the TNC to disconnect a station, or capture the request during a replay.
+ *
+ * Returns EXIT_SUCCESS unless it was unable to send the request to the TNC
+ */
+int trace_disconnect(char *from_callsign, char *to_callsign, int channel) {
+	trace_sent(channel, 'd', from_callsign, to_callsign, 0, NULL, 0, tx_now_ms());
+	if (trace_replay) return EXIT_SUCCESS;
+	return tnc_diconnect(from_callsign, to_callsign, channel);
+}
+
+void trace_get_stats(TRACE_STATS *stats) {
+	pthread_mutex_lock(&trace_mutex);
+	*stats = trace_stats;
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+/**
+ * trace_print_report()
+ *
+ * Print the throughput and response latency of a replay that took elapsed_ms.
+ */
+void trace_print_report(uint32_t elapsed_ms) {
+	TRACE_STATS stats;
+	trace_get_stats(&stats);
+	if (elapsed_ms == 0) elapsed_ms = 1;
+	printf("Replayed %d frames in %d ms: %d frames/s\n", stats.rx_frames, elapsed_ms,
+			(int)((uint64_t)stats.rx_frames * 1000 / elapsed_ms));
+	printf("Sent %d frames, %d when recorded\n", stats.tx_frames, stats.recorded_tx_frames);
+	if (stats.responses > 0)
+		printf("Responses: %d Latency avg: %d ms max: %d ms\n", stats.responses,
+				(int)(stats.total_latency_ms / stats.responses), stats.max_latency_ms);
+	else
+		printf("Responses: 0\n");
+}
+
+/*********************************************************************************************
+ *
+ * SELF TESTS FOLLOW
+ *
+ */
+
+int test_trace() {
+	printf("##### TEST TRACE:\n");
+	int rc = EXIT_SUCCESS;
+	char *filename = "/tmp/pacsat_test_trace.bin";
+
+	/* Record a request, our response and the confirm from the TNC */
+	struct t_agw_header header;
+	unsigned char data[TRACE_MAX_DATA_LEN];
+	struct t_agw_frame_ptr frame;
+	frame.header = &header;
+	frame.data = data;
+	memset(&header, 0, sizeof(header));
+	for (int i=0; i < 20; i++)
+		data[i] = i;
+	if (trace_record_open(filename) != EXIT_SUCCESS) return EXIT_FAILURE;
+	uint64_t now_ms = tx_now_ms();
+	header.data_kind = 'K';
+	header.pid = 0xBD;
+	strlcpy(header.call_from, "G0KLA", sizeof(header.call_from));
+	strlcpy(header.call_to, "PACB-11", sizeof(header.call_to));
+	header.data_len = 20;
+	trace_received(&frame, now_ms + 100);
+	trace_sent(0, 'K', "PACB-11", "G0KLA", 0xF0, (unsigned char *)"OK", 2, now_ms + 150);
+	header.data_kind = 'T';
+	header.data_len = 0;
+	trace_received(&frame, now_ms + 400);
+	trace_close();
+
+	FILE *f = fopen(filename, "rb");
+	if (f == NULL) { printf("** Trace file not written\n"); return EXIT_FAILURE; }
+	fseek(f, 0, SEEK_END);
+	long len = ftell(f);
+	fclose(f);
+	if (len != sizeof(TRACE_FILE_HEADER) + 3 * sizeof(TRACE_RECORD) + 22) {
+		printf("** Wrong trace file length %ld\n", len); rc = EXIT_FAILURE;
+	}
+
+	/* Replay it.  Only the received frames are read back */
+	if (trace_replay_open(filename) != EXIT_SUCCESS) return EXIT_FAILURE;
+	if (!trace_replaying()) { printf("** Not replaying\n"); rc = EXIT_FAILURE; }
+	uint32_t time_ms;
+	memset(data, 0, sizeof(data));
+	if (trace_read_next(&time_ms, &header, data) != EXIT_SUCCESS || header.data_kind != 'K' || header.pid != 0xBD
+			|| strcmp(header.call_from, "G0KLA") != 0 || header.data_len != 20 || data[19] != 19 || time_ms != 100) {
+		printf("** First frame not replayed\n"); rc = EXIT_FAILURE;
+	}
+	now_ms = tx_now_ms();
+	trace_received(&frame, now_ms);
+	if (trace_read_next(&time_ms, &header, data) != EXIT_SUCCESS || header.data_kind != 'T' || time_ms != 400) {
+		printf("** Confirm not replayed\n"); rc = EXIT_FAILURE;
+	}
+	trace_received(&frame, now_ms);
+	if (trace_read_next(&time_ms, &header, data) == EXIT_SUCCESS) { printf("** Read past the end\n"); rc = EXIT_FAILURE; }
+
+	/* The response is captured and timed */
+	trace_sent(0, 'K', "PACB-11", "QST-1", 0xBB, data, 10, now_ms + 10);
+	trace_sent(0, 'K', "PACB-11", "G0KLA", 0xF0, (unsigned char *)"OK", 2, now_ms + 50);
+	trace_sent(0, 'K', "PACB-11", "G0KLA", 0xF0, (unsigned char *)"OK", 2, now_ms + 60);
+	TRACE_STATS stats;
+	trace_get_stats(&stats);
+	if (stats.rx_frames != 2 || stats.recorded_tx_frames != 1 || stats.tx_frames != 3) {
+		printf("** Wrong frame counts %d %d %d\n", stats.rx_frames, stats.recorded_tx_frames, stats.tx_frames); rc = EXIT_FAILURE;
+	}
+	if (stats.responses != 1 || stats.max_latency_ms != 50) {
+		printf("** Wrong latency: %d responses, max %d ms\n", stats.responses, stats.max_latency_ms); rc = EXIT_FAILURE;
+	}
+	trace_print_report(1000);
+	trace_close();
+	if (trace_replaying()) { printf("** Still replaying\n"); rc = EXIT_FAILURE; }
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST TRACE: success\n");
+	else
+		printf("##### TEST TRACE: fail\n");
+	return rc;
+}
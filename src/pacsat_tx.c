@@ -0,0 +1,625 @@
+/*
+ * pacsat_tx.c
+ *
+ *  Created on: Oct 18, 2026
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ *
+ * =====================================================================
+ *
+ * Pacing of the UI frames that we send to the TNC.
+ *
+ * We want to keep the transmitter busy, but if we queue too many frames in
+ * the TNC then an OK or a status frame waits behind all of them.  Each UI
+ * frame sent is recorded with its length and the time it was queued.  The TNC
+ * sends a 'T' frame when it has transmitted a frame, so the oldest frame is
+ * then removed and we know how long it took to get on the air.
+ *
+ * The number of frames allowed in the TNC is a window that is adjusted like
+ * TCP congestion control (AIMD).  While frames get on the air within
+ * tx_target_latency_ms the window grows by one frame for each window of
+ * frames confirmed.  When a frame takes longer the window is halved, but only
+ * once for the frames that were already queued when we halved it.  A frame
+ * that is never confirmed is assumed sent after TX_CONFIRM_TIMEOUT_FACTOR
+ * times the target latency, and that also halves the window.
+ *
+ * As well as the window, we stop when the frames queued would take longer
+ * than the target latency to transmit at g_bit_rate.
+ *
+ * Frames that are not PB broadcasts wait in a queue for their class and are
+ * released by tx_next_action() in strict priority order: control responses,
+ * then connected mode FTL0 frames, then status frames.  The PB only makes its
+ * next broadcast when all of the queues are empty and it leaves one frame of
+ * the window free, so an OK never waits behind more than a window of
+ * broadcasts.  Connected mode frames are not confirmed with 'T' so they are
+ * not counted in the window.  They have their own class, and when the UI
+ * frames above them are waiting for the window they are released anyway, so
+ * they never wait behind a UI frame.  They are never dropped, because a lost
+ * ACK or LOGIN_RESP stalls the upload until T3 expires.
+ *
+ * Each radio port has its own queues and window, because each has its own
+ * transmitter.  The 'T' confirm from the TNC says which port sent the frame.
+ *
+ * The PB and FTL0 threads queue frames while the receive loop confirms them
+ * and releases the queues, so all of the state is protected by tx_mutex.  It
+ * is recursive because the public functions call each other.
+ *
+ */
+
+/* System include files */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+/* Program Include Files */
+#include "config.h"
+#include "debug.h"
+#include "agw_tnc.h"
+#include "str_util.h"
+#include "pacsat_stats.h"
+#include "pacsat_broadcast.h"
+#include "pacsat_tx.h"
+#include "pacsat_trace.h"
+
+struct tx_frame {
+	uint64_t sent_ms; /* When we queued the frame in the TNC */
+	uint32_t seq;
+	int bytes; /* Bytes on the air including the AX25 header */
+};
+
+struct tx_queue_entry {
+	int connected; /* true if this is connected mode data, otherwise a UI frame */
+	char from_callsign[MAX_CALLSIGN_LEN];
+	char to_callsign[MAX_CALLSIGN_LEN];
+	int pid_or_channel; /* The PID of a UI frame or the channel for connected mode data */
+	int len;
+	unsigned char bytes[AX25_MAX_DATA_LEN];
+};
+
+/* The queues and the window for one radio port */
+struct tx_port {
+	struct tx_queue_entry queue[TX_NUMBER_OF_CLASSES][TX_QUEUE_LEN];
+	int queue_head[TX_NUMBER_OF_CLASSES];
+	int queue_num[TX_NUMBER_OF_CLASSES];
+	struct tx_frame outstanding[TX_MAX_OUTSTANDING]; /* Ring of frames waiting for a 'T' confirm, oldest first */
+	int outstanding_head;
+	int outstanding_num;
+	uint32_t queued_bytes;
+	uint32_t next_seq;
+	uint32_t recovery_seq; /* Frames sent before this were queued before the last decrease */
+	int window;
+	int increase_credit;
+	uint32_t connected_sent; /* Connected mode frames released to the TNC */
+};
+
+/* Local variables */
+static struct tx_port tx_ports[MAX_PORTS];
+static pthread_mutex_t tx_mutex;
+static pthread_once_t tx_mutex_once = PTHREAD_ONCE_INIT;
+
+/* Forward declarations */
+static void tx_port_next_action(int port, uint64_t now_ms);
+
+static void tx_mutex_init() {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&tx_mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void tx_lock() {
+	pthread_once(&tx_mutex_once, tx_mutex_init);
+	pthread_mutex_lock(&tx_mutex);
+}
+
+static void tx_unlock() {
+	pthread_mutex_unlock(&tx_mutex);
+}
+
+/* Returns the state for a port.  A frame for a port that is not configured is paced with port 0 */
+static struct tx_port *tx_get_port(int port) {
+	if (port < 0 || port >= g_number_of_ports) port = 0;
+	return &tx_ports[port];
+}
+
+/**
+ * tx_init()
+ *
+ * Empty the queues of every port and start the window at max_frames_in_tx_buffer from the
+ * config file.
+ */
+void tx_init() {
+	tx_lock();
+	for (int port=0; port < MAX_PORTS; port++) {
+		struct tx_port *tx = &tx_ports[port];
+		memset(tx->queue_head, 0, sizeof(tx->queue_head));
+		memset(tx->queue_num, 0, sizeof(tx->queue_num));
+		tx->outstanding_head = 0;
+		tx->outstanding_num = 0;
+		tx->queued_bytes = 0;
+		tx->increase_credit = 0;
+		tx->recovery_seq = tx->next_seq;
+		tx->window = g_max_frames_in_tx_buffer;
+		if (tx->window < TX_MIN_WINDOW) tx->window = TX_MIN_WINDOW;
+		if (tx->window > TX_MAX_WINDOW) tx->window = TX_MAX_WINDOW;
+	}
+	tx_unlock();
+}
+
+/**
+ * tx_now_ms()
+ *
+ * Returns a monotonic time in milliseconds for measuring the latency
+ */
+uint64_t tx_now_ms() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * tx_send_raw_packet()
+ *
+ * Send a UI frame on port now and record it so that it is paced.  This is used for the
+ * PB broadcasts, which are only made when tx_busy() is false for the port.  Other UI frames
+ * should be queued with tx_queue_raw_packet().
+ *
+ * Returns EXIT_SUCCESS unless it was unable to send the frame to the TNC
+ *
+ */
+int tx_send_raw_packet(int port, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len) {
+	tx_lock();
+	int rc = trace_send_raw_packet(port, from_callsign, to_callsign, pid, bytes, len);
+	if (rc == EXIT_SUCCESS)
+		tx_frame_sent(port, len, tx_now_ms());
+	tx_unlock();
+	return rc;
+}
+
+/* Copy a frame onto the end of the queue for tx_class.  Call with the lock held and room in the queue */
+static void tx_queue_append(struct tx_port *tx, int tx_class, int connected, char *from_callsign, char *to_callsign,
+		int pid_or_channel, unsigned char *bytes, int len) {
+	int i = (tx->queue_head[tx_class] + tx->queue_num[tx_class]) % TX_QUEUE_LEN;
+	struct tx_queue_entry *entry = &tx->queue[tx_class][i];
+	entry->connected = connected;
+	strlcpy(entry->from_callsign, from_callsign, sizeof(entry->from_callsign));
+	strlcpy(entry->to_callsign, to_callsign, sizeof(entry->to_callsign));
+	entry->pid_or_channel = pid_or_channel;
+	entry->len = len;
+	memcpy(entry->bytes, bytes, len);
+	tx->queue_num[tx_class]++;
+}
+
+/**
+ * tx_queue_add()
+ *
+ * Copy a frame onto the end of the queue for its class on port and try to send it straight away.
+ * Connected mode frames are always in TX_CLASS_CONNECTED and UI frames never are.  The
+ * connected queue does not wait for the window, so if it is full it is released to make room.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if a UI queue is full
+ *
+ */
+static int tx_queue_add(int port, int tx_class, int connected, char *from_callsign, char *to_callsign,
+		int pid_or_channel, unsigned char *bytes, int len) {
+	if (connected)
+		tx_class = TX_CLASS_CONNECTED;
+	else if (tx_class == TX_CLASS_CONNECTED || tx_class < 0 || tx_class >= TX_NUMBER_OF_CLASSES)
+		tx_class = TX_CLASS_BULK;
+	if (len < 0 || len > AX25_MAX_DATA_LEN) {
+		error_print("TX: Frame of %d bytes is too long to queue\n", len);
+		return EXIT_FAILURE;
+	}
+	tx_lock();
+	struct tx_port *tx = tx_get_port(port);
+	if (connected && tx->queue_num[tx_class] == TX_QUEUE_LEN)
+		tx_port_next_action(tx - tx_ports, tx_now_ms());
+	if (tx->queue_num[tx_class] == TX_QUEUE_LEN) {
+		tx_unlock();
+		error_print("TX: Queue %d is full, frame to %s dropped\n", tx_class, to_callsign);
+		return EXIT_FAILURE;
+	}
+	tx_queue_append(tx, tx_class, connected, from_callsign, to_callsign, pid_or_channel, bytes, len);
+
+	tx_next_action(tx_now_ms());
+	tx_unlock();
+	return EXIT_SUCCESS;
+}
+
+/**
+ * tx_queue_raw_packet()
+ *
+ * Queue a UI frame in tx_class on port.  It is sent when it reaches the front of the queue and
+ * there is room in the TNC for that port.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the frame could not be queued
+ *
+ */
+int tx_queue_raw_packet(int port, int tx_class, char *from_callsign, char *to_callsign, int pid, unsigned char *bytes, int len) {
+	return tx_queue_add(port, tx_class, false, from_callsign, to_callsign, pid, bytes, len);
+}
+
+/**
+ * tx_queue_connected_data()
+ *
+ * Queue connected mode data.  The AGW channel is the radio port, so it is queued for that
+ * port.  It is sent straight away, ahead of any UI frames that are waiting.
+ *
+ * Returns EXIT_SUCCESS or EXIT_FAILURE if the frame is too long
+ *
+ */
+int tx_queue_connected_data(char *from_callsign, char *to_callsign, int channel, unsigned char *bytes, int len) {
+	return tx_queue_add(channel, TX_CLASS_CONNECTED, true, from_callsign, to_callsign, channel, bytes, len);
+}
+
+/**
+ * tx_frame_sent()
+ *
+ * Record a frame of len data bytes that was queued in the TNC for port
+ */
+void tx_frame_sent(int port, int len, uint64_t now_ms) {
+	tx_lock();
+	struct tx_port *tx = tx_get_port(port);
+	if (tx->outstanding_num == TX_MAX_OUTSTANDING) {
+		/* We lost track of the confirms.  Forget the oldest frame */
+		tx->queued_bytes -= tx->outstanding[tx->outstanding_head].bytes;
+		tx->outstanding_head = (tx->outstanding_head + 1) % TX_MAX_OUTSTANDING;
+		tx->outstanding_num--;
+	}
+	int i = (tx->outstanding_head + tx->outstanding_num) % TX_MAX_OUTSTANDING;
+	tx->outstanding[i].sent_ms = now_ms;
+	tx->outstanding[i].seq = tx->next_seq++;
+	tx->outstanding[i].bytes = len + PB_AX25_HEADER_BYTES;
+	tx->queued_bytes += tx->outstanding[i].bytes;
+	tx->outstanding_num++;
+	tx_unlock();
+}
+
+/**
+ * tx_bulk_limit(tx)
+ *
+ * Returns how many frames the PB may have in the TNC.  One frame of the window is kept free so
+ * that a control response only waits behind the frames already in the TNC.
+ */
+static int tx_bulk_limit(struct tx_port *tx) {
+	return (tx->window > TX_MIN_WINDOW) ? tx->window - 1 : TX_MIN_WINDOW;
+}
+
+/**
+ * tx_decrease_window()
+ *
+ * Halve the window unless we already did for a frame that was queued at the same time.
+ */
+static void tx_decrease_window(struct tx_port *tx, uint32_t seq) {
+	if ((int32_t)(seq - tx->recovery_seq) < 0) return;
+	tx->window = tx->window / 2;
+	if (tx->window < TX_MIN_WINDOW) tx->window = TX_MIN_WINDOW;
+	tx->increase_credit = 0;
+	tx->recovery_seq = tx->next_seq;
+	debug_print("TX: Window decreased to %d\n", tx->window);
+}
+
+/**
+ * tx_remove_oldest()
+ *
+ * The oldest frame is on the air.  Returns how long it took in ms.
+ */
+static uint32_t tx_remove_oldest(struct tx_port *tx, uint64_t now_ms, uint32_t *seq) {
+	struct tx_frame *frame = &tx->outstanding[tx->outstanding_head];
+	tx->queued_bytes -= frame->bytes;
+	tx->outstanding_head = (tx->outstanding_head + 1) % TX_MAX_OUTSTANDING;
+	tx->outstanding_num--;
+	*seq = frame->seq;
+	return (now_ms > frame->sent_ms) ? (uint32_t)(now_ms - frame->sent_ms) : 0;
+}
+
+/**
+ * tx_frame_confirmed()
+ *
+ * Called when the TNC sends a 'T' frame to say that a frame was transmitted on port.  Adjust
+ * the window for the port based on how long the frame waited.  The count of frames queued that is kept by the
+ * TNC library is decremented here too, so that it is changed under the same lock as it is
+ * incremented when a frame is sent.
+ */
+void tx_frame_confirmed(int port, uint64_t now_ms) {
+	tx_lock();
+	struct tx_port *tx = tx_get_port(port);
+	if (g_common_frames_queued)
+		g_common_frames_queued--;
+	if (tx->outstanding_num == 0) { /* A frame we did not send, or one we already timed out */
+		tx_unlock();
+		return;
+	}
+	uint32_t seq;
+	uint32_t latency = tx_remove_oldest(tx, now_ms, &seq);
+	if (latency > g_tx_target_latency_ms) {
+		tx_decrease_window(tx, seq);
+	} else if (tx->outstanding_num + 1 >= tx_bulk_limit(tx)) {
+		/* Only grow the window if we were using it */
+		tx->increase_credit++;
+		if (tx->increase_credit >= tx->window) {
+			tx->increase_credit = 0;
+			if (tx->window < TX_MAX_WINDOW) tx->window++;
+		}
+	}
+	tx_unlock();
+}
+
+/**
+ * tx_window_full()
+ *
+ * Time out any frames that were never confirmed.
+ *
+ * Returns true if limit frames or the target latency worth of airtime are already in the TNC
+ */
+static int tx_window_full(struct tx_port *tx, uint64_t now_ms, int limit) {
+	uint64_t timeout = (uint64_t)g_tx_target_latency_ms * TX_CONFIRM_TIMEOUT_FACTOR;
+	while (tx->outstanding_num > 0 && now_ms - tx->outstanding[tx->outstanding_head].sent_ms > timeout) {
+		uint32_t seq;
+		tx_remove_oldest(tx, now_ms, &seq);
+		tx_decrease_window(tx, seq);
+	}
+	if (tx->outstanding_num >= limit) return true;
+	if (stats_airtime_ms(tx->queued_bytes) >= g_tx_target_latency_ms) return true;
+	return false;
+}
+
+/**
+ * tx_port_next_action()
+ *
+ * Release the queued frames for one port.  When the window is full the UI classes wait, but
+ * the connected mode frames below them are still released.
+ */
+static void tx_port_next_action(int port, uint64_t now_ms) {
+	struct tx_port *tx = &tx_ports[port];
+	for (int c=0; c < TX_NUMBER_OF_CLASSES; c++) {
+		while (tx->queue_num[c] > 0) {
+			struct tx_queue_entry *entry = &tx->queue[c][tx->queue_head[c]];
+			int rc = EXIT_SUCCESS;
+			if (entry->connected) {
+				if (!g_run_self_test)
+					rc = trace_send_connected_data(entry->from_callsign, entry->to_callsign, entry->pid_or_channel,
+							entry->bytes, entry->len);
+				if (rc == EXIT_SUCCESS)
+					tx->connected_sent++;
+			} else {
+				if (tx_window_full(tx, now_ms, tx->window))
+					break;
+				if (!g_run_self_test)
+					rc = trace_send_raw_packet(port, entry->from_callsign, entry->to_callsign, entry->pid_or_channel,
+							entry->bytes, entry->len);
+				if (rc == EXIT_SUCCESS)
+					tx_frame_sent(port, entry->len, now_ms);
+			}
+			if (rc != EXIT_SUCCESS)
+				error_print("TX: Could not send frame to %s\n", entry->to_callsign);
+			tx->queue_head[c] = (tx->queue_head[c] + 1) % TX_QUEUE_LEN;
+			tx->queue_num[c]--;
+		}
+	}
+}
+
+/**
+ * tx_next_action()
+ *
+ * Release queued frames to the TNC in priority order on each port.  A class waits until the
+ * classes above it are empty.  UI frames wait for room in the window for their port, and
+ * connected mode frames do not wait for them.
+ */
+void tx_next_action(uint64_t now_ms) {
+	tx_lock();
+	for (int port=0; port < g_number_of_ports; port++)
+		tx_port_next_action(port, now_ms);
+	tx_unlock();
+}
+
+/**
+ * tx_busy()
+ *
+ * Called by the PB before it makes a broadcast on port.
+ *
+ * Returns true if there are frames waiting in the queues for the port or the PB should not
+ * queue another frame in the TNC for it yet
+ */
+int tx_busy(int port, uint64_t now_ms) {
+	int busy = false;
+	tx_lock();
+	struct tx_port *tx = tx_get_port(port);
+	for (int c=0; c < TX_NUMBER_OF_CLASSES; c++)
+		if (tx->queue_num[c] > 0) busy = true;
+	if (!busy)
+		busy = tx_window_full(tx, now_ms, tx_bulk_limit(tx));
+	tx_unlock();
+	return busy;
+}
+
+int tx_get_queue_len(int port, int tx_class) { return tx_get_port(port)->queue_num[tx_class]; }
+int tx_get_window(int port) { return tx_get_port(port)->window; }
+int tx_get_frames_queued(int port) { return tx_get_port(port)->outstanding_num; }
+uint32_t tx_get_queued_airtime_ms(int port) { return stats_airtime_ms(tx_get_port(port)->queued_bytes); }
+
+/*********************************************************************************************
+ *
+ * SELF TESTS FOLLOW
+ *
+ */
+int test_tx_pacing() {
+	printf("##### TEST TX PACING:\n");
+	int rc = EXIT_SUCCESS;
+	int saved_window = g_max_frames_in_tx_buffer;
+	int saved_rate = g_bit_rate;
+	int saved_latency = g_tx_target_latency_ms;
+	g_max_frames_in_tx_buffer = 3;
+	g_bit_rate = 9600;
+	g_tx_target_latency_ms = 1000;
+	tx_init();
+
+	uint64_t now = 1000000;
+	/* Frames of 103 bytes take 100ms at 9600 bps.  Fill the window, less the one frame kept for control */
+	tx_frame_sent(0, 103, now);
+	if (tx_busy(0, now)) { printf("** Busy with one frame\n"); rc = EXIT_FAILURE; }
+	tx_frame_sent(0, 103, now);
+	if (!tx_busy(0, now)) { printf("** Not busy with a full window\n"); rc = EXIT_FAILURE; }
+	if (tx_get_queued_airtime_ms(0) != 200) { printf("** Wrong airtime %d\n", tx_get_queued_airtime_ms(0)); rc = EXIT_FAILURE; }
+
+	/* Fast confirms grow the window by one for each window of frames */
+	for (int i=0; i < 20; i++) {
+		now += 100;
+		tx_frame_confirmed(0, now);
+		while (!tx_busy(0, now))
+			tx_frame_sent(0, 103, now);
+	}
+	if (tx_get_window(0) <= 3) { printf("** Window did not grow: %d\n", tx_get_window(0)); rc = EXIT_FAILURE; }
+
+	/* The queued airtime limits us even if the window is bigger */
+	if (tx_get_queued_airtime_ms(0) > g_tx_target_latency_ms + 100) {
+		printf("** Too much queued: %d ms\n", tx_get_queued_airtime_ms(0)); rc = EXIT_FAILURE; }
+
+	/* A slow confirm halves the window, but only once for the frames already queued */
+	int window = tx_get_window(0);
+	now += 5000;
+	tx_frame_confirmed(0, now);
+	tx_frame_confirmed(0, now);
+	if (tx_get_window(0) != window / 2) { printf("** Window not halved once: %d from %d\n", tx_get_window(0), window); rc = EXIT_FAILURE; }
+
+	/* Frames that are never confirmed are timed out */
+	now += g_tx_target_latency_ms * TX_CONFIRM_TIMEOUT_FACTOR + 1;
+	tx_busy(0, now);
+	if (tx_get_frames_queued(0) != 0) { printf("** Frames not timed out: %d\n", tx_get_frames_queued(0)); rc = EXIT_FAILURE; }
+	if (tx_get_window(0) < TX_MIN_WINDOW) { printf("** Window below minimum\n"); rc = EXIT_FAILURE; }
+
+	/* A confirm for a frame we did not send is ignored */
+	tx_frame_confirmed(0, now);
+	if (tx_get_frames_queued(0) != 0) { printf("** Confirm with nothing queued\n"); rc = EXIT_FAILURE; }
+
+	g_max_frames_in_tx_buffer = saved_window;
+	g_bit_rate = saved_rate;
+	g_tx_target_latency_ms = saved_latency;
+	tx_init();
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST TX PACING: success\n");
+	else
+		printf("##### TEST TX PACING: fail\n");
+	return rc;
+}
+
+int test_tx_queue() {
+	printf("##### TEST TX QUEUE:\n");
+	int rc = EXIT_SUCCESS;
+	int saved_window = g_max_frames_in_tx_buffer;
+	int saved_rate = g_bit_rate;
+	int saved_latency = g_tx_target_latency_ms;
+	g_max_frames_in_tx_buffer = 2;
+	g_bit_rate = 9600;
+	g_tx_target_latency_ms = 1000;
+	tx_init();
+	uint64_t now = tx_now_ms();
+	unsigned char data[] = "OK AC2CZ";
+
+	/* The PB has filled the window */
+	tx_frame_sent(0, 103, now);
+	tx_frame_sent(0, 103, now);
+
+	/* UI frames wait for the window.  Connected mode data does not wait behind them */
+	tx_queue_raw_packet(0, TX_CLASS_BULK, "PACSAT-11", "PBLIST", PID_NO_PROTOCOL, data, sizeof(data));
+	tx_queue_raw_packet(0, TX_CLASS_CONTROL, "PACSAT-11", "AC2CZ", PID_FILE, data, sizeof(data));
+	uint32_t connected_sent = tx_get_port(0)->connected_sent;
+	tx_queue_connected_data("PACSAT-12", "AC2CZ", 0, data, sizeof(data));
+	if (tx_get_queue_len(0, TX_CLASS_CONTROL) != 1 || tx_get_queue_len(0, TX_CLASS_BULK) != 1) {
+		printf("** UI frames should be waiting\n"); rc = EXIT_FAILURE; }
+	if (tx_get_queue_len(0, TX_CLASS_CONNECTED) != 0 || tx_get_port(0)->connected_sent != connected_sent + 1) {
+		printf("** Connected data should not wait for UI frames\n"); rc = EXIT_FAILURE; }
+	if (!tx_busy(0, now)) { printf("** PB should wait for the queues\n"); rc = EXIT_FAILURE; }
+
+	/* Connected mode frames are never dropped, however many are queued while the window is full */
+	connected_sent = tx_get_port(0)->connected_sent;
+	int lost = 0;
+	for (int i=0; i < 3 * TX_QUEUE_LEN; i++)
+		if (tx_queue_connected_data("PACSAT-12", "AC2CZ", 0, data, sizeof(data)) != EXIT_SUCCESS)
+			lost++;
+	if (lost != 0 || tx_get_port(0)->connected_sent != connected_sent + 3 * TX_QUEUE_LEN
+			|| tx_get_queue_len(0, TX_CLASS_CONNECTED) != 0) {
+		printf("** Lost %d connected frames\n", lost); rc = EXIT_FAILURE; }
+	if (tx_get_queue_len(0, TX_CLASS_CONTROL) != 1) { printf("** Control frame should still wait\n"); rc = EXIT_FAILURE; }
+
+	/* An OK and a burst of connected data are waiting together.  The OK goes first when there is
+	 * room in the window and the data does not wait for the OK when there is not */
+	connected_sent = tx_get_port(0)->connected_sent;
+	tx_lock();
+	for (int i=0; i < TX_QUEUE_LEN; i++)
+		tx_queue_append(tx_get_port(0), TX_CLASS_CONNECTED, true, "PACSAT-12", "AC2CZ", 0, data, sizeof(data));
+	tx_unlock();
+	tx_next_action(now);
+	if (tx_get_queue_len(0, TX_CLASS_CONNECTED) != 0 || tx_get_port(0)->connected_sent != connected_sent + TX_QUEUE_LEN
+			|| tx_get_queue_len(0, TX_CLASS_CONTROL) != 1) {
+		printf("** Connected data should not wait for an OK that is waiting for the window\n"); rc = EXIT_FAILURE; }
+	tx_lock();
+	for (int i=0; i < TX_QUEUE_LEN; i++)
+		tx_queue_append(tx_get_port(0), TX_CLASS_CONNECTED, true, "PACSAT-12", "AC2CZ", 0, data, sizeof(data));
+	tx_unlock();
+	int frames_queued = tx_get_frames_queued(0);
+
+	/* One frame is on the air.  The control frame goes next, with the connected data.  Status still waits */
+	tx_frame_confirmed(0, now);
+	tx_next_action(now);
+	if (tx_get_queue_len(0, TX_CLASS_CONTROL) != 0 || tx_get_queue_len(0, TX_CLASS_BULK) != 1) {
+		printf("** Control frame should have been sent first\n"); rc = EXIT_FAILURE; }
+	if (tx_get_frames_queued(0) != frames_queued || tx_get_queue_len(0, TX_CLASS_CONNECTED) != 0) {
+		printf("** OK should be released no later than the connected data\n"); rc = EXIT_FAILURE; }
+
+	tx_frame_confirmed(0, now);
+	tx_next_action(now);
+	if (tx_get_queue_len(0, TX_CLASS_BULK) != 0) { printf("** Status frame not sent\n"); rc = EXIT_FAILURE; }
+
+	/* The PB keeps one frame of the window free for control frames */
+	if (!tx_busy(0, now)) { printf("** PB should leave room for control frames\n"); rc = EXIT_FAILURE; }
+	tx_frame_confirmed(0, now);
+	if (tx_busy(0, now)) { printf("** PB should be able to send\n"); rc = EXIT_FAILURE; }
+
+	/* A full UI queue drops the frame */
+	for (int i=0; i < TX_MAX_WINDOW; i++)
+		tx_frame_sent(0, 103, now);
+	for (int i=0; i < TX_QUEUE_LEN; i++)
+		tx_queue_raw_packet(0, TX_CLASS_BULK, "PACSAT-11", "PBLIST", PID_NO_PROTOCOL, data, sizeof(data));
+	if (tx_queue_raw_packet(0, TX_CLASS_BULK, "PACSAT-11", "PBLIST", PID_NO_PROTOCOL, data, sizeof(data)) != EXIT_FAILURE) {
+		printf("** Full queue accepted a frame\n"); rc = EXIT_FAILURE; }
+
+	/* Another port has its own queues and window */
+	int saved_ports = g_number_of_ports;
+	g_number_of_ports = 2;
+	int port0_queued = tx_get_frames_queued(0);
+	if (tx_busy(1, now)) { printf("** Port 1 busy because port 0 is\n"); rc = EXIT_FAILURE; }
+	tx_queue_raw_packet(1, TX_CLASS_CONTROL, "PACSAT-11", "AC2CZ", PID_FILE, data, sizeof(data));
+	if (tx_get_queue_len(1, TX_CLASS_CONTROL) != 0 || tx_get_frames_queued(1) != 1) {
+		printf("** Control frame not sent on port 1\n"); rc = EXIT_FAILURE; }
+	tx_frame_confirmed(1, now);
+	if (tx_get_frames_queued(1) != 0 || tx_get_frames_queued(0) != port0_queued) {
+		printf("** Confirm on port 1 changed port 0\n"); rc = EXIT_FAILURE; }
+	g_number_of_ports = saved_ports;
+
+	g_max_frames_in_tx_buffer = saved_window;
+	g_bit_rate = saved_rate;
+	g_tx_target_latency_ms = saved_latency;
+	tx_init();
+
+	if (rc == EXIT_SUCCESS)
+		printf("##### TEST TX QUEUE: success\n");
+	else
+		printf("##### TEST TX QUEUE: fail\n");
+	return rc;
+}
@@ -84,6 +84,18 @@ void load_state(char *filepath) {
 					g_ftl0_max_upload_age_in_seconds = atoi(value);
 				} else if (strcmp(key, STATE_PACSAT_LOG_LEVEL) == 0) {
 					g_state_pacsat_log_level = atoi(value);
+				} else if (strcmp(key, PB_BSTAT_PERIOD_IN_SECONDS) == 0) {
+					g_pb_bstat_period_in_seconds = atoi(value);
+				} else if (strcmp(key, STATS_PASS_IDLE_PERIOD_IN_SECONDS) == 0) {
+					g_stats_pass_idle_period_in_seconds = atoi(value);
+				} else if (strcmp(key, PB_IDLE_PERIOD_IN_SECONDS) == 0) {
+					g_pb_idle_period_in_seconds = atoi(value);
+				} else if (strcmp(key, PB_RECENT_WINDOW_IN_SECONDS) == 0) {
+					g_pb_recent_window_in_seconds = atoi(value);
+				} else if (strcmp(key, PB_FOUNTAIN_REPAIR_PERCENT) == 0) {
+					g_pb_fountain_repair_percent = atoi(value);
+				} else if (strcmp(key, PB_ADMISSION_SLACK_PERCENT) == 0) {
+					g_pb_admission_slack_percent = atoi(value);
 				} else {
 					error_print("Unknown key in state file: %s : %s\n",filename, key);
 				}
@@ -117,6 +129,12 @@ void save_state() {
 		if(save_int_key_value(FTL0_MAX_FILE_SIZE, g_ftl0_max_file_size, file) == EXIT_FAILURE) { fclose(file); return;}
 		if(save_int_key_value(FTL0_MAX_UPLOAD_AGE_IN_IN_SECONDS, g_ftl0_max_upload_age_in_seconds, file) == EXIT_FAILURE) { fclose(file); return;}
 		if(save_int_key_value(STATE_PACSAT_LOG_LEVEL, g_state_pacsat_log_level, file) == EXIT_FAILURE) { fclose(file); return;}
+		if(save_int_key_value(PB_BSTAT_PERIOD_IN_SECONDS, g_pb_bstat_period_in_seconds, file) == EXIT_FAILURE) { fclose(file); return;}
+		if(save_int_key_value(STATS_PASS_IDLE_PERIOD_IN_SECONDS, g_stats_pass_idle_period_in_seconds, file) == EXIT_FAILURE) { fclose(file); return;}
+		if(save_int_key_value(PB_IDLE_PERIOD_IN_SECONDS, g_pb_idle_period_in_seconds, file) == EXIT_FAILURE) { fclose(file); return;}
+		if(save_int_key_value(PB_RECENT_WINDOW_IN_SECONDS, g_pb_recent_window_in_seconds, file) == EXIT_FAILURE) { fclose(file); return;}
+		if(save_int_key_value(PB_FOUNTAIN_REPAIR_PERCENT, g_pb_fountain_repair_percent, file) == EXIT_FAILURE) { fclose(file); return;}
+		if(save_int_key_value(PB_ADMISSION_SLACK_PERCENT, g_pb_admission_slack_percent, file) == EXIT_FAILURE) { fclose(file); return;}
 	}
 	fclose(file);
 	/* This rename is atomic and overwrites the existing file.  So we either get the whole new file or we stay with the old one.*/